@@ -0,0 +1,186 @@
+// Single pass downsampler. Builds up to MAX_LEVELS levels of a mip chain in one dispatch: every
+// workgroup reduces a 64x64 tile of the source down to one texel of level 6 in groupshared memory,
+// the last workgroup to finish (found through an atomic counter) then reduces level 6 down to 12.
+// Levels are read and written through storage views, sRGB images use UNORM views and convert here.
+
+#define MAX_LEVELS 12
+#define TILE_SIZE 32
+
+#define REDUCTION_AVERAGE 0
+#define REDUCTION_MIN 1
+#define REDUCTION_MAX 2
+
+[[vk::binding(0)]] [[vk::image_format("unknown")]] RWTexture2D<float4> levels[MAX_LEVELS + 1];
+[[vk::binding(1)]] [[vk::image_format("unknown")]] globallycoherent RWTexture2D<float4> level6;
+[[vk::binding(2)]] globallycoherent RWStructuredBuffer<uint> counters;
+
+struct PushConstants
+{
+    uint2 size;           // Size of the source level
+    uint level_count;     // Number of levels to generate after the source
+    uint workgroup_count;
+    uint counter_index;
+    uint reduction;
+    uint is_srgb;
+};
+
+[[vk::push_constant]]
+PushConstants push_constants;
+
+groupshared float4 tile_texels[TILE_SIZE][TILE_SIZE];
+groupshared uint is_last_workgroup;
+
+float3 srgb_to_linear(float3 c)
+{
+    return select(c <= 0.04045, c / 12.92, pow((c + 0.055) / 1.055, 2.4));
+}
+
+float3 linear_to_srgb(float3 c)
+{
+    return select(c <= 0.0031308, c * 12.92, 1.055 * pow(c, 1.0 / 2.4) - 0.055);
+}
+
+float4 decode(float4 value)
+{
+    return push_constants.is_srgb != 0 ? float4(srgb_to_linear(value.rgb), value.a) : value;
+}
+
+float4 encode(float4 value)
+{
+    return push_constants.is_srgb != 0 ? float4(linear_to_srgb(value.rgb), value.a) : value;
+}
+
+float4 reduce(float4 a, float4 b, float4 c, float4 d)
+{
+    if (push_constants.reduction == REDUCTION_MIN)
+        return min(min(a, b), min(c, d));
+    if (push_constants.reduction == REDUCTION_MAX)
+        return max(max(a, b), max(c, d));
+    return (a + b + c + d) * 0.25;
+}
+
+uint2 level_size(uint level)
+{
+    return max(push_constants.size >> level, 1u);
+}
+
+void store_texel(uint level, uint2 p, float4 value)
+{
+    if (all(p < level_size(level)))
+        levels[level][p] = encode(value);
+}
+
+// Reduces the 2x2 footprint of a level n texel from the level n - 1 texels held in the tile, whose
+// first texel is at origin. Footprints crossing the edge of level n - 1 are clamped to it.
+float4 reduce_tile(uint n, uint2 origin, uint2 local)
+{
+    int2 last = max(int2(level_size(n - 1)) - 1 - int2(origin), 0);
+    uint2 p0 = min(local * 2, uint2(last));
+    uint2 p1 = min(local * 2 + 1, uint2(last));
+    return reduce(tile_texels[p0.y][p0.x], tile_texels[p0.y][p1.x], tile_texels[p1.y][p0.x], tile_texels[p1.y][p1.x]);
+}
+
+// Reduces the level first_level - 1 texels in the tile down five more levels. tile is the position
+// of the tile in units of its own size.
+void downsample_tile(uint2 tile, uint thread_index, uint first_level)
+{
+    for (uint n = first_level; n < first_level + 5; ++n)
+    {
+        if (n > push_constants.level_count)
+            return;
+
+        uint size = TILE_SIZE >> (n - first_level + 1);
+        uint2 local = uint2(thread_index % size, thread_index / size);
+        bool active = thread_index < size * size;
+
+        float4 value = 0.0;
+        if (active)
+            value = reduce_tile(n, tile * size * 2, local);
+
+        GroupMemoryBarrierWithGroupSync();
+
+        if (active)
+        {
+            tile_texels[local.y][local.x] = value;
+            uint2 p = tile * size + local;
+            if (n == 6)
+            {
+                if (all(p < level_size(6)))
+                    level6[p] = encode(value);
+            }
+            else
+            {
+                store_texel(n, p, value);
+            }
+        }
+
+        GroupMemoryBarrierWithGroupSync();
+    }
+}
+
+[numthreads(256, 1, 1)]
+void cs_main(uint3 group_id : SV_GroupID, uint thread_index : SV_GroupIndex)
+{
+    uint2 tile = group_id.xy;
+
+    // Level 1, four texels per thread straight from the source
+    uint2 last = level_size(0) - 1;
+    for (uint i = thread_index; i < TILE_SIZE * TILE_SIZE; i += 256)
+    {
+        uint2 local = uint2(i % TILE_SIZE, i / TILE_SIZE);
+        uint2 p = tile * TILE_SIZE + local;
+        float4 value = reduce(
+            decode(levels[0][min(p * 2, last)]),
+            decode(levels[0][min(p * 2 + uint2(1, 0), last)]),
+            decode(levels[0][min(p * 2 + uint2(0, 1), last)]),
+            decode(levels[0][min(p * 2 + 1, last)]));
+
+        tile_texels[local.y][local.x] = value;
+        store_texel(1, p, value);
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    // Levels 2 to 6 stay inside the tile
+    downsample_tile(tile, thread_index, 2);
+
+    if (push_constants.level_count <= 6)
+        return;
+
+    // Levels past 6 need the level 6 texels of every workgroup, only the last one to finish goes on.
+    // Every thread's level 6 writes have to be visible device wide before the counter is incremented.
+    AllMemoryBarrierWithGroupSync();
+    if (thread_index == 0)
+    {
+        uint previous;
+        InterlockedAdd(counters[push_constants.counter_index], 1, previous);
+        is_last_workgroup = previous == push_constants.workgroup_count - 1 ? 1 : 0;
+    }
+
+    AllMemoryBarrierWithGroupSync();
+
+    if (is_last_workgroup == 0)
+        return;
+
+    // Ready for the next dispatch using this counter
+    if (thread_index == 0)
+        counters[push_constants.counter_index] = 0;
+
+    uint2 last6 = level_size(6) - 1;
+    for (uint i = thread_index; i < TILE_SIZE * TILE_SIZE; i += 256)
+    {
+        uint2 p = uint2(i % TILE_SIZE, i / TILE_SIZE);
+        float4 value = reduce(
+            decode(level6[min(p * 2, last6)]),
+            decode(level6[min(p * 2 + uint2(1, 0), last6)]),
+            decode(level6[min(p * 2 + uint2(0, 1), last6)]),
+            decode(level6[min(p * 2 + 1, last6)]));
+
+        tile_texels[p.y][p.x] = value;
+        store_texel(7, p, value);
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    downsample_tile(uint2(0, 0), thread_index, 8);
+}
@@ -0,0 +1,42 @@
+// Shared by the environment bake shaders. Cubemap faces are addressed as layers of 2D array views,
+// in the Vulkan face order +X, -X, +Y, -Y, +Z, -Z.
+
+#define PI 3.14159265359
+
+// Direction a cube sampler fetches a face position from, position in texels from the top left corner
+float3 get_cube_direction(float2 position, uint face, uint size)
+{
+    float2 uv = position / size * 2.0 - 1.0;
+    float3 direction;
+    switch (face)
+    {
+    case 0: direction = float3(1.0, -uv.y, -uv.x); break;
+    case 1: direction = float3(-1.0, -uv.y, uv.x); break;
+    case 2: direction = float3(uv.x, 1.0, uv.y); break;
+    case 3: direction = float3(uv.x, -1.0, -uv.y); break;
+    case 4: direction = float3(uv.x, -uv.y, 1.0); break;
+    default: direction = float3(-uv.x, -uv.y, -1.0); break;
+    }
+    return normalize(direction);
+}
+
+// Solid angle covered by a texel of a face
+float get_cube_texel_solid_angle(float2 position, uint size)
+{
+    float2 uv = position / size * 2.0 - 1.0;
+    return 4.0 / (size * size * pow(1.0 + dot(uv, uv), 1.5));
+}
+
+// Real spherical harmonics basis of the first three bands
+void evaluate_sh9(float3 d, out float sh[9])
+{
+    sh[0] = 0.282095;
+    sh[1] = 0.488603 * d.y;
+    sh[2] = 0.488603 * d.z;
+    sh[3] = 0.488603 * d.x;
+    sh[4] = 1.092548 * d.x * d.y;
+    sh[5] = 1.092548 * d.y * d.z;
+    sh[6] = 0.315392 * (3.0 * d.z * d.z - 1.0);
+    sh[7] = 1.092548 * d.x * d.z;
+    sh[8] = 0.546274 * (d.x * d.x - d.y * d.y);
+}
@@ -0,0 +1,55 @@
+#include "env_bake.hlsli"
+
+[[vk::binding(0)]] StructuredBuffer<uint2> source; // RGB half floats
+[[vk::binding(1)]] [[vk::image_format("rgba16f")]] RWTexture2DArray<float4> sky;
+
+struct PushConstants
+{
+    uint2 source_size;
+    uint size;
+};
+
+[[vk::push_constant]]
+PushConstants push_constants;
+
+float3 load_source(int2 texel)
+{
+    uint2 size = push_constants.source_size;
+    texel.x = (texel.x + size.x) % size.x;
+    texel.y = clamp(texel.y, 0, int(size.y) - 1);
+    uint2 packed = source[texel.y * size.x + texel.x];
+    return float3(f16tof32(packed.x), f16tof32(packed.x >> 16), f16tof32(packed.y));
+}
+
+// Bilinear filtering, wrapping around horizontally
+float3 sample_source(float3 direction)
+{
+    float2 uv = float2(0.5 + atan2(direction.x, direction.z) / (2.0 * PI), acos(clamp(direction.y, -1.0, 1.0)) / PI);
+    float2 position = uv * push_constants.source_size - 0.5;
+    int2 texel = int2(floor(position));
+    float2 t = position - texel;
+
+    float3 top = lerp(load_source(texel), load_source(texel + int2(1, 0)), t.x);
+    float3 bottom = lerp(load_source(texel + int2(0, 1)), load_source(texel + int2(1, 1)), t.x);
+    return lerp(top, bottom, t.y);
+}
+
+// Every face texel averages 2x2 samples, the faces are at least a quarter of the source wide. The sky and
+// lighting shaders look cubemaps up with z negated, the source is sampled the same way so it is not mirrored.
+[numthreads(8, 8, 1)]
+void cs_main(uint3 thread_id : SV_DispatchThreadID)
+{
+    uint size = push_constants.size;
+    if (any(thread_id.xy >= size))
+        return;
+
+    float3 color = 0.0;
+    for (uint i = 0; i < 4; ++i)
+    {
+        float2 position = thread_id.xy + float2(i % 2, i / 2) * 0.5 + 0.25;
+        float3 direction = get_cube_direction(position, thread_id.z, size);
+        color += sample_source(float3(direction.xy, -direction.z));
+    }
+
+    sky[thread_id] = float4(color * 0.25, 1.0);
+}
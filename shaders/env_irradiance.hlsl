@@ -0,0 +1,38 @@
+#include "env_bake.hlsli"
+
+[[vk::binding(0)]] StructuredBuffer<float4> sums; // 9 coefficients per face
+[[vk::binding(1)]] [[vk::image_format("rgba16f")]] RWTexture2DArray<float4> irradiance;
+
+struct PushConstants
+{
+    uint size;
+};
+
+[[vk::push_constant]]
+PushConstants push_constants;
+
+// Convolution with the clamped cosine per band (Ramamoorthi and Hanrahan 2001, "An Efficient Representation
+// for Irradiance Environment Maps"), divided by pi so the stored value times the albedo is the reflected radiance
+static const float BAND_FACTORS[9] = { 1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25 };
+
+[numthreads(8, 8, 1)]
+void cs_main(uint3 thread_id : SV_DispatchThreadID)
+{
+    uint size = push_constants.size;
+    if (any(thread_id.xy >= size))
+        return;
+
+    float sh[9];
+    evaluate_sh9(get_cube_direction(thread_id.xy + 0.5, thread_id.z, size), sh);
+
+    float3 result = 0.0;
+    for (uint c = 0; c < 9; ++c)
+    {
+        float3 coefficient = 0.0;
+        for (uint face = 0; face < 6; ++face)
+            coefficient += sums[face * 9 + c].rgb;
+        result += coefficient * BAND_FACTORS[c] * sh[c];
+    }
+
+    irradiance[thread_id] = float4(max(result, 0.0), 1.0);
+}
@@ -0,0 +1,81 @@
+#include "env_bake.hlsli"
+
+[[vk::binding(0)]] SamplerState linear_sampler;
+[[vk::binding(1)]] TextureCube sky;
+[[vk::binding(2)]] [[vk::image_format("rgba16f")]] RWTexture2DArray<float4> reflection;
+
+struct PushConstants
+{
+    uint size;
+    uint sky_size;
+    float roughness;
+    uint sample_count;
+};
+
+[[vk::push_constant]]
+PushConstants push_constants;
+
+float2 hammersley(uint i, uint count)
+{
+    return float2((i + 0.5) / count, reversebits(i) * 2.3283064365386963e-10);
+}
+
+// GGX distributed half vector around +Z
+float3 importance_sample_ggx(float2 xi, float alpha)
+{
+    float phi = 2.0 * PI * xi.x;
+    float cos_theta = sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+    float sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+    return float3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+}
+
+// Split sum prefiltering (Karis 2013, "Real Shading in Unreal Engine 4") with the view and reflection
+// directions equal to the normal. Samples read the sky level whose texels cover about the solid angle
+// of the sample (Colbert and Krivanek 2007, "GPU-Based Importance Sampling"), which hides the noise
+// of a small sample count.
+[numthreads(8, 8, 1)]
+void cs_main(uint3 thread_id : SV_DispatchThreadID)
+{
+    uint size = push_constants.size;
+    if (any(thread_id.xy >= size))
+        return;
+
+    float3 normal = get_cube_direction(thread_id.xy + 0.5, thread_id.z, size);
+
+    if (push_constants.roughness == 0.0)
+    {
+        float level = log2(float(push_constants.sky_size) / size);
+        reflection[thread_id] = float4(sky.SampleLevel(linear_sampler, normal, level).rgb, 1.0);
+        return;
+    }
+
+    float3 up = abs(normal.z) < 0.999 ? float3(0.0, 0.0, 1.0) : float3(1.0, 0.0, 0.0);
+    float3 tangent = normalize(cross(up, normal));
+    float3 bitangent = cross(normal, tangent);
+
+    float alpha = push_constants.roughness * push_constants.roughness;
+    float texel_solid_angle = 4.0 * PI / (6.0 * push_constants.sky_size * push_constants.sky_size);
+
+    float3 color = 0.0;
+    float weight = 0.0;
+    for (uint i = 0; i < push_constants.sample_count; ++i)
+    {
+        float3 h = importance_sample_ggx(hammersley(i, push_constants.sample_count), alpha);
+        float3 half_vector = tangent * h.x + bitangent * h.y + normal * h.z;
+        float3 light = reflect(-normal, half_vector);
+        float n_dot_l = dot(normal, light);
+        if (n_dot_l <= 0.0)
+            continue;
+
+        // With N = V the pdf of the light direction is D / 4
+        float n_dot_h = h.z;
+        float d = alpha * alpha / (PI * pow(n_dot_h * n_dot_h * (alpha * alpha - 1.0) + 1.0, 2.0));
+        float sample_solid_angle = 4.0 / (push_constants.sample_count * d);
+        float level = max(0.5 * log2(sample_solid_angle / texel_solid_angle) + 1.0, 0.0);
+
+        color += sky.SampleLevel(linear_sampler, light, level).rgb * n_dot_l;
+        weight += n_dot_l;
+    }
+
+    reflection[thread_id] = float4(color / max(weight, 1e-4), 1.0);
+}
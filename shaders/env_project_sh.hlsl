@@ -0,0 +1,59 @@
+#include "env_bake.hlsli"
+
+[[vk::binding(0)]] SamplerState linear_sampler;
+[[vk::binding(1)]] TextureCube sky;
+[[vk::binding(2)]] RWStructuredBuffer<float4> sums; // 9 coefficients per face
+
+struct PushConstants
+{
+    uint size; // Face size of the projected level
+    float level;
+};
+
+[[vk::push_constant]]
+PushConstants push_constants;
+
+#define THREAD_COUNT 256
+
+groupshared float3 shared_sums[THREAD_COUNT];
+
+// Every workgroup projects one face of the sky onto the basis, texels weighted by their solid angle
+[numthreads(THREAD_COUNT, 1, 1)]
+void cs_main(uint3 group_id : SV_GroupID, uint thread_index : SV_GroupIndex)
+{
+    uint face = group_id.x;
+    uint size = push_constants.size;
+
+    float3 coefficients[9];
+    for (uint c = 0; c < 9; ++c)
+        coefficients[c] = 0.0;
+
+    for (uint texel = thread_index; texel < size * size; texel += THREAD_COUNT)
+    {
+        float2 position = float2(texel % size, texel / size) + 0.5;
+        float3 direction = get_cube_direction(position, face, size);
+        float3 radiance = sky.SampleLevel(linear_sampler, direction, push_constants.level).rgb * get_cube_texel_solid_angle(position, size);
+
+        float sh[9];
+        evaluate_sh9(direction, sh);
+        for (uint c = 0; c < 9; ++c)
+            coefficients[c] += radiance * sh[c];
+    }
+
+    for (uint c = 0; c < 9; ++c)
+    {
+        shared_sums[thread_index] = coefficients[c];
+        GroupMemoryBarrierWithGroupSync();
+
+        for (uint stride = THREAD_COUNT / 2; stride > 0; stride /= 2)
+        {
+            if (thread_index < stride)
+                shared_sums[thread_index] += shared_sums[thread_index + stride];
+            GroupMemoryBarrierWithGroupSync();
+        }
+
+        if (thread_index == 0)
+            sums[face * 9 + c] = float4(shared_sums[0], 0.0);
+        GroupMemoryBarrierWithGroupSync();
+    }
+}
@@ -12,13 +12,7 @@ struct VSOutput
     float2 uv : TEXCOORD0;
 };
 
-struct Vertex
-{
-	float3 position;
-	float3 normal;
-	float4 tangent;
-	float2 uv;
-};
+#include "vertex.hlsli"
 
 struct Light {
     float3 position;
@@ -32,7 +26,7 @@ struct Light {
     float4x4 view_projection;
 };
 
-[[vk::binding(0)]] StructuredBuffer<Vertex> vertex_buffer;
+[[vk::binding(0)]] StructuredBuffer<PackedVertex> vertex_buffer;
 [[vk::binding(1)]] SamplerState anisotropic_sampler;
 [[vk::binding(2)]] SamplerState LinearSampler;
 [[vk::binding(3)]] SamplerState PointSampler;
@@ -44,6 +38,7 @@ struct Light {
 [[vk::binding(9)]] SamplerComparisonState shadow_sampler;
 [[vk::binding(10)]] Texture2D shadowmaps[5];
 [[vk::binding(11)]] TextureCube irradiance_texture;
+[[vk::binding(12)]] RWStructuredBuffer<uint> streaming_feedback;
 
 #include "sss_config.hlsli"
 #include "separable_sss.h"
@@ -51,11 +46,16 @@ struct Light {
 struct PushConstants
 {
     float4x4 viewproj;
+    float4 position_dequantize;
     uint num_lights;
     float3 camera_pos;
     float translucency;
     float sss_width;
     float ambient;
+    // Texture index in the upper 24 bits and first resident mip level in the lower 8, ~0 if not streamed
+    uint basecolor_stream;
+    uint normal_stream;
+    uint specular_stream;
 };
 
 [[vk::push_constant]]
@@ -65,14 +65,15 @@ VSOutput vs_main(VSInput input)
 {
     VSOutput output = (VSOutput)0;
 
-    Vertex v = vertex_buffer[input.vertex_id];
-    float4 position = mul(push_constants.viewproj, float4(v.position, 1.0f));
+    PackedVertex v = vertex_buffer[input.vertex_id];
+    float3 vertex_position = decode_position(v.position_xy, v.position_z_tangent_sign, push_constants.position_dequantize);
+    float4 position = mul(push_constants.viewproj, float4(vertex_position, 1.0f));
 
     output.position = position;
-    output.world_position = v.position;
-    output.normal = v.normal;
-    output.tangent = v.tangent;
-    output.uv = v.uv;
+    output.world_position = vertex_position;
+    output.normal = decode_octahedral(v.normal);
+    output.tangent = float4(decode_octahedral(v.tangent), (v.position_z_tangent_sign >> 16) != 0 ? -1.0f : 1.0f);
+    output.uv = decode_half2(v.uv);
 
     return output;
 }
@@ -157,6 +158,15 @@ float3 normal_map(Texture2D tex, SamplerState tex_sampler, float2 uv)
     return normalize(normal);
 }
 
+// Records the finest level of the full mip chain the texture is sampled at. The bound texture only holds
+// the resident levels, so the level of detail is relative to the first resident one.
+void write_streaming_feedback(Texture2D tex, float2 uv, uint stream, bool is_feedback_pixel)
+{
+    float lod = tex.CalculateLevelOfDetailUnclamped(anisotropic_sampler, uv);
+    if (stream != ~0u && is_feedback_pixel)
+        InterlockedMin(streaming_feedback[stream >> 8], (uint)max(floor(lod) + (float)(stream & 0xFF), 0.0));
+}
+
 float4 sample_cubemap(TextureCube cubemap, float3 dir)
 {
     dir.z = -dir.z;
@@ -174,6 +184,12 @@ FSOutput fs_main(FSInput input)
 
     float3 view = normalize(push_constants.camera_pos - input.world_position);
 
+    // One pixel out of every 4x4 block is enough to find the finest level a texture needs
+    bool is_feedback_pixel = all((uint2(input.position.xy) & 3) == 0);
+    write_streaming_feedback(basecolor_texture, input.uv, push_constants.basecolor_stream, is_feedback_pixel);
+    write_streaming_feedback(normal_texture, input.uv, push_constants.normal_stream, is_feedback_pixel);
+    write_streaming_feedback(specular_texture, input.uv, push_constants.specular_stream, is_feedback_pixel);
+
     float4 basecolor = basecolor_texture.Sample(anisotropic_sampler, input.uv);
     float3 specular_ao = specular_texture.Sample(anisotropic_sampler, input.uv).rgb;
 
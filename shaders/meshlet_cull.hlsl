@@ -0,0 +1,139 @@
+// Meshlet culling pre-pass. Every thread handles one command slot of one draw for one view. The draw
+// selects its level of detail for the view and the slot takes the meshlet of that level with its index,
+// slots past the meshlets of the level are left alone. The meshlet is tested against the view: the
+// bounding sphere against the frustum planes and the normal cone against the eye, which drops meshlets
+// whose triangles all face away. It writes the indirect command in its slot, drawing its indices in place
+// from the geometry index buffer once if it is visible and with no instances otherwise, so the commands of
+// a draw keep the meshlet order. The first slot of every chunk writes how many of its commands are drawn.
+
+#define WORKGROUP_SIZE 64
+#define MAX_LODS 5 // MESH_MAX_LODS
+#define MAX_DRAW_COUNT 65535 // CULL_MAX_DRAW_COUNT
+
+struct View
+{
+    float4 planes[5];
+    float4 position; // Pixels per unit at distance one over the pixel error threshold in w
+};
+
+struct Draw
+{
+    float4x4 transform;
+    uint view_mask;
+    float scale;
+    uint lod_count;
+    int vertex_offset;
+    float4 bounds;
+    float lod_errors[MAX_LODS];
+    uint lod_first_meshlets[MAX_LODS];
+    uint lod_meshlet_counts[MAX_LODS];
+    uint first_chunk;
+};
+
+// Mirrors GeometryMeshlet in geometry.h
+struct Meshlet
+{
+    float4 bounds;
+    float4 cone;
+    uint index_offset;
+    uint index_size;
+    uint triangle_count;
+    uint lod;
+};
+
+struct DrawIndexedIndirectCommand
+{
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int vertex_offset;
+    uint first_instance;
+};
+
+[[vk::binding(0)]] StructuredBuffer<View> views;
+[[vk::binding(1)]] StructuredBuffer<Draw> draws;
+[[vk::binding(2)]] StructuredBuffer<Meshlet> meshlets;
+[[vk::binding(3)]] StructuredBuffer<uint2> tasks; // Draw and slot
+[[vk::binding(4)]] RWStructuredBuffer<DrawIndexedIndirectCommand> commands; // Per view and task
+[[vk::binding(5)]] RWStructuredBuffer<uint> counts; // Per view and chunk
+
+struct PushConstants
+{
+    uint first_task;
+    uint task_count;
+    uint chunk_count;
+};
+
+[[vk::push_constant]]
+PushConstants push_constants;
+
+// Coarsest level whose error projects to at most the threshold, the errors grow with the level
+uint select_lod(Draw draw, View view)
+{
+    float3 center = mul(draw.transform, float4(draw.bounds.xyz, 1.0f)).xyz;
+    float distance = max(length(center - view.position.xyz) - draw.bounds.w * draw.scale, 1e-4f);
+
+    uint lod = 0;
+    for (uint i = 1; i < draw.lod_count; ++i)
+    {
+        if (draw.lod_errors[i] * draw.scale * view.position.w <= distance)
+            lod = i;
+    }
+    return lod;
+}
+
+bool is_visible(Meshlet meshlet, Draw draw, View view)
+{
+    float3 center = mul(draw.transform, float4(meshlet.bounds.xyz, 1.0f)).xyz;
+    float radius = meshlet.bounds.w * draw.scale;
+
+    for (uint i = 0; i < 5; ++i)
+    {
+        if (dot(view.planes[i].xyz, center) + view.planes[i].w < -radius)
+            return false;
+    }
+
+    // Back facing for every point of the sphere, "Optimizing the Graphics Pipeline with Compute" (Wihlidal 2016)
+    if (meshlet.cone.w < 1.0f)
+    {
+        float3 axis = normalize(mul((float3x3)draw.transform, meshlet.cone.xyz));
+        float3 eye_to_center = center - view.position.xyz;
+        if (dot(eye_to_center, axis) >= meshlet.cone.w * length(eye_to_center) + radius)
+            return false;
+    }
+
+    return true;
+}
+
+[numthreads(WORKGROUP_SIZE, 1, 1)]
+void cs_main(uint3 thread_id : SV_DispatchThreadID)
+{
+    uint task_index = push_constants.first_task + thread_id.x;
+    if (task_index >= push_constants.task_count)
+        return;
+
+    uint2 task = tasks[task_index];
+    uint view_index = thread_id.y;
+    Draw draw = draws[task.x];
+    View view = views[view_index];
+    uint lod = select_lod(draw, view);
+    uint meshlet_count = (draw.view_mask & (1u << view_index)) != 0 ? draw.lod_meshlet_counts[lod] : 0;
+
+    uint slot = task.y;
+    if (slot % MAX_DRAW_COUNT == 0)
+        counts[view_index * push_constants.chunk_count + draw.first_chunk + slot / MAX_DRAW_COUNT] = slot < meshlet_count ? min(meshlet_count - slot, MAX_DRAW_COUNT) : 0;
+    if (slot >= meshlet_count)
+        return;
+
+    Meshlet meshlet = meshlets[draw.lod_first_meshlets[lod] + slot];
+    bool visible = is_visible(meshlet, draw, view);
+
+    // The index buffer is bound at offset 0 with the type of the mesh, the 32 bit section is 4 byte aligned
+    DrawIndexedIndirectCommand command;
+    command.index_count = meshlet.triangle_count * 3;
+    command.instance_count = visible ? 1 : 0;
+    command.first_index = meshlet.index_offset / meshlet.index_size;
+    command.vertex_offset = draw.vertex_offset;
+    command.first_instance = 0;
+    commands[view_index * push_constants.task_count + task_index] = command;
+}
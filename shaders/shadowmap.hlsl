@@ -8,19 +8,15 @@ struct VSOutput
     float4 position: SV_Position;
 };
 
-struct Vertex
-{
-	float3 position;
-	float3 normal;
-	float4 tangent;
-	float2 uv;
-};
+#include "vertex.hlsli"
 
-[[vk::binding(0)]] StructuredBuffer<Vertex> vertex_buffer;
+// PackedPosition: xy in the first word, z in the low half of the second
+[[vk::binding(0)]] StructuredBuffer<uint2> position_buffer;
 
 struct PushConstants
 {
     float4x4 mvp;
+    float4 position_dequantize;
 };
 
 [[vk::push_constant]]
@@ -30,8 +26,9 @@ VSOutput vs_main(VSInput input)
 {
     VSOutput output = (VSOutput)0;
 
-    Vertex v = vertex_buffer[input.vertex_id];
-    float4 position = mul(push_constants.mvp, float4(v.position, 1.0f));
+    uint2 v = position_buffer[input.vertex_id];
+    float3 object_position = decode_position(v.x, v.y, push_constants.position_dequantize);
+    float4 position = mul(push_constants.mvp, float4(object_position, 1.0f));
     position.z = position.z * position.w; // Linear output to mitigate shadow map artifacts
     output.position = position;
 
@@ -0,0 +1,39 @@
+#pragma once
+
+// Mirrors PackedVertex in geometry.h
+struct PackedVertex
+{
+    uint position_xy;
+    uint position_z_tangent_sign;
+    uint normal;
+    uint tangent;
+    uint uv;
+};
+
+// Offset in xyz and scale in w, see GeometryMesh::position_dequantize
+float3 decode_position(uint position_xy, uint position_z, float4 dequantize)
+{
+    float3 q = float3(position_xy & 0xFFFF, position_xy >> 16, position_z & 0xFFFF);
+    return dequantize.xyz + q * dequantize.w;
+}
+
+float2 decode_snorm16x2(uint packed)
+{
+    int2 v = int2(asint(packed << 16), asint(packed)) >> 16;
+    return max(float2(v) / 32767.0f, -1.0f);
+}
+
+float3 decode_octahedral(uint packed)
+{
+    float2 e = decode_snorm16x2(packed);
+    float3 n = float3(e, 1.0f - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+float2 decode_half2(uint packed)
+{
+    return float2(f16tof32(packed & 0xFFFF), f16tof32(packed >> 16));
+}
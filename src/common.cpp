@@ -1,7 +1,20 @@
 #include "common.h"
+#include "load_telemetry.h"
+
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 bool read_binary_file(const char* filepath, std::vector<uint8_t>& data)
 {
+	LoadScope scope(LOAD_STAGE_FILE_READ, filepath);
 	FILE* f = fopen(filepath, "rb");
 	if (!f)
 	{
@@ -15,6 +28,7 @@ bool read_binary_file(const char* filepath, std::vector<uint8_t>& data)
 	data.resize(filesize);
 	size_t bytes_read = fread(data.data(), 1, filesize, f);
 	assert(bytes_read == filesize);
+	load_telemetry_add_bytes_read(bytes_read);
 
 	fclose(f);
 
@@ -44,3 +58,136 @@ std::string read_text_file(const char* filepath)
 
 	return str;
 }
+
+double get_time_ms()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t mix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ull);
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t k;
+		memcpy(&k, bytes + i, 8);
+		h = (h ^ mix64(k)) * 0x9e3779b97f4a7c15ull;
+	}
+
+	uint64_t tail = 0;
+	memcpy(&tail, bytes + i, size - i);
+	h ^= mix64(tail);
+
+	return mix64(h);
+}
+
+bool map_file(MappedFile& file, const char* filepath)
+{
+	file = {};
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		printf("Failed to open file %s\n", filepath);
+		return false;
+	}
+
+	LARGE_INTEGER filesize{};
+	if (!GetFileSizeEx(handle, &filesize) || filesize.QuadPart == 0)
+	{
+		printf("Failed to map empty file %s\n", filepath);
+		CloseHandle(handle);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view)
+	{
+		printf("Failed to map file %s\n", filepath);
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file.data = (const uint8_t*)view;
+	file.size = (size_t)filesize.QuadPart;
+	file.file_handle = handle;
+	file.mapping_handle = mapping;
+#else
+	int fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+	{
+		printf("Failed to open file %s\n", filepath);
+		return false;
+	}
+
+	struct stat st{};
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		printf("Failed to map empty file %s\n", filepath);
+		close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED)
+	{
+		printf("Failed to map file %s\n", filepath);
+		close(fd);
+		return false;
+	}
+
+	// Assets are consumed front to back exactly once, let the kernel read ahead aggressively
+	// and drop pages behind the reader
+	madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	file.data = (const uint8_t*)view;
+	file.size = (size_t)st.st_size;
+	file.fd = fd;
+#endif
+
+	return true;
+}
+
+void unmap_file(MappedFile& file)
+{
+	if (!file.data) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle(file.mapping_handle);
+	CloseHandle(file.file_handle);
+#else
+	munmap((void*)file.data, file.size);
+	close(file.fd);
+#endif
+
+	file = {};
+}
+
+void prefetch_mapped_file(const MappedFile& file)
+{
+	if (!file.data) return;
+
+#ifdef _WIN32
+	WIN32_MEMORY_RANGE_ENTRY range{ (void*)file.data, file.size };
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	madvise((void*)file.data, file.size, MADV_WILLNEED);
+#endif
+}
@@ -31,4 +31,30 @@
 
 
 bool read_binary_file(const char* filepath, std::vector<uint8_t>&data);
-std::string read_text_file(const char* filepath);
\ No newline at end of file
+std::string read_text_file(const char* filepath);
+
+// Monotonic wall clock in milliseconds, for timing load stages
+double get_time_ms();
+
+// Fast non-cryptographic 64 bit hash, for content keyed caches
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
+
+// Read only view of a whole file mapped into memory. Reading through the mapping copies straight
+// out of the page cache instead of going through an intermediate heap buffer.
+struct MappedFile
+{
+	const uint8_t* data;
+	size_t size;
+
+#ifdef _WIN32
+	void* file_handle;
+	void* mapping_handle;
+#else
+	int fd;
+#endif
+};
+
+bool map_file(MappedFile& file, const char* filepath);
+void unmap_file(MappedFile& file);
+// Starts reading the whole mapping into the page cache in the background, without waiting for it
+void prefetch_mapped_file(const MappedFile& file);
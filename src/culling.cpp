@@ -0,0 +1,251 @@
+#include "culling.h"
+#include "upload.h"
+
+#include <algorithm>
+
+// Mirror the structs in meshlet_cull.hlsl
+struct GPUCullView
+{
+	glm::vec4 planes[5]; // Left, right, bottom, top and near, normals point inwards
+	glm::vec4 position;  // Pixels per unit at distance one over CULL_LOD_PIXEL_ERROR in w
+};
+
+struct GPUCullDraw
+{
+	glm::mat4 transform;
+	uint32_t view_mask;
+	float scale;        // Largest axis scale of the transform, applied to radii and errors
+	uint32_t lod_count; // The full mesh included
+	int32_t vertex_offset;
+	glm::vec4 bounds;   // Of the mesh in object space
+	float lod_errors[MESH_MAX_LODS];
+	uint32_t lod_first_meshlets[MESH_MAX_LODS];
+	uint32_t lod_meshlet_counts[MESH_MAX_LODS];
+	uint32_t first_chunk;
+};
+
+struct CullConstants
+{
+	uint32_t first_task;
+	uint32_t task_count;
+	uint32_t chunk_count;
+};
+
+// Tasks per workgroup, WORKGROUP_SIZE in meshlet_cull.hlsl
+static constexpr uint32_t CULL_WORKGROUP_SIZE = 64;
+// Workgroups along x per dispatch, the guaranteed minimum of maxComputeWorkGroupCount
+static constexpr uint32_t CULL_MAX_WORKGROUPS = 65535;
+
+bool create_meshlet_culler(MeshletCuller& culler, VkDevice device, VmaAllocator allocator, const ShaderCompiler& compiler)
+{
+	Shader shader{};
+	if (!load_shader(shader, compiler, device, "meshlet_cull.hlsl", "cs_main", VK_SHADER_STAGE_COMPUTE_BIT))
+		return false;
+
+	culler.device = device;
+	culler.program = create_program(device, { shader }, true);
+	culler.pipeline = create_compute_pipeline(device, shader, culler.program.pipeline_layout);
+	culler.views = create_buffer(allocator, CULL_MAX_VIEWS * sizeof(GPUCullView), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+
+	return true;
+}
+
+void destroy_meshlet_culler(MeshletCuller& culler)
+{
+	culler.views.destroy();
+	vkDestroyPipeline(culler.device, culler.pipeline, nullptr);
+	destroy_program(culler.device, culler.program);
+}
+
+void create_cull_batch(
+	CullBatch& batch,
+	const Geometry& geometry,
+	const std::vector<Mesh>& meshes,
+	const std::vector<MeshDraw>& draws,
+	const std::vector<uint32_t>& view_masks,
+	uint32_t view_count,
+	VmaAllocator allocator,
+	UploadBatcher& uploader)
+{
+	assert(view_count <= CULL_MAX_VIEWS && view_masks.size() == draws.size());
+
+	batch.draw_count = (uint32_t)draws.size();
+	batch.view_count = view_count;
+	batch.chunk_count = 0;
+	batch.draw_ranges.assign(draws.size(), CullDrawRange{});
+
+	std::vector<GPUCullDraw> gpu_draws(draws.size());
+	std::vector<glm::uvec2> tasks;
+	for (uint32_t i = 0; i < (uint32_t)draws.size(); ++i)
+	{
+		const glm::mat4& transform = draws[i].transform;
+		const Mesh& mesh = meshes[draws[i].mesh_index];
+		const GeometryMesh& geometry_mesh = geometry.meshes[draws[i].mesh_index];
+		GPUCullDraw& gpu_draw = gpu_draws[i];
+		gpu_draw = GPUCullDraw{
+			.transform = transform,
+			.view_mask = view_masks[i],
+			.scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])))),
+			.lod_count = 1 + mesh.lod_count,
+			.vertex_offset = (int32_t)mesh.first_vertex,
+			.bounds = geometry_mesh.bounds,
+		};
+		uint32_t slot_count = 0;
+		uint32_t first_meshlet = geometry_mesh.first_meshlet;
+		for (uint32_t level = 0; level <= mesh.lod_count; ++level)
+		{
+			gpu_draw.lod_errors[level] = get_mesh_lod(mesh, level).error;
+			gpu_draw.lod_first_meshlets[level] = first_meshlet;
+			gpu_draw.lod_meshlet_counts[level] = geometry_mesh.lod_meshlet_counts[level];
+			first_meshlet += geometry_mesh.lod_meshlet_counts[level];
+			slot_count = std::max(slot_count, geometry_mesh.lod_meshlet_counts[level]);
+		}
+
+		// Only one level is drawn per view, the slots fit the largest
+		if (view_masks[i] == 0 || slot_count == 0)
+			continue;
+
+		uint32_t chunk_count = (slot_count + CULL_MAX_DRAW_COUNT - 1) / CULL_MAX_DRAW_COUNT;
+		gpu_draw.first_chunk = batch.chunk_count;
+		batch.draw_ranges[i] = CullDrawRange{
+			.first_task = (uint32_t)tasks.size(),
+			.task_count = slot_count,
+			.first_chunk = batch.chunk_count,
+			.chunk_count = chunk_count,
+			.index_type = geometry_mesh.index_type,
+		};
+		batch.chunk_count += chunk_count;
+		for (uint32_t j = 0; j < slot_count; ++j)
+			tasks.push_back(glm::uvec2(i, j));
+	}
+	batch.task_count = (uint32_t)tasks.size();
+
+	// Buffers are never empty, neither are the copies into them
+	VkDeviceSize commands_size = (VkDeviceSize)std::max(view_count * batch.task_count, 1u) * sizeof(VkDrawIndexedIndirectCommand);
+	batch.draws = create_buffer(allocator, std::max<VkDeviceSize>(gpu_draws.size() * sizeof(GPUCullDraw), sizeof(GPUCullDraw)),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	batch.tasks = create_buffer(allocator, std::max<VkDeviceSize>(tasks.size() * sizeof(glm::uvec2), sizeof(glm::uvec2)),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	batch.commands = create_buffer(allocator, commands_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+	batch.counts = create_buffer(allocator, (VkDeviceSize)std::max(view_count * batch.chunk_count, 1u) * sizeof(uint32_t),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+
+	if (!gpu_draws.empty())
+		upload_batcher_upload_buffer(uploader, batch.draws, gpu_draws.data(), gpu_draws.size() * sizeof(GPUCullDraw));
+	if (!tasks.empty())
+		upload_batcher_upload_buffer(uploader, batch.tasks, tasks.data(), tasks.size() * sizeof(glm::uvec2));
+
+	printf("Culling: %u draws, %u command slots, %u views, %.2f MB of indirect commands\n",
+		batch.draw_count, batch.task_count, view_count, commands_size / (1024.0 * 1024.0));
+}
+
+void destroy_cull_batch(CullBatch& batch)
+{
+	batch.draws.destroy();
+	batch.tasks.destroy();
+	batch.commands.destroy();
+	batch.counts.destroy();
+	batch.draw_ranges.clear();
+}
+
+std::vector<uint32_t> get_cull_view_masks(const std::vector<MeshDraw>& mesh_draws, const std::vector<Material>& materials, size_t light_count)
+{
+	uint32_t shadow_views = ((1u << light_count) - 1u) << 1;
+	std::vector<uint32_t> view_masks(mesh_draws.size());
+	for (size_t i = 0; i < mesh_draws.size(); ++i)
+		view_masks[i] = 1u | (casts_shadows(materials[mesh_draws[i].material_index]) ? shadow_views : 0u);
+	return view_masks;
+}
+
+// Gribb and Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix"
+static glm::vec4 normalize_plane(glm::vec4 plane)
+{
+	return plane / glm::length(glm::vec3(plane));
+}
+
+void update_cull_views(MeshletCuller& culler, const CullView* views, uint32_t view_count)
+{
+	assert(view_count <= CULL_MAX_VIEWS);
+
+	GPUCullView gpu_views[CULL_MAX_VIEWS];
+	for (uint32_t i = 0; i < view_count; ++i)
+	{
+		glm::mat4 m = glm::transpose(views[i].view_projection);
+		// The far plane is left out, shadow passes remap depth and nothing in the scenes reaches it
+		gpu_views[i] = GPUCullView{
+			.planes = {
+				normalize_plane(m[3] + m[0]),
+				normalize_plane(m[3] - m[0]),
+				normalize_plane(m[3] + m[1]),
+				normalize_plane(m[3] - m[1]),
+				normalize_plane(m[2]),
+			},
+			.position = glm::vec4(views[i].position, views[i].pixels_per_unit / CULL_LOD_PIXEL_ERROR),
+		};
+	}
+
+	void* mapped = culler.views.map();
+	memcpy(mapped, gpu_views, view_count * sizeof(GPUCullView));
+	culler.views.unmap();
+}
+
+void record_meshlet_culling(const MeshletCuller& culler, VkCommandBuffer command_buffer, const Geometry& geometry, const CullBatch& batch)
+{
+	if (batch.task_count == 0)
+		return;
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culler.pipeline);
+
+	DescriptorInfo descriptors[] = {
+		DescriptorInfo(culler.views.buffer),
+		DescriptorInfo(batch.draws.buffer),
+		DescriptorInfo(geometry.meshlet_buffer.buffer),
+		DescriptorInfo(batch.tasks.buffer),
+		DescriptorInfo(batch.commands.buffer),
+		DescriptorInfo(batch.counts.buffer),
+	};
+	vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, culler.program.descriptor_update_template, culler.program.pipeline_layout, 0, descriptors);
+
+	// One thread per command slot and view
+	for (uint32_t first_task = 0; first_task < batch.task_count; first_task += CULL_MAX_WORKGROUPS * CULL_WORKGROUP_SIZE)
+	{
+		CullConstants constants{
+			.first_task = first_task,
+			.task_count = batch.task_count,
+			.chunk_count = batch.chunk_count,
+		};
+		uint32_t workgroups = (std::min(batch.task_count - first_task, CULL_MAX_WORKGROUPS * CULL_WORKGROUP_SIZE) + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE;
+		vkCmdPushConstants(command_buffer, culler.program.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		vkCmdDispatch(command_buffer, workgroups, batch.view_count, 1);
+	}
+
+	VkMemoryBarrier2 barrier = memory_barrier(
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+	pipeline_barrier(command_buffer, 1, &barrier);
+}
+
+void draw_culled(VkCommandBuffer command_buffer, const Geometry& geometry, const CullBatch& batch, uint32_t view, uint32_t draw, VkIndexType& bound_index_type)
+{
+	const CullDrawRange& range = batch.draw_ranges[draw];
+	if (range.task_count == 0)
+		return;
+
+	// Bound at the start of the buffer, the commands index both sections from there
+	if (range.index_type != bound_index_type)
+	{
+		vkCmdBindIndexBuffer(command_buffer, geometry.index_buffer.buffer, 0, range.index_type);
+		bound_index_type = range.index_type;
+	}
+
+	// The count of a chunk is at most CULL_MAX_DRAW_COUNT, which every device supports as maxDrawCount
+	for (uint32_t chunk = 0; chunk < range.chunk_count; ++chunk)
+	{
+		uint32_t first_slot = chunk * CULL_MAX_DRAW_COUNT;
+		VkDeviceSize offset = ((VkDeviceSize)view * batch.task_count + range.first_task + first_slot) * sizeof(VkDrawIndexedIndirectCommand);
+		VkDeviceSize count_offset = ((VkDeviceSize)view * batch.chunk_count + range.first_chunk + chunk) * sizeof(uint32_t);
+		vkCmdDrawIndexedIndirectCount(command_buffer, batch.commands.buffer, offset, batch.counts.buffer, count_offset,
+			std::min(range.task_count - first_slot, CULL_MAX_DRAW_COUNT), sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "geometry.h"
+#include "shader_compiler.h"
+
+struct UploadBatcher;
+
+// Views culled by a single dispatch, the main camera and one per shadow casting light
+static constexpr uint32_t CULL_MAX_VIEWS = 8;
+
+// Every draw uses the coarsest level of detail whose error projects to at most this many pixels
+static constexpr float CULL_LOD_PIXEL_ERROR = 1.0f;
+
+// Commands per vkCmdDrawIndexedIndirectCount, the guaranteed minimum of maxDrawIndirectCount with
+// multiDrawIndirect. Draws with more meshlets are split into chunks of this many, each with its own count.
+static constexpr uint32_t CULL_MAX_DRAW_COUNT = 65535;
+
+// A camera meshlets are culled against
+struct CullView
+{
+	glm::mat4 view_projection; // Frustum of the pass
+	glm::vec3 position;        // Eye the back face cones are tested from
+	float pixels_per_unit;     // Pixels a unit long object at distance one covers, projection[1][1] * height / 2
+};
+
+// Compute based meshlet culling. A pre-pass picks the level of detail of every draw for each view from the
+// projected size of its error and tests the meshlets of that level against the frustum and the back face
+// cone of the view. A draw has a command slot per view for every meshlet of its largest level, the meshlets
+// of the selected level write theirs in order, drawing their triangles straight from the geometry index
+// buffer with no instances if they were culled, and the number of slots written goes to a count buffer. The
+// geometry passes draw the commands of a draw with vkCmdDrawIndexedIndirectCount, so the slots the selected
+// level leaves unused cost nothing.
+struct MeshletCuller
+{
+	VkDevice device;
+	Program program;
+	VkPipeline pipeline;
+	Buffer views; // Host visible, written every frame
+};
+
+// Commands of a draw, the same range in every view
+struct CullDrawRange
+{
+	uint32_t first_task;  // One task per meshlet of the level of detail with the most of them
+	uint32_t task_count;  // 0 for draws in no view
+	uint32_t first_chunk; // Counts of CULL_MAX_DRAW_COUNT commands each
+	uint32_t chunk_count;
+	VkIndexType index_type;
+};
+
+// The draws of a scene as the culler sees them. Recreated whenever the draws or the geometry change.
+struct CullBatch
+{
+	uint32_t draw_count;
+	uint32_t view_count;
+	uint32_t task_count;
+	uint32_t chunk_count;
+	std::vector<CullDrawRange> draw_ranges;
+	Buffer draws;    // Transform, view mask, first vertex and meshlets per level per draw
+	Buffer tasks;    // Draw and slot index pairs
+	Buffer commands; // VkDrawIndexedIndirectCommand per view and task, the culling shader writes those of the selected levels every frame
+	Buffer counts;   // Commands to draw per view and chunk, all rewritten every frame
+};
+
+bool create_meshlet_culler(MeshletCuller& culler, VkDevice device, VmaAllocator allocator, const ShaderCompiler& compiler);
+void destroy_meshlet_culler(MeshletCuller& culler);
+
+// view_masks has a bit per view for every draw, draws are only culled and drawn for the views they are in.
+// The caller flushes the uploader.
+void create_cull_batch(
+	CullBatch& batch,
+	const Geometry& geometry,
+	const std::vector<Mesh>& meshes,
+	const std::vector<MeshDraw>& draws,
+	const std::vector<uint32_t>& view_masks,
+	uint32_t view_count,
+	VmaAllocator allocator,
+	UploadBatcher& uploader);
+void destroy_cull_batch(CullBatch& batch);
+
+// View masks of the renderer: view 0 is the main camera, view 1 + i the shadow pass of light i, which
+// only draws materials that cast shadows
+std::vector<uint32_t> get_cull_view_masks(const std::vector<MeshDraw>& mesh_draws, const std::vector<Material>& materials, size_t light_count);
+
+// Writes the views of the next frame, the previous frame has to be complete
+void update_cull_views(MeshletCuller& culler, const CullView* views, uint32_t view_count);
+
+// Culls every meshlet for all views and writes the commands and counts, which are visible to indirect draws afterwards
+void record_meshlet_culling(const MeshletCuller& culler, VkCommandBuffer command_buffer, const Geometry& geometry, const CullBatch& batch);
+
+// Binds the geometry index buffer with the index type of the draw if the bound one has a different type and
+// draws the meshlets that survived culling for the view. bound_index_type starts out as VK_INDEX_TYPE_MAX_ENUM
+// for every command buffer.
+void draw_culled(VkCommandBuffer command_buffer, const Geometry& geometry, const CullBatch& batch, uint32_t view, uint32_t draw, VkIndexType& bound_index_type);
@@ -0,0 +1,147 @@
+#include "downsample.h"
+
+#include <algorithm>
+
+struct DownsampleConstants
+{
+	glm::uvec2 size;
+	uint32_t level_count;
+	uint32_t workgroup_count;
+	uint32_t counter_index;
+	uint32_t reduction;
+	uint32_t is_srgb;
+};
+
+// Every workgroup reduces a 64x64 tile of the source level
+static constexpr uint32_t DOWNSAMPLE_TILE_SIZE = 64;
+
+bool create_downsampler(Downsampler& downsampler, VkDevice device, VmaAllocator allocator, const Shader& shader)
+{
+	std::vector<uint32_t> counters(DOWNSAMPLE_MAX_DISPATCHES, 0);
+
+	downsampler.device = device;
+	downsampler.program = create_program(device, { shader }, true);
+	downsampler.pipeline = create_compute_pipeline(device, shader, downsampler.program.pipeline_layout);
+	downsampler.counters = create_buffer(allocator, counters.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, counters.data());
+
+	return true;
+}
+
+void destroy_downsampler(Downsampler& downsampler)
+{
+	downsampler.counters.destroy();
+	vkDestroyPipeline(downsampler.device, downsampler.pipeline, nullptr);
+	destroy_program(downsampler.device, downsampler.program);
+}
+
+DownsampleChain create_downsample_chain(VkDevice device, VkImage image, VkFormat format, uint32_t width, uint32_t height, uint32_t level_count, uint32_t layer)
+{
+	DownsampleChain chain{
+		.image = image,
+		.width = width,
+		.height = height,
+		.is_srgb = get_unorm_format(format) != format,
+	};
+
+	chain.views.resize(level_count);
+	for (uint32_t i = 0; i < level_count; ++i)
+	{
+		VkImageViewCreateInfo create_info{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+			.image = image,
+			.viewType = VK_IMAGE_VIEW_TYPE_2D,
+			.format = get_unorm_format(format),
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = i,
+				.levelCount = 1,
+				.baseArrayLayer = layer,
+				.layerCount = 1,
+			}
+		};
+
+		VK_CHECK(vkCreateImageView(device, &create_info, nullptr, &chain.views[i]));
+	}
+
+	return chain;
+}
+
+void destroy_downsample_chain(VkDevice device, DownsampleChain& chain)
+{
+	for (VkImageView view : chain.views)
+		vkDestroyImageView(device, view, nullptr);
+	chain.views.clear();
+}
+
+void record_downsample(const Downsampler& downsampler, VkCommandBuffer command_buffer, const DownsampleChain* chains, uint32_t chain_count, DownsampleReduction reduction)
+{
+	// Orders the counter resets of earlier dispatches, and the last level of a pass, before the next reads
+	VkMemoryBarrier2 barrier = memory_barrier(
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+	pipeline_barrier(command_buffer, 1, &barrier);
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, downsampler.pipeline);
+
+	// Levels past 6 are built by a single workgroup from at most 64x64 texels of level 6, larger
+	// sources only get 6 levels per pass. Chains continue from the last level of their previous pass.
+	std::vector<uint32_t> bases(chain_count, 0);
+	for (bool first_pass = true; ; first_pass = false)
+	{
+		bool has_work = false;
+		for (uint32_t i = 0; i < chain_count && !has_work; ++i)
+			has_work = bases[i] + 1 < chains[i].views.size();
+
+		if (!has_work)
+			break;
+
+		if (!first_pass)
+			pipeline_barrier(command_buffer, 1, &barrier);
+
+		uint32_t dispatch_count = 0;
+		for (uint32_t i = 0; i < chain_count; ++i)
+		{
+			const DownsampleChain& chain = chains[i];
+			uint32_t base = bases[i];
+			if (base + 1 >= chain.views.size())
+				continue;
+
+			if (dispatch_count == DOWNSAMPLE_MAX_DISPATCHES)
+			{
+				pipeline_barrier(command_buffer, 1, &barrier);
+				dispatch_count = 0;
+			}
+
+			glm::uvec2 size = glm::max(glm::uvec2(chain.width, chain.height) >> base, glm::uvec2(1u));
+			glm::uvec2 workgroups = (size + DOWNSAMPLE_TILE_SIZE - 1u) / DOWNSAMPLE_TILE_SIZE;
+
+			uint32_t level_count = std::min(DOWNSAMPLE_MAX_LEVELS, (uint32_t)chain.views.size() - 1 - base);
+			if (std::max(size.x, size.y) > DOWNSAMPLE_TILE_SIZE * DOWNSAMPLE_TILE_SIZE)
+				level_count = std::min(level_count, 6u);
+
+			// Unused slots still need a valid view, they are never written
+			DescriptorInfo descriptors[DOWNSAMPLE_MAX_LEVELS + 3];
+			for (uint32_t level = 0; level <= DOWNSAMPLE_MAX_LEVELS; ++level)
+				descriptors[level] = DescriptorInfo(chain.views[base + std::min(level, level_count)], VK_IMAGE_LAYOUT_GENERAL);
+			descriptors[DOWNSAMPLE_MAX_LEVELS + 1] = DescriptorInfo(chain.views[base + std::min(6u, level_count)], VK_IMAGE_LAYOUT_GENERAL);
+			descriptors[DOWNSAMPLE_MAX_LEVELS + 2] = DescriptorInfo(downsampler.counters.buffer);
+
+			DownsampleConstants constants{
+				.size = size,
+				.level_count = level_count,
+				.workgroup_count = workgroups.x * workgroups.y,
+				.counter_index = dispatch_count,
+				.reduction = (uint32_t)reduction,
+				.is_srgb = chain.is_srgb ? 1u : 0u,
+			};
+
+			vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, downsampler.program.descriptor_update_template, downsampler.program.pipeline_layout, 0, descriptors);
+			vkCmdPushConstants(command_buffer, downsampler.program.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+			vkCmdDispatch(command_buffer, workgroups.x, workgroups.y, 1);
+
+			bases[i] += level_count;
+			dispatch_count++;
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "resources.h"
+#include "shaders.h"
+
+// Levels written by a single dispatch of the downsample shader, longer chains take several passes
+static constexpr uint32_t DOWNSAMPLE_MAX_LEVELS = 12;
+// Dispatches recorded between two counter buffer barriers
+static constexpr uint32_t DOWNSAMPLE_MAX_DISPATCHES = 256;
+
+enum DownsampleReduction
+{
+	DOWNSAMPLE_AVERAGE = 0, // Box filter, sRGB chains are filtered in linear space
+	DOWNSAMPLE_MIN,         // Hi-Z pyramids
+	DOWNSAMPLE_MAX,
+};
+
+// Compute based mip chain generation. A single dispatch builds up to DOWNSAMPLE_MAX_LEVELS levels
+// of an image and the dispatches of every chain recorded together run without barriers in between.
+struct Downsampler
+{
+	VkDevice device;
+	Program program;
+	VkPipeline pipeline;
+	Buffer counters; // One atomic counter per dispatch, reset by the shader once it is done
+};
+
+// Storage views of every level of a mip chain, views[0] is the source
+struct DownsampleChain
+{
+	VkImage image;
+	uint32_t width;
+	uint32_t height;
+	bool is_srgb;
+	std::vector<VkImageView> views;
+};
+
+// shader is the cs_main entry point of downsample.hlsl. Taking it compiled keeps the downsampler, and the
+// uploads using it, free of the shader compiler.
+bool create_downsampler(Downsampler& downsampler, VkDevice device, VmaAllocator allocator, const Shader& shader);
+void destroy_downsampler(Downsampler& downsampler);
+
+// The image needs storage usage, sRGB images also need VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT (see create_texture).
+// The chain covers a single array layer, cubemaps take one chain per face.
+DownsampleChain create_downsample_chain(VkDevice device, VkImage image, VkFormat format, uint32_t width, uint32_t height, uint32_t level_count, uint32_t layer = 0);
+void destroy_downsample_chain(VkDevice device, DownsampleChain& chain);
+
+// Fills every level after the first from level 0 for all chains. Images have to be in general layout
+// with level 0 visible to compute shaders, the new levels are written by the compute shader stage.
+void record_downsample(const Downsampler& downsampler, VkCommandBuffer command_buffer, const DownsampleChain* chains, uint32_t chain_count, DownsampleReduction reduction = DOWNSAMPLE_AVERAGE);
@@ -0,0 +1,425 @@
+#include "environment_baker.h"
+#include "pack.h"
+
+#include <glm/gtc/packing.hpp>
+#include <stb_image.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+struct EnvironmentSkyConstants
+{
+	glm::uvec2 source_size;
+	uint32_t size;
+};
+
+struct EnvironmentPrefilterConstants
+{
+	uint32_t size;
+	uint32_t sky_size;
+	float roughness;
+	uint32_t sample_count;
+};
+
+struct EnvironmentShConstants
+{
+	uint32_t size;
+	float level;
+};
+
+struct EnvironmentIrradianceConstants
+{
+	uint32_t size;
+};
+
+// Largest finite half float, brighter texels such as the sun would become infinite
+static constexpr float HALF_MAX = 65504.0f;
+
+static bool create_bake_pipeline(VkDevice device, const ShaderCompiler& compiler, const char* path, Program& program, VkPipeline& pipeline)
+{
+	Shader shader{};
+	if (!load_shader(shader, compiler, device, path, "cs_main", VK_SHADER_STAGE_COMPUTE_BIT))
+		return false;
+
+	program = create_program(device, { shader }, true);
+	pipeline = create_compute_pipeline(device, shader, program.pipeline_layout);
+	return true;
+}
+
+bool create_environment_baker(EnvironmentBaker& baker, VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queue_family,
+	const ShaderCompiler& compiler, const Downsampler& downsampler)
+{
+	baker = {};
+	baker.device = device;
+	baker.allocator = allocator;
+	baker.queue = queue;
+	baker.downsampler = &downsampler;
+
+	if (!create_bake_pipeline(device, compiler, "env_equirect_to_cube.hlsl", baker.sky_program, baker.sky_pipeline)
+		|| !create_bake_pipeline(device, compiler, "env_prefilter.hlsl", baker.prefilter_program, baker.prefilter_pipeline)
+		|| !create_bake_pipeline(device, compiler, "env_project_sh.hlsl", baker.sh_program, baker.sh_pipeline)
+		|| !create_bake_pipeline(device, compiler, "env_irradiance.hlsl", baker.irradiance_program, baker.irradiance_pipeline))
+		return false;
+
+	VkCommandPoolCreateInfo pool_info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+		.queueFamilyIndex = queue_family,
+	};
+	VK_CHECK(vkCreateCommandPool(device, &pool_info, nullptr, &baker.command_pool));
+
+	VkCommandBufferAllocateInfo allocate_info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = baker.command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1
+	};
+	VK_CHECK(vkAllocateCommandBuffers(device, &allocate_info, &baker.command_buffer));
+
+	VkFenceCreateInfo fence_info{ .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	VK_CHECK(vkCreateFence(device, &fence_info, nullptr, &baker.fence));
+
+	VkSamplerCreateInfo sampler_info{
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_LINEAR,
+		.minFilter = VK_FILTER_LINEAR,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.maxLod = VK_LOD_CLAMP_NONE
+	};
+	VK_CHECK(vkCreateSampler(device, &sampler_info, nullptr, &baker.sampler));
+
+	return true;
+}
+
+void destroy_environment_baker(EnvironmentBaker& baker)
+{
+	if (baker.is_baking)
+	{
+		VK_CHECK(vkWaitForFences(baker.device, 1, &baker.fence, VK_TRUE, UINT64_MAX));
+		std::vector<TextureImage> images;
+		finish_environment_bake(baker, images);
+	}
+
+	vkDestroySampler(baker.device, baker.sampler, nullptr);
+	vkDestroyFence(baker.device, baker.fence, nullptr);
+	vkDestroyCommandPool(baker.device, baker.command_pool, nullptr);
+
+	vkDestroyPipeline(baker.device, baker.sky_pipeline, nullptr);
+	vkDestroyPipeline(baker.device, baker.prefilter_pipeline, nullptr);
+	vkDestroyPipeline(baker.device, baker.sh_pipeline, nullptr);
+	vkDestroyPipeline(baker.device, baker.irradiance_pipeline, nullptr);
+	destroy_program(baker.device, baker.sky_program);
+	destroy_program(baker.device, baker.prefilter_program);
+	destroy_program(baker.device, baker.sh_program);
+	destroy_program(baker.device, baker.irradiance_program);
+}
+
+bool decode_hdr_image(HdrImage& image, const uint8_t* data, size_t size)
+{
+	int width = 0, height = 0, channels = 0;
+	float* pixels = stbi_loadf_from_memory(data, (int)size, &width, &height, &channels, 3);
+	if (!pixels)
+	{
+		printf("Failed to decode HDR image: %s\n", stbi_failure_reason());
+		return false;
+	}
+
+	image.width = (uint32_t)width;
+	image.height = (uint32_t)height;
+	image.texels.resize((size_t)width * height * 2);
+	for (size_t i = 0; i < (size_t)width * height; ++i)
+	{
+		glm::vec3 rgb = glm::min(glm::vec3(pixels[i * 3 + 0], pixels[i * 3 + 1], pixels[i * 3 + 2]), glm::vec3(HALF_MAX));
+		image.texels[i * 2 + 0] = glm::packHalf2x16(glm::vec2(rgb.r, rgb.g));
+		image.texels[i * 2 + 1] = glm::packHalf2x16(glm::vec2(rgb.b, 0.0f));
+	}
+
+	stbi_image_free(pixels);
+	return true;
+}
+
+std::string get_environment_cache_path(const uint8_t* data, size_t size)
+{
+	uint32_t versions[] = { PACK_VERSION, ENVIRONMENT_BAKE_VERSION, ENVIRONMENT_SKY_MAX_SIZE, ENVIRONMENT_REFLECTION_SIZE,
+		ENVIRONMENT_REFLECTION_LEVELS, ENVIRONMENT_PREFILTER_SAMPLES, ENVIRONMENT_IRRADIANCE_SIZE, ENVIRONMENT_SH_SIZE };
+	uint64_t hash = hash_bytes(versions, sizeof(versions), hash_bytes(data, size));
+
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%016llx_v%u.rxpak", ENVIRONMENT_CACHE_DIRECTORY, (unsigned long long)hash, PACK_VERSION);
+	return path;
+}
+
+// Storage view of the six faces of one level of a cubemap
+static VkImageView create_level_view(VkDevice device, VkImage image, uint32_t level)
+{
+	VkImageViewCreateInfo create_info{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.image = image,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+		.format = ENVIRONMENT_FORMAT,
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.baseMipLevel = level,
+			.levelCount = 1,
+			.baseArrayLayer = 0,
+			.layerCount = 6,
+		}
+	};
+
+	VkImageView view = VK_NULL_HANDLE;
+	VK_CHECK(vkCreateImageView(device, &create_info, nullptr, &view));
+	return view;
+}
+
+static void bake_dispatch(VkCommandBuffer command_buffer, const Program& program, VkPipeline pipeline, const DescriptorInfo* descriptors,
+	const void* constants, uint32_t constants_size, glm::uvec3 groups)
+{
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, program.descriptor_update_template, program.pipeline_layout, 0, descriptors);
+	vkCmdPushConstants(command_buffer, program.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, constants_size, constants);
+	vkCmdDispatch(command_buffer, groups.x, groups.y, groups.z);
+}
+
+void begin_environment_bake(EnvironmentBaker& baker, const HdrImage& image, Texture& irradiance, Texture& reflection, Texture& sky)
+{
+	assert(!baker.is_baking);
+	baker.start_ms = get_time_ms();
+
+	VkDevice device = baker.device;
+	uint32_t sky_size = std::clamp(std::bit_ceil(std::max(image.width / 4, 1u)), ENVIRONMENT_SKY_MIN_SIZE, ENVIRONMENT_SKY_MAX_SIZE);
+	uint32_t sky_levels = (uint32_t)std::bit_width(sky_size);
+
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	irradiance = create_texture(device, baker.allocator, ENVIRONMENT_IRRADIANCE_SIZE, ENVIRONMENT_IRRADIANCE_SIZE, 1, ENVIRONMENT_FORMAT, usage,
+		1, VK_SAMPLE_COUNT_1_BIT, 6, true);
+	reflection = create_texture(device, baker.allocator, ENVIRONMENT_REFLECTION_SIZE, ENVIRONMENT_REFLECTION_SIZE, 1, ENVIRONMENT_FORMAT, usage,
+		ENVIRONMENT_REFLECTION_LEVELS, VK_SAMPLE_COUNT_1_BIT, 6, true);
+	sky = create_texture(device, baker.allocator, sky_size, sky_size, 1, ENVIRONMENT_FORMAT, usage, sky_levels, VK_SAMPLE_COUNT_1_BIT, 6, true);
+
+	baker.source = create_buffer(baker.allocator, image.texels.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, (void*)image.texels.data());
+	baker.sh_sums = create_buffer(baker.allocator, 6 * 9 * sizeof(glm::vec4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+	// Every level of the three cubemaps is read back with its faces next to each other
+	const Texture* textures[] = { &irradiance, &reflection, &sky };
+	VkDeviceSize readback_size = 0;
+	baker.images.resize(3);
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		const Texture& texture = *textures[i];
+		TextureImage& out = baker.images[i];
+		out = {
+			.width = texture.width,
+			.height = texture.height,
+			.depth = 1,
+			.mip_levels = texture.mip_levels,
+			.array_layers = 6,
+			.format = ENVIRONMENT_FORMAT,
+			.is_cubemap = true,
+		};
+
+		for (uint32_t level = 0; level < texture.mip_levels; ++level)
+		{
+			uint32_t size = std::max(texture.width >> level, 1u);
+			out.regions.push_back({
+				.bufferOffset = readback_size,
+				.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 6 },
+				.imageExtent = { size, size, 1 },
+			});
+
+			size_t level_size = get_subresource_size(ENVIRONMENT_FORMAT, size, size, 1) * 6;
+			readback_size += level_size;
+			out.size += level_size;
+		}
+	}
+	baker.readback = create_buffer(baker.allocator, readback_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+
+	VkCommandBuffer command_buffer = baker.command_buffer;
+	VK_CHECK(vkResetCommandPool(device, baker.command_pool, 0));
+	VkCommandBufferBeginInfo begin_info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	VK_CHECK(vkBeginCommandBuffer(command_buffer, &begin_info));
+
+	VkImageMemoryBarrier2 barriers[3];
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		barriers[i] = image_barrier(textures[i]->image,
+			VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL);
+	}
+	pipeline_barrier(command_buffer, 0, nullptr, 3, barriers);
+
+	VkMemoryBarrier2 compute_barrier = memory_barrier(
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+
+	// Level 0 of the sky from the source, the rest of its chain from the downsampler
+	{
+		VkImageView view = create_level_view(device, sky.image, 0);
+		baker.views.push_back(view);
+
+		DescriptorInfo descriptors[] = { DescriptorInfo(baker.source.buffer), DescriptorInfo(view, VK_IMAGE_LAYOUT_GENERAL) };
+		EnvironmentSkyConstants constants{ .source_size = { image.width, image.height }, .size = sky_size };
+		bake_dispatch(command_buffer, baker.sky_program, baker.sky_pipeline, descriptors, &constants, sizeof(constants),
+			baker.sky_program.shaders[0].get_dispatch_size(sky_size, sky_size, 6));
+	}
+
+	for (uint32_t face = 0; face < 6; ++face)
+		baker.chains.push_back(create_downsample_chain(device, sky.image, ENVIRONMENT_FORMAT, sky_size, sky_size, sky_levels, face));
+	record_downsample(*baker.downsampler, command_buffer, baker.chains.data(), (uint32_t)baker.chains.size());
+	pipeline_barrier(command_buffer, 1, &compute_barrier);
+
+	for (uint32_t level = 0; level < ENVIRONMENT_REFLECTION_LEVELS; ++level)
+	{
+		VkImageView view = create_level_view(device, reflection.image, level);
+		baker.views.push_back(view);
+
+		uint32_t size = std::max(ENVIRONMENT_REFLECTION_SIZE >> level, 1u);
+		DescriptorInfo descriptors[] = { DescriptorInfo(baker.sampler), DescriptorInfo(sky.view, VK_IMAGE_LAYOUT_GENERAL), DescriptorInfo(view, VK_IMAGE_LAYOUT_GENERAL) };
+		EnvironmentPrefilterConstants constants{
+			.size = size,
+			.sky_size = sky_size,
+			.roughness = (float)level / (float)(ENVIRONMENT_REFLECTION_LEVELS - 1),
+			.sample_count = ENVIRONMENT_PREFILTER_SAMPLES,
+		};
+		bake_dispatch(command_buffer, baker.prefilter_program, baker.prefilter_pipeline, descriptors, &constants, sizeof(constants),
+			baker.prefilter_program.shaders[0].get_dispatch_size(size, size, 6));
+	}
+
+	// One workgroup per face projects the sky onto spherical harmonics, which are convolved into irradiance
+	{
+		uint32_t size = std::min(ENVIRONMENT_SH_SIZE, sky_size);
+		DescriptorInfo descriptors[] = { DescriptorInfo(baker.sampler), DescriptorInfo(sky.view, VK_IMAGE_LAYOUT_GENERAL), DescriptorInfo(baker.sh_sums.buffer) };
+		EnvironmentShConstants constants{ .size = size, .level = log2f((float)sky_size / (float)size) };
+		bake_dispatch(command_buffer, baker.sh_program, baker.sh_pipeline, descriptors, &constants, sizeof(constants), glm::uvec3(6, 1, 1));
+	}
+	pipeline_barrier(command_buffer, 1, &compute_barrier);
+
+	{
+		VkImageView view = create_level_view(device, irradiance.image, 0);
+		baker.views.push_back(view);
+
+		DescriptorInfo descriptors[] = { DescriptorInfo(baker.sh_sums.buffer), DescriptorInfo(view, VK_IMAGE_LAYOUT_GENERAL) };
+		EnvironmentIrradianceConstants constants{ .size = ENVIRONMENT_IRRADIANCE_SIZE };
+		bake_dispatch(command_buffer, baker.irradiance_program, baker.irradiance_pipeline, descriptors, &constants, sizeof(constants),
+			baker.irradiance_program.shaders[0].get_dispatch_size(ENVIRONMENT_IRRADIANCE_SIZE, ENVIRONMENT_IRRADIANCE_SIZE, 6));
+	}
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		barriers[i] = image_barrier(textures[i]->image,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+			VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	}
+	pipeline_barrier(command_buffer, 0, nullptr, 3, barriers);
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		const TextureImage& out = baker.images[i];
+		vkCmdCopyImageToBuffer(command_buffer, textures[i]->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, baker.readback.buffer,
+			(uint32_t)out.regions.size(), out.regions.data());
+	}
+
+	// Frames submitted after the bake sample the cubemaps in any stage
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		barriers[i] = image_barrier(textures[i]->image,
+			VK_PIPELINE_STAGE_2_COPY_BIT, 0, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	}
+	VkMemoryBarrier2 readback_barrier = memory_barrier(
+		VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+	pipeline_barrier(command_buffer, 1, &readback_barrier, 3, barriers);
+
+	VK_CHECK(vkEndCommandBuffer(command_buffer));
+
+	VkSubmitInfo submit_info{
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &command_buffer,
+	};
+	VK_CHECK(vkQueueSubmit(baker.queue, 1, &submit_info, baker.fence));
+
+	baker.is_baking = true;
+}
+
+bool finish_environment_bake(EnvironmentBaker& baker, std::vector<TextureImage>& images)
+{
+	assert(baker.is_baking);
+	if (vkGetFenceStatus(baker.device, baker.fence) != VK_SUCCESS)
+		return false;
+
+	VK_CHECK(vmaInvalidateAllocation(baker.allocator, baker.readback.allocation, 0, VK_WHOLE_SIZE));
+	const uint8_t* readback = (const uint8_t*)baker.readback.map();
+
+	// Regions are made relative to the payload of their image
+	images = std::move(baker.images);
+	baker.images.clear();
+	for (TextureImage& image : images)
+	{
+		VkDeviceSize offset = image.regions[0].bufferOffset;
+		for (VkBufferImageCopy& region : image.regions)
+			region.bufferOffset -= offset;
+
+		image.storage.assign(readback + offset, readback + offset + image.size);
+		image.data = image.storage.data();
+	}
+	baker.readback.unmap();
+
+	for (VkImageView view : baker.views)
+		vkDestroyImageView(baker.device, view, nullptr);
+	baker.views.clear();
+	for (DownsampleChain& chain : baker.chains)
+		destroy_downsample_chain(baker.device, chain);
+	baker.chains.clear();
+
+	baker.source.destroy();
+	baker.sh_sums.destroy();
+	baker.readback.destroy();
+	VK_CHECK(vkResetFences(baker.device, 1, &baker.fence));
+	baker.is_baking = false;
+
+	printf("Baked environment in %.2f ms\n", get_time_ms() - baker.start_ms);
+	return true;
+}
+
+void generate_sky_box(std::vector<Mesh>& meshes, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	Mesh mesh{
+		.first_vertex = (uint32_t)vertices.size(),
+		.vertex_count = 24,
+		.first_index = (uint32_t)indices.size(),
+		.index_count = 36,
+	};
+
+	const glm::vec2 corners[] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f } };
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		for (float sign : { 1.0f, -1.0f })
+		{
+			// u x v points along the axis, so the winding is reversed on the positive face to face inwards
+			glm::vec3 normal(0.0f), u(0.0f), v(0.0f);
+			normal[axis] = -sign;
+			u[(axis + 1) % 3] = 1.0f;
+			v[(axis + 2) % 3] = 1.0f;
+
+			uint32_t first = (uint32_t)vertices.size() - mesh.first_vertex;
+			for (glm::vec2 corner : corners)
+				vertices.push_back({ -normal + u * corner.x + v * corner.y, normal, glm::vec4(u, 1.0f), corner * 0.5f + 0.5f });
+
+			if (sign > 0.0f)
+				indices.insert(indices.end(), { first, first + 2, first + 1, first, first + 3, first + 2 });
+			else
+				indices.insert(indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+		}
+	}
+
+	meshes.push_back(mesh);
+}
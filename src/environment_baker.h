@@ -0,0 +1,86 @@
+#pragma once
+
+#include "downsample.h"
+#include "scene.h"
+#include "shader_compiler.h"
+
+// Face size of the sky cubemap is a quarter of the source width, rounded up to a power of two and clamped
+static constexpr uint32_t ENVIRONMENT_SKY_MIN_SIZE = 64;
+static constexpr uint32_t ENVIRONMENT_SKY_MAX_SIZE = 1024;
+// Prefiltered radiance, level i is convolved with the GGX lobe of roughness i / (levels - 1)
+static constexpr uint32_t ENVIRONMENT_REFLECTION_SIZE = 128;
+static constexpr uint32_t ENVIRONMENT_REFLECTION_LEVELS = 6;
+static constexpr uint32_t ENVIRONMENT_PREFILTER_SAMPLES = 64;
+static constexpr uint32_t ENVIRONMENT_IRRADIANCE_SIZE = 32;
+// Face size of the sky level projected onto spherical harmonics
+static constexpr uint32_t ENVIRONMENT_SH_SIZE = 32;
+static constexpr VkFormat ENVIRONMENT_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+// Bump whenever the baked output changes
+static constexpr uint32_t ENVIRONMENT_BAKE_VERSION = 1;
+static constexpr const char* ENVIRONMENT_CACHE_DIRECTORY = "cache/environments";
+
+// Equirectangular image decoded for the bake, RGB half floats in two words per texel
+struct HdrImage
+{
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint32_t> texels;
+};
+
+// Bakes the image based lighting of an equirectangular HDR image in compute shaders: the image is resampled
+// into the sky cubemap, whose mips come from the downsampler, the reflection cubemap holds the GGX prefiltered
+// radiance of the sky and the sky's spherical harmonics projection is convolved into the irradiance cubemap.
+// A bake runs on its own command buffer while frames keep being submitted and is polled for completion.
+struct EnvironmentBaker
+{
+	VkDevice device;
+	VmaAllocator allocator;
+	VkQueue queue;
+	const Downsampler* downsampler;
+
+	VkCommandPool command_pool;
+	VkCommandBuffer command_buffer;
+	VkFence fence;
+	VkSampler sampler;
+
+	Program sky_program;
+	Program prefilter_program;
+	Program sh_program;
+	Program irradiance_program;
+	VkPipeline sky_pipeline;
+	VkPipeline prefilter_pipeline;
+	VkPipeline sh_pipeline;
+	VkPipeline irradiance_pipeline;
+
+	// Of the bake in flight
+	bool is_baking;
+	Buffer source;
+	Buffer sh_sums;
+	Buffer readback;
+	std::vector<VkImageView> views;
+	std::vector<DownsampleChain> chains;
+	std::vector<TextureImage> images; // Irradiance, reflection and sky, with regions into the readback buffer
+	double start_ms;
+};
+
+bool create_environment_baker(EnvironmentBaker& baker, VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queue_family,
+	const ShaderCompiler& compiler, const Downsampler& downsampler);
+// Waits for a bake in flight
+void destroy_environment_baker(EnvironmentBaker& baker);
+
+// Decodes a Radiance .hdr image. Touches no Vulkan state.
+bool decode_hdr_image(HdrImage& image, const uint8_t* data, size_t size);
+
+// Path of the baked environment of an image file's contents under ENVIRONMENT_CACHE_DIRECTORY
+std::string get_environment_cache_path(const uint8_t* data, size_t size);
+
+// Creates the three cubemaps and submits their bake, they are in shader read only layout once it completes.
+// Commands submitted to the queue later see the results, the textures must not be used before that.
+void begin_environment_bake(EnvironmentBaker& baker, const HdrImage& image, Texture& irradiance, Texture& reflection, Texture& sky);
+// Returns false while the bake is running. Once it has completed, images receives copies of the irradiance,
+// reflection and sky cubemaps for caching and the resources of the bake are released.
+bool finish_environment_bake(EnvironmentBaker& baker, std::vector<TextureImage>& images);
+
+// Appends a cube around the origin facing inwards, for the sky to be drawn on
+void generate_sky_box(std::vector<Mesh>& meshes, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
@@ -0,0 +1,331 @@
+#include "file_reader.h"
+#include "load_telemetry.h"
+
+#ifdef RAYDERX_HAS_IO_URING
+#include <liburing.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+static void complete_request(FileReader& reader, FileReader::Request* request, bool failed)
+{
+	if (!failed)
+		request->contents = request->mapping.data ? FileReader::Contents{ request->mapping.data, request->mapping.size } : FileReader::Contents{ request->data.data(), request->data.size() };
+	request->failed = failed;
+	request->done = true;
+	reader.completed.push_back(request->index);
+}
+
+static void worker_main(FileReader* reader)
+{
+	for (;;)
+	{
+		FileReader::Request* request;
+		{
+			std::unique_lock<std::mutex> lock(reader->mutex);
+			reader->work_available.wait(lock, [&] { return reader->stopping || !reader->queue.empty(); });
+			if (reader->queue.empty())
+				return;
+
+			request = reader->queue.front();
+			reader->queue.pop_front();
+		}
+
+		bool success = read_binary_file(request->path.c_str(), request->data);
+
+		{
+			std::lock_guard<std::mutex> lock(reader->mutex);
+			complete_request(*reader, request, !success);
+		}
+		reader->request_completed.notify_all();
+	}
+}
+
+#ifdef RAYDERX_HAS_IO_URING
+// Largest single read the kernel accepts, longer files are read in several steps
+static constexpr size_t MAX_READ_SIZE = 0x7ffff000;
+
+static void queue_ring_read(FileReader& reader, FileReader::Request* request)
+{
+	io_uring_sqe* sqe = io_uring_get_sqe(reader.ring);
+	if (!sqe)
+	{
+		// Submission queue is full, hand what is in there to the kernel to make room
+		io_uring_submit(reader.ring);
+		sqe = io_uring_get_sqe(reader.ring);
+		assert(sqe);
+	}
+
+	size_t size = std::min(request->data.size() - request->bytes_read, MAX_READ_SIZE);
+	io_uring_prep_read(sqe, request->fd, request->data.data() + request->bytes_read, (unsigned)size, request->bytes_read);
+	io_uring_sqe_set_data(sqe, request);
+	reader.ring_in_flight++;
+}
+
+static void finish_ring_request(FileReader& reader, FileReader::Request* request, bool failed)
+{
+	if (request->fd >= 0)
+	{
+		close(request->fd);
+		request->fd = -1;
+	}
+
+	if (failed)
+		printf("Failed to read file %s\n", request->path.c_str());
+
+	complete_request(reader, request, failed);
+}
+
+// Processes one completion, blocking until there is one
+static void reap_ring(FileReader& reader)
+{
+	assert(reader.ring_in_flight > 0);
+
+	io_uring_cqe* cqe = nullptr;
+	int result = io_uring_wait_cqe(reader.ring, &cqe);
+	if (result == -EINTR)
+		return;
+	assert(result == 0);
+
+	FileReader::Request* request = (FileReader::Request*)io_uring_cqe_get_data(cqe);
+	int bytes = cqe->res;
+	io_uring_cqe_seen(reader.ring, cqe);
+	reader.ring_in_flight--;
+
+	if (bytes == -EAGAIN || bytes == -EINTR)
+	{
+		queue_ring_read(reader, request);
+		io_uring_submit(reader.ring);
+		return;
+	}
+
+	if (bytes <= 0)
+	{
+		finish_ring_request(reader, request, true);
+		return;
+	}
+
+	request->bytes_read += (size_t)bytes;
+	if (request->bytes_read < request->data.size())
+	{
+		// Short read, continue where it stopped
+		queue_ring_read(reader, request);
+		io_uring_submit(reader.ring);
+		return;
+	}
+
+	finish_ring_request(reader, request, false);
+}
+#endif
+
+void init_file_reader(FileReader& reader, uint32_t queue_depth, uint32_t worker_count)
+{
+	reader.undelivered = 0;
+	reader.ring = nullptr;
+	reader.ring_in_flight = 0;
+	reader.stopping = false;
+
+#ifdef RAYDERX_HAS_IO_URING
+	reader.ring = new io_uring;
+	int result = io_uring_queue_init(queue_depth, reader.ring, 0);
+	if (result == 0)
+		return;
+
+	printf("Failed to create io_uring (%d), falling back to reader threads\n", result);
+	delete reader.ring;
+	reader.ring = nullptr;
+#endif
+
+	worker_count = std::max(worker_count, 1u);
+	for (uint32_t i = 0; i < worker_count; ++i)
+		reader.workers.emplace_back(worker_main, &reader);
+}
+
+void destroy_file_reader(FileReader& reader)
+{
+#ifdef RAYDERX_HAS_IO_URING
+	if (reader.ring)
+	{
+		// The kernel may still be writing into request buffers
+		while (reader.ring_in_flight > 0)
+			reap_ring(reader);
+
+		io_uring_queue_exit(reader.ring);
+		delete reader.ring;
+		reader.ring = nullptr;
+	}
+#endif
+
+	{
+		std::lock_guard<std::mutex> lock(reader.mutex);
+		reader.stopping = true;
+	}
+	reader.work_available.notify_all();
+
+	for (std::thread& worker : reader.workers)
+		worker.join();
+
+	reader.workers.clear();
+	reader.queue.clear();
+	reader.completed.clear();
+	for (std::unique_ptr<FileReader::Request>& request : reader.requests)
+		unmap_file(request->mapping);
+	reader.requests.clear();
+	reader.undelivered = 0;
+}
+
+uint32_t file_reader_read(FileReader& reader, const char* path)
+{
+	uint32_t index = (uint32_t)reader.requests.size();
+	reader.requests.push_back(std::make_unique<FileReader::Request>());
+
+	FileReader::Request* request = reader.requests.back().get();
+	request->index = index;
+	request->path = path;
+	request->mapping = {};
+	request->contents = {};
+	request->bytes_read = 0;
+	request->fd = -1;
+	request->done = false;
+	request->failed = false;
+	request->delivered = false;
+	reader.undelivered++;
+
+	// The kernel reads every prefetched mapping at once, consumers only wait for the pages they touch
+	if (map_file(request->mapping, path))
+	{
+		prefetch_mapped_file(request->mapping);
+		{
+			std::lock_guard<std::mutex> lock(reader.mutex);
+			complete_request(reader, request, false);
+		}
+		reader.request_completed.notify_all();
+		return index;
+	}
+
+#ifdef RAYDERX_HAS_IO_URING
+	if (reader.ring)
+	{
+		// Opening is cheap compared to the read itself, only the read goes through the ring
+		request->fd = open(path, O_RDONLY | O_CLOEXEC);
+		struct stat st;
+		if (request->fd < 0 || fstat(request->fd, &st) != 0)
+		{
+			finish_ring_request(reader, request, true);
+			return index;
+		}
+
+		request->data.resize((size_t)st.st_size);
+		if (request->data.empty())
+		{
+			finish_ring_request(reader, request, false);
+			return index;
+		}
+
+		queue_ring_read(reader, request);
+		io_uring_submit(reader.ring);
+		return index;
+	}
+#endif
+
+	{
+		std::lock_guard<std::mutex> lock(reader.mutex);
+		reader.queue.push_back(request);
+	}
+	reader.work_available.notify_one();
+
+	return index;
+}
+
+static void deliver(FileReader& reader, FileReader::Request* request)
+{
+	if (!request->delivered)
+	{
+		request->delivered = true;
+		reader.undelivered--;
+	}
+}
+
+const FileReader::Contents* file_reader_wait(FileReader& reader, uint32_t request_index)
+{
+	assert(request_index < reader.requests.size());
+	FileReader::Request* request = reader.requests[request_index].get();
+	LoadScope scope(LOAD_STAGE_FILE_READ, request->path);
+
+#ifdef RAYDERX_HAS_IO_URING
+	if (reader.ring)
+	{
+		while (!request->done)
+			reap_ring(reader);
+	}
+	else
+#endif
+	{
+		std::unique_lock<std::mutex> lock(reader.mutex);
+		reader.request_completed.wait(lock, [&] { return request->done; });
+	}
+
+	deliver(reader, request);
+	if (request->failed)
+		return nullptr;
+
+	// Counted where the data is handed out, so the bytes land in the scope of the load that uses them
+	load_telemetry_add_bytes_read(request->contents.size);
+	return &request->contents;
+}
+
+bool file_reader_wait_any(FileReader& reader, uint32_t& request_index)
+{
+	if (reader.undelivered == 0)
+		return false;
+
+	// The read that completes is not known yet, the scope only times the wait for it
+	LoadScope scope(LOAD_STAGE_FILE_READ, "next completed read");
+
+	auto pop_undelivered = [&]() {
+		while (!reader.completed.empty())
+		{
+			uint32_t index = reader.completed.front();
+			reader.completed.pop_front();
+			if (!reader.requests[index]->delivered)
+			{
+				request_index = index;
+				return true;
+			}
+		}
+		return false;
+	};
+
+#ifdef RAYDERX_HAS_IO_URING
+	if (reader.ring)
+	{
+		while (!pop_undelivered())
+			reap_ring(reader);
+	}
+	else
+#endif
+	{
+		std::unique_lock<std::mutex> lock(reader.mutex);
+		reader.request_completed.wait(lock, pop_undelivered);
+	}
+
+	deliver(reader, reader.requests[request_index].get());
+
+	return true;
+}
+
+void file_reader_release(FileReader& reader, uint32_t request_index)
+{
+	assert(request_index < reader.requests.size());
+	FileReader::Request* request = reader.requests[request_index].get();
+	assert(request->delivered);
+
+	unmap_file(request->mapping);
+	std::vector<uint8_t>().swap(request->data);
+	request->contents = {};
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct io_uring;
+
+// Reads whole files in the background. Every read that is known up front can be queued at once so
+// the disk works on all of them in parallel instead of paying the latency of one blocking read per
+// asset, and results are handed back in the order they complete.
+//
+// Local files are mapped and the kernel is asked to read all of them into the page cache right away,
+// so consumers read them straight from the page cache without a heap copy. Those requests complete
+// at once, in the order they were queued. Files that cannot be mapped are read into memory: on Linux
+// through io_uring when it is available, otherwise (or when the ring cannot be created) by a small pool
+// of worker threads performing blocking reads, and handed back in the order they complete.
+struct FileReader
+{
+	// Contents of a completed request, in its mapping or its data
+	struct Contents
+	{
+		const uint8_t* data;
+		size_t size;
+	};
+
+	struct Request
+	{
+		uint32_t index;
+		std::string path;
+		MappedFile mapping;
+		std::vector<uint8_t> data;
+		Contents contents;
+		size_t bytes_read;
+		int fd;
+		bool done;
+		bool failed;
+		bool delivered;
+	};
+
+	std::vector<std::unique_ptr<Request>> requests;
+	std::deque<uint32_t> completed; // Completion order, may still contain already delivered requests
+	uint32_t undelivered;
+
+	io_uring* ring;
+	uint32_t ring_in_flight;
+
+	std::vector<std::thread> workers;
+	std::deque<Request*> queue;
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable request_completed;
+	bool stopping;
+
+	inline bool uses_io_uring() const { return ring != nullptr; }
+};
+
+void init_file_reader(FileReader& reader, uint32_t queue_depth, uint32_t worker_count);
+void destroy_file_reader(FileReader& reader);
+
+// Queues a read of the whole file and returns the request index used to retrieve it.
+uint32_t file_reader_read(FileReader& reader, const char* path);
+
+// Blocks until the request has completed. Returns nullptr if the file could not be read. Mapped contents
+// may still be read in from disk as they are accessed.
+const FileReader::Contents* file_reader_wait(FileReader& reader, uint32_t request);
+
+// Blocks until any request that has not been waited on yet completes and returns its index.
+// Returns false once every request has been delivered.
+bool file_reader_wait_any(FileReader& reader, uint32_t& request);
+
+// Unmaps or frees the contents of a delivered request.
+void file_reader_release(FileReader& reader, uint32_t request);
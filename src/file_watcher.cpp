@@ -0,0 +1,122 @@
+#include "file_watcher.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+static std::filesystem::file_time_type get_write_time(const std::filesystem::path& path)
+{
+	std::error_code error;
+	std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+	return error ? std::filesystem::file_time_type::min() : time;
+}
+
+void init_file_watcher(FileWatcher& watcher)
+{
+	watcher.inotify_fd = -1;
+
+#ifdef __linux__
+	watcher.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watcher.inotify_fd < 0)
+		printf("inotify is not available (errno %d), polling modification times instead\n", errno);
+#endif
+}
+
+void destroy_file_watcher(FileWatcher& watcher)
+{
+#ifdef __linux__
+	if (watcher.inotify_fd >= 0)
+		close(watcher.inotify_fd);
+#endif
+
+	watcher.inotify_fd = -1;
+	watcher.files.clear();
+	watcher.directories.clear();
+}
+
+uint32_t file_watcher_add(FileWatcher& watcher, const std::filesystem::path& path)
+{
+	std::error_code error;
+	std::filesystem::path absolute = std::filesystem::weakly_canonical(std::filesystem::absolute(path), error);
+	if (error)
+		absolute = std::filesystem::absolute(path);
+
+	watcher.files.push_back({ absolute, get_write_time(absolute) });
+
+#ifdef __linux__
+	std::filesystem::path directory = absolute.parent_path();
+	bool is_watched = std::any_of(watcher.directories.begin(), watcher.directories.end(), [&](const FileWatcher::WatchedDirectory& watched) {
+		return watched.path == directory;
+	});
+
+	if (watcher.inotify_fd >= 0 && !is_watched)
+	{
+		// Editors either rewrite the file in place or rename a temporary file over it
+		int watch = inotify_add_watch(watcher.inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (watch >= 0)
+			watcher.directories.push_back({ directory, watch });
+		else
+			printf("Failed to watch '%s' (errno %d)\n", directory.c_str(), errno);
+	}
+#endif
+
+	return (uint32_t)watcher.files.size() - 1;
+}
+
+static void add_changed(std::vector<uint32_t>& changed, uint32_t id)
+{
+	if (std::find(changed.begin(), changed.end(), id) == changed.end())
+		changed.push_back(id);
+}
+
+void file_watcher_poll(FileWatcher& watcher, std::vector<uint32_t>& changed)
+{
+#ifdef __linux__
+	if (watcher.inotify_fd >= 0)
+	{
+		alignas(inotify_event) char buffer[4096];
+		for (;;)
+		{
+			ssize_t length = read(watcher.inotify_fd, buffer, sizeof(buffer));
+			if (length <= 0)
+				break;
+
+			for (ssize_t offset = 0; offset < length; )
+			{
+				const inotify_event* event = (const inotify_event*)(buffer + offset);
+				offset += sizeof(inotify_event) + event->len;
+
+				auto directory = std::find_if(watcher.directories.begin(), watcher.directories.end(), [&](const FileWatcher::WatchedDirectory& watched) {
+					return watched.watch == event->wd;
+				});
+				if (directory == watcher.directories.end() || event->len == 0)
+					continue;
+
+				std::filesystem::path path = directory->path / event->name;
+				for (uint32_t i = 0; i < (uint32_t)watcher.files.size(); ++i)
+				{
+					if (watcher.files[i].path == path)
+						add_changed(changed, i);
+				}
+			}
+		}
+
+		return;
+	}
+#endif
+
+	for (uint32_t i = 0; i < (uint32_t)watcher.files.size(); ++i)
+	{
+		FileWatcher::WatchedFile& file = watcher.files[i];
+		std::filesystem::file_time_type write_time = get_write_time(file.path);
+		if (write_time != file.write_time)
+		{
+			file.write_time = write_time;
+			add_changed(changed, i);
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+
+#include <filesystem>
+
+// Reports watched files that were written since the last poll, without blocking.
+//
+// On Linux the directories holding the watched files are watched with inotify, so a poll only reads
+// the pending events. Elsewhere every poll compares the modification times of the watched files.
+struct FileWatcher
+{
+	struct WatchedFile
+	{
+		std::filesystem::path path; // Absolute
+		std::filesystem::file_time_type write_time;
+	};
+
+	struct WatchedDirectory
+	{
+		std::filesystem::path path;
+		int watch;
+	};
+
+	std::vector<WatchedFile> files;
+	std::vector<WatchedDirectory> directories;
+	int inotify_fd;
+};
+
+void init_file_watcher(FileWatcher& watcher);
+void destroy_file_watcher(FileWatcher& watcher);
+
+// Starts watching a file and returns the id file_watcher_poll reports it with. Files that are
+// replaced by renaming a new file over them are picked up as well.
+uint32_t file_watcher_add(FileWatcher& watcher, const std::filesystem::path& path);
+
+// Appends the ids of the files that changed since the last poll, every file at most once.
+void file_watcher_poll(FileWatcher& watcher, std::vector<uint32_t>& changed);
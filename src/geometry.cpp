@@ -0,0 +1,241 @@
+#include "geometry.h"
+#include "meshlets.h"
+#include "upload.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <glm/packing.hpp>
+
+// Octahedral encoding, "A Survey of Efficient Representations for Independent Unit Vectors" (Cigolle et al. 2014)
+static uint32_t encode_octahedral(glm::vec3 n)
+{
+	float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (length == 0.0f)
+		return glm::packSnorm2x16(glm::vec2(0.0f, 0.0f));
+
+	n /= length;
+	glm::vec2 e(n.x, n.y);
+	if (n.z < 0.0f)
+	{
+		e.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		e.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return glm::packSnorm2x16(e);
+}
+
+static uint16_t quantize_unorm16(float value, float offset, float inv_scale)
+{
+	float q = (value - offset) * inv_scale;
+	return (uint16_t)std::clamp(q + 0.5f, 0.0f, 65535.0f);
+}
+
+void create_geometry(
+	Geometry& geometry,
+	const std::vector<Mesh>& meshes,
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	VmaAllocator allocator,
+	UploadBatcher& uploader)
+{
+	GeometryData data;
+	build_geometry(geometry, data, meshes, vertices, indices);
+	upload_geometry(geometry, data, allocator, uploader);
+}
+
+void build_geometry(
+	Geometry& geometry,
+	GeometryData& data,
+	const std::vector<Mesh>& meshes,
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices)
+{
+	geometry.meshes.resize(meshes.size());
+
+	// Quantization groups: vertex ranges of all meshes with overlapping ones merged, so every vertex is
+	// quantized exactly once
+	std::vector<uint32_t> order(meshes.size());
+	for (uint32_t i = 0; i < (uint32_t)order.size(); ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return meshes[a].first_vertex < meshes[b].first_vertex; });
+
+	std::vector<PackedVertex>& packed_vertices = data.vertices;
+	std::vector<PackedPosition>& packed_positions = data.positions;
+	packed_vertices.assign(vertices.size(), PackedVertex{});
+	packed_positions.assign(vertices.size(), PackedPosition{});
+	for (size_t begin = 0; begin < order.size(); )
+	{
+		uint64_t group_first = meshes[order[begin]].first_vertex;
+		uint64_t group_end = group_first + meshes[order[begin]].vertex_count;
+		size_t end = begin + 1;
+		while (end < order.size() && meshes[order[end]].first_vertex < group_end)
+		{
+			group_end = std::max(group_end, (uint64_t)meshes[order[end]].first_vertex + meshes[order[end]].vertex_count);
+			end++;
+		}
+		group_end = std::min(group_end, (uint64_t)vertices.size());
+
+		glm::vec3 min_position(FLT_MAX);
+		glm::vec3 max_position(-FLT_MAX);
+		for (uint64_t v = group_first; v < group_end; ++v)
+		{
+			min_position = glm::min(min_position, vertices[v].position);
+			max_position = glm::max(max_position, vertices[v].position);
+		}
+
+		// A single scale for all axes keeps the dequantization a uniform scale, which folds into any transform
+		glm::vec3 extent = max_position - min_position;
+		float scale = std::max(extent.x, std::max(extent.y, extent.z)) / 65535.0f;
+		float inv_scale = scale > 0.0f ? 1.0f / scale : 0.0f;
+		if (group_first >= group_end)
+			min_position = glm::vec3(0.0f);
+
+		for (uint64_t v = group_first; v < group_end; ++v)
+		{
+			const Vertex& vertex = vertices[v];
+			PackedVertex& packed = packed_vertices[v];
+			for (uint32_t c = 0; c < 3; ++c)
+				packed.position[c] = quantize_unorm16(vertex.position[c], min_position[c], inv_scale);
+			packed.tangent_sign = vertex.tangent.w < 0.0f ? 1 : 0;
+			packed.normal = encode_octahedral(vertex.normal);
+			packed.tangent = encode_octahedral(glm::vec3(vertex.tangent));
+			packed.uv = glm::packHalf2x16(vertex.uv);
+
+			memcpy(packed_positions[v].position, packed.position, sizeof(packed.position));
+		}
+
+		for (size_t i = begin; i < end; ++i)
+			geometry.meshes[order[i]].position_dequantize = glm::vec4(min_position, scale);
+
+		begin = end;
+	}
+
+	// Meshes whose indices all fit go to the 16 bit section. Simplified levels only reference vertices of
+	// the full mesh and follow it in the same section.
+	std::vector<uint16_t>& indices16 = data.indices16;
+	std::vector<uint32_t>& indices32 = data.indices32;
+	indices16.clear();
+	indices32.clear();
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		const Mesh& mesh = meshes[i];
+		const uint32_t* mesh_indices = indices.data() + mesh.first_index;
+		bool is_16_bit = mesh.vertex_count <= 65536
+			&& std::all_of(mesh_indices, mesh_indices + mesh.index_count, [](uint32_t index) { return index <= UINT16_MAX; });
+
+		GeometryMesh& geometry_mesh = geometry.meshes[i];
+		geometry_mesh.first_index = (uint32_t)(is_16_bit ? indices16.size() : indices32.size());
+		geometry_mesh.index_type = is_16_bit ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+		for (uint32_t level = 0; level <= mesh.lod_count; ++level)
+		{
+			MeshLod lod = get_mesh_lod(mesh, level);
+			const uint32_t* lod_indices = indices.data() + lod.first_index;
+			if (is_16_bit)
+				indices16.insert(indices16.end(), lod_indices, lod_indices + lod.index_count);
+			else
+				indices32.insert(indices32.end(), lod_indices, lod_indices + lod.index_count);
+		}
+
+		glm::vec3 min_position(FLT_MAX);
+		glm::vec3 max_position(-FLT_MAX);
+		for (uint32_t j = 0; j < mesh.index_count; ++j)
+		{
+			min_position = glm::min(min_position, vertices[mesh.first_vertex + mesh_indices[j]].position);
+			max_position = glm::max(max_position, vertices[mesh.first_vertex + mesh_indices[j]].position);
+		}
+		geometry_mesh.bounds = mesh.index_count > 0
+			? glm::vec4((min_position + max_position) * 0.5f, glm::length(max_position - min_position) * 0.5f)
+			: glm::vec4(0.0f);
+	}
+
+	// The 32 bit section starts 4 byte aligned, as vkCmdBindIndexBuffer requires
+	VkDeviceSize indices16_size = indices16.size() * sizeof(uint16_t);
+	VkDeviceSize indices32_offset = (indices16_size + 3) & ~VkDeviceSize(3);
+	geometry.index_section_offsets[0] = 0;
+	geometry.index_section_offsets[1] = indices32_offset;
+
+	std::vector<GeometryMeshlet>& geometry_meshlets = data.meshlets;
+	geometry_meshlets.clear();
+	std::vector<Meshlet> meshlets;
+	uint64_t meshlet_triangles = 0;
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		const Mesh& mesh = meshes[i];
+		GeometryMesh& geometry_mesh = geometry.meshes[i];
+		uint32_t index_size = geometry_mesh.index_type == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+		VkDeviceSize section_offset = geometry.index_section_offsets[index_size == 2 ? 0 : 1];
+		// Positions are off by up to half a quantization step per axis
+		float quantization_error = geometry_mesh.position_dequantize.w * 0.87f;
+
+		geometry_mesh.first_meshlet = (uint32_t)geometry_meshlets.size();
+		std::fill(std::begin(geometry_mesh.lod_meshlet_counts), std::end(geometry_mesh.lod_meshlet_counts), 0u);
+		uint32_t level_first_index = geometry_mesh.first_index;
+		for (uint32_t level = 0; level <= mesh.lod_count; ++level)
+		{
+			MeshLod lod = get_mesh_lod(mesh, level);
+			meshlets.clear();
+			build_meshlets(meshlets, mesh, level, vertices, indices);
+
+			for (const Meshlet& meshlet : meshlets)
+			{
+				geometry_meshlets.push_back(GeometryMeshlet{
+					.bounds = glm::vec4(meshlet.center, meshlet.radius + quantization_error),
+					.cone = glm::vec4(meshlet.cone_axis, meshlet.cone_cutoff),
+					.index_offset = (uint32_t)(section_offset + (level_first_index + meshlet.first_index - lod.first_index) * index_size),
+					.index_size = index_size,
+					.triangle_count = meshlet.triangle_count,
+					.lod = level,
+				});
+				meshlet_triangles += level == 0 ? meshlet.triangle_count : 0;
+			}
+			geometry_mesh.lod_meshlet_counts[level] = (uint32_t)meshlets.size();
+			level_first_index += lod.index_count;
+		}
+		geometry_mesh.meshlet_count = (uint32_t)geometry_meshlets.size() - geometry_mesh.first_meshlet;
+	}
+	geometry.meshlet_count = (uint32_t)geometry_meshlets.size();
+
+	printf("Geometry: %zu vertices %.2f MB -> %.2f MB (+%.2f MB shadow positions), indices %.2f MB -> %.2f MB, %zu of %zu meshes with 16 bit indices\n",
+		vertices.size(), vertices.size() * sizeof(Vertex) / (1024.0 * 1024.0), packed_vertices.size() * sizeof(PackedVertex) / (1024.0 * 1024.0),
+		packed_positions.size() * sizeof(PackedPosition) / (1024.0 * 1024.0), indices.size() * sizeof(uint32_t) / (1024.0 * 1024.0),
+		(indices16_size + indices32.size() * sizeof(uint32_t)) / (1024.0 * 1024.0),
+		(size_t)std::count_if(geometry.meshes.begin(), geometry.meshes.end(), [](const GeometryMesh& mesh) { return mesh.index_type == VK_INDEX_TYPE_UINT16; }),
+		meshes.size());
+	printf("Geometry: %zu meshlets over all levels of detail, %.1f triangles per full detail meshlet\n", geometry_meshlets.size(),
+		(double)meshlet_triangles / std::max<size_t>(std::count_if(geometry_meshlets.begin(), geometry_meshlets.end(), [](const GeometryMeshlet& meshlet) { return meshlet.lod == 0; }), 1));
+}
+
+void upload_geometry(Geometry& geometry, const GeometryData& data, VmaAllocator allocator, UploadBatcher& uploader)
+{
+	VkDeviceSize indices16_size = data.indices16.size() * sizeof(uint16_t);
+	VkDeviceSize indices32_offset = geometry.index_section_offsets[1];
+	VkDeviceSize index_buffer_size = std::max<VkDeviceSize>(indices32_offset + data.indices32.size() * sizeof(uint32_t), 4);
+	VkDeviceSize vertex_buffer_size = std::max<VkDeviceSize>(data.vertices.size() * sizeof(PackedVertex), sizeof(PackedVertex));
+	VkDeviceSize position_buffer_size = std::max<VkDeviceSize>(data.positions.size() * sizeof(PackedPosition), sizeof(PackedPosition));
+	geometry.vertex_buffer = create_buffer(allocator, vertex_buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	geometry.position_buffer = create_buffer(allocator, position_buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	geometry.index_buffer = create_buffer(allocator, index_buffer_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	geometry.meshlet_buffer = create_buffer(allocator, std::max<VkDeviceSize>(data.meshlets.size() * sizeof(GeometryMeshlet), sizeof(GeometryMeshlet)),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+
+	// Empty copies are not allowed, the buffers themselves are never empty
+	if (!data.vertices.empty())
+	{
+		upload_batcher_upload_buffer(uploader, geometry.vertex_buffer, data.vertices.data(), data.vertices.size() * sizeof(PackedVertex));
+		upload_batcher_upload_buffer(uploader, geometry.position_buffer, data.positions.data(), data.positions.size() * sizeof(PackedPosition));
+	}
+	if (!data.indices16.empty())
+		upload_batcher_upload_buffer(uploader, geometry.index_buffer, data.indices16.data(), indices16_size);
+	if (!data.indices32.empty())
+		upload_batcher_upload_buffer(uploader, geometry.index_buffer, data.indices32.data(), data.indices32.size() * sizeof(uint32_t), indices32_offset);
+	if (!data.meshlets.empty())
+		upload_batcher_upload_buffer(uploader, geometry.meshlet_buffer, data.meshlets.data(), data.meshlets.size() * sizeof(GeometryMeshlet));
+}
+
+void destroy_geometry(Geometry& geometry)
+{
+	geometry.vertex_buffer.destroy();
+	geometry.position_buffer.destroy();
+	geometry.index_buffer.destroy();
+	geometry.meshlet_buffer.destroy();
+	geometry.meshes.clear();
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "scene.h"
+
+// Bump whenever build_geometry changes its output, packs store the built geometry
+static constexpr uint32_t GEOMETRY_VERSION = 2;
+
+// Vertex layout the forward pass pulls, 20 bytes instead of the 48 of Vertex
+struct PackedVertex
+{
+	uint16_t position[3];  // Unorm16 within the bounds of its vertex range, see GeometryMesh::position_dequantize
+	uint16_t tangent_sign; // 1 for a negative bitangent sign
+	uint32_t normal;       // Octahedral, snorm16x2
+	uint32_t tangent;      // Octahedral, snorm16x2
+	uint32_t uv;           // half2
+};
+
+// Vertex layout of the shadow passes, which only need the position
+struct PackedPosition
+{
+	uint16_t position[3];
+	uint16_t padding;
+};
+
+struct GeometryMesh
+{
+	glm::vec4 position_dequantize; // Offset in xyz and scale in w: position = offset + unorm16 * scale
+	glm::vec4 bounds;              // Center and radius in object space
+	uint32_t first_index;          // Relative to the index section of index_type, the simplified levels follow the full mesh
+	VkIndexType index_type;        // 16 bit for meshes with fewer than 65536 vertices
+	uint32_t first_meshlet;        // Meshlets of every level of detail
+	uint32_t meshlet_count;
+	uint32_t lod_meshlet_counts[MESH_MAX_LODS]; // Meshlets of each level, the levels follow each other from first_meshlet
+};
+
+// Meshlet layout the culling shader reads, mirrors Meshlet in meshlet_cull.hlsl
+struct GeometryMeshlet
+{
+	glm::vec4 bounds;      // Center and radius in object space, padded by the quantization error
+	glm::vec4 cone;        // Axis and cutoff, see Meshlet
+	uint32_t index_offset; // Bytes into the index buffer
+	uint32_t index_size;   // 2 or 4
+	uint32_t triangle_count;
+	uint32_t lod;          // Level of detail of the mesh the meshlet belongs to
+};
+
+// Scene geometry in the layouts the shaders read. Vertices keep their order, so Mesh::first_vertex stays
+// valid, indices are split into a 16 bit and a 32 bit section of the same index buffer.
+struct Geometry
+{
+	Buffer vertex_buffer;   // PackedVertex
+	Buffer position_buffer; // PackedPosition
+	Buffer index_buffer;    // Drawn in place by the culled indirect commands
+	Buffer meshlet_buffer;  // GeometryMeshlet
+	VkDeviceSize index_section_offsets[2]; // uint16_t section, then uint32_t section
+	std::vector<GeometryMesh> meshes;      // Parallel to the scene meshes
+	uint32_t meshlet_count;
+};
+
+// Buffer contents of a Geometry, produced by build_geometry
+struct GeometryData
+{
+	std::vector<PackedVertex> vertices;
+	std::vector<PackedPosition> positions;
+	std::vector<uint16_t> indices16;
+	std::vector<uint32_t> indices32;
+	std::vector<GeometryMeshlet> meshlets;
+};
+
+// Quantizes positions against the bounds of each vertex range (meshes sharing or overlapping one share the
+// bounds), packs normals, tangents and uvs, splits every level of detail of every mesh into meshlets and
+// queues the uploads. The caller flushes the uploader.
+void create_geometry(
+	Geometry& geometry,
+	const std::vector<Mesh>& meshes,
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	VmaAllocator allocator,
+	UploadBatcher& uploader);
+void destroy_geometry(Geometry& geometry);
+
+// The two halves of create_geometry. build_geometry does all the CPU work and fills everything but the
+// buffers, it touches no Vulkan state and can run on any thread. upload_geometry creates the buffers.
+void build_geometry(
+	Geometry& geometry,
+	GeometryData& data,
+	const std::vector<Mesh>& meshes,
+	const std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices);
+void upload_geometry(Geometry& geometry, const GeometryData& data, VmaAllocator allocator, UploadBatcher& uploader);
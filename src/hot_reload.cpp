@@ -0,0 +1,150 @@
+#include "hot_reload.h"
+#include "texture_streaming.h"
+#include "upload.h"
+
+// Without inotify every poll stats all watched files, so polls are spaced out
+static constexpr double HOT_RELOAD_POLL_INTERVAL_MS = 250.0;
+
+void init_hot_reloader(HotReloader& reloader, VkDevice device, VmaAllocator allocator)
+{
+	reloader.device = device;
+	reloader.allocator = allocator;
+	reloader.last_poll_ms = 0.0;
+	reloader.reload_count = 0;
+	init_file_watcher(reloader.watcher);
+}
+
+void destroy_hot_reloader(HotReloader& reloader)
+{
+	// Swaps that never ran still own their replacements, run them so the caller destroys the results
+	for (std::function<void()>& swap : reloader.swaps)
+		swap();
+	reloader.swaps.clear();
+
+	destroy_file_watcher(reloader.watcher);
+}
+
+uint32_t hot_reload_watch_texture(HotReloader& reloader, Texture& texture, const std::filesystem::path& path, bool is_srgb, int stream_index)
+{
+	uint32_t id = file_watcher_add(reloader.watcher, path);
+	reloader.files.resize(reloader.watcher.files.size());
+	reloader.files[id] = { &texture, is_srgb, stream_index, true };
+	return id;
+}
+
+uint32_t hot_reload_watch_file(HotReloader& reloader, const std::filesystem::path& path)
+{
+	uint32_t id = file_watcher_add(reloader.watcher, path);
+	reloader.files.resize(reloader.watcher.files.size());
+	reloader.files[id] = { nullptr, false, -1, true };
+	return id;
+}
+
+void hot_reload_unwatch(HotReloader& reloader, uint32_t id)
+{
+	reloader.files[id].is_watched = false;
+}
+
+void hot_reload_unwatch_texture(HotReloader& reloader, const Texture& texture)
+{
+	for (HotReloader::WatchedTexture& watched : reloader.files)
+	{
+		if (watched.texture == &texture)
+			watched.is_watched = false;
+	}
+}
+
+void hot_reload_defer(HotReloader& reloader, std::function<void()> swap)
+{
+	reloader.swaps.push_back(std::move(swap));
+}
+
+// Returns false if the texture has to be retried by a later update
+static bool reload_texture(HotReloader& reloader, const HotReloader::WatchedTexture& watched, const char* path, TextureStreamer& streamer, UploadBatcher& uploader)
+{
+	MappedFile file;
+	if (!map_file(file, path))
+	{
+		printf("Failed to reload '%s'\n", path);
+		return true;
+	}
+
+	TextureImage image;
+	if (!parse_texture(image, file.data, file.size, watched.is_srgb))
+	{
+		printf("Failed to reload '%s', keeping the old texture\n", path);
+		unmap_file(file);
+		return true;
+	}
+
+	bool queued = true;
+	if (watched.stream_index >= 0)
+	{
+		queued = restream_texture_image(streamer, (uint32_t)watched.stream_index, std::move(image), uploader);
+	}
+	else
+	{
+		Texture replacement{};
+		load_texture_image(replacement, image, reloader.device, reloader.allocator, uploader);
+
+		Texture* texture = watched.texture;
+		hot_reload_defer(reloader, [texture, replacement]() {
+			texture->destroy();
+			*texture = replacement;
+		});
+	}
+
+	// Everything the new texture needs has been copied to staging memory or into the streamer
+	unmap_file(file);
+
+	if (queued)
+	{
+		printf("Reloaded '%s'\n", path);
+		reloader.reload_count++;
+	}
+
+	return queued;
+}
+
+void update_hot_reloader(HotReloader& reloader, TextureStreamer& streamer, UploadBatcher& uploader, std::vector<uint32_t>& changed_files)
+{
+	// The frame that just completed acquired and waited for everything the previous update uploaded
+	for (std::function<void()>& swap : reloader.swaps)
+		swap();
+	reloader.swaps.clear();
+
+	reloader.changed.swap(reloader.retries);
+	reloader.retries.clear();
+
+	double now_ms = get_time_ms();
+	if (reloader.watcher.inotify_fd >= 0 || now_ms - reloader.last_poll_ms >= HOT_RELOAD_POLL_INTERVAL_MS)
+	{
+		file_watcher_poll(reloader.watcher, reloader.changed);
+		reloader.last_poll_ms = now_ms;
+	}
+
+	if (reloader.changed.empty())
+		return;
+
+	bool uploaded = false;
+	for (uint32_t id : reloader.changed)
+	{
+		const HotReloader::WatchedTexture& watched = reloader.files[id];
+		if (!watched.is_watched)
+			continue;
+		if (!watched.texture)
+		{
+			changed_files.push_back(id);
+			continue;
+		}
+
+		if (reload_texture(reloader, watched, reloader.watcher.files[id].path.string().c_str(), streamer, uploader))
+			uploaded = true;
+		else
+			reloader.retries.push_back(id);
+	}
+	reloader.changed.clear();
+
+	if (uploaded)
+		upload_batcher_flush(uploader);
+}
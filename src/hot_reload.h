@@ -0,0 +1,56 @@
+#pragma once
+
+#include "file_watcher.h"
+#include "resources.h"
+
+#include <functional>
+
+struct TextureStreamer;
+
+// Reloads assets whose files change on disk while the application runs. Textures are re-read, uploaded
+// through the upload batcher and swapped in at a frame boundary once the frame that acquired their upload
+// has completed, so nothing waits for the device to go idle. Other watched files are reported back to the
+// caller, which queues its replacements with hot_reload_defer.
+struct HotReloader
+{
+	struct WatchedTexture
+	{
+		Texture* texture; // Null for files handled by the caller
+		bool is_srgb;
+		int stream_index; // Index in the texture streamer, -1 for textures that are not streamed
+		bool is_watched;  // False once unwatched, the file watcher keeps the id
+	};
+
+	VkDevice device;
+	VmaAllocator allocator;
+
+	FileWatcher watcher;
+	std::vector<WatchedTexture> files; // Indexed by file watcher id
+	std::vector<uint32_t> changed;
+	std::vector<uint32_t> retries; // Streamed textures that still had an upload pending
+
+	std::vector<std::function<void()>> swaps; // Run by the next update
+	double last_poll_ms;
+	uint32_t reload_count;
+};
+
+void init_hot_reloader(HotReloader& reloader, VkDevice device, VmaAllocator allocator);
+void destroy_hot_reloader(HotReloader& reloader);
+
+// The texture is replaced in place, so references to it stay valid. Returns the file watcher id.
+uint32_t hot_reload_watch_texture(HotReloader& reloader, Texture& texture, const std::filesystem::path& path, bool is_srgb, int stream_index = -1);
+uint32_t hot_reload_watch_file(HotReloader& reloader, const std::filesystem::path& path);
+
+// Changes of the file are ignored from now on, e.g. once what was loaded from it has been unloaded
+void hot_reload_unwatch(HotReloader& reloader, uint32_t id);
+// Unwatches every file that is reloaded into the texture
+void hot_reload_unwatch_texture(HotReloader& reloader, const Texture& texture);
+
+// Runs the function at the start of the next update, once everything uploaded before it can be used
+void hot_reload_defer(HotReloader& reloader, std::function<void()> swap);
+
+// Call once per frame after the frame fence wait and after update_texture_streamer, which would otherwise swap
+// in reloaded streamed textures before their upload has been acquired. Runs the swaps deferred by the previous
+// update, reloads the textures that changed and appends the ids of the other changed files. Uploads queued by
+// the caller for those have to be flushed before the next frame is submitted.
+void update_hot_reloader(HotReloader& reloader, TextureStreamer& streamer, UploadBatcher& uploader, std::vector<uint32_t>& changed_files);
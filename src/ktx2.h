@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+
+// KTX 2.0 container (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html). The file starts with
+// KTX2_HEADER, followed by one KTX2_LEVEL_INDEX per mip level (level 0 first), the data format
+// descriptor, optional key/value data and the levels themselves, stored smallest level first.
+
+#define KTX2_IDENTIFIER { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A } // "«KTX 20»\r\n\x1A\n"
+#define KTX2_IDENTIFIER_SIZE 12
+
+#define KTX2_SUPERCOMPRESSION_NONE 0
+#define KTX2_SUPERCOMPRESSION_BASISLZ 1
+#define KTX2_SUPERCOMPRESSION_ZSTD 2
+#define KTX2_SUPERCOMPRESSION_ZLIB 3
+
+// Data format descriptor, basic block (Khronos Data Format Specification 1.3, section 5)
+#define KHR_DF_VERSION 2
+#define KHR_DF_MODEL_RGBSDA 1
+#define KHR_DF_MODEL_BC1A 128
+#define KHR_DF_MODEL_BC2 129
+#define KHR_DF_MODEL_BC3 130
+#define KHR_DF_MODEL_BC4 131
+#define KHR_DF_MODEL_BC5 132
+#define KHR_DF_MODEL_BC6H 133
+#define KHR_DF_MODEL_BC7 134
+#define KHR_DF_PRIMARIES_BT709 1
+#define KHR_DF_TRANSFER_LINEAR 1
+#define KHR_DF_TRANSFER_SRGB 2
+
+#define KHR_DF_CHANNEL_RED 0 // Also the color channel of the BC models
+#define KHR_DF_CHANNEL_GREEN 1
+#define KHR_DF_CHANNEL_BLUE 2
+#define KHR_DF_CHANNEL_ALPHA 15
+#define KHR_DF_CHANNEL_BC1A_ALPHA 1
+
+#define KHR_DF_SAMPLE_DATATYPE_LINEAR 0x10 // Qualifiers, stored in the top nibble of the channel type
+#define KHR_DF_SAMPLE_DATATYPE_SIGNED 0x40
+#define KHR_DF_SAMPLE_DATATYPE_FLOAT 0x80
+
+struct KTX2_HEADER
+{
+	uint8_t identifier[KTX2_IDENTIFIER_SIZE];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+
+static_assert(sizeof(KTX2_HEADER) == 80);
+
+struct KTX2_LEVEL_INDEX
+{
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+struct KTX2_DFD_BLOCK_HEADER
+{
+	uint32_t vendorAndType; // vendorId (17 bits) and descriptorType (15 bits), 0 for the basic block
+	uint16_t versionNumber;
+	uint16_t descriptorBlockSize;
+	uint8_t colorModel;
+	uint8_t colorPrimaries;
+	uint8_t transferFunction;
+	uint8_t flags;
+	uint8_t texelBlockDimension[4]; // Dimension - 1
+	uint8_t bytesPlane[8];
+};
+
+struct KTX2_DFD_SAMPLE
+{
+	uint16_t bitOffset;
+	uint8_t bitLength; // Length - 1
+	uint8_t channelType;
+	uint8_t samplePosition[4];
+	uint32_t sampleLower;
+	uint32_t sampleUpper;
+};
@@ -0,0 +1,184 @@
+#include "load_telemetry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+static const char* LOAD_STAGE_NAMES[LOAD_STAGE_COUNT] = {
+	"file_read",
+	"texture",
+	"scene",
+	"pack",
+	"mipmaps",
+	"shader",
+	"pipeline",
+	"gpu_wait",
+};
+
+// Loads are recorded from deep inside the loaders and from pool threads, so the log is process wide
+static std::atomic<bool> recording_enabled{ false };
+static double recording_start_ms = 0.0;
+static std::mutex records_mutex;
+static std::vector<LoadRecord> records;
+static thread_local LoadScope* innermost_scope = nullptr;
+
+LoadScope::LoadScope(LoadStage stage, const char* asset)
+{
+	parent = nullptr;
+	is_recording = recording_enabled.load(std::memory_order_relaxed);
+	if (!is_recording)
+		return;
+
+	parent = innermost_scope;
+	innermost_scope = this;
+
+	record = {
+		.stage = stage,
+		.asset = asset,
+		.is_outermost = true,
+		.start_ms = get_time_ms(),
+	};
+	for (LoadScope* scope = parent; scope; scope = scope->parent)
+	{
+		record.depth++;
+		record.is_outermost = record.is_outermost && scope->record.stage != stage;
+	}
+}
+
+LoadScope::~LoadScope()
+{
+	if (!is_recording)
+		return;
+
+	record.wall_ms = get_time_ms() - record.start_ms;
+	if (record.stage == LOAD_STAGE_GPU_WAIT)
+		record.gpu_wait_ms = record.wall_ms;
+
+	innermost_scope = parent;
+	if (parent)
+	{
+		parent->record.bytes_read += record.bytes_read;
+		parent->record.bytes_uploaded += record.bytes_uploaded;
+		parent->record.gpu_wait_ms += record.gpu_wait_ms;
+	}
+
+	std::lock_guard<std::mutex> lock(records_mutex);
+	if (!recording_enabled.load(std::memory_order_relaxed))
+		return;
+
+	record.start_ms -= recording_start_ms;
+	records.push_back(std::move(record));
+}
+
+void begin_load_telemetry()
+{
+	std::lock_guard<std::mutex> lock(records_mutex);
+	records.clear();
+	recording_start_ms = get_time_ms();
+	recording_enabled.store(true);
+}
+
+void load_telemetry_add_bytes_read(uint64_t bytes)
+{
+	if (innermost_scope)
+		innermost_scope->record.bytes_read += bytes;
+}
+
+void load_telemetry_add_bytes_uploaded(uint64_t bytes)
+{
+	if (innermost_scope)
+		innermost_scope->record.bytes_uploaded += bytes;
+}
+
+static void write_json_string(FILE* f, const std::string& string)
+{
+	fputc('"', f);
+	for (char c : string)
+	{
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if ((unsigned char)c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+bool end_load_telemetry(const char* json_path)
+{
+	std::vector<LoadRecord> sorted;
+	double total_ms = 0.0;
+	{
+		std::lock_guard<std::mutex> lock(records_mutex);
+		recording_enabled.store(false);
+		sorted = std::move(records);
+		records.clear();
+		total_ms = get_time_ms() - recording_start_ms;
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const LoadRecord& a, const LoadRecord& b) { return a.wall_ms > b.wall_ms; });
+
+	LoadRecord totals[LOAD_STAGE_COUNT]{};
+	uint32_t counts[LOAD_STAGE_COUNT]{};
+	for (const LoadRecord& record : sorted)
+	{
+		counts[record.stage]++;
+		if (!record.is_outermost)
+			continue;
+
+		LoadRecord& total = totals[record.stage];
+		total.wall_ms += record.wall_ms;
+		total.bytes_read += record.bytes_read;
+		total.bytes_uploaded += record.bytes_uploaded;
+		total.gpu_wait_ms += record.gpu_wait_ms;
+	}
+
+	printf("Load telemetry: %zu loads recorded over %.2f ms\n", sorted.size(), total_ms);
+	printf("  %-10s %6s %12s %10s %12s %12s\n", "stage", "count", "wall ms", "read MB", "uploaded MB", "gpu wait ms");
+	for (uint32_t stage = 0; stage < LOAD_STAGE_COUNT; ++stage)
+	{
+		const LoadRecord& total = totals[stage];
+		printf("  %-10s %6u %12.2f %10.2f %12.2f %12.2f\n", LOAD_STAGE_NAMES[stage], counts[stage], total.wall_ms,
+			total.bytes_read / (1024.0 * 1024.0), total.bytes_uploaded / (1024.0 * 1024.0), total.gpu_wait_ms);
+	}
+	printf("  Slowest loads:\n");
+	for (size_t i = 0; i < std::min(sorted.size(), LOAD_TELEMETRY_SUMMARY_RECORDS); ++i)
+	{
+		const LoadRecord& record = sorted[i];
+		printf("  %10.2f ms %-10s %s\n", record.wall_ms, LOAD_STAGE_NAMES[record.stage], record.asset.c_str());
+	}
+
+	FILE* f = fopen(json_path, "wb");
+	if (!f)
+	{
+		printf("Failed to open file %s for writing\n", json_path);
+		return false;
+	}
+
+	fprintf(f, "{\n\t\"total_ms\": %.3f,\n\t\"stages\": [\n", total_ms);
+	for (uint32_t stage = 0; stage < LOAD_STAGE_COUNT; ++stage)
+	{
+		const LoadRecord& total = totals[stage];
+		fprintf(f, "\t\t{ \"stage\": \"%s\", \"count\": %u, \"wall_ms\": %.3f, \"bytes_read\": %llu, \"bytes_uploaded\": %llu, \"gpu_wait_ms\": %.3f }%s\n",
+			LOAD_STAGE_NAMES[stage], counts[stage], total.wall_ms, (unsigned long long)total.bytes_read, (unsigned long long)total.bytes_uploaded,
+			total.gpu_wait_ms, stage + 1 < LOAD_STAGE_COUNT ? "," : "");
+	}
+	fprintf(f, "\t],\n\t\"loads\": [\n");
+	for (size_t i = 0; i < sorted.size(); ++i)
+	{
+		const LoadRecord& record = sorted[i];
+		fprintf(f, "\t\t{ \"stage\": \"%s\", \"asset\": ", LOAD_STAGE_NAMES[record.stage]);
+		write_json_string(f, record.asset);
+		fprintf(f, ", \"depth\": %u, \"start_ms\": %.3f, \"wall_ms\": %.3f, \"bytes_read\": %llu, \"bytes_uploaded\": %llu, \"gpu_wait_ms\": %.3f }%s\n",
+			record.depth, record.start_ms, record.wall_ms, (unsigned long long)record.bytes_read, (unsigned long long)record.bytes_uploaded,
+			record.gpu_wait_ms, i + 1 < sorted.size() ? "," : "");
+	}
+	fprintf(f, "\t]\n}\n");
+
+	bool success = fclose(f) == 0;
+	if (success)
+		printf("Wrote load report to %s\n", json_path);
+	else
+		printf("Failed to write file %s\n", json_path);
+	return success;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+
+// Records shown in the printed summary, the JSON report has all of them
+static constexpr size_t LOAD_TELEMETRY_SUMMARY_RECORDS = 15;
+
+enum LoadStage
+{
+	LOAD_STAGE_FILE_READ,
+	LOAD_STAGE_TEXTURE,  // load_texture, load_png_or_jpg_texture and DDS and KTX2 parsing
+	LOAD_STAGE_SCENE,    // load_scene, load_cached_scene, import_cached_gltf and sdkmesh imports
+	LOAD_STAGE_PACK,     // load_pack and read_pack
+	LOAD_STAGE_MIPMAPS,  // Recording of generate_mipmaps
+	LOAD_STAGE_SHADER,   // Reading and compiling in load_shader
+	LOAD_STAGE_PIPELINE,
+	LOAD_STAGE_GPU_WAIT, // The CPU waiting for the GPU, also counted in gpu_wait_ms
+	LOAD_STAGE_COUNT,
+};
+
+// One timed load. Values include what the scopes nested in it on the same thread recorded, work a load
+// hands to other threads is recorded there.
+struct LoadRecord
+{
+	LoadStage stage;
+	std::string asset;
+	uint32_t depth;    // Of the scope on its thread
+	bool is_outermost; // Not nested in a scope of the same stage, only these add up to the stage totals
+	double start_ms;   // Since begin_load_telemetry
+	double wall_ms;
+	uint64_t bytes_read;
+	uint64_t bytes_uploaded;
+	double gpu_wait_ms;
+};
+
+// Times the enclosing block while telemetry is recording and costs an atomic load otherwise. The bytes and
+// GPU waits reported while a scope is the innermost one of its thread are added to it.
+struct LoadScope
+{
+	LoadScope(LoadStage stage, const char* asset);
+	LoadScope(LoadStage stage, const std::string& asset) : LoadScope(stage, asset.c_str()) {}
+	~LoadScope();
+
+	LoadScope(const LoadScope&) = delete;
+	LoadScope& operator=(const LoadScope&) = delete;
+
+	LoadScope* parent;
+	bool is_recording;
+	LoadRecord record;
+};
+
+// Loads from any thread are recorded from here on
+void begin_load_telemetry();
+
+void load_telemetry_add_bytes_read(uint64_t bytes);
+void load_telemetry_add_bytes_uploaded(uint64_t bytes);
+
+// Stops recording, prints the totals per stage and the slowest loads and writes every record to json_path,
+// sorted by wall time. Scopes still open are not included.
+bool end_load_telemetry(const char* json_path);
@@ -16,21 +16,41 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
-#define VMA_IMPLEMENTATION
 #include "vma/vk_mem_alloc.h"
 
+#include <algorithm>
 #include <vector>
 #include <stdio.h>
 #include <filesystem>
 
+#include "culling.h"
 #include "dds.h"
+#include "downsample.h"
+#include "environment_baker.h"
+#include "file_reader.h"
+#include "geometry.h"
+#include "hot_reload.h"
+#include "load_telemetry.h"
+#include "pack.h"
 #include "resources.h"
 #include "scene.h"
-#include "sdkmesh.h"
-#include "shaders.h"
+#include "residency.h"
+#include "scene_manager.h"
+#include "shader_compiler.h"
+#include "texture_cache.h"
+#include "texture_streaming.h"
+#include "thread_pool.h"
+#include "upload.h"
 
 #define VSYNC 0
 #define PREFER_INTEGRATED_GPU 0
+#define DECODE_WORKER_COUNT 0 // 0 = one worker per hardware thread
+#define COMPRESS_TEXTURES 1 // Block compress glTF textures at import, results are cached under cache/textures
+#define STREAM_TEXTURES 1 // Start scene textures with their smallest mips and stream finer ones as they are sampled
+#define HOT_RELOAD 1 // Reload textures and sdkmesh scenes when their files change
+#define CACHE_SCENES 1 // Load glTF scenes through a pack cooked into cache/scenes on their first load
+#define LOAD_REPORT 1 // Time asset loads until the first frame has completed, print a summary and write load_report.json
+#define UPLOAD_STAGING_MB 128 // Peak host visible memory used to stage uploads, larger assets are uploaded in chunks
 
 #if PREFER_INTEGRATED_GPU == 1
 static constexpr VkPhysicalDeviceType PREFERRED_GPU_TYPE = VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU;
@@ -205,15 +225,58 @@ uint32_t find_queue_family(VkPhysicalDevice physical_device)
 	return VK_QUEUE_FAMILY_IGNORED;
 }
 
-VkDevice create_device(VkInstance instance, VkPhysicalDevice physical_device, uint32_t queue_family_index)
+// Prefers a transfer only family (usually backed by a DMA engine) for uploads, falls back to the graphics family
+uint32_t find_transfer_queue_family(VkPhysicalDevice physical_device, uint32_t graphics_queue_family)
+{
+	uint32_t queue_family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, nullptr);
+	std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families.data());
+	for (uint32_t i = 0; i < queue_family_count; i++)
+	{
+		VkQueueFlags flags = queue_families[i].queueFlags;
+		if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			return i;
+		}
+	}
+
+	return graphics_queue_family;
+}
+
+bool has_device_extension(VkPhysicalDevice physical_device, const char* name)
+{
+	uint32_t extension_count = 0;
+	VK_CHECK(vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count, nullptr));
+	std::vector<VkExtensionProperties> extensions(extension_count);
+	VK_CHECK(vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count, extensions.data()));
+	for (const VkExtensionProperties& extension : extensions)
+	{
+		if (strcmp(extension.extensionName, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+VkDevice create_device(VkInstance instance, VkPhysicalDevice physical_device, uint32_t queue_family_index, uint32_t transfer_queue_family_index, bool memory_budget)
 {
 	float priorities = 1.0f;
-	VkDeviceQueueCreateInfo queue_create_info{
-		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-		.queueFamilyIndex = queue_family_index,
-		.queueCount = 1,
-		.pQueuePriorities = &priorities
+	VkDeviceQueueCreateInfo queue_create_infos[] = {
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = queue_family_index,
+			.queueCount = 1,
+			.pQueuePriorities = &priorities
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = transfer_queue_family_index,
+			.queueCount = 1,
+			.pQueuePriorities = &priorities
+		},
 	};
+	uint32_t queue_create_info_count = transfer_queue_family_index != queue_family_index ? 2 : 1;
 
 	std::vector<const char*> extensions = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -221,10 +284,14 @@ VkDevice create_device(VkInstance instance, VkPhysicalDevice physical_device, ui
 		VK_KHR_MAINTENANCE_5_EXTENSION_NAME,
 		VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME,
 	};
+	if (memory_budget)
+		extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 
 	VkPhysicalDeviceVulkan12Features features12{
 		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+		.drawIndirectCount = VK_TRUE,
 		.scalarBlockLayout = VK_TRUE,
+		.timelineSemaphore = VK_TRUE,
 	};
 
 	VkPhysicalDeviceVulkan13Features features13{
@@ -250,14 +317,19 @@ VkDevice create_device(VkInstance instance, VkPhysicalDevice physical_device, ui
 
 	VkPhysicalDeviceFeatures features{
 		.sampleRateShading = VK_TRUE,
+		.multiDrawIndirect = VK_TRUE,
 		.samplerAnisotropy = VK_TRUE,
+		.fragmentStoresAndAtomics = VK_TRUE,
+		.shaderStorageImageReadWithoutFormat = VK_TRUE,
+		.shaderStorageImageWriteWithoutFormat = VK_TRUE,
+		.shaderStorageImageArrayDynamicIndexing = VK_TRUE,
 	};
 
 	VkDeviceCreateInfo create_info{
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
 		.pNext = &maintenance5_features,
-		.queueCreateInfoCount = 1,
-		.pQueueCreateInfos = &queue_create_info,
+		.queueCreateInfoCount = queue_create_info_count,
+		.pQueueCreateInfos = queue_create_infos,
 		.enabledLayerCount = 0,
 		.ppEnabledLayerNames = nullptr,
 		.enabledExtensionCount = (uint32_t)extensions.size(),
@@ -384,19 +456,21 @@ VkCommandPool crate_command_pool(VkDevice device, uint32_t queue_family)
 	return command_pool;
 }
 
-VmaAllocator create_allocator(VkInstance instance, VkPhysicalDevice physical_device, VkDevice device)
+// With memory_budget VMA reads the heap budgets from VK_EXT_memory_budget, otherwise it estimates them
+VmaAllocator create_allocator(VkInstance instance, VkPhysicalDevice physical_device, VkDevice device, bool memory_budget)
 {
-
 	VmaVulkanFunctions funcs{
 		.vkGetInstanceProcAddr = vkGetInstanceProcAddr,
 		.vkGetDeviceProcAddr = vkGetDeviceProcAddr
 	};
 
 	VmaAllocatorCreateInfo create_info{
+		.flags = memory_budget ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT : 0u,
 		.physicalDevice = physical_device,
 		.device = device,
 		.pVulkanFunctions = &funcs,
-		.instance = instance
+		.instance = instance,
+		.vulkanApiVersion = VK_API_VERSION_1_3,
 	};
 
 	VmaAllocator allocator = VK_NULL_HANDLE;
@@ -406,6 +480,7 @@ VmaAllocator create_allocator(VkInstance instance, VkPhysicalDevice physical_dev
 
 VkPipeline create_shadowmap_pipeline(VkDevice device, std::initializer_list<Shader> shaders, VkPipelineLayout layout, VkFormat depth_format)
 {
+	LoadScope scope(LOAD_STAGE_PIPELINE, shaders.begin()->filepath);
 	std::vector<VkPipelineShaderStageCreateInfo> shader_stages(shaders.size());
 	std::vector<VkShaderModuleCreateInfo> module_info(shaders.size());
 	for (size_t i = 0; i < shaders.size(); ++i)
@@ -521,6 +596,7 @@ VkPipeline create_pipeline(VkDevice device, std::initializer_list<Shader> shader
 	VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT
 	)
 {
+	LoadScope scope(LOAD_STAGE_PIPELINE, shaders.begin()->filepath);
 	std::vector<VkPipelineShaderStageCreateInfo> shader_stages(shaders.size());
 	std::vector<VkShaderModuleCreateInfo> module_info(shaders.size());
 	for (size_t i = 0; i < shaders.size(); ++i)
@@ -621,30 +697,6 @@ VkPipeline create_pipeline(VkDevice device, std::initializer_list<Shader> shader
 }
 
 
-VkPipeline create_compute_pipeline(VkDevice device, const Shader& shader, VkPipelineLayout layout)
-{
-	VkShaderModuleCreateInfo module_info{
-		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-		.codeSize = shader.spirv.size(),
-		.pCode = (uint32_t*)shader.spirv.data(),
-	};
-
-	VkComputePipelineCreateInfo create_info{
-		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-		.stage = {
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-			.pNext = &module_info,
-			.stage = shader.stage,
-			.pName = shader.entry_point.c_str()
-		},
-		.layout = layout
-	};
-
-	VkPipeline pipeline = 0;
-	VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
-	return pipeline;
-}
-
 bool init_imgui(SDL_Window* window, VkInstance instance, VkPhysicalDevice physical_device, VkDevice device, uint32_t queue_family, VkQueue queue, uint32_t min_image_count, uint32_t image_count, VkFormat format)
 {
 	ImGui_ImplVulkan_InitInfo info{};
@@ -808,9 +860,9 @@ bool load_shader_and_create_compute_program(Program& program, VkDevice device, c
 
 int main(int argc, char** argv)
 {
-	if (argc != 2)
+	if (argc < 2)
 	{
-		printf("Usage: %s <scene file>\n", argv[0]);
+		printf("Usage: %s <scene file> [more scene files...]\n", argv[0]);
 		return 1;
 	}
     
@@ -830,13 +882,17 @@ int main(int argc, char** argv)
 
 	VkPhysicalDevice physical_device = pick_physical_device(instance);
 	uint32_t queue_family = find_queue_family(physical_device);
-	VkDevice device = create_device(instance, physical_device, queue_family);
+	uint32_t transfer_queue_family = find_transfer_queue_family(physical_device, queue_family);
+	bool has_memory_budget = has_device_extension(physical_device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	VkDevice device = create_device(instance, physical_device, queue_family, transfer_queue_family, has_memory_budget);
 	VkPhysicalDeviceProperties device_properties{};
 	vkGetPhysicalDeviceProperties(physical_device, &device_properties);
 	VkQueue queue = VK_NULL_HANDLE;
 	vkGetDeviceQueue(device, queue_family, 0, &queue);
+	VkQueue transfer_queue = VK_NULL_HANDLE;
+	vkGetDeviceQueue(device, transfer_queue_family, 0, &transfer_queue);
 
-	VmaAllocator allocator = create_allocator(instance, physical_device, device);
+	VmaAllocator allocator = create_allocator(instance, physical_device, device, has_memory_budget);
 
 	ShaderCompiler compiler{};
 	if (!create_shader_compiler(compiler))
@@ -875,7 +931,40 @@ int main(int argc, char** argv)
 	}
 #endif
 
-	Buffer scratch_buffer = create_buffer(allocator, 1024 * 1024 * 128, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+	const uint64_t load_start_counter = SDL_GetPerformanceCounter();
+	if (LOAD_REPORT)
+		begin_load_telemetry();
+
+	ThreadPool thread_pool;
+	init_thread_pool(thread_pool, DECODE_WORKER_COUNT);
+
+	UploadBatcher uploader = create_upload_batcher(device, allocator, transfer_queue_family, transfer_queue, queue_family, (VkDeviceSize)UPLOAD_STAGING_MB * 1024 * 1024);
+	if (uploader.uses_dedicated_queue())
+		printf("Uploading through dedicated transfer queue family %u\n", transfer_queue_family);
+
+	Shader downsample_shader{};
+	FAIL_ON_ERROR(load_shader(downsample_shader, compiler, device, "downsample.hlsl", "cs_main", VK_SHADER_STAGE_COMPUTE_BIT));
+	Downsampler downsampler{};
+	FAIL_ON_ERROR(create_downsampler(downsampler, device, allocator, downsample_shader));
+	uploader.downsampler = &downsampler;
+
+	EnvironmentBaker environment_baker{};
+	FAIL_ON_ERROR(create_environment_baker(environment_baker, device, allocator, queue, queue_family, compiler, downsampler));
+
+	MeshletCuller meshlet_culler{};
+	FAIL_ON_ERROR(create_meshlet_culler(meshlet_culler, device, allocator, compiler));
+
+	TextureStreamer texture_streamer{};
+	create_texture_streamer(texture_streamer, device, allocator);
+	TextureStreamer* streamer = STREAM_TEXTURES ? &texture_streamer : nullptr;
+
+	HotReloader hot_reloader{};
+	init_hot_reloader(hot_reloader, device, allocator);
+
+	ResidencyManager residency{};
+	create_residency_manager(residency, allocator);
+	if (!has_memory_budget)
+		printf("VK_EXT_memory_budget is not supported, the VRAM budget is estimated\n");
 
 	std::vector<Mesh> meshes;
 	std::vector<Vertex> vertices;
@@ -883,19 +972,78 @@ int main(int argc, char** argv)
 	std::vector<MeshDraw> mesh_draws;
 	std::vector<Material> materials;
 	std::vector<Texture> textures;
+	TextureCache texture_cache{};
+	Environment environment{};
+	Geometry geometry{}; // Uploaded by packs and cached scenes that hold it, built after loading otherwise
+
+	// Hot reload, streaming and residency keep pointers into textures, slots are added without ever growing it past this
+	textures.reserve(TEXTURE_STREAMING_MAX_TEXTURES);
 
 	Texture beckmann_lut;
-	if (!load_texture(beckmann_lut, "data/BeckmannMap.dds", device, allocator, command_pool, command_buffer, queue, scratch_buffer, false))
+	Texture noise_texture;
+
+	// Every read that is known up front is queued right away so the disk works on all of them at once.
+	// Textures are decoded into the upload batcher in the order their reads complete.
+	FileReader file_reader;
+	init_file_reader(file_reader, 64, 4);
+	printf("Reading assets through %s\n", file_reader.uses_io_uring() ? "io_uring" : "reader threads");
+
+	struct TextureRead
 	{
-		printf("Failed to load beckmann lut!\n");
-		return EXIT_FAILURE;
-	}
+		uint32_t request;
+		Texture* texture; // Null for sdkmesh scene textures, they get a slot in textures once their content is known
+		bool is_srgb;
+		int stream_index; // Index into textures for scene textures that are streamed, -1 otherwise
+		std::vector<uint32_t> references; // Texture references of import_sdkmesh_scene the file is read for
+	};
+	std::vector<TextureRead> texture_reads;
+	auto get_texture_path = [](std::filesystem::path path) {
+		// A .ktx2 converted by the cooker next to the original is smaller on disk and preferred
+		std::filesystem::path ktx2_path = path;
+		ktx2_path.replace_extension(".ktx2");
+		return std::filesystem::exists(ktx2_path) ? ktx2_path : path;
+	};
+	auto read_texture = [&](Texture* texture, std::filesystem::path path, bool is_srgb) {
+		path = get_texture_path(path);
+		texture_reads.push_back({ file_reader_read(file_reader, path.string().c_str()), texture, is_srgb, -1 });
+		if (HOT_RELOAD)
+			hot_reload_watch_texture(hot_reloader, *texture, path, is_srgb);
+	};
+
+	// Files referenced by several sdkmesh materials are read once, their slot is in sdkmesh_texture_indices
+	std::vector<uint32_t> sdkmesh_texture_indices; // Slot per texture reference of import_sdkmesh_scene
+	auto read_sdkmesh_texture = [&](std::filesystem::path path, bool is_srgb, uint32_t reference) {
+		path = get_texture_path(path);
+		for (TextureRead& read : texture_reads)
+		{
+			if (!read.texture && read.is_srgb == is_srgb && file_reader.requests[read.request]->path == path.string())
+			{
+				read.references.push_back(reference);
+				return;
+			}
+		}
+		texture_reads.push_back({ file_reader_read(file_reader, path.string().c_str()), nullptr, is_srgb, -1, { reference } });
+	};
 
-	bool scene_is_gltf = false;
 	std::filesystem::path ext = std::filesystem::path(argv[1]).extension();
+	uint32_t scene_read = ext == ".sdkmesh" ? file_reader_read(file_reader, argv[1]) : 0;
+
+	std::filesystem::path environment_path = "data/StPeters/SkyDome.sdkmesh";
+	uint32_t environment_read = file_reader_read(file_reader, environment_path.string().c_str());
+
+	read_texture(&beckmann_lut, "data/BeckmannMap.dds", false);
+	read_texture(&noise_texture, "data/Noise.dds", false);
+	read_texture(&environment.irradiance, environment_path.parent_path() / "IrradianceMap.dds", false);
+	read_texture(&environment.reflection, environment_path.parent_path() / "ReflectionMap.dds", false);
+
+	bool scene_is_gltf = false;
+	size_t sdkmesh_material_count = 0;
 	if (ext == ".glb" || ext == ".gltf")
 	{
-		if (!load_scene(argv[1], meshes, materials, textures, vertices, indices, mesh_draws, device, allocator, command_pool, command_buffer, queue, scratch_buffer))
+		bool loaded = CACHE_SCENES
+			? load_cached_scene(argv[1], meshes, materials, textures, vertices, indices, mesh_draws, geometry, device, allocator, uploader, thread_pool, COMPRESS_TEXTURES, streamer, &texture_cache)
+			: load_scene(argv[1], meshes, materials, textures, vertices, indices, mesh_draws, device, allocator, uploader, thread_pool, COMPRESS_TEXTURES, streamer, &texture_cache);
+		if (!loaded)
 		{
 			printf("Failed to load scene!\n");
 			return 1;
@@ -903,117 +1051,44 @@ int main(int argc, char** argv)
 
 		scene_is_gltf = true;
 	}
-	else if (ext == ".sdkmesh")
+	else if (ext == ".rxpak")
 	{
-		std::vector<uint8_t> sdkmesh;
-		if (!read_binary_file(argv[1], sdkmesh))
+		if (!load_pack(argv[1], meshes, materials, textures, vertices, indices, mesh_draws, geometry, device, allocator, uploader, streamer, &texture_cache))
 		{
-			printf("Failed to load sdkmesh\n");
+			printf("Failed to load pack!\n");
 			return EXIT_FAILURE;
 		}
-
-		uint8_t* data = sdkmesh.data();
-		SDKMESH_HEADER* header = (SDKMESH_HEADER*)data;
-		SDKMESH_VERTEX_BUFFER_HEADER* vertex_buffer_array = (SDKMESH_VERTEX_BUFFER_HEADER*)(data +
-			header->VertexStreamHeadersOffset);
-		SDKMESH_INDEX_BUFFER_HEADER* index_buffer_array = (SDKMESH_INDEX_BUFFER_HEADER*)(data +
-			header->IndexStreamHeadersOffset);
-		SDKMESH_MESH* mesh = (SDKMESH_MESH*)(data + header->MeshDataOffset);
-		SDKMESH_SUBSET* subset = (SDKMESH_SUBSET*)(data + header->SubsetDataOffset);
-		SDKMESH_FRAME* frame = (SDKMESH_FRAME*)(data + header->FrameDataOffset);
-		SDKMESH_MATERIAL* material = (SDKMESH_MATERIAL*)(data + header->MaterialDataOffset);
-
-		struct SDKVertex
-		{
-			glm::vec3 position;
-			glm::vec3 normal;
-			glm::vec2 texcoord;
-			glm::vec3 tangent;
-		};
-
-		assert(header->NumVertexBuffers == 1);
-		assert(header->NumIndexBuffers == 1);
-		assert(sizeof(SDKVertex) == vertex_buffer_array[0].StrideBytes);
-
-		std::vector<SDKVertex> verts(vertex_buffer_array->NumVertices);
-		memcpy(verts.data(), data + vertex_buffer_array->DataOffset, vertex_buffer_array->SizeBytes);
-
-		std::vector<uint32_t> inds(index_buffer_array->NumIndices);
-		uint32_t bytes_per_index = index_buffer_array->IndexType == 0 ? 2 : 4;
-		assert(index_buffer_array->SizeBytes / bytes_per_index == index_buffer_array->NumIndices);
-		for (uint32_t i = 0; i < index_buffer_array->NumIndices; ++i)
-		{
-			inds[i] = ((uint16_t*)(data + index_buffer_array->DataOffset))[i];
-		}
-
-		Mesh m{
-			.first_vertex = 0,
-			.vertex_count = (uint32_t)verts.size(),
-			.first_index = 0,
-			.index_count = (uint32_t)inds.size(),
-		};
-
-		Material mat{
-			.type = Material::SKIN,
-			.basecolor_texture = (int)textures.size(),
-			.normal_texture = (int)textures.size() + 1,
-			.specular_texture = (int)textures.size() + 2,
-		};
-
-		MeshDraw mesh_draw{
-			.transform = glm::mat4(1.0f),
-			.mesh_index = 0,
-			.material_index = 0,
-		};
-
-		indices = inds;
-		for (uint32_t i = 0; i < indices.size(); i += 3)
-		{
-			std::swap(indices[i], indices[i + 2]);
-		}
-		vertices.resize(verts.size());
-		for (size_t i = 0; i < verts.size(); ++i)
-		{
-			glm::vec3 p = verts[i].position;
-			glm::vec3 n = verts[i].normal;
-			glm::vec3 t = verts[i].tangent;
-			p = glm::vec3(p.x, p.y, -p.z);
-			n = glm::vec3(n.x, n.y, -n.z);
-			t = glm::vec3(t.x, t.y, -t.z);
-			vertices[i] = {
-				.position = p,
-				.normal = n,
-				.tangent = glm::vec4(t, -1.0f),
-				.uv = verts[i].texcoord,
-			};
-		}
-
-		mesh_draws.push_back(mesh_draw);
-		meshes.push_back(m);
-		materials.push_back(mat);
-
+	}
+	else if (ext == ".sdkmesh")
+	{
 		std::filesystem::path directory = std::filesystem::path(argv[1]).parent_path();
-		std::filesystem::path diffuse_path = directory / std::filesystem::path(material->DiffuseTexture);
-		std::filesystem::path normal_path = directory / std::filesystem::path(material->NormalTexture);
-		std::filesystem::path specular_path = directory / std::filesystem::path("SpecularAOMap.dds");
-		Texture diffuse, normal, specular;
-		if (!load_texture(diffuse, diffuse_path.string().c_str(), device, allocator, command_pool, command_buffer, queue, scratch_buffer, true))
+
+		const FileReader::Contents* sdkmesh = file_reader_wait(file_reader, scene_read);
+		if (!sdkmesh)
 		{
-			printf("Failed to load texture: %s\n", diffuse_path.string().c_str());
+			printf("Failed to load sdkmesh\n");
 			return EXIT_FAILURE;
 		}
-		if (!load_texture(normal, normal_path.string().c_str(), device, allocator, command_pool, command_buffer, queue, scratch_buffer, false))
+
+		// Materials reference the textures in the layout of import_sdkmesh_scene, they are remapped to the
+		// deduplicated slots once every read has completed
+		std::vector<SdkMeshTextures> sdkmesh_textures;
+		if (!import_sdkmesh_scene(sdkmesh->data, sdkmesh->size, meshes, materials, vertices, indices, mesh_draws, 0, sdkmesh_textures, &thread_pool))
 		{
-			printf("Failed to load texture: %s\n", diffuse_path.string().c_str());
+			printf("Failed to load sdkmesh\n");
 			return EXIT_FAILURE;
 		}
-		if (!load_texture(specular, specular_path.string().c_str(), device, allocator, command_pool, command_buffer, queue, scratch_buffer, false))
+
+		uint32_t reference_count = 1 + 2 * (uint32_t)sdkmesh_textures.size();
+		sdkmesh_texture_indices.resize(reference_count);
+		sdkmesh_material_count = sdkmesh_textures.size();
+		read_sdkmesh_texture(directory / SDKMESH_SPECULAR_TEXTURE, false, 0);
+		for (uint32_t i = 0; i < (uint32_t)sdkmesh_textures.size(); ++i)
 		{
-			printf("Failed to load texture: %s\n", diffuse_path.string().c_str());
-			return EXIT_FAILURE;
+			read_sdkmesh_texture(directory / sdkmesh_textures[i].diffuse, true, 1 + 2 * i);
+			read_sdkmesh_texture(directory / sdkmesh_textures[i].normal, false, 2 + 2 * i);
 		}
-
-		textures.insert(textures.end(), { diffuse, normal, specular });
+		file_reader_release(file_reader, scene_read);
 	}
 	else
 	{
@@ -1021,128 +1096,105 @@ int main(int argc, char** argv)
 		return EXIT_FAILURE;
 	}
 
-	struct Environment
 	{
-		Texture irradiance;
-		Texture diffuse;
-		Texture reflection;
-		Mesh mesh;
-		std::vector<Vertex> vertices;
-		std::vector<uint32_t> indices;
-		Buffer index_buffer;
-		Buffer vertex_buffer;
-	} environment;
-
-	{
-		std::vector<uint8_t> sdkmesh;
-		std::filesystem::path path = "data/StPeters/SkyDome.sdkmesh";
-		if (!read_binary_file(path.string().c_str(), sdkmesh))
+		const FileReader::Contents* sdkmesh = file_reader_wait(file_reader, environment_read);
+		if (!sdkmesh)
 		{
 			printf("Failed to load sdkmesh\n");
 			return EXIT_FAILURE;
 		}
 
-		uint8_t* data = sdkmesh.data();
-		SDKMESH_HEADER* header = (SDKMESH_HEADER*)data;
-		SDKMESH_VERTEX_BUFFER_HEADER* vertex_buffer_array = (SDKMESH_VERTEX_BUFFER_HEADER*)(data +
-			header->VertexStreamHeadersOffset);
-		SDKMESH_INDEX_BUFFER_HEADER* index_buffer_array = (SDKMESH_INDEX_BUFFER_HEADER*)(data +
-			header->IndexStreamHeadersOffset);
-		SDKMESH_MESH* mesh = (SDKMESH_MESH*)(data + header->MeshDataOffset);
-		SDKMESH_SUBSET* subset = (SDKMESH_SUBSET*)(data + header->SubsetDataOffset);
-		SDKMESH_FRAME* frame = (SDKMESH_FRAME*)(data + header->FrameDataOffset);
-		SDKMESH_MATERIAL* material = (SDKMESH_MATERIAL*)(data + header->MaterialDataOffset);
-
-		struct SDKVertex
+		// The sky dome is drawn as a single mesh with the texture of its first material
+		std::vector<Mesh> environment_meshes;
+		std::vector<MeshDraw> environment_draws;
+		std::vector<SdkMeshTextures> sdkmesh_textures;
+		if (!import_sdkmesh(sdkmesh->data, sdkmesh->size, environment_meshes, environment_draws, environment.vertices, environment.indices, sdkmesh_textures)
+			|| environment_meshes.empty() || sdkmesh_textures.empty())
 		{
-			glm::vec3 position;
-			glm::vec3 normal;
-			glm::vec2 texcoord;
-			glm::vec3 tangent;
-		};
-
-		assert(header->NumVertexBuffers == 1);
-		assert(header->NumIndexBuffers == 1);
-		assert(sizeof(SDKVertex) == vertex_buffer_array[0].StrideBytes);
-
-		std::vector<SDKVertex> verts(vertex_buffer_array->NumVertices);
-		memcpy(verts.data(), data + vertex_buffer_array->DataOffset, vertex_buffer_array->SizeBytes);
-
-		std::vector<uint32_t> inds(index_buffer_array->NumIndices);
-		uint32_t bytes_per_index = index_buffer_array->IndexType == 0 ? 2 : 4;
-		assert(index_buffer_array->SizeBytes / bytes_per_index == index_buffer_array->NumIndices);
-		for (uint32_t i = 0; i < index_buffer_array->NumIndices; ++i)
-		{
-			inds[i] = ((uint16_t*)(data + index_buffer_array->DataOffset))[i];
+			printf("Failed to load sdkmesh\n");
+			return EXIT_FAILURE;
 		}
 
-		Mesh m{
-			.first_vertex = 0,
-			.vertex_count = (uint32_t)verts.size(),
-			.first_index = 0,
-			.index_count = (uint32_t)inds.size(),
-		};
+		environment.mesh = environment_meshes[0];
+		read_texture(&environment.diffuse, environment_path.parent_path() / sdkmesh_textures[0].diffuse, true);
+		file_reader_release(file_reader, environment_read);
+	}
 
-		for (uint32_t i = 0; i < inds.size(); i += 3)
+	uint32_t completed_read;
+	while (file_reader_wait_any(file_reader, completed_read))
+	{
+		auto texture_read = std::find_if(texture_reads.begin(), texture_reads.end(), [&](const TextureRead& read) { return read.request == completed_read; });
+		assert(texture_read != texture_reads.end());
+
+		const std::string& path = file_reader.requests[completed_read]->path;
+		LoadScope scope(LOAD_STAGE_TEXTURE, path);
+		const FileReader::Contents* data = file_reader_wait(file_reader, completed_read);
+		if (!data)
 		{
-			std::swap(inds[i], inds[i + 2]);
+			printf("Failed to load texture: %s\n", path.c_str());
+			return EXIT_FAILURE;
 		}
 
-		environment.vertices.resize(verts.size());
-		for (size_t i = 0; i < verts.size(); ++i)
+		// Files with the same content as a texture loaded earlier use its slot and are not parsed or uploaded
+		Texture* texture = texture_read->texture;
+		int stream_index = texture_read->stream_index;
+		if (!texture)
 		{
-			glm::vec3 p = verts[i].position;
-			glm::vec3 n = verts[i].normal;
-			glm::vec3 t = verts[i].tangent;
-			p = glm::vec3(p.x, p.y, -p.z);
-			n = glm::vec3(n.x, n.y, -n.z);
-			t = glm::vec3(t.x, t.y, -t.z);
-			environment.vertices[i] = {
-				.position = p,
-				.normal = n,
-				.tangent = glm::vec4(t, -1.0f),
-				.uv = verts[i].texcoord,
-			};
-		}
+			uint64_t key = get_texture_cache_key(data->data, data->size, texture_read->is_srgb);
+			int texture_index = texture_cache_acquire(texture_cache, key);
+			if (texture_index < 0)
+			{
+				texture_index = (int)textures.size();
+				texture_cache_insert(texture_cache, key, (uint32_t)texture_index, data->size);
+				texture = &textures.emplace_back();
+				stream_index = streamer ? texture_index : -1;
+				if (HOT_RELOAD)
+					hot_reload_watch_texture(hot_reloader, *texture, path, texture_read->is_srgb, stream_index);
+			}
 
-		environment.indices = inds;
-		environment.mesh = m;
+			for (size_t i = 0; i < texture_read->references.size(); ++i)
+			{
+				sdkmesh_texture_indices[texture_read->references[i]] = (uint32_t)texture_index;
+				if (i > 0)
+					texture_cache_acquire(texture_cache, key);
+			}
 
-		std::filesystem::path directory = path.parent_path();
-		std::filesystem::path diffuse_path = directory / std::filesystem::path(material->DiffuseTexture);
-		std::filesystem::path irradiance_path = directory / std::filesystem::path("IrradianceMap.dds");
-		std::filesystem::path reflection_path = directory / std::filesystem::path("ReflectionMap.dds");
-		Texture diffuse, irradiance, reflection;
-		if (!load_texture(diffuse, diffuse_path.string().c_str(), device, allocator, command_pool, command_buffer, queue, scratch_buffer, true))
-		{
-			printf("Failed to load texture: %s\n", diffuse_path.string().c_str());
-			return EXIT_FAILURE;
-		}
-		if (!load_texture(irradiance, irradiance_path.string().c_str(), device, allocator, command_pool, command_buffer, queue, scratch_buffer, false))
-		{
-			printf("Failed to load texture: %s\n", diffuse_path.string().c_str());
-			return EXIT_FAILURE;
+			if (!texture)
+			{
+				file_reader_release(file_reader, completed_read);
+				continue;
+			}
 		}
-		if (!load_texture(reflection, reflection_path.string().c_str(), device, allocator, command_pool, command_buffer, queue, scratch_buffer, false))
+
+		TextureImage image;
+		if (!parse_texture(image, data->data, data->size, texture_read->is_srgb, &thread_pool))
 		{
-			printf("Failed to load texture: %s\n", diffuse_path.string().c_str());
+			printf("Failed to load texture: %s\n", path.c_str());
 			return EXIT_FAILURE;
 		}
 
-		environment.diffuse = diffuse;
-		environment.irradiance = irradiance;
-		environment.reflection = reflection;
+		if (stream_index >= 0)
+			stream_texture_image(texture_streamer, *texture, (uint32_t)stream_index, std::move(image), uploader);
+		else
+			load_texture_image(*texture, image, device, allocator, uploader);
+		file_reader_release(file_reader, completed_read);
 	}
+	destroy_file_reader(file_reader);
 
-	Buffer index_buffer = create_buffer(allocator, indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, indices.data());
-	Buffer vertex_buffer = create_buffer(allocator, vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, vertices.data());
+	if (!sdkmesh_texture_indices.empty())
+	{
+		remap_material_textures(materials, 0, sdkmesh_texture_indices);
+		printf("Texture cache: %u of %zu texture references shared, %.2f MB of files not parsed again\n",
+			texture_cache.deduplicated_count, sdkmesh_texture_indices.size(), texture_cache.deduplicated_bytes / (1024.0 * 1024.0));
+	}
 
-	environment.index_buffer = create_buffer(allocator, environment.indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, environment.indices.data());
-	environment.vertex_buffer = create_buffer(allocator, environment.vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, environment.vertices.data());
+	if (!geometry.vertex_buffer.buffer)
+		create_geometry(geometry, meshes, vertices, indices, allocator, uploader);
+
+	environment.index_buffer = create_buffer(allocator, environment.indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	environment.vertex_buffer = create_buffer(allocator, environment.vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	upload_batcher_upload_buffer(uploader, environment.index_buffer, environment.indices.data(), environment.index_buffer.size);
+	upload_batcher_upload_buffer(uploader, environment.vertex_buffer, environment.vertices.data(), environment.vertex_buffer.size);
 
 	//constexpr float camera_fov = glm::radians(20.0f);
 	constexpr float camera_fov = glm::radians(19.5f);
@@ -1295,8 +1347,35 @@ int main(int argc, char** argv)
 	dof_resources.coc_render_target = create_texture(device, allocator, swapchain.width, swapchain.height, 1, VK_FORMAT_R8_UNORM,
 		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
 
-	Texture noise_texture;
-	FAIL_ON_ERROR(load_texture(noise_texture, "data/Noise.dds", device, allocator, command_pool, command_buffer, queue, scratch_buffer, false));
+	uint32_t cull_view_count = 1 + (uint32_t)lights.lights.size();
+	CullBatch cull_batch{};
+	create_cull_batch(cull_batch, geometry, meshes, mesh_draws, get_cull_view_masks(mesh_draws, materials, lights.lights.size()), cull_view_count, allocator, uploader);
+
+	// N switches to the next scene given on the command line and E to the next environment under data/, a sky
+	// dome directory or an .hdr image. Both are loaded in the background while the current ones keep rendering.
+	SceneManager scene_manager{};
+	init_scene_manager(scene_manager, device, allocator, thread_pool, environment_baker, COMPRESS_TEXTURES, CACHE_SCENES, HOT_RELOAD, lights.lights.size(), cull_view_count);
+	scene_manager_adopt_textures(scene_manager, texture_cache);
+
+	std::vector<std::string> scene_paths(argv + 1, argv + argc);
+	size_t scene_index = 0;
+	std::vector<std::filesystem::path> environment_paths;
+	std::error_code error;
+	for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator("data", error))
+	{
+		if (entry.path().filename() == "SkyDome.sdkmesh")
+			environment_paths.push_back(entry.path().parent_path());
+		else if (entry.path().extension() == ".hdr")
+			environment_paths.push_back(entry.path());
+	}
+	std::sort(environment_paths.begin(), environment_paths.end());
+	size_t environment_index = std::find(environment_paths.begin(), environment_paths.end(), environment_path.parent_path()) - environment_paths.begin();
+
+	// Nothing waits on the uploads here, the first frame acquires the resources and waits on the GPU timeline instead
+	upload_batcher_flush(uploader);
+	printf("Submitted assets in %.2f ms (%u upload submissions, %.2f MB uploaded, %.2f MB peak staging)\n",
+		(double)(SDL_GetPerformanceCounter() - load_start_counter) * 1000.0 / (double)SDL_GetPerformanceFrequency(),
+		uploader.submit_count, (double)uploader.bytes_uploaded / (1024.0 * 1024.0), (double)uploader.staging_peak_size / (1024.0 * 1024.0));
 
 	Shader vertex_shader{};
 	Shader fragment_shader{};
@@ -1369,6 +1448,30 @@ int main(int argc, char** argv)
 	Texture main_render_target_msaa = create_texture(device, allocator, swapchain.width, swapchain.height, 1, RENDER_TARGET_FORMAT,
 		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, 1, MSAA);
 
+	for (const Texture* texture : { &depth_texture_msaa, &depth_texture, &linear_depth_texture_msaa, &linear_depth_texture, &main_render_target,
+		&tmp_render_target, &main_render_target_msaa, &bloom_resources.glare_texture, &dof_resources.tmp_render_target, &dof_resources.coc_render_target })
+		residency_track(residency, *texture, RESIDENCY_RENDER_TARGET);
+	for (uint32_t i = 0; i < N_BLOOM_PASSES; ++i)
+		for (uint32_t j = 0; j < 2; ++j)
+			residency_track(residency, bloom_resources.tmp_render_targets[i][j], RESIDENCY_RENDER_TARGET);
+	for (const auto& l : lights.lights)
+		residency_track(residency, l.shadowmap, RESIDENCY_SHADOW_MAP);
+	for (const Texture& texture : textures)
+		residency_track(residency, texture, RESIDENCY_MATERIAL);
+	residency_track(residency, beckmann_lut, RESIDENCY_MATERIAL);
+	residency_track(residency, noise_texture, RESIDENCY_MATERIAL);
+	for (const Texture* texture : { &environment.irradiance, &environment.diffuse, &environment.reflection })
+		residency_track(residency, *texture, RESIDENCY_ENVIRONMENT);
+	residency_track(residency, environment.index_buffer, RESIDENCY_ENVIRONMENT);
+	residency_track(residency, environment.vertex_buffer, RESIDENCY_ENVIRONMENT);
+	residency_track(residency, geometry.index_buffer, RESIDENCY_GEOMETRY);
+	residency_track(residency, geometry.vertex_buffer, RESIDENCY_GEOMETRY);
+	residency_track(residency, geometry.position_buffer, RESIDENCY_GEOMETRY);
+	residency_track(residency, geometry.meshlet_buffer, RESIDENCY_GEOMETRY);
+	residency_track(residency, cull_batch.tasks, RESIDENCY_GEOMETRY);
+	residency_track(residency, cull_batch.commands, RESIDENCY_GEOMETRY);
+	residency_track(residency, lights.buffer, RESIDENCY_GEOMETRY);
+
 
 	VkSampler anisotropic_sampler = VK_NULL_HANDLE;
 	VkSampler linear_sampler = VK_NULL_HANDLE;
@@ -1444,6 +1547,50 @@ int main(int argc, char** argv)
 	uint64_t start_counter = SDL_GetPerformanceCounter();
 	uint64_t prev_counter = start_counter;
 
+	// Geometry and materials of an sdkmesh scene are imported again when the file changes, its textures are
+	// watched on their own. glTF scenes and packs embed their textures and are not reloaded.
+	uint32_t scene_watch = HOT_RELOAD && ext == ".sdkmesh" ? hot_reload_watch_file(hot_reloader, argv[1]) : UINT32_MAX;
+	auto reload_sdkmesh_scene = [&]() {
+		std::vector<uint8_t> contents;
+		std::vector<Mesh> new_meshes;
+		std::vector<Material> new_materials;
+		std::vector<Vertex> new_vertices;
+		std::vector<uint32_t> new_indices;
+		std::vector<MeshDraw> new_mesh_draws;
+		std::vector<SdkMeshTextures> new_textures;
+		if (!read_binary_file(argv[1], contents)
+			|| !import_sdkmesh_scene(contents.data(), contents.size(), new_meshes, new_materials, new_vertices, new_indices, new_mesh_draws, 0, new_textures, &thread_pool)
+			|| new_textures.size() != sdkmesh_material_count || new_indices.empty())
+		{
+			printf("Failed to reload '%s', keeping the old scene (the material count has to stay the same)\n", argv[1]);
+			return;
+		}
+		remap_material_textures(new_materials, 0, sdkmesh_texture_indices);
+
+		Geometry new_geometry{};
+		create_geometry(new_geometry, new_meshes, new_vertices, new_indices, allocator, uploader);
+		CullBatch new_cull_batch{};
+		create_cull_batch(new_cull_batch, new_geometry, new_meshes, new_mesh_draws, get_cull_view_masks(new_mesh_draws, new_materials, lights.lights.size()),
+			cull_view_count, allocator, uploader);
+		upload_batcher_flush(uploader);
+
+		hot_reload_defer(hot_reloader, [&, new_meshes = std::move(new_meshes), new_materials = std::move(new_materials), new_mesh_draws = std::move(new_mesh_draws),
+			new_vertices = std::move(new_vertices), new_indices = std::move(new_indices), new_geometry, new_cull_batch]() {
+			destroy_geometry(geometry);
+			geometry = new_geometry;
+			destroy_cull_batch(cull_batch);
+			cull_batch = new_cull_batch;
+			meshes = new_meshes;
+			materials = new_materials;
+			mesh_draws = new_mesh_draws;
+			vertices = new_vertices;
+			indices = new_indices;
+		});
+		printf("Reloaded '%s'\n", argv[1]);
+	};
+
+	// The first frame acquires the uploads of the startup load, the report covers the wait for it
+	bool is_first_frame = true;
     bool running = true;
 	while (running)
 	{
@@ -1462,6 +1609,20 @@ int main(int argc, char** argv)
 			case SDL_MOUSEMOTION:
 				mouse_delta = glm::vec2(event.motion.xrel, event.motion.yrel) * mouse_sensitivity;
 				break;
+			case SDL_KEYDOWN:
+				if (event.key.repeat)
+					break;
+				if (event.key.keysym.sym == SDLK_n && scene_paths.size() > 1)
+				{
+					scene_index = (scene_index + 1) % scene_paths.size();
+					scene_manager_load_scene(scene_manager, scene_paths[scene_index].c_str());
+				}
+				else if (event.key.keysym.sym == SDLK_e && !environment_paths.empty())
+				{
+					environment_index = (environment_index + 1) % environment_paths.size();
+					scene_manager_load_environment(scene_manager, environment_paths[environment_index]);
+				}
+				break;
 			default:break;
 			}
 		}
@@ -1501,6 +1662,26 @@ int main(int argc, char** argv)
 		view = glm::inverse(camera_to_world);
 		viewproj = proj * view;
 
+		{
+			CullView cull_views[CULL_MAX_VIEWS];
+			cull_views[0] = CullView{
+				.view_projection = viewproj,
+				.position = glm::vec3(camera_to_world[3]),
+				.pixels_per_unit = proj[1][1] * swapchain.height * 0.5f,
+			};
+			for (size_t i = 0; i < lights.lights.size(); ++i)
+			{
+				const OrbitCamera& light_camera = lights.lights[i].orbit_camera;
+				glm::mat4 light_view = light_camera.compute_view();
+				cull_views[1 + i] = CullView{
+					.view_projection = light_camera.projection * light_view,
+					.position = glm::vec3(glm::inverse(light_view)[3]),
+					.pixels_per_unit = light_camera.projection[1][1] * SHADOWMAP_SIZE * 0.5f,
+				};
+			}
+			update_cull_views(meshlet_culler, cull_views, cull_view_count);
+		}
+
 		VK_CHECK(vkResetCommandPool(device, command_pool, 0));
 		VkCommandBufferBeginInfo begin_info{
 			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -1508,6 +1689,8 @@ int main(int argc, char** argv)
 		};
 		VK_CHECK(vkBeginCommandBuffer(command_buffer, &begin_info));
 
+		uint64_t upload_wait_value = upload_batcher_record_acquire(uploader, command_buffer);
+
 		vkCmdResetQueryPool(command_buffer, query_pool, 0, QUERY_POOL_MAX_QUERIES);
 		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, query_pool, 0);
 
@@ -1557,6 +1740,8 @@ int main(int argc, char** argv)
 			pipeline_barrier(command_buffer, 0, nullptr, (uint32_t)std::size(barriers2), barriers2);
 		}
 
+		record_meshlet_culling(meshlet_culler, command_buffer, geometry, cull_batch);
+
 		for (size_t i = 0; i < lights.lights.size(); ++i)
 		{ // Do shadows
 			const Texture& sm = lights.lights[i].shadowmap;
@@ -1606,18 +1791,20 @@ int main(int argc, char** argv)
 			vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowmap_pipeline);
 
 			DescriptorInfo descriptor_info[] = {
-				DescriptorInfo(vertex_buffer.buffer),
+				DescriptorInfo(geometry.position_buffer.buffer),
 			};
 
 			vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, shadowmap_program.descriptor_update_template, shadowmap_program.pipeline_layout, 0, descriptor_info);
-			vkCmdBindIndexBuffer(command_buffer, index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+			VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
 
-			for (const auto& d : mesh_draws)
+			for (uint32_t draw_index = 0; draw_index < (uint32_t)mesh_draws.size(); ++draw_index)
 			{
-				if (materials[d.material_index].type == Material::EYES || materials[d.material_index].type == Material::STANDARD) continue;
+				const MeshDraw& d = mesh_draws[draw_index];
+				if (!casts_shadows(materials[d.material_index])) continue;
 
 				struct {
 					glm::mat4 mvp;
+					glm::vec4 position_dequantize;
 				} pc;
 
 				/**
@@ -1634,11 +1821,11 @@ int main(int argc, char** argv)
 				linear_projection[3][2] /= f;
 
 				pc.mvp = linear_projection * lights.lights[i].orbit_camera.compute_view() * d.transform;
+				pc.position_dequantize = geometry.meshes[d.mesh_index].position_dequantize;
 
 				vkCmdPushConstants(command_buffer, shadowmap_program.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(pc), &pc);
 
-				const Mesh& mesh = meshes[d.mesh_index];
-				vkCmdDrawIndexed(command_buffer, mesh.index_count, 1, mesh.first_index, mesh.first_vertex, 0);
+				draw_culled(command_buffer, geometry, cull_batch, 1 + (uint32_t)i, draw_index, bound_index_type);
 			}
 
 			vkCmdEndRendering(command_buffer);
@@ -1761,10 +1948,11 @@ int main(int argc, char** argv)
 			vkCmdSetScissor(command_buffer, 0, 1, &scissor);
 
 			vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-			vkCmdBindIndexBuffer(command_buffer, index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+			VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
 
-			for (const auto& d : mesh_draws)
+			for (uint32_t draw_index = 0; draw_index < (uint32_t)mesh_draws.size(); ++draw_index)
 			{
+				const MeshDraw& d = mesh_draws[draw_index];
 				assert(d.material_index >= 0);
 				const Material& mat = materials[d.material_index];
 
@@ -1773,7 +1961,7 @@ int main(int argc, char** argv)
 				assert(mat.specular_texture >= 0);
 
 				DescriptorInfo descriptor_info[] = {
-					DescriptorInfo(vertex_buffer.buffer),
+					DescriptorInfo(geometry.vertex_buffer.buffer),
 					DescriptorInfo(anisotropic_sampler),
 					DescriptorInfo(linear_sampler),
 					DescriptorInfo(point_sampler),
@@ -1789,30 +1977,44 @@ int main(int argc, char** argv)
 					DescriptorInfo(lights.lights[3].shadowmap.view, VK_IMAGE_LAYOUT_GENERAL),
 					DescriptorInfo(lights.lights[4].shadowmap.view, VK_IMAGE_LAYOUT_GENERAL),
 					DescriptorInfo(environment.irradiance.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+					DescriptorInfo(texture_streamer.feedback.buffer),
 				};
 
 				vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, forward_program.descriptor_update_template, forward_program.pipeline_layout, 0, descriptor_info);
 
 				struct {
 					glm::mat4 mvp;
+					glm::vec4 position_dequantize;
 					uint32_t n_lights;
 					glm::vec3 camera_pos;
 					float translucency = SSS_TRANSLUCENCY;
 					float sss_width = SSS_WIDTH;
 					float ambient = AMBIENT_INTENSITY;
+					uint32_t basecolor_stream;
+					uint32_t normal_stream;
+					uint32_t specular_stream;
 				} pc;
 
 				pc.mvp = viewproj * d.transform;
+				pc.position_dequantize = geometry.meshes[d.mesh_index].position_dequantize;
 				pc.n_lights = (uint32_t)lights.lights.size();
 				pc.camera_pos = glm::inverse(view)[3];
+				pc.basecolor_stream = get_texture_stream(texture_streamer, mat.basecolor_texture);
+				pc.normal_stream = get_texture_stream(texture_streamer, mat.normal_texture);
+				pc.specular_stream = get_texture_stream(texture_streamer, mat.specular_texture);
 
 				vkCmdPushConstants(command_buffer, forward_program.pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pc), &pc);
 
-				const Mesh& mesh = meshes[d.mesh_index];
-				vkCmdDrawIndexed(command_buffer, mesh.index_count, 1, mesh.first_index, mesh.first_vertex, 0);
+				draw_culled(command_buffer, geometry, cull_batch, 0, draw_index, bound_index_type);
 			}
 
 			vkCmdEndRendering(command_buffer);
+
+			// The streaming feedback is read on the CPU once the frame fence has been signaled
+			VkMemoryBarrier2 barrier = memory_barrier(
+				VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+				VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+			pipeline_barrier(command_buffer, { barrier }, {});
 		}
 
 		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, query_pool, 1);
@@ -2091,13 +2293,23 @@ int main(int argc, char** argv)
 
 		VK_CHECK(vkEndCommandBuffer(command_buffer));
 
-		VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		VkSemaphore wait_semaphores[] = { acquire_semaphore, uploader.timeline };
+		VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+		uint64_t wait_values[] = { 0, upload_wait_value };
+		uint32_t wait_semaphore_count = upload_wait_value != 0 ? 2u : 1u;
+
+		VkTimelineSemaphoreSubmitInfo timeline_info{
+			.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+			.waitSemaphoreValueCount = wait_semaphore_count,
+			.pWaitSemaphoreValues = wait_values,
+		};
 
 		VkSubmitInfo submit_info{
 			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-			.waitSemaphoreCount = 1,
-			.pWaitSemaphores = &acquire_semaphore,
-			.pWaitDstStageMask = &wait_stage,
+			.pNext = &timeline_info,
+			.waitSemaphoreCount = wait_semaphore_count,
+			.pWaitSemaphores = wait_semaphores,
+			.pWaitDstStageMask = wait_stages,
 			.commandBufferCount = 1,
 			.pCommandBuffers = &command_buffer,
 			.signalSemaphoreCount = 1,
@@ -2118,8 +2330,50 @@ int main(int argc, char** argv)
 		};
 		VK_CHECK(vkQueuePresentKHR(queue, &present_info));
 
-		VK_CHECK(vkWaitForFences(device, 1, &frame_fence, VK_TRUE, UINT64_MAX));
+		if (is_first_frame && LOAD_REPORT)
+		{
+			{
+				LoadScope scope(LOAD_STAGE_GPU_WAIT, "first frame");
+				VK_CHECK(vkWaitForFences(device, 1, &frame_fence, VK_TRUE, UINT64_MAX));
+			}
+			end_load_telemetry("load_report.json");
+		}
+		else
+			VK_CHECK(vkWaitForFences(device, 1, &frame_fence, VK_TRUE, UINT64_MAX));
 		VK_CHECK(vkResetFences(device, 1, &frame_fence));
+		is_first_frame = false;
+
+		SceneSwap scene_swap;
+		if (update_scene_manager(scene_manager, textures, environment, texture_cache, streamer, residency, hot_reloader, uploader, scene_swap))
+		{
+			destroy_geometry(geometry);
+			geometry = scene_swap.geometry;
+			destroy_cull_batch(cull_batch);
+			cull_batch = scene_swap.cull_batch;
+			meshes = std::move(scene_swap.meshes);
+			materials = std::move(scene_swap.materials);
+			vertices = std::move(scene_swap.vertices);
+			indices = std::move(scene_swap.indices);
+			mesh_draws = std::move(scene_swap.mesh_draws);
+
+			// Only the scene loaded at startup is reloaded when its file changes
+			if (scene_watch != UINT32_MAX)
+				hot_reload_unwatch(hot_reloader, scene_watch);
+			scene_watch = UINT32_MAX;
+		}
+
+		update_texture_streamer(texture_streamer, textures, uploader, residency.stream_budget);
+		update_residency(residency, texture_streamer, textures, uploader);
+
+		std::vector<uint32_t> changed_files;
+		update_hot_reloader(hot_reloader, texture_streamer, uploader, changed_files);
+		for (uint32_t id : changed_files)
+		{
+			if (id == scene_watch)
+				reload_sdkmesh_scene();
+		}
+
+		upload_batcher_trim(uploader);
 
 		uint64_t timestamps[7] = {};
 		VK_CHECK(vkGetQueryPoolResults(device, query_pool, 0, 7, sizeof(timestamps), timestamps, sizeof(double), VK_QUERY_RESULT_64_BIT));
@@ -2134,14 +2388,18 @@ int main(int argc, char** argv)
 		post_process_ms = glm::mix(post_process_ms, post_process, 0.05f);
 
 		{
-			char title[256];
-			sprintf(title, "gpu: %f ms, post process: %f ms, sss: %f ms, bloom: %f ms, dof: %f ms, film grain: %f ms", 
-				smoothed_frametime_ms, post_process_ms, sss_ms, bloom_ms, dof_ms, film_grain_ms);
+			char title[320];
+			sprintf(title, "gpu: %f ms, post process: %f ms, sss: %f ms, bloom: %f ms, dof: %f ms, film grain: %f ms, vram: %.0f/%.0f MB (materials %.0f MB)", 
+				smoothed_frametime_ms, post_process_ms, sss_ms, bloom_ms, dof_ms, film_grain_ms,
+				residency.heap_usage / (1024.0 * 1024.0), residency.heap_budget / (1024.0 * 1024.0), residency.resident_bytes[RESIDENCY_MATERIAL] / (1024.0 * 1024.0));
 			SDL_SetWindowTitle(window, title);
 		}
 	}
 
 	VK_CHECK(vkDeviceWaitIdle(device));
+	destroy_scene_manager(scene_manager);
+	destroy_environment_baker(environment_baker);
+	destroy_hot_reloader(hot_reloader);
 
 	SDL_DestroyWindow(window);
 
@@ -2165,11 +2423,15 @@ int main(int argc, char** argv)
 	environment.vertex_buffer.destroy();	
 	beckmann_lut.destroy();
 	for (auto& l : lights.lights) l.shadowmap.destroy();
-	for (Texture& t : textures) t.destroy();
-	scratch_buffer.destroy();
+	for (Texture& t : textures) if (t.image) t.destroy();
+	destroy_texture_streamer(texture_streamer);
+	destroy_upload_batcher(uploader);
+	destroy_downsampler(downsampler);
+	destroy_thread_pool(thread_pool);
 	lights.buffer.destroy();
-	vertex_buffer.destroy();
-	index_buffer.destroy();
+	destroy_geometry(geometry);
+	destroy_cull_batch(cull_batch);
+	destroy_meshlet_culler(meshlet_culler);
 	depth_texture_msaa.destroy();
 	depth_texture.destroy();
 	linear_depth_texture.destroy();
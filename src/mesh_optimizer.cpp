@@ -0,0 +1,691 @@
+#include "mesh_optimizer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <filesystem>
+#include <map>
+
+static constexpr uint32_t MESH_CACHE_MAGIC = 0x484d5852; // "RXMH"
+
+// Resolution of the depth buffers overdraw is measured with
+static constexpr int OVERDRAW_GRID = 256;
+
+// Cache entry of one vertex range: the statistics and optimized indices of every index range using it,
+// followed by the new vertex order (new -> old index) when the vertices were reordered.
+struct MeshCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertex_count;
+	uint32_t range_count;
+	uint64_t index_count;
+	uint32_t has_vertex_order;
+	uint32_t padding;
+};
+
+// FIFO post-transform cache. A vertex is cached while fewer than size misses happened since it was loaded.
+struct VertexCacheSimulation
+{
+	std::vector<uint32_t> load_time;
+	uint32_t time;
+	uint32_t size;
+
+	VertexCacheSimulation(uint32_t vertex_count, uint32_t cache_size) : load_time(vertex_count, 0), time(cache_size + 1), size(cache_size) {}
+
+	uint32_t add_triangle(const uint32_t* triangle)
+	{
+		uint32_t misses = 0;
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			uint32_t v = triangle[k];
+			if (time - load_time[v] > size)
+			{
+				load_time[v] = time++;
+				misses++;
+			}
+		}
+		return misses;
+	}
+
+	void flush() { time += size + 1; }
+};
+
+static void analyze_vertex_cache(MeshStats& stats, const uint32_t* indices, size_t index_count, uint32_t vertex_count)
+{
+	VertexCacheSimulation cache(vertex_count, MESH_VERTEX_CACHE_SIZE);
+	std::vector<uint8_t> is_referenced(vertex_count, 0);
+	size_t misses = 0;
+	size_t referenced = 0;
+	for (size_t i = 0; i + 3 <= index_count; i += 3)
+	{
+		misses += cache.add_triangle(indices + i);
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			referenced += is_referenced[indices[i + k]] ^ 1;
+			is_referenced[indices[i + k]] = 1;
+		}
+	}
+
+	stats.acmr = index_count >= 3 ? (float)misses / (float)(index_count / 3) : 0.0f;
+	stats.atvr = referenced > 0 ? (float)misses / (float)referenced : 0.0f;
+}
+
+// Rasterizes the mesh in submission order along each axis. Triangles facing the other way go to a second
+// depth buffer looking from the opposite side, so no winding has to be assumed.
+static float analyze_overdraw(const uint32_t* indices, size_t index_count, const Vertex* vertices)
+{
+	glm::vec3 min_position(FLT_MAX);
+	glm::vec3 max_position(-FLT_MAX);
+	for (size_t i = 0; i < index_count; ++i)
+	{
+		min_position = glm::min(min_position, vertices[indices[i]].position);
+		max_position = glm::max(max_position, vertices[indices[i]].position);
+	}
+
+	glm::vec3 extent = max_position - min_position;
+	float scale = std::max(extent.x, std::max(extent.y, extent.z));
+	if (index_count < 3 || scale <= 0.0f)
+		return 0.0f;
+	scale = 1.0f / scale;
+
+	std::vector<float> depth(2 * OVERDRAW_GRID * OVERDRAW_GRID);
+	size_t shaded = 0;
+	size_t covered = 0;
+	for (uint32_t axis = 0; axis < 3; ++axis)
+	{
+		std::fill(depth.begin(), depth.end(), FLT_MAX);
+		uint32_t u_axis = (axis + 1) % 3;
+		uint32_t v_axis = (axis + 2) % 3;
+
+		for (size_t i = 0; i + 3 <= index_count; i += 3)
+		{
+			glm::vec3 p[3];
+			for (uint32_t k = 0; k < 3; ++k)
+			{
+				glm::vec3 n = (vertices[indices[i + k]].position - min_position) * scale;
+				p[k] = glm::vec3(n[u_axis] * OVERDRAW_GRID, n[v_axis] * OVERDRAW_GRID, n[axis]);
+			}
+
+			float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+			if (area == 0.0f)
+				continue;
+
+			// Positive area faces the viewer on the positive side of the axis, for whom larger depths are nearer
+			uint32_t side = area > 0.0f ? 0 : 1;
+			if (side == 0)
+				for (glm::vec3& q : p)
+					q.z = 1.0f - q.z;
+			float* side_depth = depth.data() + side * OVERDRAW_GRID * OVERDRAW_GRID;
+
+			int x0 = std::max((int)std::floor(std::min(p[0].x, std::min(p[1].x, p[2].x))), 0);
+			int y0 = std::max((int)std::floor(std::min(p[0].y, std::min(p[1].y, p[2].y))), 0);
+			int x1 = std::min((int)std::ceil(std::max(p[0].x, std::max(p[1].x, p[2].x))), OVERDRAW_GRID - 1);
+			int y1 = std::min((int)std::ceil(std::max(p[0].y, std::max(p[1].y, p[2].y))), OVERDRAW_GRID - 1);
+			float inv_area = 1.0f / area;
+
+			for (int y = y0; y <= y1; ++y)
+			{
+				for (int x = x0; x <= x1; ++x)
+				{
+					// Barycentrics of the pixel center, all positive inside for either winding
+					float px = x + 0.5f;
+					float py = y + 0.5f;
+					float w0 = ((p[1].x - px) * (p[2].y - py) - (p[2].x - px) * (p[1].y - py)) * inv_area;
+					float w1 = ((p[2].x - px) * (p[0].y - py) - (p[0].x - px) * (p[2].y - py)) * inv_area;
+					float w2 = 1.0f - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+						continue;
+
+					float z = w0 * p[0].z + w1 * p[1].z + w2 * p[2].z;
+					float& stored = side_depth[y * OVERDRAW_GRID + x];
+					if (z < stored)
+					{
+						covered += stored == FLT_MAX;
+						stored = z;
+						shaded++;
+					}
+				}
+			}
+		}
+	}
+
+	return covered > 0 ? (float)shaded / (float)covered : 0.0f;
+}
+
+MeshStats analyze_mesh(const uint32_t* indices, size_t index_count, const Vertex* vertices, uint32_t vertex_count)
+{
+	MeshStats stats{};
+	analyze_vertex_cache(stats, indices, index_count, vertex_count);
+	stats.overdraw = analyze_overdraw(indices, index_count, vertices);
+	return stats;
+}
+
+// Tipsify, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander et al. 2007). Fans
+// around the most recently cached vertex that still has triangles left, jumping to an unrelated vertex only
+// at dead ends. Appends the first triangle after every such jump to clusters.
+static void tipsify(const uint32_t* indices, size_t index_count, uint32_t vertex_count, uint32_t* result, std::vector<uint32_t>& clusters)
+{
+	size_t triangle_count = index_count / 3;
+
+	// Triangles around every vertex, and how many of them are not emitted yet
+	std::vector<uint32_t> offsets(vertex_count + 1, 0);
+	for (size_t i = 0; i < triangle_count * 3; ++i)
+		offsets[indices[i] + 1]++;
+	for (uint32_t v = 0; v < vertex_count; ++v)
+		offsets[v + 1] += offsets[v];
+
+	std::vector<uint32_t> adjacency(triangle_count * 3);
+	std::vector<uint32_t> live(vertex_count);
+	for (uint32_t v = 0; v < vertex_count; ++v)
+		live[v] = offsets[v + 1] - offsets[v];
+	{
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < triangle_count * 3; ++i)
+			adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	std::vector<uint32_t> cache_time(vertex_count, 0);
+	std::vector<uint8_t> is_emitted(triangle_count, 0);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> candidates;
+	uint32_t time = MESH_VERTEX_CACHE_SIZE + 1;
+	uint32_t cursor = 0;
+	size_t emitted = 0;
+
+	clusters.clear();
+	clusters.push_back(0);
+
+	int64_t fan = triangle_count > 0 ? (int64_t)indices[0] : -1;
+	while (fan >= 0)
+	{
+		candidates.clear();
+		for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; ++a)
+		{
+			uint32_t t = adjacency[a];
+			if (is_emitted[t])
+				continue;
+
+			for (uint32_t k = 0; k < 3; ++k)
+			{
+				uint32_t v = indices[t * 3 + k];
+				result[emitted * 3 + k] = v;
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cache_time[v] > MESH_VERTEX_CACHE_SIZE)
+					cache_time[v] = time++;
+			}
+			is_emitted[t] = 1;
+			emitted++;
+		}
+
+		// Prefer the vertex that has been in the cache longest and stays cached while its fan is emitted
+		int64_t next = -1;
+		int64_t best_priority = -1;
+		for (uint32_t v : candidates)
+		{
+			if (live[v] == 0)
+				continue;
+
+			int64_t priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= MESH_VERTEX_CACHE_SIZE)
+				priority = time - cache_time[v];
+			if (priority > best_priority)
+			{
+				best_priority = priority;
+				next = v;
+			}
+		}
+
+		if (next < 0)
+		{
+			while (!dead_end.empty() && next < 0)
+			{
+				uint32_t v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v] > 0)
+					next = v;
+			}
+
+			for (; cursor < vertex_count && next < 0; ++cursor)
+			{
+				if (live[cursor] > 0)
+					next = cursor;
+			}
+
+			if (next >= 0)
+				clusters.push_back((uint32_t)emitted);
+		}
+
+		fan = next;
+	}
+
+	assert(emitted == triangle_count);
+}
+
+// Merges tipsify clusters until each one is worth moving on its own, see MESH_OVERDRAW_THRESHOLD
+static void merge_clusters(const uint32_t* indices, size_t triangle_count, uint32_t vertex_count, std::vector<uint32_t>& clusters)
+{
+	VertexCacheSimulation warm(vertex_count, MESH_VERTEX_CACHE_SIZE);
+	VertexCacheSimulation cold(vertex_count, MESH_VERTEX_CACHE_SIZE);
+
+	std::vector<uint32_t> merged = { 0 };
+	uint32_t warm_misses = 0;
+	uint32_t cold_misses = 0;
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+		for (size_t t = clusters[c]; t < end; ++t)
+		{
+			warm_misses += warm.add_triangle(indices + t * 3);
+			cold_misses += cold.add_triangle(indices + t * 3);
+		}
+
+		if (end < triangle_count && cold_misses <= warm_misses * MESH_OVERDRAW_THRESHOLD)
+		{
+			merged.push_back((uint32_t)end);
+			cold.flush();
+			warm_misses = 0;
+			cold_misses = 0;
+		}
+	}
+
+	clusters.swap(merged);
+}
+
+// Draws outward facing clusters far from the mesh center first, as they are the most likely to occlude the
+// rest. Front faces are counter clockwise, like in glTF and after sdkmesh conversion.
+static void sort_clusters(const uint32_t* indices, size_t triangle_count, const Vertex* vertices, const std::vector<uint32_t>& clusters, uint32_t* result)
+{
+	struct Cluster
+	{
+		glm::vec3 centroid;
+		glm::vec3 normal;
+		float area;
+		float sort_key;
+	};
+
+	std::vector<Cluster> cluster_data(clusters.size());
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		Cluster& cluster = cluster_data[c];
+		cluster = { glm::vec3(0.0f), glm::vec3(0.0f), 0.0f, 0.0f };
+
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+		for (size_t t = clusters[c]; t < end; ++t)
+		{
+			const glm::vec3& p0 = vertices[indices[t * 3 + 0]].position;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+
+			cluster.centroid += (p0 + p1 + p2) * (area / 3.0f);
+			cluster.normal += normal;
+			cluster.area += area;
+		}
+
+		mesh_centroid += cluster.centroid;
+		mesh_area += cluster.area;
+		if (cluster.area > 0.0f)
+			cluster.centroid /= cluster.area;
+	}
+
+	if (mesh_area > 0.0f)
+		mesh_centroid /= mesh_area;
+
+	for (Cluster& cluster : cluster_data)
+	{
+		float length = glm::length(cluster.normal);
+		cluster.sort_key = length > 0.0f ? glm::dot(cluster.centroid - mesh_centroid, cluster.normal / length) : 0.0f;
+	}
+
+	std::vector<uint32_t> order(clusters.size());
+	for (uint32_t c = 0; c < (uint32_t)order.size(); ++c)
+		order[c] = c;
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return cluster_data[a].sort_key > cluster_data[b].sort_key;
+	});
+
+	uint32_t* dst = result;
+	for (uint32_t c : order)
+	{
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+		size_t count = (end - clusters[c]) * 3;
+		memcpy(dst, indices + clusters[c] * 3, count * sizeof(uint32_t));
+		dst += count;
+	}
+}
+
+void optimize_triangle_order(uint32_t* indices, size_t index_count, const Vertex* vertices, uint32_t vertex_count)
+{
+	size_t triangle_count = index_count / 3;
+	std::vector<uint32_t> cache_order(triangle_count * 3);
+	std::vector<uint32_t> clusters;
+	tipsify(indices, index_count, vertex_count, cache_order.data(), clusters);
+	merge_clusters(cache_order.data(), triangle_count, vertex_count, clusters);
+	sort_clusters(cache_order.data(), triangle_count, vertices, clusters, indices);
+}
+
+// Meshes referencing the same vertex range, optimized together as the vertex order is shared
+struct MeshVertexRange
+{
+	uint32_t first_vertex;
+	uint32_t vertex_count;
+	std::vector<uint32_t> index_ranges;
+	bool reorder_vertices;
+	bool is_cached;
+};
+
+struct MeshIndexRange
+{
+	uint32_t first_index;
+	uint32_t index_count;
+	uint32_t vertex_range;
+	bool is_valid;
+	MeshStats before;
+	MeshStats after;
+};
+
+static bool read_cached_meshes(const char* path, MeshVertexRange& range, std::vector<MeshIndexRange>& index_ranges, Vertex* vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint8_t> cached;
+	std::error_code error;
+	if (!std::filesystem::exists(path, error) || !read_binary_file(path, cached))
+		return false;
+
+	size_t index_count = 0;
+	for (uint32_t r : range.index_ranges)
+		index_count += index_ranges[r].index_count;
+
+	MeshCacheHeader header;
+	size_t stats_size = range.index_ranges.size() * 2 * sizeof(MeshStats);
+	size_t order_size = range.reorder_vertices ? range.vertex_count * sizeof(uint32_t) : 0;
+	if (cached.size() < sizeof(header))
+		return false;
+	memcpy(&header, cached.data(), sizeof(header));
+	if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_OPTIMIZER_VERSION || header.vertex_count != range.vertex_count
+		|| header.range_count != range.index_ranges.size() || header.index_count != index_count || header.has_vertex_order != (range.reorder_vertices ? 1u : 0u)
+		|| cached.size() != sizeof(header) + stats_size + index_count * sizeof(uint32_t) + order_size)
+	{
+		printf("Ignoring invalid mesh cache entry %s\n", path);
+		return false;
+	}
+
+	// The vertex order is checked before anything is applied, a failed read leaves the meshes untouched
+	const uint8_t* src = cached.data() + sizeof(header);
+	std::vector<uint32_t> order(order_size / sizeof(uint32_t));
+	memcpy(order.data(), cached.data() + cached.size() - order_size, order_size);
+	for (uint32_t v : order)
+	{
+		if (v >= range.vertex_count)
+		{
+			printf("Ignoring invalid mesh cache entry %s\n", path);
+			return false;
+		}
+	}
+
+	for (uint32_t r : range.index_ranges)
+	{
+		memcpy(&index_ranges[r].before, src, sizeof(MeshStats));
+		memcpy(&index_ranges[r].after, src + sizeof(MeshStats), sizeof(MeshStats));
+		src += 2 * sizeof(MeshStats);
+	}
+	for (uint32_t r : range.index_ranges)
+	{
+		memcpy(indices.data() + index_ranges[r].first_index, src, index_ranges[r].index_count * sizeof(uint32_t));
+		src += index_ranges[r].index_count * sizeof(uint32_t);
+	}
+
+	if (range.reorder_vertices)
+	{
+		std::vector<Vertex> reordered(range.vertex_count);
+		for (uint32_t v = 0; v < range.vertex_count; ++v)
+			reordered[v] = vertices[order[v]];
+		memcpy(vertices, reordered.data(), reordered.size() * sizeof(Vertex));
+	}
+
+	return true;
+}
+
+static void write_cached_meshes(const char* path, const MeshVertexRange& range, const std::vector<MeshIndexRange>& index_ranges, const std::vector<uint32_t>& indices, const std::vector<uint32_t>& order)
+{
+	// Write to a unique temporary name first, another process may import the same meshes at once
+	char temp_path[600];
+	snprintf(temp_path, sizeof(temp_path), "%s.%p.tmp", path, (const void*)&range);
+
+	std::error_code error;
+	std::filesystem::create_directories(MESH_CACHE_DIRECTORY, error);
+	FILE* f = fopen(temp_path, "wb");
+	if (!f)
+		return;
+
+	MeshCacheHeader header{
+		.magic = MESH_CACHE_MAGIC,
+		.version = MESH_OPTIMIZER_VERSION,
+		.vertex_count = range.vertex_count,
+		.range_count = (uint32_t)range.index_ranges.size(),
+		.has_vertex_order = range.reorder_vertices ? 1u : 0u,
+	};
+	for (uint32_t r : range.index_ranges)
+		header.index_count += index_ranges[r].index_count;
+
+	bool success = fwrite(&header, sizeof(header), 1, f) == 1;
+	for (uint32_t r : range.index_ranges)
+	{
+		success = success && fwrite(&index_ranges[r].before, sizeof(MeshStats), 1, f) == 1;
+		success = success && fwrite(&index_ranges[r].after, sizeof(MeshStats), 1, f) == 1;
+	}
+	for (uint32_t r : range.index_ranges)
+		success = success && fwrite(indices.data() + index_ranges[r].first_index, sizeof(uint32_t), index_ranges[r].index_count, f) == index_ranges[r].index_count;
+	if (range.reorder_vertices)
+		success = success && fwrite(order.data(), sizeof(uint32_t), order.size(), f) == order.size();
+	fclose(f);
+
+	if (success)
+		std::filesystem::rename(temp_path, path, error);
+	else
+		std::filesystem::remove(temp_path, error);
+}
+
+static void optimize_vertex_range(MeshVertexRange& range, std::vector<MeshIndexRange>& index_ranges, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	Vertex* range_vertices = vertices.data() + range.first_vertex;
+
+	uint64_t hash = hash_bytes(range_vertices, range.vertex_count * sizeof(Vertex), MESH_OPTIMIZER_VERSION);
+	for (uint32_t r : range.index_ranges)
+		hash = hash_bytes(indices.data() + index_ranges[r].first_index, index_ranges[r].index_count * sizeof(uint32_t), hash);
+
+	char cache_path[512];
+	snprintf(cache_path, sizeof(cache_path), "%s/%016llx_%u_v%u.bin", MESH_CACHE_DIRECTORY,
+		(unsigned long long)hash, range.reorder_vertices ? 1u : 0u, MESH_OPTIMIZER_VERSION);
+
+	range.is_cached = read_cached_meshes(cache_path, range, index_ranges, range_vertices, indices);
+	if (range.is_cached)
+		return;
+
+	for (uint32_t r : range.index_ranges)
+	{
+		MeshIndexRange& index_range = index_ranges[r];
+		uint32_t* range_indices = indices.data() + index_range.first_index;
+		index_range.before = analyze_mesh(range_indices, index_range.index_count, range_vertices, range.vertex_count);
+		optimize_triangle_order(range_indices, index_range.index_count, range_vertices, range.vertex_count);
+		index_range.after = analyze_mesh(range_indices, index_range.index_count, range_vertices, range.vertex_count);
+	}
+
+	// Vertices in order of first use, the ones no triangle references go last
+	std::vector<uint32_t> order;
+	if (range.reorder_vertices)
+	{
+		std::vector<uint32_t> remap(range.vertex_count, UINT32_MAX);
+		order.reserve(range.vertex_count);
+		for (uint32_t r : range.index_ranges)
+		{
+			uint32_t* range_indices = indices.data() + index_ranges[r].first_index;
+			for (uint32_t i = 0; i < index_ranges[r].index_count; ++i)
+			{
+				uint32_t& new_index = remap[range_indices[i]];
+				if (new_index == UINT32_MAX)
+				{
+					new_index = (uint32_t)order.size();
+					order.push_back(range_indices[i]);
+				}
+				range_indices[i] = new_index;
+			}
+		}
+
+		for (uint32_t v = 0; v < range.vertex_count; ++v)
+			if (remap[v] == UINT32_MAX)
+				order.push_back(v);
+
+		std::vector<Vertex> reordered(range.vertex_count);
+		for (uint32_t v = 0; v < range.vertex_count; ++v)
+			reordered[v] = range_vertices[order[v]];
+		memcpy(range_vertices, reordered.data(), reordered.size() * sizeof(Vertex));
+	}
+
+	write_cached_meshes(cache_path, range, index_ranges, indices, order);
+}
+
+void optimize_meshes(
+	std::vector<Mesh>& meshes,
+	size_t first_mesh,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	ThreadPool* thread_pool)
+{
+	double start_ms = get_time_ms();
+
+	// Meshes drawing the same triangles share an index range, meshes drawing the same vertices a vertex range
+	std::vector<MeshVertexRange> vertex_ranges;
+	std::vector<MeshIndexRange> index_ranges;
+	std::vector<uint32_t> mesh_index_ranges(meshes.size() - first_mesh);
+	std::map<std::pair<uint32_t, uint32_t>, uint32_t> vertex_range_ids;
+	std::map<std::pair<uint32_t, uint32_t>, uint32_t> index_range_ids;
+	for (size_t i = first_mesh; i < meshes.size(); ++i)
+	{
+		const Mesh& mesh = meshes[i];
+		auto [vertex_range, new_vertex_range] = vertex_range_ids.try_emplace({ mesh.first_vertex, mesh.vertex_count }, (uint32_t)vertex_ranges.size());
+		if (new_vertex_range)
+			vertex_ranges.push_back({ mesh.first_vertex, mesh.vertex_count, {}, true, false });
+
+		auto [index_range, new_index_range] = index_range_ids.try_emplace({ mesh.first_index, mesh.index_count }, (uint32_t)index_ranges.size());
+		if (new_index_range)
+		{
+			index_ranges.push_back({ mesh.first_index, mesh.index_count, vertex_range->second, mesh.index_count % 3 == 0, {}, {} });
+			vertex_ranges[vertex_range->second].index_ranges.push_back(index_range->second);
+		}
+		else if (index_ranges[index_range->second].vertex_range != vertex_range->second)
+		{
+			// The same indices drawn with two vertex offsets, neither may be renumbered
+			index_ranges[index_range->second].is_valid = false;
+			vertex_ranges[vertex_range->second].reorder_vertices = false;
+		}
+		mesh_index_ranges[i - first_mesh] = index_range->second;
+	}
+
+	// Partially overlapping ranges would be reordered twice
+	std::vector<uint32_t> sorted(index_ranges.size());
+	for (uint32_t r = 0; r < (uint32_t)sorted.size(); ++r)
+		sorted[r] = r;
+	std::sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) { return index_ranges[a].first_index < index_ranges[b].first_index; });
+	for (size_t s = 1, last = 0; s < sorted.size(); ++s)
+	{
+		// Compared against the range reaching furthest so far, which may contain several later ones
+		MeshIndexRange& previous = index_ranges[sorted[last]];
+		MeshIndexRange& current = index_ranges[sorted[s]];
+		if ((uint64_t)previous.first_index + previous.index_count > current.first_index)
+			previous.is_valid = current.is_valid = false;
+		if ((uint64_t)current.first_index + current.index_count > (uint64_t)previous.first_index + previous.index_count)
+			last = s;
+	}
+
+	sorted.resize(vertex_ranges.size());
+	for (uint32_t r = 0; r < (uint32_t)sorted.size(); ++r)
+		sorted[r] = r;
+	std::sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) { return vertex_ranges[a].first_vertex < vertex_ranges[b].first_vertex; });
+	for (size_t s = 1, last = 0; s < sorted.size(); ++s)
+	{
+		MeshVertexRange& previous = vertex_ranges[sorted[last]];
+		MeshVertexRange& current = vertex_ranges[sorted[s]];
+		if ((uint64_t)previous.first_vertex + previous.vertex_count > current.first_vertex)
+			previous.reorder_vertices = current.reorder_vertices = false;
+		if ((uint64_t)current.first_vertex + current.vertex_count > (uint64_t)previous.first_vertex + previous.vertex_count)
+			last = s;
+	}
+
+	// Indices outside of the vertex range are left to the validation of the importer
+	for (MeshIndexRange& index_range : index_ranges)
+	{
+		uint32_t vertex_count = vertex_ranges[index_range.vertex_range].vertex_count;
+		const uint32_t* range_indices = indices.data() + index_range.first_index;
+		for (uint32_t i = 0; i < index_range.index_count && index_range.is_valid; ++i)
+			index_range.is_valid = range_indices[i] < vertex_count;
+	}
+
+	// Vertices can only be renumbered if every index referencing them is rewritten
+	for (MeshVertexRange& vertex_range : vertex_ranges)
+	{
+		std::vector<uint32_t> valid_ranges;
+		for (uint32_t r : vertex_range.index_ranges)
+		{
+			if (index_ranges[r].is_valid)
+				valid_ranges.push_back(r);
+			else
+				vertex_range.reorder_vertices = false;
+		}
+		vertex_range.index_ranges.swap(valid_ranges);
+	}
+
+	auto optimize = [&](uint32_t i) {
+		if (!vertex_ranges[i].index_ranges.empty())
+			optimize_vertex_range(vertex_ranges[i], index_ranges, vertices, indices);
+	};
+
+	if (thread_pool)
+		parallel_for(*thread_pool, (uint32_t)vertex_ranges.size(), optimize);
+	else
+		for (uint32_t i = 0; i < (uint32_t)vertex_ranges.size(); ++i)
+			optimize(i);
+
+	uint32_t optimized_count = 0;
+	uint32_t cached_count = 0;
+	MeshStats total_before{};
+	MeshStats total_after{};
+	size_t total_triangles = 0;
+	for (size_t i = first_mesh; i < meshes.size(); ++i)
+	{
+		const MeshIndexRange& index_range = index_ranges[mesh_index_ranges[i - first_mesh]];
+		if (!index_range.is_valid)
+		{
+			printf("Mesh %zu: overlaps another mesh, left unoptimized\n", i);
+			continue;
+		}
+
+		const MeshStats& before = index_range.before;
+		const MeshStats& after = index_range.after;
+		printf("Mesh %zu: %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f\n",
+			i, index_range.index_count / 3, before.acmr, after.acmr, before.atvr, after.atvr, before.overdraw, after.overdraw);
+
+		float triangles = (float)(index_range.index_count / 3);
+		total_before.acmr += before.acmr * triangles;
+		total_before.overdraw += before.overdraw * triangles;
+		total_after.acmr += after.acmr * triangles;
+		total_after.overdraw += after.overdraw * triangles;
+		total_triangles += index_range.index_count / 3;
+		optimized_count++;
+		cached_count += vertex_ranges[index_range.vertex_range].is_cached ? 1 : 0;
+	}
+
+	if (total_triangles > 0)
+	{
+		float scale = 1.0f / (float)total_triangles;
+		printf("Optimized %u meshes (%u from cache) in %.2f ms: ACMR %.3f -> %.3f, overdraw %.3f -> %.3f\n",
+			optimized_count, cached_count, get_time_ms() - start_ms,
+			total_before.acmr * scale, total_after.acmr * scale, total_before.overdraw * scale, total_after.overdraw * scale);
+	}
+}
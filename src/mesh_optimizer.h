@@ -0,0 +1,44 @@
+#pragma once
+
+#include "scene.h"
+
+// Bump whenever the optimizer changes so stale cache entries are not picked up
+static constexpr uint32_t MESH_OPTIMIZER_VERSION = 1;
+static constexpr const char* MESH_CACHE_DIRECTORY = "cache/meshes";
+
+// Size of the FIFO post-transform cache triangles are ordered for and statistics are measured with
+static constexpr uint32_t MESH_VERTEX_CACHE_SIZE = 16;
+
+// Neighbouring triangle clusters are merged until drawing one with a cold cache transforms at most this
+// many times the vertices it transforms in the cache optimized order, so sorting them costs little reuse.
+static constexpr float MESH_OVERDRAW_THRESHOLD = 1.05f;
+
+struct MeshStats
+{
+	float acmr;     // Vertices transformed per triangle, 3 is the worst case
+	float atvr;     // Vertices transformed per referenced vertex, 1 is optimal
+	float overdraw; // Fragments shaded per covered pixel with early depth testing, over 6 axis aligned views
+};
+
+// Optimizes meshes[first_mesh..] in place for the forward and shadow passes:
+//
+//   - triangles are reordered for post-transform cache reuse (tipsify, Sander et al. 2007)
+//   - the resulting clusters are sorted so the outermost, most likely occluding ones are drawn first
+//   - vertices are reordered by first use and the indices remapped, so vertex pulling reads memory linearly
+//
+// Meshes sharing a vertex range are optimized together. Index ranges that partially overlap another one
+// are left alone, and vertices are only reordered for vertex ranges no other mesh overlaps. Results are
+// cached under MESH_CACHE_DIRECTORY keyed by a hash of the vertex and index data, later imports of the same
+// meshes only read the cached file. ACMR, ATVR and overdraw before and after are printed per mesh.
+void optimize_meshes(
+	std::vector<Mesh>& meshes,
+	size_t first_mesh,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	ThreadPool* thread_pool = nullptr);
+
+// Reorders the triangles of a single index list like optimize_meshes does, indices are relative to vertices
+void optimize_triangle_order(uint32_t* indices, size_t index_count, const Vertex* vertices, uint32_t vertex_count);
+
+// Statistics of a single index list, indices are relative to vertices
+MeshStats analyze_mesh(const uint32_t* indices, size_t index_count, const Vertex* vertices, uint32_t vertex_count);
@@ -0,0 +1,550 @@
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <filesystem>
+#include <map>
+#include <numeric>
+#include <tuple>
+#include <unordered_map>
+
+static constexpr uint32_t MESH_LOD_CACHE_MAGIC = 0x4c4d5852; // "RXML"
+
+// Weight of the planes through open border edges relative to the triangle planes, keeps borders in place
+static constexpr float BORDER_WEIGHT = 10.0f;
+
+// A collapse may turn the normal of a remaining triangle by at most acos(0.25)
+static constexpr float MAX_NORMAL_CHANGE = 0.25f;
+
+// Cache entry of one mesh: its levels with first_index relative to the indices that follow
+struct LodCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t lod_count;
+	uint32_t index_count;
+};
+
+// Sum of weighted squared plane distances: p^T A p + 2 b^T p + c, normalized by the total weight
+struct Quadric
+{
+	float a00, a11, a22, a10, a20, a21;
+	float b0, b1, b2;
+	float c;
+	float weight;
+};
+
+static void add_plane(Quadric& q, glm::vec3 n, float d, float weight)
+{
+	q.a00 += weight * n.x * n.x;
+	q.a11 += weight * n.y * n.y;
+	q.a22 += weight * n.z * n.z;
+	q.a10 += weight * n.y * n.x;
+	q.a20 += weight * n.z * n.x;
+	q.a21 += weight * n.z * n.y;
+	q.b0 += weight * d * n.x;
+	q.b1 += weight * d * n.y;
+	q.b2 += weight * d * n.z;
+	q.c += weight * d * d;
+	q.weight += weight;
+}
+
+static void add_quadric(Quadric& q, const Quadric& other)
+{
+	q.a00 += other.a00;
+	q.a11 += other.a11;
+	q.a22 += other.a22;
+	q.a10 += other.a10;
+	q.a20 += other.a20;
+	q.a21 += other.a21;
+	q.b0 += other.b0;
+	q.b1 += other.b1;
+	q.b2 += other.b2;
+	q.c += other.c;
+	q.weight += other.weight;
+}
+
+// Mean squared distance of p to the planes
+static float quadric_error(const Quadric& q, glm::vec3 p)
+{
+	float rx = q.a00 * p.x + q.a10 * p.y + q.a20 * p.z + 2.0f * q.b0;
+	float ry = q.a10 * p.x + q.a11 * p.y + q.a21 * p.z + 2.0f * q.b1;
+	float rz = q.a20 * p.x + q.a21 * p.y + q.a22 * p.z + 2.0f * q.b2;
+	float error = rx * p.x + ry * p.y + rz * p.z + q.c;
+	return q.weight > 0.0f ? std::abs(error) / q.weight : 0.0f;
+}
+
+enum VertexKind : uint8_t
+{
+	VERTEX_MANIFOLD = 0, // Collapses onto any neighbour
+	VERTEX_BORDER,       // On an open border, collapses along it
+	VERTEX_LOCKED,       // On a seam, a non-manifold edge or where borders meet
+};
+
+struct Collapse
+{
+	uint32_t vertex;
+	uint32_t target;
+	float error;
+};
+
+static uint64_t edge_key(uint32_t a, uint32_t b)
+{
+	return ((uint64_t)a << 32) | b;
+}
+
+// Simplifies the index list towards target_index_count without exceeding max_error. Returns the largest
+// error of a performed collapse, in the units of the positions.
+static float simplify_mesh(std::vector<uint32_t>& result, const uint32_t* indices, size_t index_count, const Vertex* vertices, uint32_t vertex_count,
+	size_t target_index_count, float max_error, float radius)
+{
+	result.assign(indices, indices + index_count);
+
+	// Vertices at the same position are welded for the topology and the quadrics, they are wedges of one
+	// vertex with different attributes
+	std::vector<uint32_t> welded(vertex_count);
+	{
+		std::vector<uint32_t> order(vertex_count);
+		std::iota(order.begin(), order.end(), 0u);
+		auto position_tuple = [&](uint32_t v) { return std::tie(vertices[v].position.x, vertices[v].position.y, vertices[v].position.z); };
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return position_tuple(a) < position_tuple(b); });
+		for (uint32_t i = 0; i < vertex_count; ++i)
+			welded[order[i]] = i > 0 && position_tuple(order[i]) == position_tuple(order[i - 1]) ? welded[order[i - 1]] : order[i];
+	}
+
+	std::vector<uint8_t> has_wedge(vertex_count, 0);
+	for (uint32_t v = 0; v < vertex_count; ++v)
+		if (welded[v] != v)
+			has_wedge[v] = has_wedge[welded[v]] = 1;
+
+	// Quadrics live on the welded vertices
+	std::vector<Quadric> quadrics(vertex_count, Quadric{});
+	for (size_t i = 0; i + 2 < result.size(); i += 3)
+	{
+		glm::vec3 p0 = vertices[result[i + 0]].position;
+		glm::vec3 p1 = vertices[result[i + 1]].position;
+		glm::vec3 p2 = vertices[result[i + 2]].position;
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length == 0.0f)
+			continue;
+
+		normal /= length;
+		for (uint32_t j = 0; j < 3; ++j)
+			add_plane(quadrics[welded[result[i + j]]], normal, -glm::dot(normal, p0), length * 0.5f);
+	}
+
+	float normal_weight = MESH_LOD_NORMAL_WEIGHT * radius;
+	float uv_weight = MESH_LOD_UV_WEIGHT * radius;
+
+	std::unordered_map<uint64_t, uint32_t> edges;
+	std::vector<uint8_t> kinds(vertex_count);
+	std::vector<uint8_t> border_edges(vertex_count);
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<uint32_t> collapse_targets(vertex_count);
+	std::vector<uint8_t> is_touched(vertex_count);
+	std::vector<Collapse> collapses;
+	float result_error = 0.0f;
+	for (bool first_pass = true; result.size() > target_index_count; first_pass = false)
+	{
+		size_t triangle_count = result.size() / 3;
+
+		// Directed edges between welded vertices, an edge without its opposite is on an open border
+		edges.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+			for (uint32_t j = 0; j < 3; ++j)
+				edges[edge_key(welded[result[i + j]], welded[result[i + (j + 1) % 3]])]++;
+
+		auto edge_count = [&](uint32_t a, uint32_t b) {
+			auto it = edges.find(edge_key(a, b));
+			return it == edges.end() ? 0u : it->second;
+		};
+		auto is_border_edge = [&](uint32_t a, uint32_t b) {
+			return (edge_count(a, b) == 1 && edge_count(b, a) == 0) || (edge_count(b, a) == 1 && edge_count(a, b) == 0);
+		};
+
+		std::fill(kinds.begin(), kinds.end(), (uint8_t)VERTEX_MANIFOLD);
+		std::fill(border_edges.begin(), border_edges.end(), (uint8_t)0);
+		for (const auto& [key, count] : edges)
+		{
+			uint32_t a = (uint32_t)(key >> 32);
+			uint32_t b = (uint32_t)key;
+			uint32_t opposite_count = edge_count(b, a);
+			if (count > 1 || opposite_count > 1)
+				kinds[a] = kinds[b] = VERTEX_LOCKED;
+			else if (opposite_count == 0)
+			{
+				border_edges[a] = (uint8_t)std::min(border_edges[a] + 1, 255);
+				border_edges[b] = (uint8_t)std::min(border_edges[b] + 1, 255);
+			}
+		}
+
+		for (uint32_t v = 0; v < vertex_count; ++v)
+		{
+			if (welded[v] != v)
+				continue;
+			if (kinds[v] != VERTEX_LOCKED && border_edges[v] > 0)
+				kinds[v] = border_edges[v] == 2 ? VERTEX_BORDER : VERTEX_LOCKED;
+		}
+		for (uint32_t v = 0; v < vertex_count; ++v)
+			kinds[v] = has_wedge[v] ? VERTEX_LOCKED : kinds[welded[v]];
+
+		// Planes perpendicular to the border edges, their quadrics carry over to later passes
+		if (first_pass)
+		{
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				for (uint32_t j = 0; j < 3; ++j)
+				{
+					uint32_t a = welded[result[i + j]];
+					uint32_t b = welded[result[i + (j + 1) % 3]];
+					if (edge_count(b, a) != 0)
+						continue;
+
+					glm::vec3 p0 = vertices[result[i + 0]].position;
+					glm::vec3 normal = glm::cross(vertices[result[i + 1]].position - p0, vertices[result[i + 2]].position - p0);
+					glm::vec3 edge = vertices[b].position - vertices[a].position;
+					glm::vec3 plane_normal = glm::cross(edge, normal);
+					float length = glm::length(plane_normal);
+					if (length == 0.0f)
+						continue;
+
+					plane_normal /= length;
+					float weight = glm::dot(edge, edge) * BORDER_WEIGHT;
+					add_plane(quadrics[a], plane_normal, -glm::dot(plane_normal, vertices[a].position), weight);
+					add_plane(quadrics[b], plane_normal, -glm::dot(plane_normal, vertices[a].position), weight);
+				}
+			}
+		}
+
+		// Triangles around every vertex
+		std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0u);
+		for (uint32_t index : result)
+			adjacency_offsets[index + 1]++;
+		for (uint32_t v = 0; v < vertex_count; ++v)
+			adjacency_offsets[v + 1] += adjacency_offsets[v];
+		adjacency.resize(result.size());
+		{
+			std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+			for (size_t i = 0; i < result.size(); ++i)
+				adjacency[fill[result[i]]++] = (uint32_t)(i / 3);
+		}
+
+		// Cheapest collapse of every vertex that may move
+		collapses.clear();
+		for (uint32_t v = 0; v < vertex_count; ++v)
+		{
+			if (kinds[v] == VERTEX_LOCKED || adjacency_offsets[v] == adjacency_offsets[v + 1])
+				continue;
+
+			Collapse best{ v, UINT32_MAX, FLT_MAX };
+			for (uint32_t a = adjacency_offsets[v]; a < adjacency_offsets[v + 1]; ++a)
+			{
+				const uint32_t* triangle = result.data() + adjacency[a] * 3;
+				for (uint32_t j = 0; j < 3; ++j)
+				{
+					uint32_t t = triangle[j];
+					if (welded[t] == welded[v] || (kinds[v] == VERTEX_BORDER && !is_border_edge(welded[v], welded[t])))
+						continue;
+
+					glm::vec3 normal_change = vertices[v].normal - vertices[t].normal;
+					glm::vec2 uv_change = vertices[v].uv - vertices[t].uv;
+					float error = quadric_error(quadrics[welded[v]], vertices[t].position)
+						+ normal_weight * normal_weight * glm::dot(normal_change, normal_change)
+						+ uv_weight * uv_weight * glm::dot(uv_change, uv_change);
+					if (error < best.error)
+						best = Collapse{ v, t, error };
+				}
+			}
+
+			if (best.target != UINT32_MAX)
+			{
+				best.error = sqrtf(best.error);
+				collapses.push_back(best);
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+		// Collapses in order of their error. The neighbourhood of a collapsed vertex is left alone for the
+		// rest of the pass, so every flip check sees the final positions.
+		std::iota(collapse_targets.begin(), collapse_targets.end(), 0u);
+		std::fill(is_touched.begin(), is_touched.end(), (uint8_t)0);
+		size_t removed_triangles = 0;
+		size_t removal_goal = triangle_count - target_index_count / 3;
+		bool has_collapsed = false;
+		for (const Collapse& collapse : collapses)
+		{
+			if (removed_triangles >= removal_goal || collapse.error > max_error)
+				break;
+
+			uint32_t v = collapse.vertex;
+			uint32_t t = collapse.target;
+			if (is_touched[welded[v]] || is_touched[welded[t]])
+				continue;
+
+			glm::vec3 target_position = vertices[t].position;
+			bool flips = false;
+			size_t collapsed_triangles = 0;
+			for (uint32_t a = adjacency_offsets[v]; a < adjacency_offsets[v + 1] && !flips; ++a)
+			{
+				const uint32_t* triangle = result.data() + adjacency[a] * 3;
+				if (welded[triangle[0]] == welded[t] || welded[triangle[1]] == welded[t] || welded[triangle[2]] == welded[t])
+				{
+					collapsed_triangles++;
+					continue;
+				}
+
+				glm::vec3 p[3];
+				glm::vec3 q[3];
+				for (uint32_t j = 0; j < 3; ++j)
+				{
+					p[j] = vertices[triangle[j]].position;
+					q[j] = triangle[j] == v ? target_position : p[j];
+				}
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flips = glm::dot(before, after) < MAX_NORMAL_CHANGE * glm::length(before) * glm::length(after);
+			}
+
+			if (flips)
+				continue;
+
+			collapse_targets[v] = t;
+			add_quadric(quadrics[welded[t]], quadrics[welded[v]]);
+			for (uint32_t a = adjacency_offsets[v]; a < adjacency_offsets[v + 1]; ++a)
+				for (uint32_t j = 0; j < 3; ++j)
+					is_touched[welded[result[adjacency[a] * 3 + j]]] = 1;
+
+			removed_triangles += collapsed_triangles;
+			result_error = std::max(result_error, collapse.error);
+			has_collapsed = true;
+		}
+
+		if (!has_collapsed)
+			break;
+
+		// Triangles with two wedges of one vertex are gone as well
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			uint32_t a = collapse_targets[result[i + 0]];
+			uint32_t b = collapse_targets[result[i + 1]];
+			uint32_t c = collapse_targets[result[i + 2]];
+			if (welded[a] == welded[b] || welded[b] == welded[c] || welded[a] == welded[c])
+				continue;
+
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	return result_error;
+}
+
+// Levels of a mesh, first_index relative to indices until they are appended to the scene indices
+struct LodChain
+{
+	uint32_t mesh;
+	std::vector<MeshLod> lods;
+	std::vector<uint32_t> indices;
+	uint32_t first_index;
+	bool is_cached;
+};
+
+static bool read_cached_lods(const char* path, LodChain& chain, uint32_t vertex_count)
+{
+	std::vector<uint8_t> cached;
+	std::error_code error;
+	if (!std::filesystem::exists(path, error) || !read_binary_file(path, cached))
+		return false;
+
+	LodCacheHeader header;
+	if (cached.size() < sizeof(header))
+		return false;
+	memcpy(&header, cached.data(), sizeof(header));
+	if (header.magic != MESH_LOD_CACHE_MAGIC || header.version != MESH_SIMPLIFIER_VERSION || header.lod_count >= MESH_MAX_LODS
+		|| cached.size() != sizeof(header) + header.lod_count * sizeof(MeshLod) + (size_t)header.index_count * sizeof(uint32_t))
+	{
+		printf("Ignoring invalid mesh LOD cache entry %s\n", path);
+		return false;
+	}
+
+	std::vector<MeshLod> lods(header.lod_count);
+	std::vector<uint32_t> indices(header.index_count);
+	memcpy(lods.data(), cached.data() + sizeof(header), lods.size() * sizeof(MeshLod));
+	memcpy(indices.data(), cached.data() + sizeof(header) + lods.size() * sizeof(MeshLod), indices.size() * sizeof(uint32_t));
+
+	bool is_valid = std::all_of(indices.begin(), indices.end(), [&](uint32_t index) { return index < vertex_count; });
+	for (const MeshLod& lod : lods)
+		is_valid = is_valid && lod.index_count % 3 == 0 && (uint64_t)lod.first_index + lod.index_count <= indices.size();
+	if (!is_valid)
+	{
+		printf("Ignoring invalid mesh LOD cache entry %s\n", path);
+		return false;
+	}
+
+	chain.lods.swap(lods);
+	chain.indices.swap(indices);
+	return true;
+}
+
+static void write_cached_lods(const char* path, const LodChain& chain)
+{
+	// Write to a unique temporary name first, another process may import the same meshes at once
+	char temp_path[600];
+	snprintf(temp_path, sizeof(temp_path), "%s.%p.tmp", path, (const void*)&chain);
+
+	std::error_code error;
+	std::filesystem::create_directories(MESH_LOD_CACHE_DIRECTORY, error);
+	FILE* f = fopen(temp_path, "wb");
+	if (!f)
+		return;
+
+	LodCacheHeader header{
+		.magic = MESH_LOD_CACHE_MAGIC,
+		.version = MESH_SIMPLIFIER_VERSION,
+		.lod_count = (uint32_t)chain.lods.size(),
+		.index_count = (uint32_t)chain.indices.size(),
+	};
+
+	bool success = fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(chain.lods.data(), sizeof(MeshLod), chain.lods.size(), f) == chain.lods.size()
+		&& fwrite(chain.indices.data(), sizeof(uint32_t), chain.indices.size(), f) == chain.indices.size();
+	fclose(f);
+
+	if (success)
+		std::filesystem::rename(temp_path, path, error);
+	else
+		std::filesystem::remove(temp_path, error);
+}
+
+static void build_lod_chain(LodChain& chain, const Mesh& mesh, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	const Vertex* mesh_vertices = vertices.data() + mesh.first_vertex;
+	const uint32_t* mesh_indices = indices.data() + mesh.first_index;
+
+	uint64_t hash = hash_bytes(mesh_vertices, mesh.vertex_count * sizeof(Vertex), MESH_SIMPLIFIER_VERSION);
+	hash = hash_bytes(mesh_indices, mesh.index_count * sizeof(uint32_t), hash);
+
+	char cache_path[512];
+	snprintf(cache_path, sizeof(cache_path), "%s/%016llx_v%u.bin", MESH_LOD_CACHE_DIRECTORY, (unsigned long long)hash, MESH_SIMPLIFIER_VERSION);
+
+	chain.is_cached = read_cached_lods(cache_path, chain, mesh.vertex_count);
+	if (chain.is_cached)
+		return;
+
+	glm::vec3 min_position(FLT_MAX);
+	glm::vec3 max_position(-FLT_MAX);
+	for (uint32_t i = 0; i < mesh.index_count; ++i)
+	{
+		min_position = glm::min(min_position, mesh_vertices[mesh_indices[i]].position);
+		max_position = glm::max(max_position, mesh_vertices[mesh_indices[i]].position);
+	}
+	float radius = glm::length(max_position - min_position) * 0.5f;
+
+	std::vector<uint32_t> current(mesh_indices, mesh_indices + mesh.index_count);
+	std::vector<uint32_t> simplified;
+	float error = 0.0f;
+	for (uint32_t level = 1; level < MESH_MAX_LODS; ++level)
+	{
+		size_t target_index_count = (size_t)(current.size() / 3 * MESH_LOD_REDUCTION) * 3;
+		float level_error = simplify_mesh(simplified, current.data(), current.size(), mesh_vertices, mesh.vertex_count,
+			target_index_count, MESH_LOD_MAX_ERROR * radius - error, radius);
+		if (simplified.empty() || simplified.size() > current.size() * MESH_LOD_MIN_REDUCTION)
+			break;
+
+		optimize_triangle_order(simplified.data(), simplified.size(), mesh_vertices, mesh.vertex_count);
+		error += level_error;
+		chain.lods.push_back(MeshLod{ (uint32_t)chain.indices.size(), (uint32_t)simplified.size(), error });
+		chain.indices.insert(chain.indices.end(), simplified.begin(), simplified.end());
+		current.swap(simplified);
+	}
+
+	write_cached_lods(cache_path, chain);
+}
+
+void build_mesh_lods(
+	std::vector<Mesh>& meshes,
+	size_t first_mesh,
+	const std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	ThreadPool* thread_pool)
+{
+	double start_ms = get_time_ms();
+
+	// Meshes drawing the same triangles with the same vertices share a chain
+	std::vector<LodChain> chains;
+	std::vector<uint32_t> mesh_chains(meshes.size() - first_mesh, UINT32_MAX);
+	std::map<std::tuple<uint32_t, uint32_t, uint32_t>, uint32_t> chain_ids;
+	for (size_t i = first_mesh; i < meshes.size(); ++i)
+	{
+		Mesh& mesh = meshes[i];
+		mesh.lod_count = 0;
+
+		const uint32_t* mesh_indices = indices.data() + mesh.first_index;
+		if (mesh.index_count == 0 || mesh.index_count % 3 != 0 || (uint64_t)mesh.first_vertex + mesh.vertex_count > vertices.size()
+			|| !std::all_of(mesh_indices, mesh_indices + mesh.index_count, [&](uint32_t index) { return index < mesh.vertex_count; }))
+			continue;
+
+		auto [chain, is_new] = chain_ids.try_emplace({ mesh.first_vertex, mesh.first_index, mesh.index_count }, (uint32_t)chains.size());
+		if (is_new)
+			chains.push_back(LodChain{ .mesh = (uint32_t)i });
+		mesh_chains[i - first_mesh] = chain->second;
+	}
+
+	auto build = [&](uint32_t c) {
+		build_lod_chain(chains[c], meshes[chains[c].mesh], vertices, indices);
+	};
+
+	if (thread_pool)
+		parallel_for(*thread_pool, (uint32_t)chains.size(), build);
+	else
+		for (uint32_t c = 0; c < (uint32_t)chains.size(); ++c)
+			build(c);
+
+	size_t added_indices = 0;
+	uint32_t cached_count = 0;
+	for (LodChain& chain : chains)
+	{
+		chain.first_index = (uint32_t)indices.size();
+		indices.insert(indices.end(), chain.indices.begin(), chain.indices.end());
+		added_indices += chain.indices.size();
+		cached_count += chain.is_cached ? 1 : 0;
+	}
+
+	uint32_t lod_mesh_count = 0;
+	uint64_t full_triangles = 0;
+	uint64_t coarsest_triangles = 0;
+	for (size_t i = first_mesh; i < meshes.size(); ++i)
+	{
+		if (mesh_chains[i - first_mesh] == UINT32_MAX)
+			continue;
+
+		Mesh& mesh = meshes[i];
+		const LodChain& chain = chains[mesh_chains[i - first_mesh]];
+		mesh.lod_count = (uint32_t)chain.lods.size();
+		for (uint32_t l = 0; l < mesh.lod_count; ++l)
+		{
+			mesh.lods[l] = chain.lods[l];
+			mesh.lods[l].first_index += chain.first_index;
+		}
+
+		if (mesh.lod_count > 0)
+		{
+			lod_mesh_count++;
+			full_triangles += mesh.index_count / 3;
+			coarsest_triangles += mesh.lods[mesh.lod_count - 1].index_count / 3;
+		}
+	}
+
+	printf("Built LODs for %u of %zu meshes (%u chains from cache) in %.2f ms, %llu -> %llu triangles at the coarsest level, %.2f MB of extra indices\n",
+		lod_mesh_count, meshes.size() - first_mesh, cached_count, get_time_ms() - start_ms, (unsigned long long)full_triangles,
+		(unsigned long long)coarsest_triangles, added_indices * sizeof(uint32_t) / (1024.0 * 1024.0));
+}
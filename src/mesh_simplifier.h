@@ -0,0 +1,34 @@
+#pragma once
+
+#include "scene.h"
+
+// Bump whenever the simplifier changes so stale cache entries are not picked up
+static constexpr uint32_t MESH_SIMPLIFIER_VERSION = 1;
+static constexpr const char* MESH_LOD_CACHE_DIRECTORY = "cache/lods";
+
+// Every level targets this fraction of the triangles of the previous one, and is dropped along with the
+// coarser ones if it does not get below MESH_LOD_MIN_REDUCTION of them
+static constexpr float MESH_LOD_REDUCTION = 0.5f;
+static constexpr float MESH_LOD_MIN_REDUCTION = 0.85f;
+
+// Error budget of the coarsest level, relative to the bounding radius of the mesh
+static constexpr float MESH_LOD_MAX_ERROR = 0.1f;
+
+// Collapsing a vertex onto one with a different normal or uv costs as much as moving it by this many
+// times the bounding radius per unit of difference
+static constexpr float MESH_LOD_NORMAL_WEIGHT = 0.05f;
+static constexpr float MESH_LOD_UV_WEIGHT = 0.5f;
+
+// Builds up to MESH_MAX_LODS - 1 simplified levels for meshes[first_mesh..] with half edge collapses
+// ordered by quadric error (Garland and Heckbert 1997) plus the normal and uv change. Every level is
+// simplified from the previous one and its error is the sum of the errors so far. Vertices on uv and
+// normal seams and on non-manifold edges never move and vertices on open borders only slide along them,
+// so levels keep the vertices of the full mesh and only add index ranges, which are appended to indices
+// and optimized like the full mesh. Meshes drawing the same triangles share their levels. Results are
+// cached under MESH_LOD_CACHE_DIRECTORY keyed by a hash of the vertex and index data.
+void build_mesh_lods(
+	std::vector<Mesh>& meshes,
+	size_t first_mesh,
+	const std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	ThreadPool* thread_pool = nullptr);
@@ -0,0 +1,102 @@
+#include "meshlets.h"
+
+#include <algorithm>
+#include <cfloat>
+
+static Meshlet compute_meshlet_bounds(const Vertex* vertices, const uint32_t* indices, uint32_t first_index, uint32_t triangle_count)
+{
+	Meshlet meshlet{
+		.first_index = first_index,
+		.triangle_count = triangle_count,
+	};
+
+	const uint32_t* triangles = indices + first_index;
+	glm::vec3 min_position(FLT_MAX);
+	glm::vec3 max_position(-FLT_MAX);
+	for (uint32_t i = 0; i < triangle_count * 3; ++i)
+	{
+		min_position = glm::min(min_position, vertices[triangles[i]].position);
+		max_position = glm::max(max_position, vertices[triangles[i]].position);
+	}
+
+	meshlet.center = (min_position + max_position) * 0.5f;
+	meshlet.radius = 0.0f;
+	for (uint32_t i = 0; i < triangle_count * 3; ++i)
+		meshlet.radius = std::max(meshlet.radius, glm::length(vertices[triangles[i]].position - meshlet.center));
+
+	// Normal cone, "Optimizing the Graphics Pipeline with Compute" (Wihlidal 2016)
+	std::vector<glm::vec3> normals;
+	normals.reserve(triangle_count);
+	glm::vec3 axis(0.0f);
+	for (uint32_t i = 0; i < triangle_count; ++i)
+	{
+		glm::vec3 a = vertices[triangles[i * 3 + 0]].position;
+		glm::vec3 b = vertices[triangles[i * 3 + 1]].position;
+		glm::vec3 c = vertices[triangles[i * 3 + 2]].position;
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float length = glm::length(normal);
+		if (length == 0.0f)
+			continue;
+
+		normals.push_back(normal / length);
+		axis += normals.back();
+	}
+
+	float axis_length = glm::length(axis);
+	meshlet.cone_axis = axis_length > 0.0f ? axis / axis_length : glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.cone_cutoff = 1.0f;
+	if (normals.empty() || axis_length == 0.0f)
+		return meshlet;
+
+	float min_dot = 1.0f;
+	for (const glm::vec3& normal : normals)
+		min_dot = std::min(min_dot, glm::dot(normal, meshlet.cone_axis));
+
+	// Cones wider than ~84 degrees almost never cull
+	if (min_dot > 0.1f)
+		meshlet.cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+
+	return meshlet;
+}
+
+void build_meshlets(std::vector<Meshlet>& meshlets, const Mesh& mesh, uint32_t level, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	const Vertex* mesh_vertices = vertices.data() + mesh.first_vertex;
+	MeshLod lod = get_mesh_lod(mesh, level);
+
+	// Id of the last meshlet that referenced each vertex
+	std::vector<uint32_t> vertex_meshlet(mesh.vertex_count, UINT32_MAX);
+	uint32_t meshlet_id = 0;
+	uint32_t first_index = lod.first_index;
+	uint32_t vertex_count = 0;
+	uint32_t triangle_count = 0;
+	for (uint32_t i = 0; i + 2 < lod.index_count; i += 3)
+	{
+		const uint32_t* triangle = indices.data() + lod.first_index + i;
+		uint32_t new_vertices = 0;
+		for (uint32_t j = 0; j < 3; ++j)
+			new_vertices += vertex_meshlet[triangle[j]] != meshlet_id && (j == 0 || triangle[j] != triangle[0]) && (j < 2 || triangle[j] != triangle[1]);
+
+		if (vertex_count + new_vertices > MESHLET_MAX_VERTICES || triangle_count == MESHLET_MAX_TRIANGLES)
+		{
+			meshlets.push_back(compute_meshlet_bounds(mesh_vertices, indices.data(), first_index, triangle_count));
+			meshlet_id++;
+			first_index = lod.first_index + i;
+			vertex_count = 0;
+			triangle_count = 0;
+		}
+
+		for (uint32_t j = 0; j < 3; ++j)
+		{
+			if (vertex_meshlet[triangle[j]] != meshlet_id)
+			{
+				vertex_meshlet[triangle[j]] = meshlet_id;
+				vertex_count++;
+			}
+		}
+		triangle_count++;
+	}
+
+	if (triangle_count > 0)
+		meshlets.push_back(compute_meshlet_bounds(mesh_vertices, indices.data(), first_index, triangle_count));
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "scene.h"
+
+// Limits of a single meshlet, the sizes mesh shading hardware favours
+static constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+static constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// A run of consecutive triangles of a mesh with its bounds in object space
+struct Meshlet
+{
+	glm::vec3 center;
+	float radius;
+	glm::vec3 cone_axis;  // Average triangle normal
+	float cone_cutoff;    // The meshlet is back facing for view directions within acos(cone_cutoff) of the axis, 1 never culls
+	uint32_t first_index; // Into the scene index array
+	uint32_t triangle_count;
+};
+
+// Splits the triangles of a level of detail of a mesh into meshlets in index order, starting a new one
+// whenever the next triangle would exceed either limit. Meshes are optimized for the vertex cache at
+// import, so the runs are spatially coherent and the culled draws keep that order.
+void build_meshlets(std::vector<Meshlet>& meshlets, const Mesh& mesh, uint32_t level, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
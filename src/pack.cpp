@@ -0,0 +1,527 @@
+#include "load_telemetry.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "pack.h"
+#include "texture_cache.h"
+#include "texture_streaming.h"
+#include "thread_pool.h"
+#include "upload.h"
+
+#include <atomic>
+#include <filesystem>
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static bool write_padded(FILE* f, const void* data, size_t size, uint64_t offset, uint64_t& position)
+{
+	static const uint8_t zeros[PACK_ALIGNMENT] = {};
+	assert(offset >= position && offset - position <= sizeof(zeros));
+
+	if (offset > position && fwrite(zeros, 1, offset - position, f) != offset - position)
+		return false;
+	if (size > 0 && fwrite(data, 1, size, f) != size)
+		return false;
+
+	position = offset + size;
+	return true;
+}
+
+bool write_pack(const char* path, const PackContents& contents)
+{
+	std::vector<PackTexture> textures(contents.textures.size());
+	std::vector<VkBufferImageCopy> regions;
+
+	PackHeader header{
+		.magic = PACK_MAGIC,
+		.version = PACK_VERSION,
+		.mesh_size = sizeof(Mesh),
+		.mesh_draw_size = sizeof(MeshDraw),
+		.material_size = sizeof(Material),
+		.vertex_size = sizeof(Vertex),
+		.geometry_mesh_size = sizeof(GeometryMesh),
+		.meshlet_size = sizeof(GeometryMeshlet),
+		.geometry_version = GEOMETRY_VERSION,
+		.texture_count = (uint32_t)contents.textures.size(),
+		.mesh_count = (uint32_t)contents.meshes.size(),
+		.mesh_draw_count = (uint32_t)contents.mesh_draws.size(),
+		.material_count = (uint32_t)contents.materials.size(),
+		.vertex_count = contents.vertices.size(),
+		.index_count = contents.indices.size(),
+	};
+
+	const GeometryData& geometry_data = contents.geometry_data;
+	if (has_built_geometry(contents))
+	{
+		assert(geometry_data.vertices.size() == contents.vertices.size() && geometry_data.positions.size() == contents.vertices.size());
+		header.geometry_mesh_count = (uint32_t)contents.geometry.meshes.size();
+		header.meshlet_count = (uint32_t)geometry_data.meshlets.size();
+		header.index16_count = geometry_data.indices16.size();
+		header.index32_count = geometry_data.indices32.size();
+		header.index32_section_offset = contents.geometry.index_section_offsets[1];
+	}
+	uint64_t packed_vertex_count = header.geometry_mesh_count > 0 ? header.vertex_count : 0;
+
+	for (size_t i = 0; i < contents.textures.size(); ++i)
+	{
+		const TextureImage& image = contents.textures[i];
+		textures[i] = {
+			.width = image.width,
+			.height = image.height,
+			.depth = image.depth,
+			.mip_levels = image.mip_levels,
+			.array_layers = image.array_layers,
+			.format = image.format,
+			.is_cubemap = image.is_cubemap ? 1u : 0u,
+			.first_region = (uint32_t)regions.size(),
+			.region_count = (uint32_t)image.regions.size(),
+			.data_size = image.size,
+		};
+		regions.insert(regions.end(), image.regions.begin(), image.regions.end());
+	}
+	header.region_count = (uint32_t)regions.size();
+
+	// Tables are 16 byte aligned, texture payloads PACK_ALIGNMENT aligned so they can be copied to
+	// staging memory without touching partial cache lines
+	uint64_t offset = sizeof(PackHeader);
+	header.textures_offset = offset = align_up(offset, 16);
+	offset += textures.size() * sizeof(PackTexture);
+	header.regions_offset = offset = align_up(offset, 16);
+	offset += regions.size() * sizeof(VkBufferImageCopy);
+	header.meshes_offset = offset = align_up(offset, 16);
+	offset += contents.meshes.size() * sizeof(Mesh);
+	header.mesh_draws_offset = offset = align_up(offset, 16);
+	offset += contents.mesh_draws.size() * sizeof(MeshDraw);
+	header.materials_offset = offset = align_up(offset, 16);
+	offset += contents.materials.size() * sizeof(Material);
+	header.vertices_offset = offset = align_up(offset, 16);
+	offset += contents.vertices.size() * sizeof(Vertex);
+	header.indices_offset = offset = align_up(offset, 16);
+	offset += contents.indices.size() * sizeof(uint32_t);
+	header.geometry_meshes_offset = offset = align_up(offset, 16);
+	offset += header.geometry_mesh_count * sizeof(GeometryMesh);
+	header.packed_vertices_offset = offset = align_up(offset, 16);
+	offset += packed_vertex_count * sizeof(PackedVertex);
+	header.packed_positions_offset = offset = align_up(offset, 16);
+	offset += packed_vertex_count * sizeof(PackedPosition);
+	header.indices16_offset = offset = align_up(offset, 16);
+	offset += header.index16_count * sizeof(uint16_t);
+	header.indices32_offset = offset = align_up(offset, 16);
+	offset += header.index32_count * sizeof(uint32_t);
+	header.meshlets_offset = offset = align_up(offset, 16);
+	offset += header.meshlet_count * sizeof(GeometryMeshlet);
+
+	for (PackTexture& texture : textures)
+	{
+		texture.data_offset = offset = align_up(offset, PACK_ALIGNMENT);
+		offset += texture.data_size;
+	}
+
+	FILE* f = fopen(path, "wb");
+	if (!f)
+	{
+		printf("Failed to open file %s for writing\n", path);
+		return false;
+	}
+
+	uint64_t position = 0;
+	bool success = write_padded(f, &header, sizeof(header), 0, position)
+		&& write_padded(f, textures.data(), textures.size() * sizeof(PackTexture), header.textures_offset, position)
+		&& write_padded(f, regions.data(), regions.size() * sizeof(VkBufferImageCopy), header.regions_offset, position)
+		&& write_padded(f, contents.meshes.data(), contents.meshes.size() * sizeof(Mesh), header.meshes_offset, position)
+		&& write_padded(f, contents.mesh_draws.data(), contents.mesh_draws.size() * sizeof(MeshDraw), header.mesh_draws_offset, position)
+		&& write_padded(f, contents.materials.data(), contents.materials.size() * sizeof(Material), header.materials_offset, position)
+		&& write_padded(f, contents.vertices.data(), contents.vertices.size() * sizeof(Vertex), header.vertices_offset, position)
+		&& write_padded(f, contents.indices.data(), contents.indices.size() * sizeof(uint32_t), header.indices_offset, position)
+		&& write_padded(f, contents.geometry.meshes.data(), header.geometry_mesh_count * sizeof(GeometryMesh), header.geometry_meshes_offset, position)
+		&& write_padded(f, geometry_data.vertices.data(), packed_vertex_count * sizeof(PackedVertex), header.packed_vertices_offset, position)
+		&& write_padded(f, geometry_data.positions.data(), packed_vertex_count * sizeof(PackedPosition), header.packed_positions_offset, position)
+		&& write_padded(f, geometry_data.indices16.data(), header.index16_count * sizeof(uint16_t), header.indices16_offset, position)
+		&& write_padded(f, geometry_data.indices32.data(), header.index32_count * sizeof(uint32_t), header.indices32_offset, position)
+		&& write_padded(f, geometry_data.meshlets.data(), header.meshlet_count * sizeof(GeometryMeshlet), header.meshlets_offset, position);
+
+	for (size_t i = 0; success && i < textures.size(); ++i)
+		success = write_padded(f, contents.textures[i].data, contents.textures[i].size, textures[i].data_offset, position);
+
+	fclose(f);
+
+	if (!success)
+		printf("Failed to write file %s\n", path);
+
+	return success;
+}
+
+bool cook_gltf(const char* path, PackContents& contents, ThreadPool& thread_pool, bool compress_textures)
+{
+	std::vector<SceneImage> images;
+	cgltf_data* data = import_gltf(path, contents.meshes, contents.materials, contents.vertices, contents.indices, contents.mesh_draws, images, &thread_pool);
+	if (!data)
+		return false;
+
+	// Texture entries with the same image are cooked once
+	TextureCache cache{};
+	std::vector<uint32_t> texture_indices;
+	std::vector<uint32_t> unique_images;
+	deduplicate_scene_images(cache, images, 0, compress_textures, texture_indices, unique_images, &thread_pool);
+	remap_material_textures(contents.materials, 0, texture_indices);
+
+	// Mips and block compression are done here instead of at load time, every image is processed in parallel
+	std::atomic<bool> success = true;
+	contents.textures.resize(unique_images.size());
+	parallel_for(thread_pool, (uint32_t)unique_images.size(), [&](uint32_t i) {
+		const SceneImage& image = images[unique_images[i]];
+		bool decoded = false;
+		if (compress_textures)
+		{
+			decoded = import_compressed_texture(contents.textures[i], image.data, image.size, image.usage, image.is_srgb);
+		}
+		else
+		{
+			DecodedImage decoded_image;
+			decoded = decode_png_or_jpg(decoded_image, image.data, image.size);
+			if (decoded)
+			{
+				build_mip_chain(contents.textures[i], decoded_image, image.is_srgb);
+				free_decoded_image(decoded_image);
+			}
+		}
+
+		if (!decoded)
+		{
+			printf("Failed to decode texture %u\n", unique_images[i]);
+			success = false;
+		}
+	});
+	if (cache.deduplicated_count > 0)
+		printf("Shared %u of %zu textures (%.2f MB of images)\n", cache.deduplicated_count, images.size(), cache.deduplicated_bytes / (1024.0 * 1024.0));
+
+	free_gltf(data);
+
+	// Stored with the pack, so cache hits upload it without building it again
+	build_geometry(contents.geometry, contents.geometry_data, contents.meshes, contents.vertices, contents.indices);
+
+	return success;
+}
+
+template<typename T>
+static bool read_table(const MappedFile& file, uint64_t offset, uint64_t count, std::vector<T>& table)
+{
+	if (offset > file.size || count > (file.size - offset) / sizeof(T))
+		return false;
+
+	const T* begin = (const T*)(file.data + offset);
+	table.assign(begin, begin + count);
+	return true;
+}
+
+// Maps a pack and reads its tables, texture payloads stay in the mapping. Geometry is left empty if the pack
+// holds none of the current GEOMETRY_VERSION. The file is unmapped on failure.
+static bool open_pack(
+	MappedFile& file,
+	const char* path,
+	std::vector<PackTexture>& pack_textures,
+	std::vector<VkBufferImageCopy>& regions,
+	std::vector<Mesh>& meshes,
+	std::vector<Material>& materials,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<MeshDraw>& mesh_draws,
+	Geometry& geometry,
+	GeometryData& geometry_data)
+{
+	if (!map_file(file, path))
+		return false;
+	load_telemetry_add_bytes_read(file.size);
+
+	const PackHeader* header = (const PackHeader*)file.data;
+	if (file.size < sizeof(PackHeader) || header->magic != PACK_MAGIC)
+	{
+		printf("Invalid pack file '%s': bad magic!\n", path);
+		unmap_file(file);
+		return false;
+	}
+
+	if (header->version != PACK_VERSION || header->mesh_size != sizeof(Mesh) || header->mesh_draw_size != sizeof(MeshDraw)
+		|| header->material_size != sizeof(Material) || header->vertex_size != sizeof(Vertex))
+	{
+		printf("Pack file '%s' was cooked with an incompatible version, cook it again\n", path);
+		unmap_file(file);
+		return false;
+	}
+
+	bool success = read_table(file, header->textures_offset, header->texture_count, pack_textures)
+		&& read_table(file, header->regions_offset, header->region_count, regions)
+		&& read_table(file, header->meshes_offset, header->mesh_count, meshes)
+		&& read_table(file, header->mesh_draws_offset, header->mesh_draw_count, mesh_draws)
+		&& read_table(file, header->materials_offset, header->material_count, materials)
+		&& read_table(file, header->vertices_offset, header->vertex_count, vertices)
+		&& read_table(file, header->indices_offset, header->index_count, indices);
+
+	geometry.meshes.clear();
+	geometry_data = {};
+	if (header->geometry_mesh_count > 0 && header->geometry_version == GEOMETRY_VERSION
+		&& header->geometry_mesh_size == sizeof(GeometryMesh) && header->meshlet_size == sizeof(GeometryMeshlet))
+	{
+		success = success
+			&& header->geometry_mesh_count == header->mesh_count
+			&& read_table(file, header->geometry_meshes_offset, header->geometry_mesh_count, geometry.meshes)
+			&& read_table(file, header->packed_vertices_offset, header->vertex_count, geometry_data.vertices)
+			&& read_table(file, header->packed_positions_offset, header->vertex_count, geometry_data.positions)
+			&& read_table(file, header->indices16_offset, header->index16_count, geometry_data.indices16)
+			&& read_table(file, header->indices32_offset, header->index32_count, geometry_data.indices32)
+			&& read_table(file, header->meshlets_offset, header->meshlet_count, geometry_data.meshlets);
+		geometry.index_section_offsets[0] = 0;
+		geometry.index_section_offsets[1] = header->index32_section_offset;
+		geometry.meshlet_count = header->meshlet_count;
+	}
+
+	for (const PackTexture& pack_texture : pack_textures)
+	{
+		success = success
+			&& pack_texture.data_offset <= file.size && pack_texture.data_size <= file.size - pack_texture.data_offset
+			&& pack_texture.first_region <= regions.size() && pack_texture.region_count <= regions.size() - pack_texture.first_region;
+	}
+
+	if (!success)
+	{
+		printf("Pack file '%s' is truncated or corrupt\n", path);
+		geometry.meshes.clear();
+		unmap_file(file);
+		return false;
+	}
+
+	return true;
+}
+
+static TextureImage get_pack_image(const MappedFile& file, const PackTexture& pack_texture, const std::vector<VkBufferImageCopy>& regions)
+{
+	return TextureImage{
+		.width = pack_texture.width,
+		.height = pack_texture.height,
+		.depth = pack_texture.depth,
+		.mip_levels = pack_texture.mip_levels,
+		.array_layers = pack_texture.array_layers,
+		.format = pack_texture.format,
+		.is_cubemap = pack_texture.is_cubemap != 0,
+		.regions = std::vector<VkBufferImageCopy>(regions.begin() + pack_texture.first_region, regions.begin() + pack_texture.first_region + pack_texture.region_count),
+		.data = file.data + pack_texture.data_offset,
+		.size = pack_texture.data_size,
+	};
+}
+
+bool read_pack(const char* path, PackContents& contents)
+{
+	LoadScope scope(LOAD_STAGE_PACK, path);
+	MappedFile file;
+	std::vector<PackTexture> pack_textures;
+	std::vector<VkBufferImageCopy> regions;
+	if (!open_pack(file, path, pack_textures, regions, contents.meshes, contents.materials, contents.vertices, contents.indices, contents.mesh_draws,
+		contents.geometry, contents.geometry_data))
+		return false;
+
+	contents.textures.resize(pack_textures.size());
+	for (size_t i = 0; i < pack_textures.size(); ++i)
+	{
+		TextureImage& image = contents.textures[i];
+		image = get_pack_image(file, pack_textures[i], regions);
+		image.storage.assign(image.data, image.data + image.size);
+		image.data = image.storage.data();
+	}
+
+	unmap_file(file);
+	return true;
+}
+
+bool load_pack(
+	const char* path,
+	std::vector<Mesh>& meshes,
+	std::vector<Material>& materials,
+	std::vector<Texture>& textures,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<MeshDraw>& mesh_draws,
+	Geometry& geometry,
+	VkDevice device,
+	VmaAllocator allocator,
+	UploadBatcher& uploader,
+	TextureStreamer* streamer,
+	TextureCache* texture_cache)
+{
+	LoadScope scope(LOAD_STAGE_PACK, path);
+	MappedFile file;
+	std::vector<PackTexture> pack_textures;
+	std::vector<VkBufferImageCopy> regions;
+	GeometryData geometry_data;
+	if (!open_pack(file, path, pack_textures, regions, meshes, materials, vertices, indices, mesh_draws, geometry, geometry_data))
+		return false;
+
+	if (!geometry.meshes.empty())
+		upload_geometry(geometry, geometry_data, allocator, uploader);
+
+	// Packs hold every image once, only textures of previously loaded scenes can be shared
+	size_t first_texture = textures.size();
+	std::vector<uint32_t> texture_indices(pack_textures.size());
+	std::vector<uint32_t> unique_textures;
+	for (uint32_t i = 0; i < (uint32_t)pack_textures.size(); ++i)
+	{
+		const PackTexture& pack_texture = pack_textures[i];
+		uint64_t key = 0;
+		if (texture_cache)
+		{
+			key = get_texture_cache_key(file.data + pack_texture.data_offset, pack_texture.data_size, false, pack_texture.format);
+			int cached = texture_cache_acquire(*texture_cache, key);
+			if (cached >= 0)
+			{
+				texture_indices[i] = (uint32_t)cached;
+				continue;
+			}
+		}
+
+		texture_indices[i] = (uint32_t)(first_texture + unique_textures.size());
+		if (texture_cache)
+			texture_cache_insert(*texture_cache, key, texture_indices[i], pack_texture.data_size);
+		unique_textures.push_back(i);
+	}
+	remap_material_textures(materials, 0, texture_indices);
+
+	textures.resize(first_texture + unique_textures.size());
+	for (size_t i = 0; i < unique_textures.size(); ++i)
+	{
+		TextureImage image = get_pack_image(file, pack_textures[unique_textures[i]], regions);
+
+		if (streamer)
+			stream_texture_image(*streamer, textures[first_texture + i], (uint32_t)(first_texture + i), std::move(image), uploader);
+		else
+			load_texture_image(textures[first_texture + i], image, device, allocator, uploader);
+	}
+
+	// Every payload has been copied to staging memory, the mapping is not needed anymore
+	upload_batcher_flush(uploader);
+	unmap_file(file);
+
+	return true;
+}
+
+// Every stage that shapes the cooked scene is part of the key
+static bool get_scene_cache_path(const char* path, bool compress_textures, char* cache_path, size_t cache_path_size)
+{
+	uint64_t hash = 0;
+	if (!hash_gltf_files(path, hash))
+	{
+		printf("Failed to load file '%s'\n", path);
+		return false;
+	}
+
+	uint32_t versions[] = { PACK_VERSION, SCENE_CACHE_VERSION, MESH_OPTIMIZER_VERSION, MESH_SIMPLIFIER_VERSION,
+		TEXTURE_COMPRESSION_VERSION, GEOMETRY_VERSION, compress_textures ? 1u : 0u };
+	hash = hash_bytes(versions, sizeof(versions), hash);
+
+	snprintf(cache_path, cache_path_size, "%s/%016llx_v%u.rxpak", SCENE_CACHE_DIRECTORY, (unsigned long long)hash, PACK_VERSION);
+	return true;
+}
+
+bool write_cached_pack(const char* cache_path, const PackContents& contents)
+{
+	// Write to a unique temporary name first, another process may cook the same scene at once
+	char temp_path[600];
+	snprintf(temp_path, sizeof(temp_path), "%s.%p.tmp", cache_path, (const void*)&contents);
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(cache_path).parent_path(), error);
+	bool is_cached = write_pack(temp_path, contents);
+	if (is_cached)
+	{
+		std::filesystem::rename(temp_path, cache_path, error);
+		is_cached = !error;
+	}
+	if (!is_cached)
+		std::filesystem::remove(temp_path, error);
+
+	return is_cached;
+}
+
+bool load_cached_scene(
+	const char* path,
+	std::vector<Mesh>& meshes,
+	std::vector<Material>& materials,
+	std::vector<Texture>& textures,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<MeshDraw>& mesh_draws,
+	Geometry& geometry,
+	VkDevice device,
+	VmaAllocator allocator,
+	UploadBatcher& uploader,
+	ThreadPool& thread_pool,
+	bool compress_textures,
+	TextureStreamer* streamer,
+	TextureCache* texture_cache)
+{
+	LoadScope scope(LOAD_STAGE_SCENE, path);
+	double start_ms = get_time_ms();
+	char cache_path[512];
+	if (!get_scene_cache_path(path, compress_textures, cache_path, sizeof(cache_path)))
+		return false;
+
+	std::error_code error;
+	if (std::filesystem::exists(cache_path, error))
+	{
+		if (load_pack(cache_path, meshes, materials, textures, vertices, indices, mesh_draws, geometry, device, allocator, uploader, streamer, texture_cache))
+		{
+			printf("Loaded '%s' from the scene cache in %.2f ms\n", path, get_time_ms() - start_ms);
+			return true;
+		}
+		printf("Ignoring invalid scene cache entry %s\n", cache_path);
+	}
+
+	PackContents contents;
+	if (!cook_gltf(path, contents, thread_pool, compress_textures))
+		return false;
+
+	if (!write_cached_pack(cache_path, contents))
+	{
+		printf("Failed to write scene cache entry %s, importing '%s' without it\n", cache_path, path);
+		materials.clear();
+		return load_scene(path, meshes, materials, textures, vertices, indices, mesh_draws, device, allocator, uploader, thread_pool, compress_textures, streamer, texture_cache);
+	}
+
+	// The pack was just written, mapping it reads it back from the page cache
+	contents = {};
+	if (!load_pack(cache_path, meshes, materials, textures, vertices, indices, mesh_draws, geometry, device, allocator, uploader, streamer, texture_cache))
+		return false;
+
+	printf("Cooked '%s' into the scene cache in %.2f ms\n", path, get_time_ms() - start_ms);
+	return true;
+}
+
+bool import_cached_gltf(const char* path, PackContents& contents, ThreadPool& thread_pool, bool compress_textures)
+{
+	LoadScope scope(LOAD_STAGE_SCENE, path);
+	double start_ms = get_time_ms();
+	char cache_path[512];
+	if (!get_scene_cache_path(path, compress_textures, cache_path, sizeof(cache_path)))
+		return false;
+
+	std::error_code error;
+	if (std::filesystem::exists(cache_path, error))
+	{
+		if (read_pack(cache_path, contents))
+		{
+			printf("Read '%s' from the scene cache in %.2f ms\n", path, get_time_ms() - start_ms);
+			return true;
+		}
+		printf("Ignoring invalid scene cache entry %s\n", cache_path);
+		contents = {};
+	}
+
+	if (!cook_gltf(path, contents, thread_pool, compress_textures))
+		return false;
+
+	if (write_cached_pack(cache_path, contents))
+		printf("Cooked '%s' into the scene cache in %.2f ms\n", path, get_time_ms() - start_ms);
+	else
+		printf("Failed to write scene cache entry %s\n", cache_path);
+
+	return true;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "geometry.h"
+
+// Cooked scene pack (.rxpak). A single file holding everything load_scene produces in the layout the
+// runtime uses, plus the output of build_geometry, so loading is one mapping plus a copy per table and
+// per texture payload:
+//
+//   PackHeader
+//   PackTexture[texture_count]
+//   VkBufferImageCopy[region_count]   regions of all textures, offsets relative to the texture payload
+//   Mesh[mesh_count]
+//   MeshDraw[mesh_draw_count]
+//   Material[material_count]
+//   Vertex[vertex_count]
+//   uint32_t[index_count]
+//   GeometryMesh[geometry_mesh_count]  empty, or one per mesh
+//   PackedVertex[vertex_count]         only with geometry meshes, like the tables up to meshlets
+//   PackedPosition[vertex_count]
+//   uint16_t[index16_count]
+//   uint32_t[index32_count]
+//   GeometryMeshlet[meshlet_count]
+//   texture payloads, each aligned to PACK_ALIGNMENT
+//
+// Tables are stored as raw structs, the header records their sizes and PACK_VERSION has to be bumped
+// whenever one of them changes. Geometry of another GEOMETRY_VERSION is ignored and built again on load.
+static constexpr uint32_t PACK_MAGIC = 0x4b505852; // "RXPK"
+static constexpr uint32_t PACK_VERSION = 3;
+static constexpr uint64_t PACK_ALIGNMENT = 64;
+
+// Bump whenever import_gltf or cook_gltf change their output without any of the versions in the key changing
+static constexpr uint32_t SCENE_CACHE_VERSION = 3;
+static constexpr const char* SCENE_CACHE_DIRECTORY = "cache/scenes";
+
+struct PackHeader
+{
+	uint32_t magic;
+	uint32_t version;
+
+	uint32_t mesh_size;
+	uint32_t mesh_draw_size;
+	uint32_t material_size;
+	uint32_t vertex_size;
+	uint32_t geometry_mesh_size;
+	uint32_t meshlet_size;
+	uint32_t geometry_version;
+
+	uint32_t texture_count;
+	uint32_t region_count;
+	uint32_t mesh_count;
+	uint32_t mesh_draw_count;
+	uint32_t material_count;
+	uint32_t geometry_mesh_count;
+	uint32_t meshlet_count;
+	uint32_t padding;
+	uint64_t vertex_count;
+	uint64_t index_count;
+	uint64_t index16_count;
+	uint64_t index32_count;
+	uint64_t index32_section_offset; // Geometry::index_section_offsets[1]
+
+	uint64_t textures_offset;
+	uint64_t regions_offset;
+	uint64_t meshes_offset;
+	uint64_t mesh_draws_offset;
+	uint64_t materials_offset;
+	uint64_t vertices_offset;
+	uint64_t indices_offset;
+	uint64_t geometry_meshes_offset;
+	uint64_t packed_vertices_offset;
+	uint64_t packed_positions_offset;
+	uint64_t indices16_offset;
+	uint64_t indices32_offset;
+	uint64_t meshlets_offset;
+};
+
+struct PackTexture
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint32_t mip_levels;
+	uint32_t array_layers;
+	VkFormat format;
+	uint32_t is_cubemap;
+	uint32_t first_region;
+	uint32_t region_count;
+	uint32_t padding;
+	uint64_t data_offset;
+	uint64_t data_size;
+};
+
+// Scene contents to be written by the cooker
+struct PackContents
+{
+	std::vector<Mesh> meshes;
+	std::vector<Material> materials;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<MeshDraw> mesh_draws;
+	std::vector<TextureImage> textures;
+	Geometry geometry;          // Output of build_geometry without buffers, empty if it was not built
+	GeometryData geometry_data;
+};
+
+inline bool has_built_geometry(const PackContents& contents)
+{
+	return !contents.meshes.empty() && contents.geometry.meshes.size() == contents.meshes.size();
+}
+
+bool write_pack(const char* path, const PackContents& contents);
+// write_pack for cache entries: the pack is written under a temporary name and renamed into place, so
+// readers never see a partial pack. Creates the directory of the path.
+bool write_cached_pack(const char* cache_path, const PackContents& contents);
+
+// Imports a glTF scene with every texture's full mip chain, block compressed when compress_textures is set,
+// and builds its geometry. Texture entries with the same image are stored once.
+bool cook_gltf(const char* path, PackContents& contents, ThreadPool& thread_pool, bool compress_textures = true);
+
+// Reads a cooked pack into memory, every texture owning a copy of its payload. Touches no Vulkan state.
+bool read_pack(const char* path, PackContents& contents);
+
+// Loads a cooked pack with the same outputs as load_scene. Texture payloads are copied straight
+// from the mapped file into the upload staging buffer, or handed to the streamer when one is given.
+// With a texture cache, payloads a previous scene already loaded share its texture. Geometry the pack
+// holds is uploaded without building it again, otherwise geometry is left without buffers.
+bool load_pack(
+	const char* path,
+	std::vector<Mesh>& meshes,
+	std::vector<Material>& materials,
+	std::vector<Texture>& textures,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<MeshDraw>& mesh_draws,
+	Geometry& geometry,
+	VkDevice device,
+	VmaAllocator allocator,
+	UploadBatcher& uploader,
+	TextureStreamer* streamer = nullptr,
+	TextureCache* texture_cache = nullptr);
+
+// load_scene through a pack cached under SCENE_CACHE_DIRECTORY, keyed by a hash of the glTF files and the
+// version of every import stage. The first load cooks the scene and writes the pack, later ones only map
+// it and copy the tables and texture payloads out. Falls back to load_scene if the pack cannot be written.
+// Geometry is handled like load_pack handles it.
+bool load_cached_scene(
+	const char* path,
+	std::vector<Mesh>& meshes,
+	std::vector<Material>& materials,
+	std::vector<Texture>& textures,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<MeshDraw>& mesh_draws,
+	Geometry& geometry,
+	VkDevice device,
+	VmaAllocator allocator,
+	UploadBatcher& uploader,
+	ThreadPool& thread_pool,
+	bool compress_textures = false,
+	TextureStreamer* streamer = nullptr,
+	TextureCache* texture_cache = nullptr);
+
+// The CPU half of load_cached_scene: reads the cached pack of a glTF scene, or cooks the scene and writes
+// the pack. Touches no Vulkan state. The contents are valid even if the pack could not be written.
+bool import_cached_gltf(const char* path, PackContents& contents, ThreadPool& thread_pool, bool compress_textures = false);
@@ -0,0 +1,138 @@
+#include "residency.h"
+#include "texture_streaming.h"
+#include "upload.h"
+
+#include <algorithm>
+
+#include "vma/vk_mem_alloc.h"
+
+void create_residency_manager(ResidencyManager& residency, VmaAllocator allocator)
+{
+	residency = {};
+	residency.allocator = allocator;
+
+	const VkPhysicalDeviceMemoryProperties* memory_properties = nullptr;
+	vmaGetMemoryProperties(allocator, &memory_properties);
+
+	VkDeviceSize largest_heap = 0;
+	for (uint32_t i = 0; i < memory_properties->memoryHeapCount; ++i)
+	{
+		const VkMemoryHeap& heap = memory_properties->memoryHeaps[i];
+		if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && heap.size > largest_heap)
+		{
+			largest_heap = heap.size;
+			residency.heap_index = i;
+		}
+	}
+
+	residency.stream_budget = TEXTURE_STREAMING_BYTES_PER_UPDATE;
+}
+
+void residency_track(ResidencyManager& residency, const Texture& texture, ResidencyClass residency_class)
+{
+	residency.tracked.push_back({ .texture = &texture, .residency_class = residency_class });
+}
+
+void residency_track(ResidencyManager& residency, const Buffer& buffer, ResidencyClass residency_class)
+{
+	residency.tracked.push_back({ .buffer = &buffer, .residency_class = residency_class });
+}
+
+void residency_untrack(ResidencyManager& residency, const void* resource)
+{
+	std::erase_if(residency.tracked, [&](const ResidencyManager::Tracked& tracked) {
+		return tracked.texture == resource || tracked.buffer == resource;
+	});
+}
+
+static VkDeviceSize get_allocation_size(VmaAllocator allocator, VmaAllocation allocation)
+{
+	if (allocation == VK_NULL_HANDLE)
+		return 0;
+
+	VmaAllocationInfo info{};
+	vmaGetAllocationInfo(allocator, allocation, &info);
+	return info.size;
+}
+
+void update_residency(ResidencyManager& residency, TextureStreamer& streamer, const std::vector<Texture>& textures, UploadBatcher& uploader)
+{
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetHeapBudgets(residency.allocator, budgets);
+	residency.heap_usage = budgets[residency.heap_index].usage;
+	residency.heap_budget = budgets[residency.heap_index].budget;
+
+	for (VkDeviceSize& bytes : residency.resident_bytes)
+		bytes = 0;
+
+	for (const ResidencyManager::Tracked& tracked : residency.tracked)
+	{
+		VmaAllocation allocation = tracked.texture ? tracked.texture->allocation : tracked.buffer->allocation;
+		residency.resident_bytes[tracked.residency_class] += get_allocation_size(residency.allocator, allocation);
+	}
+
+	// Uploads in flight count towards the textures they replace
+	for (const TextureStreamer::StreamedTexture& streamed : streamer.textures)
+		residency.resident_bytes[RESIDENCY_MATERIAL] += get_allocation_size(residency.allocator, streamed.pending.allocation);
+
+	VkDeviceSize target = (VkDeviceSize)(residency.heap_budget * RESIDENCY_TARGET);
+	residency.stream_budget = residency.heap_usage < target ? std::min(target - residency.heap_usage, TEXTURE_STREAMING_BYTES_PER_UPDATE) : 0;
+
+	if (residency.heap_usage <= target)
+		residency.is_evicting = false;
+	else if (residency.heap_usage > (VkDeviceSize)(residency.heap_budget * RESIDENCY_EVICT_THRESHOLD) && !residency.is_evicting)
+	{
+		residency.is_evicting = true;
+		printf("VRAM over budget (%.2f of %.2f MB), evicting texture mips. Resident:", residency.heap_usage / (1024.0 * 1024.0), residency.heap_budget / (1024.0 * 1024.0));
+		for (uint32_t i = 0; i < RESIDENCY_CLASS_COUNT; ++i)
+			printf(" %s %.2f MB%s", get_residency_class_name((ResidencyClass)i), residency.resident_bytes[i] / (1024.0 * 1024.0), i + 1 < RESIDENCY_CLASS_COUNT ? "," : "\n");
+	}
+
+	if (!residency.is_evicting)
+		return;
+
+	// Least recently sampled first, one level per texture and update
+	std::vector<uint32_t> candidates;
+	for (uint32_t i = 0; i < (uint32_t)streamer.textures.size(); ++i)
+	{
+		const TextureStreamer::StreamedTexture& streamed = streamer.textures[i];
+		if (streamed.image.data && streamed.pending.image == VK_NULL_HANDLE && streamed.resident_mip < streamed.initial_mip)
+			candidates.push_back(i);
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+		return streamer.textures[a].last_sampled < streamer.textures[b].last_sampled;
+	});
+
+	VkDeviceSize projected_usage = residency.heap_usage;
+	bool evicted = false;
+	for (uint32_t i : candidates)
+	{
+		if (projected_usage <= target)
+			break;
+
+		// The finest level is about three quarters of a mip chain
+		VkDeviceSize size = get_allocation_size(residency.allocator, textures[i].allocation);
+		if (evict_texture_mips(streamer, textures[i], i, streamer.textures[i].resident_mip + 1, uploader))
+		{
+			projected_usage -= std::min(projected_usage, size * 3 / 4);
+			evicted = true;
+		}
+	}
+
+	if (evicted)
+		upload_batcher_flush(uploader);
+}
+
+const char* get_residency_class_name(ResidencyClass residency_class)
+{
+	switch (residency_class)
+	{
+	case RESIDENCY_RENDER_TARGET: return "render targets";
+	case RESIDENCY_SHADOW_MAP: return "shadow maps";
+	case RESIDENCY_MATERIAL: return "materials";
+	case RESIDENCY_ENVIRONMENT: return "environment";
+	case RESIDENCY_GEOMETRY: return "geometry";
+	default: return "unknown";
+	}
+}
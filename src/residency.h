@@ -0,0 +1,59 @@
+#pragma once
+
+#include "resources.h"
+
+struct TextureStreamer;
+
+// What a tracked resource is used for. Only material textures are streamed and can give up mip levels,
+// the other classes are tracked for their counters.
+enum ResidencyClass
+{
+	RESIDENCY_RENDER_TARGET = 0,
+	RESIDENCY_SHADOW_MAP,
+	RESIDENCY_MATERIAL,
+	RESIDENCY_ENVIRONMENT,
+	RESIDENCY_GEOMETRY, // Vertex, index and light buffers
+	RESIDENCY_CLASS_COUNT,
+};
+
+// Eviction starts once the device local heap uses this much of its budget and stops at RESIDENCY_TARGET.
+// Streaming only allocates while usage is below the target, so evicted levels are not streamed straight back.
+static constexpr double RESIDENCY_EVICT_THRESHOLD = 0.95;
+static constexpr double RESIDENCY_TARGET = 0.85;
+
+// Keeps device local memory within the budget reported by VMA (VK_EXT_memory_budget when available).
+// Under pressure the finest levels of the least recently sampled material textures are dropped, they
+// come back through the streaming feedback once usage is below the target again.
+struct ResidencyManager
+{
+	struct Tracked
+	{
+		const Texture* texture;
+		const Buffer* buffer;
+		ResidencyClass residency_class;
+	};
+
+	VmaAllocator allocator;
+	uint32_t heap_index; // Largest device local heap
+	std::vector<Tracked> tracked;
+
+	VkDeviceSize heap_usage;
+	VkDeviceSize heap_budget;
+	VkDeviceSize resident_bytes[RESIDENCY_CLASS_COUNT];
+	VkDeviceSize stream_budget; // What the next texture streamer update may upload
+	bool is_evicting;
+};
+
+void create_residency_manager(ResidencyManager& residency, VmaAllocator allocator);
+
+// Tracked resources are read every update and have to outlive the manager or be untracked first.
+// Textures that get replaced in place, like the streamed ones, stay tracked.
+void residency_track(ResidencyManager& residency, const Texture& texture, ResidencyClass residency_class);
+void residency_track(ResidencyManager& residency, const Buffer& buffer, ResidencyClass residency_class);
+void residency_untrack(ResidencyManager& residency, const void* resource);
+
+// Call once per frame after update_texture_streamer. Refreshes the budgets and counters, queues mip
+// evictions while over RESIDENCY_EVICT_THRESHOLD and sets the stream budget for the next update.
+void update_residency(ResidencyManager& residency, TextureStreamer& streamer, const std::vector<Texture>& textures, UploadBatcher& uploader);
+
+const char* get_residency_class_name(ResidencyClass residency_class);
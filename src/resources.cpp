@@ -1,8 +1,22 @@
 #include "resources.h"
+#include "upload.h"
 #include "dds.h"
+#include "ktx2.h"
+#include "thread_pool.h"
+#include "load_telemetry.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <filesystem>
 #include <optional>
 
+#define VMA_IMPLEMENTATION
+#include "vma/vk_mem_alloc.h"
+
+#ifdef RAYDERX_HAS_ZSTD
+#include <zstd.h>
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
@@ -138,10 +152,33 @@ static VkImageAspectFlags determine_aspect_flags(VkFormat format)
 	}
 }
 
-VkImageView create_image_view(VkDevice device, VkImage image, VkImageViewType type, VkFormat format)
+VkFormat get_unorm_format(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_SRGB: return VK_FORMAT_R8G8B8A8_UNORM;
+	case VK_FORMAT_B8G8R8A8_SRGB: return VK_FORMAT_B8G8R8A8_UNORM;
+	case VK_FORMAT_A8B8G8R8_SRGB_PACK32: return VK_FORMAT_A8B8G8R8_UNORM_PACK32;
+	case VK_FORMAT_R8_SRGB: return VK_FORMAT_R8_UNORM;
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case VK_FORMAT_BC2_SRGB_BLOCK: return VK_FORMAT_BC2_UNORM_BLOCK;
+	case VK_FORMAT_BC3_SRGB_BLOCK: return VK_FORMAT_BC3_UNORM_BLOCK;
+	case VK_FORMAT_BC7_SRGB_BLOCK: return VK_FORMAT_BC7_UNORM_BLOCK;
+	default: return format;
+	}
+}
+
+VkImageView create_image_view(VkDevice device, VkImage image, VkImageViewType type, VkFormat format, VkImageUsageFlags usage)
 {
+	VkImageViewUsageCreateInfo usage_info{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO,
+		.usage = usage,
+	};
+
 	VkImageViewCreateInfo create_info{
 		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.pNext = usage != 0 ? &usage_info : nullptr,
 		.image = image,
 		.viewType = type,
 		.format = format,
@@ -168,6 +205,12 @@ VkImageView create_image_view(VkDevice device, VkImage image, VkImageViewType ty
 Texture create_texture(VkDevice device, VmaAllocator allocator, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkImageUsageFlags usage, uint32_t mip_levels, VkSampleCountFlagBits sample_count, uint32_t array_layers, bool is_cubemap)
 {
 	VkImageCreateFlags flags = is_cubemap ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
+
+	// sRGB formats don't support storage, such images are written through UNORM views instead
+	bool is_srgb_storage = (usage & VK_IMAGE_USAGE_STORAGE_BIT) && get_unorm_format(format) != format;
+	if (is_srgb_storage)
+		flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+
 	VkImageCreateInfo image_create_info{
 		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
 		.flags = flags,
@@ -190,7 +233,7 @@ Texture create_texture(VkDevice device, VmaAllocator allocator, uint32_t width,
 	VK_CHECK(vmaCreateImage(allocator, &image_create_info, &allocation_info, &image, &allocation, nullptr));
 
 	VkImageViewType view_type = is_cubemap ? VK_IMAGE_VIEW_TYPE_CUBE : (depth != 1 ? VK_IMAGE_VIEW_TYPE_3D : VK_IMAGE_VIEW_TYPE_2D);
-	VkImageView view = create_image_view(device, image, view_type, format);
+	VkImageView view = create_image_view(device, image, view_type, format, is_srgb_storage ? usage & ~VK_IMAGE_USAGE_STORAGE_BIT : 0);
 
 	return {
 		.image = image,
@@ -512,33 +555,32 @@ static size_t get_block_size(VkFormat format)
 {
 	switch (format)
 	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
 	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
 		return 8;
 	case VK_FORMAT_BC2_UNORM_BLOCK:
 	case VK_FORMAT_BC2_SRGB_BLOCK:
 	case VK_FORMAT_BC3_UNORM_BLOCK:
 	case VK_FORMAT_BC3_SRGB_BLOCK:
 	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
 		return 16;
 	default:
 		return 0;
 	}
 }
 
-static bool is_compressed_format(VkFormat format)
+bool is_compressed_format(VkFormat format)
 {
-	switch (format)
-	{
-	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
-	case VK_FORMAT_BC2_UNORM_BLOCK:
-	case VK_FORMAT_BC2_SRGB_BLOCK:
-	case VK_FORMAT_BC3_UNORM_BLOCK:
-	case VK_FORMAT_BC3_SRGB_BLOCK:
-	case VK_FORMAT_BC5_UNORM_BLOCK:
-		return true;
-	default:
-		return false;
-	}
+	return get_block_size(format) != 0;
 }
 
 static uint32_t get_format_bitcount(VkFormat format)
@@ -548,41 +590,52 @@ static uint32_t get_format_bitcount(VkFormat format)
 	case VK_FORMAT_R32G32B32A32_SFLOAT:
 		return 128;
 	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_R32G32_SFLOAT:
 		return 64;
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_R16G16_SFLOAT:
+	case VK_FORMAT_R32_SFLOAT:
+		return 32;
+	case VK_FORMAT_R8G8_UNORM:
+	case VK_FORMAT_R16_SFLOAT:
+		return 16;
+	case VK_FORMAT_R8_UNORM:
+	case VK_FORMAT_R8_SRGB:
+		return 8;
 	default:
 		return 0;
 	}
 }
 
-bool load_texture(Texture& texture, const char* path, VkDevice device, VmaAllocator allocator, VkCommandPool command_pool, VkCommandBuffer command_buffer, VkQueue queue, const Buffer& scratch, bool is_srgb)
+// Size in bytes of a width x height x depth subresource of an uncompressed or block compressed format
+size_t get_subresource_size(VkFormat format, uint32_t width, uint32_t height, uint32_t depth)
 {
-	std::filesystem::path p = path;
-	if (!p.has_extension() || p.extension() != ".dds")
-	{
-		printf("Unsupported file format: '%s'\n", path);
-		return false;
-	}
+	if (size_t block_size = get_block_size(format))
+		return (size_t)std::max(1u, (width + 3) / 4) * std::max(1u, (height + 3) / 4) * depth * block_size;
 
-	std::vector<uint8_t> data;
-	if (!read_binary_file(path, data))
-	{
-		printf("Failed to open file '%s'\n", path);
-		return false;
-	}
+	return (size_t)width * height * depth * (get_format_bitcount(format) / 8);
+}
 
-	if (*(uint32_t*)data.data() != DDS_MAGIC)
+bool parse_dds(TextureImage& image, const uint8_t* data, size_t data_size, bool is_srgb)
+{
+	// Parsed from memory, the file read is recorded by the caller
+	LoadScope scope(LOAD_STAGE_TEXTURE, "DDS of " + std::to_string(data_size) + " bytes");
+	if (data_size < sizeof(uint32_t) + sizeof(DDS_HEADER) || *(const uint32_t*)data != DDS_MAGIC)
 	{
-		printf("Invalid DDS file '%s': bad magic!\n", path);
+		printf("Invalid DDS file: bad magic!\n");
 		return false;
 	}
 
-	assert(*(uint32_t*)data.data() == fourcc("DDS "));
+	assert(*(const uint32_t*)data == fourcc("DDS "));
 
-	DDS_HEADER* header = (DDS_HEADER*)(data.data() + sizeof(uint32_t));
+	const DDS_HEADER* header = (const DDS_HEADER*)(data + sizeof(uint32_t));
 
 	bool has_dx10 = header->ddspf.dwFourCC == fourcc("DX10");
 
-	DDS_HEADER_DXT10* header_dx10 = has_dx10 ?  (DDS_HEADER_DXT10*)(header + 1) : nullptr;
+	const DDS_HEADER_DXT10* header_dx10 = has_dx10 ?  (const DDS_HEADER_DXT10*)(header + 1) : nullptr;
 
 	bool complex = header->dwCaps & DDSCAPS_COMPLEX;
 	bool is_cubemap = has_dx10 ? (header_dx10->miscFlag & DDS_RESOURCE_MISC_TEXTURECUBE): (header->dwCaps& DDSCAPS_COMPLEX) && (header->dwCaps2 & DDSCAPS2_CUBEMAP);
@@ -598,7 +651,7 @@ bool load_texture(Texture& texture, const char* path, VkDevice device, VmaAlloca
 
 	bool is_volume = header->dwCaps & DDSCAPS_COMPLEX && header->dwCaps2 & DDSCAPS2_VOLUME;
 
-	size_t file_image_size = data.size() - sizeof(uint32_t) - sizeof(DDS_HEADER) - (has_dx10 ? sizeof(DDS_HEADER_DXT10) : 0);
+	size_t file_image_size = data_size - sizeof(uint32_t) - sizeof(DDS_HEADER) - (has_dx10 ? sizeof(DDS_HEADER_DXT10) : 0);
 
 	VkFormat format = has_dx10 ? get_format(header_dx10->dxgiFormat) : get_format(header, is_srgb);
 	if (format == VK_FORMAT_UNDEFINED)
@@ -630,17 +683,25 @@ bool load_texture(Texture& texture, const char* path, VkDevice device, VmaAlloca
 		? get_image_size(header->dwWidth, header->dwHeight, mip_levels, 32)
 		: image_size;
 
-	assert(required_size <= scratch.size);
-
 	uint32_t array_layers = is_cubemap ? 6 : 1;
 
-	texture = create_texture(device, allocator, header->dwWidth, header->dwHeight, depth, format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, mip_levels, VK_SAMPLE_COUNT_1_BIT, array_layers, is_cubemap);
+	image.width = header->dwWidth;
+	image.height = header->dwHeight;
+	image.depth = depth;
+	image.mip_levels = mip_levels;
+	image.array_layers = array_layers;
+	image.format = format;
+	image.is_cubemap = is_cubemap;
+	image.storage.clear();
 
-	void* mapped = scratch.map();
 	if (!is_compressed && rgb_bit_count == 24)
 	{
+		image.storage.resize(required_size);
+		image.data = image.storage.data();
+		image.size = required_size;
+
 		uint32_t src_data_start = sizeof(uint32_t) + sizeof(DDS_HEADER) + (has_dx10 ? sizeof(DDS_HEADER_DXT10) : 0);
-		uint8_t* write_ptr = (uint8_t*)mapped;
+		uint8_t* write_ptr = image.storage.data();
 		for (uint32_t i = 0; i < image_size; i += 3)
 		{
 			*write_ptr++ = data[src_data_start + i + 0];
@@ -651,34 +712,18 @@ bool load_texture(Texture& texture, const char* path, VkDevice device, VmaAlloca
 	}
 	else
 	{
-		uint8_t* data_start = (uint8_t*)header + sizeof(DDS_HEADER) + (has_dx10 ? sizeof(DDS_HEADER_DXT10) : 0);
-		memcpy(mapped, data_start, image_size);
-	}
-	scratch.unmap();
-
-	vkResetCommandPool(device, command_pool, 0);
-
-	VkCommandBufferBeginInfo begin_info{
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-	};
-	VK_CHECK(vkBeginCommandBuffer(command_buffer, &begin_info));
-
-	{ // Undefined -> transfer dst optimal
-		VkImageMemoryBarrier2 barrier = image_barrier(texture.image,
-			0, 0, VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_IMAGE_ASPECT_COLOR_BIT);
-
-		pipeline_barrier(command_buffer, {}, { barrier });
+		// Texel data is referenced in place and only copied once, into the staging buffer
+		image.data = (const uint8_t*)header + sizeof(DDS_HEADER) + (has_dx10 ? sizeof(DDS_HEADER_DXT10) : 0);
+		image.size = image_size;
 	}
 
+	image.regions.resize(mip_levels);
 	VkDeviceSize offset = 0;
 	uint32_t width = header->dwWidth;
 	uint32_t height = header->dwHeight;
 	for (uint32_t i = 0; i < mip_levels; ++i)
 	{
-		VkBufferImageCopy copy{
+		image.regions[i] = {
 			.bufferOffset = offset,
 			.imageSubresource = {
 				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -690,8 +735,6 @@ bool load_texture(Texture& texture, const char* path, VkDevice device, VmaAlloca
 			.imageExtent = {width, height, depth}
 		};
 
-		vkCmdCopyBufferToImage(command_buffer, scratch.buffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
-
 		offset += is_compressed 
 			?  (std::max(1u, (width + 3) / 4) * std::max(1u, (height + 3) / 4) * block_size)
 			: width * height * (rgb_bit_count / 8) * array_layers;
@@ -700,67 +743,560 @@ bool load_texture(Texture& texture, const char* path, VkDevice device, VmaAlloca
 		height = height > 1 ? (height >> 1) : 1;
 	}
 
-	// Transfer dst optimal -> shader read only optimal
+	return true;
+}
+
+static DXGI_FORMAT get_dxgi_format(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM: return DXGI_FORMAT_R8G8B8A8_UNORM;
+	case VK_FORMAT_R8G8B8A8_SRGB: return DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: return DXGI_FORMAT_BC1_UNORM;
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: return DXGI_FORMAT_BC1_UNORM_SRGB;
+	case VK_FORMAT_BC4_UNORM_BLOCK: return DXGI_FORMAT_BC4_UNORM;
+	case VK_FORMAT_BC5_UNORM_BLOCK: return DXGI_FORMAT_BC5_UNORM;
+	case VK_FORMAT_BC7_UNORM_BLOCK: return DXGI_FORMAT_BC7_UNORM;
+	case VK_FORMAT_BC7_SRGB_BLOCK: return DXGI_FORMAT_BC7_UNORM_SRGB;
+	default: return DXGI_FORMAT_UNKNOWN;
+	}
+}
+
+bool write_dds(const char* path, const TextureImage& image)
+{
+	DXGI_FORMAT dxgi_format = get_dxgi_format(image.format);
+	if (dxgi_format == DXGI_FORMAT_UNKNOWN || image.is_cubemap || image.depth != 1)
+	{
+		printf("Cannot write %s: unsupported texture layout\n", path);
+		return false;
+	}
+
+	bool is_compressed = is_compressed_format(image.format);
+
+	DDS_HEADER header{};
+	header.dwSize = sizeof(DDS_HEADER);
+	header.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | (is_compressed ? DDSD_LINEARSIZE : DDSD_PITCH);
+	header.dwHeight = image.height;
+	header.dwWidth = image.width;
+	header.dwPitchOrLinearSize = is_compressed ? (DWORD)(image.regions.size() > 1 ? image.regions[1].bufferOffset : image.size) : image.width * 4;
+	header.dwMipMapCount = image.mip_levels;
+	header.ddspf.dwSize = sizeof(DDS_PIXELFORMAT);
+	header.ddspf.dwFlags = DDPF_FOURCC;
+	header.ddspf.dwFourCC = fourcc("DX10");
+	header.ddspf.dwRGBBitCount = is_compressed ? 0 : 32;
+	header.dwCaps = DDSCAPS_TEXTURE | (image.mip_levels > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+	DDS_HEADER_DXT10 header_dx10{};
+	header_dx10.dxgiFormat = dxgi_format;
+	header_dx10.resourceDimension = D3D10_RESOURCE_DIMENSION_TEXTURE2D;
+	header_dx10.arraySize = 1;
+
+	FILE* f = fopen(path, "wb");
+	if (!f)
+	{
+		printf("Failed to open file %s for writing\n", path);
+		return false;
+	}
+
+	uint32_t magic = DDS_MAGIC;
+	bool success = fwrite(&magic, sizeof(magic), 1, f) == 1
+		&& fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(&header_dx10, sizeof(header_dx10), 1, f) == 1
+		&& fwrite(image.data, 1, image.size, f) == image.size;
+
+	fclose(f);
+
+	if (!success)
+		printf("Failed to write file %s\n", path);
+
+	return success;
+}
+
+// The sRGB variant of a UNORM format, other formats are returned unchanged
+static VkFormat get_srgb_format(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R8_UNORM: return VK_FORMAT_R8_SRGB;
+	case VK_FORMAT_R8G8B8A8_UNORM: return VK_FORMAT_R8G8B8A8_SRGB;
+	case VK_FORMAT_B8G8R8A8_UNORM: return VK_FORMAT_B8G8R8A8_SRGB;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case VK_FORMAT_BC2_UNORM_BLOCK: return VK_FORMAT_BC2_SRGB_BLOCK;
+	case VK_FORMAT_BC3_UNORM_BLOCK: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case VK_FORMAT_BC7_UNORM_BLOCK: return VK_FORMAT_BC7_SRGB_BLOCK;
+	default: return format;
+	}
+}
+
+static bool is_ktx2(const uint8_t* data, size_t data_size)
+{
+	static const uint8_t identifier[KTX2_IDENTIFIER_SIZE] = KTX2_IDENTIFIER;
+	return data_size >= KTX2_IDENTIFIER_SIZE && memcmp(data, identifier, KTX2_IDENTIFIER_SIZE) == 0;
+}
+
+bool parse_ktx2(TextureImage& image, const uint8_t* data, size_t data_size, bool is_srgb, ThreadPool* thread_pool)
+{
+	LoadScope scope(LOAD_STAGE_TEXTURE, "KTX2 of " + std::to_string(data_size) + " bytes");
+	if (data_size < sizeof(KTX2_HEADER) || !is_ktx2(data, data_size))
+	{
+		printf("Invalid KTX2 file: bad identifier!\n");
+		return false;
+	}
+
+	const KTX2_HEADER* header = (const KTX2_HEADER*)data;
+
+	VkFormat format = is_srgb ? get_srgb_format((VkFormat)header->vkFormat) : (VkFormat)header->vkFormat;
+	if (get_subresource_size(format, 1, 1, 1) == 0)
+	{
+		printf("Unsupported KTX2 format %u\n", header->vkFormat);
+		return false;
+	}
+
+	bool is_supercompressed = header->supercompressionScheme == KTX2_SUPERCOMPRESSION_ZSTD;
+	if (!is_supercompressed && header->supercompressionScheme != KTX2_SUPERCOMPRESSION_NONE)
+	{
+		printf("Unsupported KTX2 supercompression scheme %u\n", header->supercompressionScheme);
+		return false;
+	}
+
+#ifndef RAYDERX_HAS_ZSTD
+	if (is_supercompressed)
+	{
+		printf("Cannot read zstd supercompressed KTX2 file: built without zstd\n");
+		return false;
+	}
+#endif
+
+	if (header->faceCount != 1 && header->faceCount != 6)
+	{
+		printf("Invalid KTX2 file: %u faces\n", header->faceCount);
+		return false;
+	}
+
+	uint32_t mip_levels = std::max(header->levelCount, 1u);
+	uint32_t array_layers = std::max(header->layerCount, 1u) * header->faceCount;
+	if (data_size < sizeof(KTX2_HEADER) + mip_levels * sizeof(KTX2_LEVEL_INDEX))
+	{
+		printf("Invalid KTX2 file: truncated level index\n");
+		return false;
+	}
+
+	const KTX2_LEVEL_INDEX* levels = (const KTX2_LEVEL_INDEX*)(header + 1);
+
+	image.width = header->pixelWidth;
+	image.height = std::max(header->pixelHeight, 1u);
+	image.depth = std::max(header->pixelDepth, 1u);
+	image.mip_levels = mip_levels;
+	image.array_layers = array_layers;
+	image.format = format;
+	image.is_cubemap = header->faceCount == 6;
+	image.storage.clear();
+	image.regions.resize(mip_levels);
+
+	// Levels are stored smallest first, supercompressed ones are decompressed into storage largest first
+	uint64_t first_offset = data_size;
+	uint64_t end_offset = 0;
+	size_t storage_size = 0;
+	std::vector<size_t> level_sizes(mip_levels);
+	for (uint32_t i = 0; i < mip_levels; ++i)
+	{
+		uint32_t width = std::max(image.width >> i, 1u);
+		uint32_t height = std::max(image.height >> i, 1u);
+		uint32_t depth = std::max(image.depth >> i, 1u);
+
+		level_sizes[i] = get_subresource_size(format, width, height, depth) * array_layers;
+		if (levels[i].byteOffset > data_size || levels[i].byteLength > data_size - levels[i].byteOffset
+			|| (is_supercompressed ? levels[i].uncompressedByteLength : levels[i].byteLength) != level_sizes[i])
+		{
+			printf("Invalid KTX2 file: bad level %u\n", i);
+			return false;
+		}
+
+		first_offset = std::min(first_offset, levels[i].byteOffset);
+		end_offset = std::max(end_offset, levels[i].byteOffset + levels[i].byteLength);
+
+		image.regions[i] = {
+			.bufferOffset = is_supercompressed ? storage_size : 0,
+			.imageSubresource = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel = i,
+				.baseArrayLayer = 0,
+				.layerCount = array_layers
+			},
+			.imageOffset = { 0, 0, 0 },
+			.imageExtent = { width, height, depth }
+		};
+
+		// Keeps every level aligned to its texel block and to the 4 bytes copies require
+		storage_size += (level_sizes[i] + 15) & ~size_t(15);
+	}
+
+	if (!is_supercompressed)
 	{
-		VkImageMemoryBarrier2 barrier = image_barrier(texture.image,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			VK_IMAGE_ASPECT_COLOR_BIT);
-		pipeline_barrier(command_buffer, {}, { barrier });
+		// Texel data is referenced in place like DDS payloads, the alignment padding between levels is skipped by the regions
+		image.data = data + first_offset;
+		image.size = end_offset - first_offset;
+		for (uint32_t i = 0; i < mip_levels; ++i)
+			image.regions[i].bufferOffset = levels[i].byteOffset - first_offset;
+
+		return true;
 	}
 
-	VK_CHECK(vkEndCommandBuffer(command_buffer));
+#ifdef RAYDERX_HAS_ZSTD
+	image.storage.resize(storage_size);
+	image.data = image.storage.data();
+	image.size = storage_size;
 
-	VkSubmitInfo submit_info{
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &command_buffer
+	std::atomic<bool> success = true;
+	auto decompress_level = [&](uint32_t i) {
+		size_t result = ZSTD_decompress(image.storage.data() + image.regions[i].bufferOffset, level_sizes[i], data + levels[i].byteOffset, levels[i].byteLength);
+		if (ZSTD_isError(result) || result != level_sizes[i])
+		{
+			printf("Failed to decompress KTX2 level %u: %s\n", i, ZSTD_isError(result) ? ZSTD_getErrorName(result) : "size mismatch");
+			success = false;
+		}
 	};
 
-	VK_CHECK(vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE));
-	VK_CHECK(vkDeviceWaitIdle(device));
+	// Every level is an independent zstd frame
+	if (thread_pool && mip_levels > 1)
+		parallel_for(*thread_pool, mip_levels, decompress_level);
+	else
+		for (uint32_t i = 0; i < mip_levels; ++i)
+			decompress_level(i);
+
+	return success;
+#else
+	return false;
+#endif
+}
+
+// Basic data format descriptor block of the formats write_ktx2 supports and the size of their components.
+// Returns false for any other format.
+static bool build_ktx2_dfd(std::vector<uint8_t>& dfd, uint32_t& type_size, VkFormat format, bool is_supercompressed)
+{
+	KTX2_DFD_BLOCK_HEADER block{
+		.versionNumber = KHR_DF_VERSION,
+		.colorPrimaries = KHR_DF_PRIMARIES_BT709,
+		.transferFunction = (uint8_t)(get_unorm_format(format) != format ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR),
+	};
+
+	type_size = 1;
+	std::vector<KTX2_DFD_SAMPLE> samples;
+	auto add_sample = [&](uint8_t channel, uint16_t bit_offset, uint16_t bit_length, uint8_t qualifiers, uint32_t lower, uint32_t upper) {
+		samples.push_back({ .bitOffset = bit_offset, .bitLength = (uint8_t)(bit_length - 1), .channelType = (uint8_t)(channel | qualifiers), .sampleLower = lower, .sampleUpper = upper });
+	};
+
+	const uint32_t float_lower = 0xBF800000; // -1.0f
+	const uint32_t float_upper = 0x3F800000; // 1.0f
+
+	switch (format)
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		block.colorModel = KHR_DF_MODEL_BC1A;
+		add_sample(KHR_DF_CHANNEL_RED, 0, 64, 0, 0, UINT32_MAX);
+		break;
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		block.colorModel = KHR_DF_MODEL_BC1A;
+		add_sample(KHR_DF_CHANNEL_BC1A_ALPHA, 0, 64, 0, 0, UINT32_MAX);
+		break;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		block.colorModel = format == VK_FORMAT_BC2_UNORM_BLOCK || format == VK_FORMAT_BC2_SRGB_BLOCK ? KHR_DF_MODEL_BC2 : KHR_DF_MODEL_BC3;
+		add_sample(KHR_DF_CHANNEL_ALPHA, 0, 64, KHR_DF_SAMPLE_DATATYPE_LINEAR, 0, UINT32_MAX);
+		add_sample(KHR_DF_CHANNEL_RED, 64, 64, 0, 0, UINT32_MAX);
+		break;
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		block.colorModel = KHR_DF_MODEL_BC4;
+		add_sample(KHR_DF_CHANNEL_RED, 0, 64, 0, 0, UINT32_MAX);
+		break;
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		block.colorModel = KHR_DF_MODEL_BC4;
+		add_sample(KHR_DF_CHANNEL_RED, 0, 64, KHR_DF_SAMPLE_DATATYPE_SIGNED, 0x80000000, 0x7FFFFFFF);
+		break;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		block.colorModel = KHR_DF_MODEL_BC5;
+		add_sample(KHR_DF_CHANNEL_RED, 0, 64, 0, 0, UINT32_MAX);
+		add_sample(KHR_DF_CHANNEL_GREEN, 64, 64, 0, 0, UINT32_MAX);
+		break;
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+		block.colorModel = KHR_DF_MODEL_BC5;
+		add_sample(KHR_DF_CHANNEL_RED, 0, 64, KHR_DF_SAMPLE_DATATYPE_SIGNED, 0x80000000, 0x7FFFFFFF);
+		add_sample(KHR_DF_CHANNEL_GREEN, 64, 64, KHR_DF_SAMPLE_DATATYPE_SIGNED, 0x80000000, 0x7FFFFFFF);
+		break;
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+		block.colorModel = KHR_DF_MODEL_BC6H;
+		add_sample(KHR_DF_CHANNEL_RED, 0, 128, KHR_DF_SAMPLE_DATATYPE_FLOAT, 0, float_upper);
+		break;
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+		block.colorModel = KHR_DF_MODEL_BC6H;
+		add_sample(KHR_DF_CHANNEL_RED, 0, 128, KHR_DF_SAMPLE_DATATYPE_FLOAT | KHR_DF_SAMPLE_DATATYPE_SIGNED, float_lower, float_upper);
+		break;
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		block.colorModel = KHR_DF_MODEL_BC7;
+		add_sample(KHR_DF_CHANNEL_RED, 0, 128, 0, 0, UINT32_MAX);
+		break;
+	case VK_FORMAT_R8_UNORM:
+	case VK_FORMAT_R8_SRGB:
+	case VK_FORMAT_R8G8_UNORM:
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	{
+		block.colorModel = KHR_DF_MODEL_RGBSDA;
+		uint32_t channel_count = format == VK_FORMAT_R8G8_UNORM ? 2 : get_format_bitcount(format) / 8;
+		const uint8_t channels[] = { KHR_DF_CHANNEL_RED, KHR_DF_CHANNEL_GREEN, KHR_DF_CHANNEL_BLUE, KHR_DF_CHANNEL_ALPHA };
+		for (uint32_t i = 0; i < channel_count; ++i)
+			add_sample(channels[i], (uint16_t)(i * 8), 8, channels[i] == KHR_DF_CHANNEL_ALPHA ? KHR_DF_SAMPLE_DATATYPE_LINEAR : 0, 0, 255);
+		break;
+	}
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+		block.colorModel = KHR_DF_MODEL_RGBSDA;
+		add_sample(KHR_DF_CHANNEL_BLUE, 0, 8, 0, 0, 255);
+		add_sample(KHR_DF_CHANNEL_GREEN, 8, 8, 0, 0, 255);
+		add_sample(KHR_DF_CHANNEL_RED, 16, 8, 0, 0, 255);
+		add_sample(KHR_DF_CHANNEL_ALPHA, 24, 8, KHR_DF_SAMPLE_DATATYPE_LINEAR, 0, 255);
+		break;
+	case VK_FORMAT_R16_SFLOAT:
+	case VK_FORMAT_R16G16_SFLOAT:
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_R32_SFLOAT:
+	case VK_FORMAT_R32G32_SFLOAT:
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+	{
+		block.colorModel = KHR_DF_MODEL_RGBSDA;
+		bool is_half = format == VK_FORMAT_R16_SFLOAT || format == VK_FORMAT_R16G16_SFLOAT || format == VK_FORMAT_R16G16B16A16_SFLOAT;
+		uint32_t channel_bits = is_half ? 16 : 32;
+		uint32_t channel_count = get_format_bitcount(format) / channel_bits;
+		type_size = channel_bits / 8;
+		const uint8_t channels[] = { KHR_DF_CHANNEL_RED, KHR_DF_CHANNEL_GREEN, KHR_DF_CHANNEL_BLUE, KHR_DF_CHANNEL_ALPHA };
+		for (uint32_t i = 0; i < channel_count; ++i)
+			add_sample(channels[i], (uint16_t)(i * channel_bits), (uint16_t)channel_bits, KHR_DF_SAMPLE_DATATYPE_FLOAT | KHR_DF_SAMPLE_DATATYPE_SIGNED, float_lower, float_upper);
+		break;
+	}
+	default:
+		return false;
+	}
+
+	bool is_compressed = is_compressed_format(format);
+	block.texelBlockDimension[0] = is_compressed ? 3 : 0;
+	block.texelBlockDimension[1] = is_compressed ? 3 : 0;
+	block.bytesPlane[0] = is_supercompressed ? 0 : (uint8_t)get_subresource_size(format, 1, 1, 1);
+	block.descriptorBlockSize = (uint16_t)(sizeof(KTX2_DFD_BLOCK_HEADER) + samples.size() * sizeof(KTX2_DFD_SAMPLE));
+
+	uint32_t total_size = sizeof(uint32_t) + block.descriptorBlockSize;
+	dfd.resize(total_size);
+	memcpy(dfd.data(), &total_size, sizeof(total_size));
+	memcpy(dfd.data() + sizeof(uint32_t), &block, sizeof(block));
+	memcpy(dfd.data() + sizeof(uint32_t) + sizeof(block), samples.data(), samples.size() * sizeof(KTX2_DFD_SAMPLE));
+
+	return true;
+}
+
+// Textures are written offline and read many times, so a slow level with a better ratio is fine
+static constexpr int KTX2_ZSTD_LEVEL = 19;
+
+bool write_ktx2(const char* path, const TextureImage& image, bool supercompress)
+{
+#ifndef RAYDERX_HAS_ZSTD
+	if (supercompress)
+	{
+		printf("Cannot write %s: built without zstd\n", path);
+		return false;
+	}
+#endif
+
+	std::vector<uint8_t> dfd;
+	uint32_t type_size = 0;
+	if (image.regions.size() != image.mip_levels || !build_ktx2_dfd(dfd, type_size, image.format, supercompress))
+	{
+		printf("Cannot write %s: unsupported texture layout\n", path);
+		return false;
+	}
+
+	uint32_t layer_count = image.is_cubemap ? image.array_layers / 6 : image.array_layers;
+	KTX2_HEADER header{
+		.identifier = KTX2_IDENTIFIER,
+		.vkFormat = (uint32_t)image.format,
+		.typeSize = type_size,
+		.pixelWidth = image.width,
+		.pixelHeight = image.height,
+		.pixelDepth = image.depth > 1 ? image.depth : 0,
+		.layerCount = layer_count > 1 ? layer_count : 0,
+		.faceCount = image.is_cubemap ? 6u : 1u,
+		.levelCount = image.mip_levels,
+		.supercompressionScheme = supercompress ? (uint32_t)KTX2_SUPERCOMPRESSION_ZSTD : (uint32_t)KTX2_SUPERCOMPRESSION_NONE,
+	};
+
+	// Levels go smallest first after the header, level index and data format descriptor
+	std::vector<KTX2_LEVEL_INDEX> levels(image.mip_levels);
+	std::vector<std::vector<uint8_t>> compressed_levels(image.mip_levels);
+	size_t alignment = supercompress ? 1 : std::max<size_t>(4, get_subresource_size(image.format, 1, 1, 1));
+
+	header.dfdByteOffset = (uint32_t)(sizeof(KTX2_HEADER) + levels.size() * sizeof(KTX2_LEVEL_INDEX));
+	header.dfdByteLength = (uint32_t)dfd.size();
+
+	uint64_t offset = header.dfdByteOffset + header.dfdByteLength;
+	for (uint32_t i = image.mip_levels; i-- > 0; )
+	{
+		const VkBufferImageCopy& region = image.regions[i];
+		size_t level_size = get_subresource_size(image.format, region.imageExtent.width, region.imageExtent.height, region.imageExtent.depth) * image.array_layers;
+		if (region.imageSubresource.mipLevel != i || region.imageSubresource.layerCount != image.array_layers || region.bufferOffset + level_size > image.size)
+		{
+			printf("Cannot write %s: unsupported texture layout\n", path);
+			return false;
+		}
+
+		levels[i].uncompressedByteLength = level_size;
+		levels[i].byteLength = level_size;
+
+#ifdef RAYDERX_HAS_ZSTD
+		if (supercompress)
+		{
+			std::vector<uint8_t>& compressed = compressed_levels[i];
+			compressed.resize(ZSTD_compressBound(level_size));
+			size_t result = ZSTD_compress(compressed.data(), compressed.size(), image.data + region.bufferOffset, level_size, KTX2_ZSTD_LEVEL);
+			if (ZSTD_isError(result))
+			{
+				printf("Failed to compress %s: %s\n", path, ZSTD_getErrorName(result));
+				return false;
+			}
+
+			compressed.resize(result);
+			levels[i].byteLength = result;
+		}
+#endif
+
+		offset = (offset + alignment - 1) / alignment * alignment;
+		levels[i].byteOffset = offset;
+		offset += levels[i].byteLength;
+	}
+
+	FILE* f = fopen(path, "wb");
+	if (!f)
+	{
+		printf("Failed to open file %s for writing\n", path);
+		return false;
+	}
+
+	bool success = fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(levels.data(), sizeof(KTX2_LEVEL_INDEX), levels.size(), f) == levels.size()
+		&& fwrite(dfd.data(), 1, dfd.size(), f) == dfd.size();
+
+	const uint8_t padding[16] = {};
+	for (uint32_t i = image.mip_levels; success && i-- > 0; )
+	{
+		size_t position = (size_t)ftell(f);
+		const uint8_t* level_data = supercompress ? compressed_levels[i].data() : image.data + image.regions[i].bufferOffset;
+		success = fwrite(padding, 1, levels[i].byteOffset - position, f) == levels[i].byteOffset - position
+			&& fwrite(level_data, 1, levels[i].byteLength, f) == levels[i].byteLength;
+	}
+
+	fclose(f);
+
+	if (!success)
+		printf("Failed to write file %s\n", path);
+
+	return success;
+}
+
+bool parse_texture(TextureImage& image, const uint8_t* data, size_t data_size, bool is_srgb, ThreadPool* thread_pool)
+{
+	if (is_ktx2(data, data_size))
+		return parse_ktx2(image, data, data_size, is_srgb, thread_pool);
+
+	return parse_dds(image, data, data_size, is_srgb);
+}
+
+bool load_texture_image(Texture& texture, const TextureImage& image, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader)
+{
+	texture = create_texture(device, allocator, image.width, image.height, image.depth, image.format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, image.mip_levels, VK_SAMPLE_COUNT_1_BIT, image.array_layers, image.is_cubemap);
+
+	upload_batcher_upload_image(uploader, texture, image.data, image.regions.data(), (uint32_t)image.regions.size());
 
 	return true;
 }
 
+bool load_dds_texture(Texture& texture, const uint8_t* data, size_t data_size, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader, bool is_srgb)
+{
+	TextureImage image;
+	if (!parse_dds(image, data, data_size, is_srgb))
+		return false;
+
+	return load_texture_image(texture, image, device, allocator, uploader);
+}
+
+bool load_texture_data(Texture& texture, const uint8_t* data, size_t data_size, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader, bool is_srgb, ThreadPool* thread_pool)
+{
+	TextureImage image;
+	if (!parse_texture(image, data, data_size, is_srgb, thread_pool))
+		return false;
+
+	return load_texture_image(texture, image, device, allocator, uploader);
+}
+
+
+bool load_texture(Texture& texture, const char* path, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader, bool is_srgb)
+{
+	LoadScope scope(LOAD_STAGE_TEXTURE, path);
+	std::filesystem::path p = path;
+	if (!p.has_extension() || (p.extension() != ".dds" && p.extension() != ".ktx2"))
+	{
+		printf("Unsupported file format: '%s'\n", path);
+		return false;
+	}
+
+	MappedFile file;
+	if (!map_file(file, path))
+	{
+		printf("Failed to open file '%s'\n", path);
+		return false;
+	}
+	load_telemetry_add_bytes_read(file.size);
+
+	bool result = load_texture_data(texture, file.data, file.size, device, allocator, uploader, is_srgb);
+	if (!result)
+		printf("Failed to load texture '%s'\n", path);
+
+	unmap_file(file);
+	return result;
+}
+
 static uint32_t get_mip_count(uint32_t texture_width, uint32_t texture_height)
 {
 	return (uint32_t)(std::floor(std::log2(std::max(texture_width, texture_height)))) + 1;
 }
 
-bool load_png_or_jpg_texture(Texture& texture, const uint8_t* data, size_t data_size, VkDevice device, VmaAllocator allocator, VkCommandPool command_pool, VkCommandBuffer command_buffer, VkQueue queue, const Buffer& scratch, bool is_srgb)
+bool decode_png_or_jpg(DecodedImage& image, const uint8_t* data, size_t data_size)
 {
 	int width, height, channels;
 	constexpr int required_channels = 4;
-	stbi_uc* loaded_data = stbi_load_from_memory(data, (int)data_size, &width, &height, &channels, required_channels);
-	if (!loaded_data) return false;
-
-	VkFormat format = is_srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
-	uint32_t mip_levels = get_mip_count(width, height);
-	texture = create_texture(device, allocator, width, height, 1, format, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, mip_levels);
-
-	size_t image_size = width * height * 4;
-	assert(image_size <= scratch.size);
-	void* mapped = scratch.map();
-	memcpy(mapped, loaded_data, image_size);
-	scratch.unmap();
+	image.pixels = stbi_load_from_memory(data, (int)data_size, &width, &height, &channels, required_channels);
+	if (!image.pixels) return false;
 
-	vkResetCommandPool(device, command_pool, 0);
+	image.width = (uint32_t)width;
+	image.height = (uint32_t)height;
 
-	VkCommandBufferBeginInfo begin_info{
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-	};
-	VK_CHECK(vkBeginCommandBuffer(command_buffer, &begin_info));
+	return true;
+}
 
-	{ // Undefined -> transfer dst optimal
-		VkImageMemoryBarrier2 barrier = image_barrier(texture.image,
-			0, 0, VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_IMAGE_ASPECT_COLOR_BIT);
+void free_decoded_image(DecodedImage& image)
+{
+	stbi_image_free(image.pixels);
+	image.pixels = nullptr;
+}
 
-		pipeline_barrier(command_buffer, {}, { barrier });
-	}
+bool load_decoded_texture(Texture& texture, const DecodedImage& image, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader, bool is_srgb)
+{
+	VkFormat format = is_srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+	uint32_t mip_levels = get_mip_count(image.width, image.height);
+	VkImageUsageFlags mip_usage = uploader.downsampler ? VK_IMAGE_USAGE_STORAGE_BIT : VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	texture = create_texture(device, allocator, image.width, image.height, 1, format, mip_usage | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, mip_levels);
 
 	VkBufferImageCopy copy{
 		.bufferOffset = 0,
@@ -771,72 +1307,153 @@ bool load_png_or_jpg_texture(Texture& texture, const uint8_t* data, size_t data_
 			.layerCount = 1
 		},
 		.imageOffset = {0, 0, 0 },
-		.imageExtent = {(uint32_t)width, (uint32_t)height, 1u}
+		.imageExtent = {image.width, image.height, 1u}
 	};
 
-	vkCmdCopyBufferToImage(command_buffer, scratch.buffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+	upload_batcher_upload_image(uploader, texture, image.pixels, &copy, 1, true);
 
-	// Transfer dst optimal -> shader read only optimal
-	{
-		VkImageMemoryBarrier2 barrier = image_barrier(texture.image,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			VK_IMAGE_ASPECT_COLOR_BIT);
-		pipeline_barrier(command_buffer, {}, { barrier });
-	}
+	return true;
+}
 
-	VK_CHECK(vkEndCommandBuffer(command_buffer));
+static float srgb_to_linear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
 
-	VkSubmitInfo submit_info{
-	.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-	.commandBufferCount = 1,
-	.pCommandBuffers = &command_buffer
-	};
+static float linear_to_srgb(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
 
-	VK_CHECK(vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE));
-	VK_CHECK(vkDeviceWaitIdle(device));
+void build_mip_chain(TextureImage& image, const DecodedImage& decoded, bool is_srgb)
+{
+	image.width = decoded.width;
+	image.height = decoded.height;
+	image.depth = 1;
+	image.mip_levels = get_mip_count(decoded.width, decoded.height);
+	image.array_layers = 1;
+	image.format = is_srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+	image.is_cubemap = false;
+	image.regions.resize(image.mip_levels);
+
+	size_t total_size = 0;
+	for (uint32_t i = 0; i < image.mip_levels; ++i)
+	{
+		uint32_t width = std::max(decoded.width >> i, 1u);
+		uint32_t height = std::max(decoded.height >> i, 1u);
+		image.regions[i] = {
+			.bufferOffset = total_size,
+			.imageSubresource = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel = i,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			},
+			.imageOffset = {0, 0, 0 },
+			.imageExtent = {width, height, 1u}
+		};
+		total_size += (size_t)width * height * 4;
+	}
 
-	stbi_image_free(loaded_data);
+	image.storage.resize(total_size);
+	image.data = image.storage.data();
+	image.size = total_size;
+	memcpy(image.storage.data(), decoded.pixels, (size_t)decoded.width * decoded.height * 4);
 
-	return true;
+	// 2x2 box filter, color channels are averaged in linear space for sRGB textures
+	float to_linear[256];
+	for (uint32_t i = 0; i < 256; ++i)
+		to_linear[i] = is_srgb ? srgb_to_linear(i / 255.0f) : i / 255.0f;
+
+	for (uint32_t level = 1; level < image.mip_levels; ++level)
+	{
+		const VkBufferImageCopy& src_region = image.regions[level - 1];
+		const VkBufferImageCopy& dst_region = image.regions[level];
+		const uint8_t* src = image.storage.data() + src_region.bufferOffset;
+		uint8_t* dst = image.storage.data() + dst_region.bufferOffset;
+		uint32_t src_width = src_region.imageExtent.width;
+		uint32_t src_height = src_region.imageExtent.height;
+
+		for (uint32_t y = 0; y < dst_region.imageExtent.height; ++y)
+		{
+			uint32_t y0 = std::min(y * 2, src_height - 1);
+			uint32_t y1 = std::min(y * 2 + 1, src_height - 1);
+			for (uint32_t x = 0; x < dst_region.imageExtent.width; ++x)
+			{
+				uint32_t x0 = std::min(x * 2, src_width - 1);
+				uint32_t x1 = std::min(x * 2 + 1, src_width - 1);
+				const uint8_t* texels[4] = {
+					src + ((size_t)y0 * src_width + x0) * 4,
+					src + ((size_t)y0 * src_width + x1) * 4,
+					src + ((size_t)y1 * src_width + x0) * 4,
+					src + ((size_t)y1 * src_width + x1) * 4,
+				};
+
+				uint8_t* out = dst + ((size_t)y * dst_region.imageExtent.width + x) * 4;
+				for (uint32_t c = 0; c < 3; ++c)
+				{
+					float sum = to_linear[texels[0][c]] + to_linear[texels[1][c]] + to_linear[texels[2][c]] + to_linear[texels[3][c]];
+					float value = is_srgb ? linear_to_srgb(sum * 0.25f) : sum * 0.25f;
+					out[c] = (uint8_t)std::clamp(value * 255.0f + 0.5f, 0.0f, 255.0f);
+				}
+				out[3] = (uint8_t)((texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3] + 2) / 4);
+			}
+		}
+	}
 }
 
-void generate_mipmaps(const std::vector<Texture>& textures, VkDevice device, VmaAllocator allocator, VkCommandPool command_pool, VkCommandBuffer command_buffer, VkQueue queue, const Buffer& scratch)
+bool load_png_or_jpg_texture(Texture& texture, const uint8_t* data, size_t data_size, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader, bool is_srgb)
 {
-	vkResetCommandPool(device, command_pool, 0);
+	// Decoded from memory, the file read is recorded by the caller
+	LoadScope scope(LOAD_STAGE_TEXTURE, "png/jpg of " + std::to_string(data_size) + " bytes");
+	DecodedImage image;
+	if (!decode_png_or_jpg(image, data, data_size)) return false;
 
-	VkCommandBufferBeginInfo begin_info{
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-	};
-	VK_CHECK(vkBeginCommandBuffer(command_buffer, &begin_info));
+	bool result = load_decoded_texture(texture, image, device, allocator, uploader, is_srgb);
 
+	free_decoded_image(image);
+
+	return result;
+}
+
+void generate_mipmaps(VkCommandBuffer command_buffer, const std::vector<Texture>& textures)
+{
+	LoadScope scope(LOAD_STAGE_MIPMAPS, std::to_string(textures.size()) + " textures");
+
+	// Blit based fallback for when no Downsampler is available (see record_downsample).
+	// Expects every level of the textures to be in transfer dst optimal with level 0 written.
+	// The chain is built one level at a time for all textures together so that each level only
+	// needs a single barrier batch regardless of the texture count.
+	uint32_t max_levels = 0;
+	std::vector<VkImageMemoryBarrier2> barriers;
+	barriers.reserve(textures.size());
 	for (const auto& t : textures)
 	{
-		VkImageMemoryBarrier2 barrier = image_barrier(t.image,
-			0, 0, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		max_levels = std::max(max_levels, t.mip_levels);
+		barriers.push_back(image_barrier(t.image,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			{
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			}
+		));
+	}
 
-		pipeline_barrier(command_buffer, {}, { barrier });
+	pipeline_barrier(command_buffer, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
 
-		int32_t width = t.width;
-		int32_t height = t.height;
-		for (uint32_t i = 1; i < t.mip_levels; ++i)
+	for (uint32_t i = 1; i < max_levels; ++i)
+	{
+		barriers.clear();
+		for (const auto& t : textures)
 		{
-			VkImageMemoryBarrier2 prebarrier = image_barrier(t.image,
-				0, 0, VK_IMAGE_LAYOUT_UNDEFINED,
-				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				{
-					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-					.baseMipLevel = i,
-					.levelCount = 1,
-					.baseArrayLayer = 0,
-					.layerCount = 1
-				}
-			);
-
-			pipeline_barrier(command_buffer, {}, { prebarrier });
+			if (i >= t.mip_levels) continue;
 
+			int32_t width = std::max(1, (int32_t)t.width >> (i - 1));
+			int32_t height = std::max(1, (int32_t)t.height >> (i - 1));
 			int32_t mip_width = std::max(1, width >> 1);
 			int32_t mip_height = std::max(1, height >> 1);
 
@@ -858,9 +1475,9 @@ void generate_mipmaps(const std::vector<Texture>& textures, VkDevice device, Vma
 			};
 			vkCmdBlitImage(command_buffer, t.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, t.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
 
-			VkImageMemoryBarrier2 postbarrier = image_barrier(t.image,
-				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			barriers.push_back(image_barrier(t.image,
+				VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
 				{
 					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
 					.baseMipLevel = i,
@@ -868,29 +1485,19 @@ void generate_mipmaps(const std::vector<Texture>& textures, VkDevice device, Vma
 					.baseArrayLayer = 0,
 					.layerCount = 1
 				}
-			);
-
-			pipeline_barrier(command_buffer, {}, { postbarrier });
-
-			width = mip_width;
-			height = mip_height;
+			));
 		}
 
-		VkImageMemoryBarrier2 final_barrier = image_barrier(t.image,
-			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-		pipeline_barrier(command_buffer, {}, { final_barrier });
+		pipeline_barrier(command_buffer, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
 	}
 
-	VK_CHECK(vkEndCommandBuffer(command_buffer));
-
-	VkSubmitInfo submit_info{
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &command_buffer
-	};
+	barriers.clear();
+	for (const auto& t : textures)
+	{
+		barriers.push_back(image_barrier(t.image,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+	}
 
-	VK_CHECK(vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE));
-	VK_CHECK(vkDeviceWaitIdle(device));
+	pipeline_barrier(command_buffer, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
 }
@@ -42,6 +42,36 @@ struct Texture
 	}
 };
 
+// RGBA8 pixels decoded from a compressed image file on the CPU, ready to be uploaded
+struct DecodedImage
+{
+	uint8_t* pixels;
+	uint32_t width;
+	uint32_t height;
+};
+
+// Every subresource of a texture laid out for one buffer to image copy, regions are relative to data.
+// data either points into the source file or into storage when the texels had to be converted, so a
+// TextureImage that owns storage must be moved rather than copied.
+struct TextureImage
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t depth;
+	uint32_t mip_levels;
+	uint32_t array_layers;
+	VkFormat format;
+	bool is_cubemap;
+
+	std::vector<VkBufferImageCopy> regions;
+	const uint8_t* data;
+	size_t size;
+	std::vector<uint8_t> storage;
+};
+
+struct UploadBatcher;
+struct ThreadPool;
+
 VkMemoryBarrier2 memory_barrier(VkPipelineStageFlags2 src_stage_mask, VkAccessFlags2 src_access_mask, VkPipelineStageFlags2 dst_stage_mask, VkAccessFlags2 dst_access_mask);
 
 VkImageMemoryBarrier2 image_barrier(VkImage image,
@@ -60,8 +90,33 @@ void pipeline_barrier(VkCommandBuffer command_buffer,
 	uint32_t image_barrier_count = 0, const VkImageMemoryBarrier2* image_barriers = nullptr);
 
 Buffer create_buffer(VmaAllocator allocator, VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags allocation_flags = 0, void* initial_data = nullptr);
-VkImageView create_image_view(VkDevice device, VkImage image, VkImageViewType type, VkFormat format);
+// The UNORM format with the same layout as an sRGB format, other formats are returned unchanged
+VkFormat get_unorm_format(VkFormat format);
+// Bytes of one layer of a subresource with the given extent, 0 for unsupported formats
+size_t get_subresource_size(VkFormat format, uint32_t width, uint32_t height, uint32_t depth);
+// True for the block compressed formats, whose blocks cover 4x4 texels
+bool is_compressed_format(VkFormat format);
+VkImageView create_image_view(VkDevice device, VkImage image, VkImageViewType type, VkFormat format, VkImageUsageFlags usage = 0);
 Texture create_texture(VkDevice device, VmaAllocator allocator, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkImageUsageFlags usage, uint32_t mip_levels = 1, VkSampleCountFlagBits sample_count = VK_SAMPLE_COUNT_1_BIT, uint32_t array_layers = 1, bool is_cubemap = false);
-bool load_texture(Texture& texture, const char* path, VkDevice device, VmaAllocator allocator, VkCommandPool command_pool, VkCommandBuffer command_buffer, VkQueue queue, const Buffer& scratch, bool is_srgb = false);
-bool load_png_or_jpg_texture(Texture& texture, const uint8_t* data, size_t data_size, VkDevice device, VmaAllocator allocator, VkCommandPool command_pool, VkCommandBuffer command_buffer, VkQueue queue, const Buffer& scratch, bool is_srgb = false);
-void generate_mipmaps(const std::vector<Texture>& textures, VkDevice device, VmaAllocator allocator, VkCommandPool command_pool, VkCommandBuffer command_buffer, VkQueue queue, const Buffer& scratch);
+bool load_texture(Texture& texture, const char* path, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader, bool is_srgb = false);
+bool load_dds_texture(Texture& texture, const uint8_t* data, size_t data_size, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader, bool is_srgb = false);
+// Loads a DDS or KTX2 file, told apart by their magic
+bool load_texture_data(Texture& texture, const uint8_t* data, size_t data_size, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader, bool is_srgb = false, ThreadPool* thread_pool = nullptr);
+bool parse_dds(TextureImage& image, const uint8_t* data, size_t data_size, bool is_srgb = false);
+// Uncompressed KTX2 levels are referenced in place, zstd supercompressed levels are decompressed into
+// storage, in parallel when a thread pool is given (which must not be done from inside a pool job).
+// is_srgb selects the sRGB variant of UNORM formats, as for legacy DDS headers.
+bool parse_ktx2(TextureImage& image, const uint8_t* data, size_t data_size, bool is_srgb = false, ThreadPool* thread_pool = nullptr);
+bool parse_texture(TextureImage& image, const uint8_t* data, size_t data_size, bool is_srgb = false, ThreadPool* thread_pool = nullptr);
+bool load_texture_image(Texture& texture, const TextureImage& image, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader);
+// Writes a single 2D texture with its mip chain as a DX10 DDS file that parse_dds can read back
+bool write_dds(const char* path, const TextureImage& image);
+// Writes a texture with its mip chain as KTX2, every level as its own zstd frame if supercompress is set
+bool write_ktx2(const char* path, const TextureImage& image, bool supercompress);
+bool load_png_or_jpg_texture(Texture& texture, const uint8_t* data, size_t data_size, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader, bool is_srgb = false);
+bool decode_png_or_jpg(DecodedImage& image, const uint8_t* data, size_t data_size);
+void free_decoded_image(DecodedImage& image);
+bool load_decoded_texture(Texture& texture, const DecodedImage& image, VkDevice device, VmaAllocator allocator, UploadBatcher& uploader, bool is_srgb = false);
+// Builds the full RGBA8 mip chain of a decoded image on the CPU, for offline cooking.
+void build_mip_chain(TextureImage& image, const DecodedImage& decoded, bool is_srgb);
+void generate_mipmaps(VkCommandBuffer command_buffer, const std::vector<Texture>& textures);
@@ -1,23 +1,55 @@
+#include "mesh_optimizer.h"
+#include "load_telemetry.h"
+#include "mesh_simplifier.h"
 #include "scene.h"
+#include "tangents.h"
+#include "texture_cache.h"
+#include "texture_streaming.h"
+#include "thread_pool.h"
+#include "upload.h"
 #define CGLTF_IMPLEMENTATION
 #include "cgltf.h"
 #include <glm/gtc/type_ptr.hpp>
 #include <algorithm>
+#include <filesystem>
 
-bool load_scene(
+// Writes the first count elements of a float accessor to dst, stride bytes apart. Float data is copied
+// straight out of the buffer view, normalized integers are converted by cgltf element by element.
+static void unpack_floats_strided(const cgltf_accessor* accessor, uint32_t component_count, float* dst, size_t stride, size_t count)
+{
+	count = std::min(count, (size_t)accessor->count);
+	uint8_t* out = (uint8_t*)dst;
+
+	if (accessor->is_sparse)
+	{
+		// Sparse accessors can only be unpacked as a whole
+		std::vector<float> unpacked(accessor->count * component_count);
+		cgltf_accessor_unpack_floats(accessor, unpacked.data(), unpacked.size());
+		for (size_t i = 0; i < count; ++i)
+			memcpy(out + i * stride, &unpacked[i * component_count], component_count * sizeof(float));
+	}
+	else if (accessor->buffer_view && accessor->component_type == cgltf_component_type_r_32f)
+	{
+		const uint8_t* src = (const uint8_t*)cgltf_buffer_view_data(accessor->buffer_view) + accessor->offset;
+		for (size_t i = 0; i < count; ++i)
+			memcpy(out + i * stride, src + i * accessor->stride, component_count * sizeof(float));
+	}
+	else
+	{
+		for (size_t i = 0; i < count; ++i)
+			cgltf_accessor_read_float(accessor, i, (float*)(out + i * stride), component_count);
+	}
+}
+
+cgltf_data* import_gltf(
 	const char* path,
 	std::vector<Mesh>& meshes,
 	std::vector<Material>& materials,
-	std::vector<Texture>& textures,
 	std::vector<Vertex>& vertices,
 	std::vector<uint32_t>& indices,
 	std::vector<MeshDraw>& mesh_draws,
-	VkDevice device,
-	VmaAllocator allocator,
-	VkCommandPool command_pool,
-	VkCommandBuffer command_buffer,
-	VkQueue queue,
-	const Buffer& scratch)
+	std::vector<SceneImage>& images,
+	ThreadPool* thread_pool)
 {
 	meshes.clear();
 	indices.clear();
@@ -30,85 +62,106 @@ bool load_scene(
 	if (res != cgltf_result_success)
 	{
 		printf("Failed to load file '%s'\n", path);
-		return false;
+		return nullptr;
 	}
 
 	res = cgltf_load_buffers(&options, data, path);
 	if (res != cgltf_result_success)
 	{
 		printf("Failed to load buffers for file '%s'\n", path);
-		return false;
+		cgltf_free(data);
+		return nullptr;
 	}
 
-	// Load meshes
+	// Geometry is extracted in two passes. The first sizes every primitive and places it in the final
+	// vertex and index arrays, the second unpacks the attributes of all primitives in parallel straight
+	// into their ranges.
+	double extract_start_ms = get_time_ms();
+	std::vector<const cgltf_primitive*> primitives;
+	std::vector<uint32_t> tangent_meshes; // Primitives with normals and uvs but without tangents
+	std::vector<uint32_t> first_meshes(data->meshes_count); // Mesh of the first primitive of every glTF mesh
+	size_t vertex_count = 0;
+	size_t index_count = 0;
 	for (uint32_t i = 0; i < data->meshes_count; ++i)
 	{
 		const cgltf_mesh& mesh = data->meshes[i];
+		first_meshes[i] = (uint32_t)meshes.size();
 		for (uint32_t j = 0; j < mesh.primitives_count; ++j)
 		{
 			const cgltf_primitive& prim = mesh.primitives[j];
-			uint32_t first_vertex = (uint32_t)vertices.size();
-			uint32_t vertex_count = (uint32_t)prim.attributes[0].data->count;
-			uint32_t first_index = (uint32_t)indices.size();
-			uint32_t index_count = (uint32_t)prim.indices->count;	
-
 			Mesh m{
-				.first_vertex = first_vertex,
-				.vertex_count = vertex_count,
-				.first_index = first_index,
-				.index_count = index_count
+				.first_vertex = (uint32_t)vertex_count,
+				.vertex_count = (uint32_t)prim.attributes[0].data->count,
+				.first_index = (uint32_t)index_count,
+				.index_count = (uint32_t)prim.indices->count
 			};
 
-			meshes.push_back(m);
+			if (!cgltf_find_accessor(&prim, cgltf_attribute_type_tangent, 0) && cgltf_find_accessor(&prim, cgltf_attribute_type_normal, 0)
+				&& cgltf_find_accessor(&prim, cgltf_attribute_type_texcoord, 0))
+				tangent_meshes.push_back((uint32_t)meshes.size());
 
-			indices.resize(first_index + prim.indices->count);
-			cgltf_accessor_unpack_indices(prim.indices, indices.data() + first_index, sizeof(uint32_t), index_count);
-			std::vector<Vertex> verts(prim.attributes[0].data->count);
-			if (const cgltf_accessor* pos = cgltf_find_accessor(&prim, cgltf_attribute_type_position, 0))
-			{
-				assert(cgltf_num_components(pos->type) == 3);
-				std::vector<glm::vec3> positions(pos->count);
-				cgltf_accessor_unpack_floats(pos, glm::value_ptr(positions[0]), positions.size() * 3);
-				for (uint32_t i = 0; i < positions.size(); ++i)
-				{
-					verts[i].position = positions[i];
-				}
-			}
-			if (const cgltf_accessor* normal = cgltf_find_accessor(&prim, cgltf_attribute_type_normal, 0))
-			{
-				assert(cgltf_num_components(normal->type) == 3);
-				std::vector<glm::vec3> normals(normal->count);
-				cgltf_accessor_unpack_floats(normal, glm::value_ptr(normals[0]), normals.size() * 3);
-				for (uint32_t i = 0; i < normals.size(); ++i)
-				{
-					verts[i].normal = normals[i];
-				}
-			}
-			if (const cgltf_accessor* tan = cgltf_find_accessor(&prim, cgltf_attribute_type_tangent, 0))
-			{
-				assert(cgltf_num_components(tan->type) == 4);
-				std::vector<glm::vec4> tangents(tan->count);
-				cgltf_accessor_unpack_floats(tan, glm::value_ptr(tangents[0]), tangents.size() * 4);
-				for (uint32_t i = 0; i < tangents.size(); ++i)
-				{
-					verts[i].tangent = tangents[i];
-				}
-			}
-			if (const cgltf_accessor* uv = cgltf_find_accessor(&prim, cgltf_attribute_type_texcoord, 0))
-			{
-				assert(cgltf_num_components(uv->type) == 2);
-				std::vector<glm::vec2> uvs(uv->count);
-				cgltf_accessor_unpack_floats(uv, glm::value_ptr(uvs[0]), uvs.size() * 2);
-				for (uint32_t i = 0; i < uvs.size(); ++i)
-				{
-					verts[i].uv = uvs[i];
-				}
-			}
-			vertices.insert(vertices.end(), verts.begin(), verts.end());
+			meshes.push_back(m);
+			primitives.push_back(&prim);
+			vertex_count += m.vertex_count;
+			index_count += m.index_count;
 		}
 	}
 
+	vertices.resize(vertex_count);
+	indices.resize(index_count);
+
+	auto extract_primitive = [&](uint32_t i) {
+		const cgltf_primitive& prim = *primitives[i];
+		const Mesh& m = meshes[i];
+		cgltf_accessor_unpack_indices(prim.indices, indices.data() + m.first_index, sizeof(uint32_t), m.index_count);
+
+		Vertex* verts = vertices.data() + m.first_vertex;
+		if (const cgltf_accessor* pos = cgltf_find_accessor(&prim, cgltf_attribute_type_position, 0))
+		{
+			assert(cgltf_num_components(pos->type) == 3);
+			unpack_floats_strided(pos, 3, glm::value_ptr(verts[0].position), sizeof(Vertex), m.vertex_count);
+		}
+		if (const cgltf_accessor* normal = cgltf_find_accessor(&prim, cgltf_attribute_type_normal, 0))
+		{
+			assert(cgltf_num_components(normal->type) == 3);
+			unpack_floats_strided(normal, 3, glm::value_ptr(verts[0].normal), sizeof(Vertex), m.vertex_count);
+		}
+		if (const cgltf_accessor* tan = cgltf_find_accessor(&prim, cgltf_attribute_type_tangent, 0))
+		{
+			assert(cgltf_num_components(tan->type) == 4);
+			unpack_floats_strided(tan, 4, glm::value_ptr(verts[0].tangent), sizeof(Vertex), m.vertex_count);
+		}
+		if (const cgltf_accessor* uv = cgltf_find_accessor(&prim, cgltf_attribute_type_texcoord, 0))
+		{
+			assert(cgltf_num_components(uv->type) == 2);
+			unpack_floats_strided(uv, 2, glm::value_ptr(verts[0].uv), sizeof(Vertex), m.vertex_count);
+		}
+	};
+
+	if (thread_pool)
+		parallel_for(*thread_pool, (uint32_t)primitives.size(), extract_primitive);
+	else
+		for (uint32_t i = 0; i < (uint32_t)primitives.size(); ++i)
+			extract_primitive(i);
+
+	printf("Extracted %u primitives (%zu vertices, %zu indices) in %.2f ms\n",
+		(uint32_t)primitives.size(), vertex_count, index_count, get_time_ms() - extract_start_ms);
+
+	generate_tangents(meshes, tangent_meshes, vertices, indices, thread_pool);
+	optimize_meshes(meshes, 0, vertices, indices, thread_pool);
+	build_mesh_lods(meshes, 0, vertices, indices, thread_pool);
+
+	// Material slots every texture is bound to, they decide its block compression format
+	enum TextureSlot
+	{
+		SLOT_BASECOLOR = 1 << 0,
+		SLOT_NORMAL = 1 << 1,
+		SLOT_OCCLUSION = 1 << 2,
+		SLOT_OTHER = 1 << 3,
+	};
+
 	std::vector<bool> texture_is_srgb(data->textures_count);
+	std::vector<uint32_t> texture_slots(data->textures_count);
 	for (uint32_t i = 0; i < data->materials_count; ++i)
 	{
 		const cgltf_material& m = data->materials[i];
@@ -135,6 +188,11 @@ bool load_scene(
 		int occlusion_index = m.occlusion_texture.texture ? (int)cgltf_texture_index(data, m.occlusion_texture.texture) : -1;
 		if (basecolor_index >= 0) texture_is_srgb[basecolor_index] = true;
 		if (emissive_index >= 0) texture_is_srgb[emissive_index] = true;
+		if (basecolor_index >= 0) texture_slots[basecolor_index] |= SLOT_BASECOLOR;
+		if (normal_index >= 0) texture_slots[normal_index] |= SLOT_NORMAL;
+		if (occlusion_index >= 0) texture_slots[occlusion_index] |= SLOT_OCCLUSION;
+		if (metallic_roughness_index >= 0) texture_slots[metallic_roughness_index] |= SLOT_OTHER;
+		if (emissive_index >= 0) texture_slots[emissive_index] |= SLOT_OTHER;
 		Material mat{
 			.type = type,
 			.basecolor_texture = basecolor_index,
@@ -152,43 +210,242 @@ bool load_scene(
 		materials.push_back(mat);
 	}
 
+	images.clear();
 	for (uint32_t i = 0; i < data->textures_count; ++i)
 	{
-		const cgltf_texture& t = data->textures[i];
-
-		size_t size = t.image->buffer_view->size;
-		const uint8_t* data = cgltf_buffer_view_data(t.image->buffer_view);
+		// Textures shared between conflicting slots fall back to the format that keeps the most channels
+		uint32_t slots = texture_slots[i];
+		TextureUsage usage = TEXTURE_USAGE_PACKED;
+		if ((slots & SLOT_BASECOLOR) || ((slots & SLOT_NORMAL) && slots != SLOT_NORMAL))
+			usage = TEXTURE_USAGE_COLOR;
+		else if (slots == SLOT_NORMAL)
+			usage = TEXTURE_USAGE_NORMAL;
+		else if (slots == SLOT_OCCLUSION)
+			usage = TEXTURE_USAGE_SINGLE_CHANNEL;
 
-		bool is_srgb = texture_is_srgb[i];
-		Texture tex;
-		if (!load_png_or_jpg_texture(tex, data, size, device, allocator, command_pool, command_buffer, queue, scratch, is_srgb))
-		{
-			printf("Failed to load texture\n");
-			return false;
-		}
-
-		textures.push_back(tex);
+		const cgltf_buffer_view* view = data->textures[i].image->buffer_view;
+		images.push_back({
+			.data = cgltf_buffer_view_data(view),
+			.size = view->size,
+			.is_srgb = texture_is_srgb[i],
+			.usage = usage
+		});
 	}
 
-	generate_mipmaps(textures, device, allocator, command_pool, command_buffer, queue, scratch);
-
 	for (size_t i = 0; i < data->nodes_count; ++i)
 	{
 		const cgltf_node& node = data->nodes[i];
 		if (node.mesh)
 		{
-			assert(node.mesh->primitives_count == 1);
 			glm::mat4 transform;
 			cgltf_node_transform_world(&node, glm::value_ptr(transform));
-			MeshDraw draw{
-				.transform = transform,
-				.mesh_index = (uint32_t)cgltf_mesh_index(data, node.mesh),
-				.material_index = (int)cgltf_material_index(data, node.mesh->primitives[0].material)
-			};
 
-			mesh_draws.push_back(draw);
+			// Every primitive was extracted into its own mesh, draw each with its own material
+			uint32_t first_mesh = first_meshes[cgltf_mesh_index(data, node.mesh)];
+			for (uint32_t j = 0; j < node.mesh->primitives_count; ++j)
+			{
+				MeshDraw draw{
+					.transform = transform,
+					.mesh_index = first_mesh + j,
+					.material_index = (int)cgltf_material_index(data, node.mesh->primitives[j].material)
+				};
+
+				mesh_draws.push_back(draw);
+			}
+		}
+	}
+
+	return data;
+}
+
+void free_gltf(cgltf_data* data)
+{
+	cgltf_free(data);
+}
+
+static bool hash_file(const char* path, uint64_t& hash)
+{
+	MappedFile file;
+	if (!map_file(file, path))
+		return false;
+
+	hash = hash_bytes(file.data, file.size, hash);
+	unmap_file(file);
+	return true;
+}
+
+bool hash_gltf_files(const char* path, uint64_t& hash)
+{
+	hash = 0;
+	if (!hash_file(path, hash))
+		return false;
+
+	// Only the JSON is parsed, .glb files keep everything in their binary chunk
+	cgltf_options options = {};
+	cgltf_data* data = nullptr;
+	if (cgltf_parse_file(&options, path, &data) != cgltf_result_success)
+		return false;
+
+	std::filesystem::path directory = std::filesystem::path(path).parent_path();
+	bool success = true;
+	auto hash_uri = [&](const char* uri) {
+		if (!uri || strncmp(uri, "data:", 5) == 0)
+			return;
+
+		std::string decoded = uri;
+		decoded.resize(cgltf_decode_uri(decoded.data()));
+		success = success && hash_file((directory / decoded).string().c_str(), hash);
+	};
+	for (size_t i = 0; i < data->buffers_count; ++i)
+		hash_uri(data->buffers[i].uri);
+	for (size_t i = 0; i < data->images_count; ++i)
+		hash_uri(data->images[i].uri);
+
+	cgltf_free(data);
+	return success;
+}
+
+bool load_scene(
+	const char* path,
+	std::vector<Mesh>& meshes,
+	std::vector<Material>& materials,
+	std::vector<Texture>& textures,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<MeshDraw>& mesh_draws,
+	VkDevice device,
+	VmaAllocator allocator,
+	UploadBatcher& uploader,
+	ThreadPool& thread_pool,
+	bool compress_textures,
+	TextureStreamer* streamer,
+	TextureCache* texture_cache)
+{
+	LoadScope scope(LOAD_STAGE_SCENE, path);
+	size_t first_material = materials.size();
+	std::vector<SceneImage> images;
+	cgltf_data* data = import_gltf(path, meshes, materials, vertices, indices, mesh_draws, images, &thread_pool);
+	if (!data)
+		return false;
+
+	// Texture entries with the same image, or an image a previous scene loaded through the cache, share a slot.
+	// Only the remaining images are decoded and uploaded.
+	TextureCache scene_cache{};
+	TextureCache& cache = texture_cache ? *texture_cache : scene_cache;
+	uint32_t deduplicated_count = cache.deduplicated_count;
+	size_t deduplicated_bytes = cache.deduplicated_bytes;
+	size_t first_texture = textures.size();
+	std::vector<uint32_t> texture_indices;
+	std::vector<uint32_t> unique_images;
+	deduplicate_scene_images(cache, images, (uint32_t)first_texture, compress_textures, texture_indices, unique_images, &thread_pool);
+	remap_material_textures(materials, first_material, texture_indices);
+
+	// Images are decoded in parallel on the thread pool. Each one is handed to the upload batcher on this
+	// thread as soon as its decode finishes, so uploads overlap with the decoding of the remaining images.
+	// With compress_textures the workers also build the mip chain and block compress it (or read the
+	// result back from the texture cache).
+	struct DecodeResult
+	{
+		DecodedImage image;
+		TextureImage compressed; // Or the uncompressed mip chain of a streamed texture
+		bool success;
+		double decode_ms;
+	};
+
+	// Decode results and slots are indexed by unique image
+	double decode_start_ms = get_time_ms();
+	std::vector<DecodeResult> decoded(unique_images.size());
+	std::deque<uint32_t> decoded_queue;
+	std::mutex decoded_mutex;
+	std::condition_variable decoded_signal;
+	for (uint32_t i = 0; i < (uint32_t)unique_images.size(); ++i)
+	{
+		thread_pool_submit(thread_pool, [&, i]() {
+			const SceneImage& image = images[unique_images[i]];
+			double start_ms = get_time_ms();
+			decoded[i].success = compress_textures
+				? import_compressed_texture(decoded[i].compressed, image.data, image.size, image.usage, image.is_srgb)
+				: decode_png_or_jpg(decoded[i].image, image.data, image.size);
+
+			// Streamed textures need every level on the CPU
+			if (decoded[i].success && !compress_textures && streamer)
+			{
+				build_mip_chain(decoded[i].compressed, decoded[i].image, image.is_srgb);
+				free_decoded_image(decoded[i].image);
+			}
+			decoded[i].decode_ms = get_time_ms() - start_ms;
+
+			// Notify under the lock, the condition variable lives on the loading thread's stack
+			std::lock_guard<std::mutex> lock(decoded_mutex);
+			decoded_queue.push_back(i);
+			decoded_signal.notify_one();
+		});
+	}
+
+	textures.resize(first_texture + unique_images.size());
+
+	bool textures_loaded = true;
+	double decode_cpu_ms = 0.0;
+	double upload_ms = 0.0;
+	size_t compressed_bytes = 0;
+	size_t uncompressed_bytes = 0;
+	for (uint32_t n = 0; n < (uint32_t)unique_images.size(); ++n)
+	{
+		uint32_t i;
+		{
+			std::unique_lock<std::mutex> lock(decoded_mutex);
+			decoded_signal.wait(lock, [&] { return !decoded_queue.empty(); });
+			i = decoded_queue.front();
+			decoded_queue.pop_front();
 		}
+
+		// Keep draining after a failure, the decode jobs reference this stack frame
+		DecodeResult& result = decoded[i];
+		decode_cpu_ms += result.decode_ms;
+		if (!result.success)
+		{
+			printf("Failed to load texture\n");
+			textures_loaded = false;
+			continue;
+		}
+
+		double upload_start_ms = get_time_ms();
+		if (compress_textures)
+		{
+			compressed_bytes += result.compressed.size;
+			for (const VkBufferImageCopy& region : result.compressed.regions)
+				uncompressed_bytes += (size_t)region.imageExtent.width * region.imageExtent.height * 4;
+
+			if (streamer)
+				stream_texture_image(*streamer, textures[first_texture + i], (uint32_t)(first_texture + i), std::move(result.compressed), uploader);
+			else
+				load_texture_image(textures[first_texture + i], result.compressed, device, allocator, uploader);
+			result.compressed = {};
+		}
+		else if (streamer)
+		{
+			stream_texture_image(*streamer, textures[first_texture + i], (uint32_t)(first_texture + i), std::move(result.compressed), uploader);
+		}
+		else
+		{
+			load_decoded_texture(textures[first_texture + i], result.image, device, allocator, uploader, images[unique_images[i]].is_srgb);
+			free_decoded_image(result.image);
+		}
+		upload_ms += get_time_ms() - upload_start_ms;
 	}
 
-    return true;
+	double flush_start_ms = get_time_ms();
+	upload_batcher_flush(uploader);
+	upload_ms += get_time_ms() - flush_start_ms;
+
+	printf("Loaded %u textures on %u decode workers in %.2f ms (decode %.2f ms CPU time, upload %.2f ms)\n",
+		(uint32_t)unique_images.size(), thread_pool.worker_count(), get_time_ms() - decode_start_ms, decode_cpu_ms, upload_ms);
+	printf("Texture cache: %u of %u textures shared, %.2f MB of images not decoded again\n",
+		cache.deduplicated_count - deduplicated_count, (uint32_t)images.size(), (cache.deduplicated_bytes - deduplicated_bytes) / (1024.0 * 1024.0));
+	if (compress_textures)
+		printf("Texture memory: %.2f MB block compressed, %.2f MB as RGBA8\n", compressed_bytes / (1024.0 * 1024.0), uncompressed_bytes / (1024.0 * 1024.0));
+
+	free_gltf(data);
+
+	return textures_loaded;
 }
@@ -1,8 +1,15 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include <glm/glm.hpp>
 #include "resources.h"
+#include "texture_compression.h"
+
+struct ThreadPool;
+struct TextureCache;
+struct TextureStreamer;
+struct cgltf_data;
 
 struct Vertex
 {
@@ -12,14 +19,32 @@ struct Vertex
 	glm::vec2 uv;
 };
 
+// Levels of detail of a mesh, the full mesh included
+static constexpr uint32_t MESH_MAX_LODS = 5;
+
+struct MeshLod
+{
+	uint32_t first_index;
+	uint32_t index_count;
+	float error; // Object space distance the level may deviate from the full mesh by, attribute changes included
+};
+
 struct Mesh
 {
 	uint32_t first_vertex;
 	uint32_t vertex_count;
 	uint32_t first_index;
 	uint32_t index_count;
+	uint32_t lod_count;              // Simplified levels in lods, see build_mesh_lods
+	MeshLod lods[MESH_MAX_LODS - 1]; // Coarser with every level, indices are relative to first_vertex as well
 };
 
+// Level 0 is the full mesh
+inline MeshLod get_mesh_lod(const Mesh& mesh, uint32_t level)
+{
+	return level == 0 ? MeshLod{ mesh.first_index, mesh.index_count, 0.0f } : mesh.lods[level - 1];
+}
+
 struct MeshDraw
 {
 	glm::mat4 transform;
@@ -51,6 +76,12 @@ struct Material
 	float metallic_factor;
 	float roughness_factor;
 };
+
+// Eyes and the standard materials of the sdkmesh scenes stay out of the shadow maps
+inline bool casts_shadows(const Material& material)
+{
+	return material.type != Material::EYES && material.type != Material::STANDARD;
+}
 	
 bool load_scene(
 	const char* path, 
@@ -62,7 +93,76 @@ bool load_scene(
 	std::vector<MeshDraw>& mesh_draws,
 	VkDevice device, 
 	VmaAllocator allocator, 
-	VkCommandPool command_pool, 
-	VkCommandBuffer command_buffer, 
-	VkQueue queue, 
-	const Buffer& scratch);
+	UploadBatcher& uploader,
+	ThreadPool& thread_pool,
+	bool compress_textures = false,
+	TextureStreamer* streamer = nullptr,
+	TextureCache* texture_cache = nullptr);
+
+// Encoded image referenced by a glTF scene. The bytes live inside the parsed glTF buffers.
+struct SceneImage
+{
+	const uint8_t* data;
+	size_t size;
+	bool is_srgb;
+	TextureUsage usage;
+};
+
+// Texture names referenced by a material of an sdkmesh file, relative to the file's directory.
+struct SdkMeshTextures
+{
+	std::string diffuse;
+	std::string normal;
+};
+
+// The specular/AO map of sdkmesh characters is not referenced by the file itself
+static constexpr const char* SDKMESH_SPECULAR_TEXTURE = "SpecularAOMap.dds";
+
+// Parses a glTF file into CPU side scene data without touching the GPU. Primitives without tangents get them
+// from generate_tangents, meshes then go through optimize_meshes and build_mesh_lods.
+// The returned data keeps the image bytes alive and has to be released with free_gltf. Returns nullptr on failure.
+cgltf_data* import_gltf(
+	const char* path,
+	std::vector<Mesh>& meshes,
+	std::vector<Material>& materials,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<MeshDraw>& mesh_draws,
+	std::vector<SceneImage>& images,
+	ThreadPool* thread_pool = nullptr);
+void free_gltf(cgltf_data* data);
+
+// Hash of a glTF file and of the external buffers and images it references, for content keyed caches.
+// Returns false if any of them cannot be read.
+bool hash_gltf_files(const char* path, uint64_t& hash);
+
+// Converts an sdkmesh file to the engine's vertex format and winding. Every vertex and index buffer is
+// converted once (16 and 32 bit indices), every triangle list subset becomes a Mesh and every frame
+// referencing a mesh adds a MeshDraw per subset with the frame's world transform. Everything is
+// appended, draws reference the appended meshes and their material_index the appended materials
+// (-1 for subsets without one). Large buffers are converted on the thread pool when one is given, the
+// appended meshes are optimized with optimize_meshes and get levels of detail from build_mesh_lods.
+bool import_sdkmesh(
+	const uint8_t* data,
+	size_t size,
+	std::vector<Mesh>& meshes,
+	std::vector<MeshDraw>& mesh_draws,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<SdkMeshTextures>& materials,
+	ThreadPool* thread_pool = nullptr);
+
+// Imports an sdkmesh character with a skin material per sdkmesh material. Every material references
+// the shared specular texture at first_texture and its diffuse and normal textures, listed in textures,
+// at first_texture + 1 + 2 * i and first_texture + 2 + 2 * i.
+bool import_sdkmesh_scene(
+	const uint8_t* data,
+	size_t size,
+	std::vector<Mesh>& meshes,
+	std::vector<Material>& materials,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<MeshDraw>& mesh_draws,
+	int first_texture,
+	std::vector<SdkMeshTextures>& textures,
+	ThreadPool* thread_pool = nullptr);
@@ -0,0 +1,525 @@
+#include "scene_manager.h"
+#include "hot_reload.h"
+#include "residency.h"
+#include "texture_cache.h"
+#include "texture_streaming.h"
+#include "thread_pool.h"
+#include "upload.h"
+
+#include <algorithm>
+
+static std::filesystem::path get_texture_path(std::filesystem::path path)
+{
+	// A .ktx2 converted by the cooker next to the original is smaller on disk and preferred
+	std::filesystem::path ktx2_path = path;
+	ktx2_path.replace_extension(".ktx2");
+	return std::filesystem::exists(ktx2_path) ? ktx2_path : path;
+}
+
+// The image owns its data, key receives the texture cache key of the file when given
+static bool read_texture_file(const std::filesystem::path& path, bool is_srgb, TextureImage& image, uint64_t* key, ThreadPool& thread_pool)
+{
+	std::vector<uint8_t> data;
+	if (!read_binary_file(path.string().c_str(), data) || !parse_texture(image, data.data(), data.size(), is_srgb, &thread_pool))
+	{
+		printf("Failed to load texture: %s\n", path.string().c_str());
+		return false;
+	}
+
+	if (key)
+		*key = get_texture_cache_key(data.data(), data.size(), is_srgb);
+
+	// Images parsed in place point into the file
+	if (image.storage.empty())
+	{
+		image.storage.assign(image.data, image.data + image.size);
+		image.data = image.storage.data();
+	}
+	return true;
+}
+
+// Textures are deduplicated and keyed by file the way the startup load does it
+static bool import_sdkmesh_file(SceneManager::Import& import, ThreadPool& thread_pool)
+{
+	PackContents& contents = import.contents;
+	std::vector<uint8_t> data;
+	std::vector<SdkMeshTextures> sdkmesh_textures;
+	if (!read_binary_file(import.path.c_str(), data)
+		|| !import_sdkmesh_scene(data.data(), data.size(), contents.meshes, contents.materials, contents.vertices, contents.indices, contents.mesh_draws,
+			0, sdkmesh_textures, &thread_pool))
+	{
+		printf("Failed to load sdkmesh\n");
+		return false;
+	}
+
+	std::filesystem::path directory = std::filesystem::path(import.path).parent_path();
+	std::vector<std::pair<std::filesystem::path, bool>> files;
+	std::vector<uint32_t> texture_indices; // File per texture reference of import_sdkmesh_scene
+	auto add_texture = [&](const std::filesystem::path& path, bool is_srgb) {
+		auto file = std::find(files.begin(), files.end(), std::make_pair(get_texture_path(path), is_srgb));
+		texture_indices.push_back((uint32_t)(file - files.begin()));
+		if (file == files.end())
+			files.push_back({ get_texture_path(path), is_srgb });
+	};
+	add_texture(directory / SDKMESH_SPECULAR_TEXTURE, false);
+	for (const SdkMeshTextures& textures : sdkmesh_textures)
+	{
+		add_texture(directory / textures.diffuse, true);
+		add_texture(directory / textures.normal, false);
+	}
+	remap_material_textures(contents.materials, 0, texture_indices);
+
+	contents.textures.resize(files.size());
+	import.texture_keys.resize(files.size());
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (!read_texture_file(files[i].first, files[i].second, contents.textures[i], &import.texture_keys[i], thread_pool))
+			return false;
+	}
+	return true;
+}
+
+static bool import_scene(SceneManager::Import& import, ThreadPool& thread_pool, bool compress_textures, bool cache_scenes)
+{
+	std::filesystem::path ext = std::filesystem::path(import.path).extension();
+	PackContents& contents = import.contents;
+	bool success = false;
+	if (ext == ".glb" || ext == ".gltf")
+	{
+		success = cache_scenes
+			? import_cached_gltf(import.path.c_str(), contents, thread_pool, compress_textures)
+			: cook_gltf(import.path.c_str(), contents, thread_pool, compress_textures);
+	}
+	else if (ext == ".rxpak")
+		success = read_pack(import.path.c_str(), contents);
+	else if (ext == ".sdkmesh")
+		success = import_sdkmesh_file(import, thread_pool);
+	else
+		printf("Unsupported file format: %s\n", ext.string().c_str());
+
+	if (!success || contents.indices.empty())
+		return false;
+
+	// Cooked payloads are keyed like load_pack keys them, so they share textures with packs and cached scenes
+	if (import.texture_keys.empty())
+	{
+		for (const TextureImage& image : contents.textures)
+			import.texture_keys.push_back(get_texture_cache_key(image.data, image.size, false, image.format));
+	}
+
+	// Packs and cached scenes hold their geometry already built
+	if (has_built_geometry(contents))
+	{
+		import.geometry = std::move(contents.geometry);
+		import.geometry_data = std::move(contents.geometry_data);
+	}
+	else
+		build_geometry(import.geometry, import.geometry_data, contents.meshes, contents.vertices, contents.indices);
+	contents.geometry = {};
+	contents.geometry_data = {};
+	return true;
+}
+
+// Reads the bake of the image from the environment cache, or decodes the image for update_scene_manager to bake
+static bool import_hdr_environment(SceneManager::Import& import)
+{
+	std::vector<uint8_t> data;
+	if (!read_binary_file(import.path.c_str(), data))
+	{
+		printf("Failed to load file '%s'\n", import.path.c_str());
+		return false;
+	}
+
+	import.cache_path = get_environment_cache_path(data.data(), data.size());
+	std::error_code error;
+	if (std::filesystem::exists(import.cache_path, error))
+	{
+		if (read_pack(import.cache_path.c_str(), import.contents) && import.contents.textures.size() == 3 && !import.contents.meshes.empty())
+		{
+			printf("Read '%s' from the environment cache\n", import.path.c_str());
+			return true;
+		}
+		printf("Ignoring invalid environment cache entry %s\n", import.cache_path.c_str());
+		import.contents = {};
+	}
+
+	if (!decode_hdr_image(import.hdr, data.data(), data.size()))
+		return false;
+
+	generate_sky_box(import.contents.meshes, import.contents.vertices, import.contents.indices);
+	return true;
+}
+
+static bool import_environment(SceneManager::Import& import, ThreadPool& thread_pool)
+{
+	if (std::filesystem::path(import.path).extension() == ".hdr")
+		return import_hdr_environment(import);
+
+	std::filesystem::path directory = import.path;
+	PackContents& contents = import.contents;
+
+	// The sky dome is drawn as a single mesh with the texture of its first material
+	std::vector<uint8_t> data;
+	std::vector<SdkMeshTextures> sdkmesh_textures;
+	if (!read_binary_file((directory / "SkyDome.sdkmesh").string().c_str(), data)
+		|| !import_sdkmesh(data.data(), data.size(), contents.meshes, contents.mesh_draws, contents.vertices, contents.indices, sdkmesh_textures, &thread_pool)
+		|| contents.meshes.empty() || sdkmesh_textures.empty())
+	{
+		printf("Failed to load sdkmesh\n");
+		return false;
+	}
+
+	import.texture_paths = {
+		get_texture_path(directory / "IrradianceMap.dds"),
+		get_texture_path(directory / "ReflectionMap.dds"),
+		get_texture_path(directory / sdkmesh_textures[0].diffuse),
+	};
+	contents.textures.resize(import.texture_paths.size());
+	for (size_t i = 0; i < import.texture_paths.size(); ++i)
+	{
+		if (!read_texture_file(import.texture_paths[i], i == 2, contents.textures[i], nullptr, thread_pool))
+			return false;
+	}
+	return true;
+}
+
+// Scenes are switched to before environments
+static void start_import(SceneManager& manager)
+{
+	if (manager.queued_scene.empty() && manager.queued_environment.empty())
+		return;
+
+	manager.import = {};
+	manager.import.is_environment = manager.queued_scene.empty();
+	manager.import.path = manager.import.is_environment ? manager.queued_environment.string() : manager.queued_scene;
+	manager.import.start_ms = get_time_ms();
+	if (manager.import.is_environment)
+		manager.queued_environment.clear();
+	else
+		manager.queued_scene.clear();
+
+	printf("Loading '%s' in the background\n", manager.import.path.c_str());
+
+	// Still writing the cache entry of the last bake
+	if (manager.import_thread.joinable())
+		manager.import_thread.join();
+
+	// A thread of its own rather than a pool job, the import spreads its own work over the pool
+	manager.state = SceneManager::SCENE_MANAGER_IMPORTING;
+	manager.import_done.store(false);
+	manager.import_thread = std::thread([&manager]() {
+		SceneManager::Import& import = manager.import;
+		import.success = import.is_environment
+			? import_environment(import, *manager.thread_pool)
+			: import_scene(import, *manager.thread_pool, manager.compress_textures, manager.cache_scenes);
+		manager.import_done.store(true, std::memory_order_release);
+	});
+}
+
+// Gives every texture of the import a slot, that of a cached texture with the same content where there is one
+static bool assign_texture_slots(SceneManager& manager, std::vector<Texture>& textures, TextureCache& texture_cache)
+{
+	SceneManager::Import& import = manager.import;
+	size_t texture_count = import.contents.textures.size();
+	size_t free_slot_count = manager.free_slots.size() + (TEXTURE_STREAMING_MAX_TEXTURES - textures.size());
+	if (texture_count > free_slot_count)
+	{
+		printf("Failed to load '%s', it has %zu textures and only %zu slots are free\n", import.path.c_str(), texture_count, free_slot_count);
+		return false;
+	}
+	assert(textures.capacity() >= TEXTURE_STREAMING_MAX_TEXTURES);
+
+	manager.texture_slots.resize(texture_count);
+	manager.new_textures.clear();
+	manager.uploaded_textures = 0;
+	for (uint32_t i = 0; i < (uint32_t)texture_count; ++i)
+	{
+		int cached = texture_cache_acquire(texture_cache, import.texture_keys[i]);
+		if (cached >= 0)
+		{
+			manager.texture_slots[i] = (uint32_t)cached;
+			continue;
+		}
+
+		uint32_t slot;
+		if (!manager.free_slots.empty())
+		{
+			slot = manager.free_slots.back();
+			manager.free_slots.pop_back();
+		}
+		else
+		{
+			slot = (uint32_t)textures.size();
+			textures.emplace_back();
+		}
+
+		texture_cache_insert(texture_cache, import.texture_keys[i], slot, import.contents.textures[i].size);
+		manager.texture_slots[i] = slot;
+		manager.new_textures.push_back(i);
+	}
+
+	remap_material_textures(import.contents.materials, 0, manager.texture_slots);
+	return true;
+}
+
+// Uploads textures up to the budget, and the buffers once the textures are done. Returns true when done.
+static bool upload_scene(SceneManager& manager, std::vector<Texture>& textures, TextureStreamer* streamer, ResidencyManager& residency,
+	UploadBatcher& uploader)
+{
+	SceneManager::Import& import = manager.import;
+
+	VkDeviceSize uploaded = 0;
+	while (manager.uploaded_textures < manager.new_textures.size() && uploaded < SCENE_SWITCH_UPLOAD_BUDGET)
+	{
+		uint32_t index = manager.new_textures[manager.uploaded_textures++];
+		uint32_t slot = manager.texture_slots[index];
+		TextureImage& image = import.contents.textures[index];
+		uploaded += image.size;
+
+		if (streamer)
+			stream_texture_image(*streamer, textures[slot], slot, std::move(image), uploader);
+		else if (!load_texture_image(textures[slot], image, manager.device, manager.allocator, uploader))
+			printf("Failed to load texture %u of '%s'\n", index, import.path.c_str());
+		image = {};
+		residency_track(residency, textures[slot], RESIDENCY_MATERIAL);
+	}
+
+	if (uploaded > 0)
+	{
+		upload_batcher_flush(uploader);
+		return false;
+	}
+
+	upload_geometry(import.geometry, import.geometry_data, manager.allocator, uploader);
+	create_cull_batch(manager.cull_batch, import.geometry, import.contents.meshes, import.contents.mesh_draws,
+		get_cull_view_masks(import.contents.mesh_draws, import.contents.materials, manager.light_count), manager.cull_view_count,
+		manager.allocator, uploader);
+	upload_batcher_flush(uploader);
+	import.geometry_data = {};
+	return true;
+}
+
+// Images that are not cached yet start their bake
+static void upload_environment(SceneManager& manager, UploadBatcher& uploader)
+{
+	SceneManager::Import& import = manager.import;
+	Environment& environment = manager.environment;
+
+	if (!import.hdr.texels.empty())
+	{
+		begin_environment_bake(*manager.baker, import.hdr, environment.irradiance, environment.reflection, environment.diffuse);
+		import.hdr = {};
+	}
+
+	Texture* environment_textures[] = { &environment.irradiance, &environment.reflection, &environment.diffuse };
+	for (size_t i = 0; i < import.contents.textures.size(); ++i)
+	{
+		if (!load_texture_image(*environment_textures[i], import.contents.textures[i], manager.device, manager.allocator, uploader))
+			printf("Failed to load texture %zu of '%s'\n", i, import.path.c_str());
+	}
+	import.contents.textures.clear();
+
+	environment.mesh = import.contents.meshes[0];
+	environment.vertices = std::move(import.contents.vertices);
+	environment.indices = std::move(import.contents.indices);
+	environment.index_buffer = create_buffer(manager.allocator, environment.indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	environment.vertex_buffer = create_buffer(manager.allocator, environment.vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	upload_batcher_upload_buffer(uploader, environment.index_buffer, environment.indices.data(), environment.index_buffer.size);
+	upload_batcher_upload_buffer(uploader, environment.vertex_buffer, environment.vertices.data(), environment.vertex_buffer.size);
+	upload_batcher_flush(uploader);
+}
+
+static void destroy_environment(Environment& environment)
+{
+	for (Texture* texture : { &environment.irradiance, &environment.diffuse, &environment.reflection })
+	{
+		if (texture->image)
+			texture->destroy();
+	}
+	for (Buffer* buffer : { &environment.index_buffer, &environment.vertex_buffer })
+	{
+		if (buffer->buffer)
+			buffer->destroy();
+	}
+	environment = {};
+}
+
+// The frame that just completed was the last to sample the textures, and every upload queued for them
+// before this update has been acquired by it
+static void release_scene_textures(SceneManager& manager, std::vector<Texture>& textures, TextureCache& texture_cache, TextureStreamer* streamer,
+	ResidencyManager& residency, HotReloader& reloader)
+{
+	for (uint32_t slot : manager.scene_slots)
+	{
+		if (!texture_cache_release(texture_cache, slot))
+			continue;
+
+		hot_reload_unwatch_texture(reloader, textures[slot]);
+		if (streamer)
+			release_streamed_texture(*streamer, slot);
+		residency_untrack(residency, &textures[slot]);
+		if (textures[slot].image)
+			textures[slot].destroy();
+		textures[slot] = {};
+		manager.free_slots.push_back(slot);
+	}
+	manager.scene_slots.clear();
+}
+
+void init_scene_manager(SceneManager& manager, VkDevice device, VmaAllocator allocator, ThreadPool& thread_pool, EnvironmentBaker& baker,
+	bool compress_textures, bool cache_scenes, bool hot_reload, size_t light_count, uint32_t cull_view_count)
+{
+	manager.device = device;
+	manager.allocator = allocator;
+	manager.thread_pool = &thread_pool;
+	manager.baker = &baker;
+	manager.compress_textures = compress_textures;
+	manager.cache_scenes = cache_scenes;
+	manager.hot_reload = hot_reload;
+	manager.light_count = light_count;
+	manager.cull_view_count = cull_view_count;
+	manager.state = SceneManager::SCENE_MANAGER_IDLE;
+	manager.import_done.store(false);
+}
+
+void destroy_scene_manager(SceneManager& manager)
+{
+	if (manager.import_thread.joinable())
+		manager.import_thread.join();
+
+	// Textures already uploaded are in the caller's texture array
+	if (manager.import.geometry.vertex_buffer.buffer)
+		destroy_geometry(manager.import.geometry);
+	if (manager.cull_batch.draws.buffer)
+		destroy_cull_batch(manager.cull_batch);
+	destroy_environment(manager.environment);
+	manager.state = SceneManager::SCENE_MANAGER_IDLE;
+}
+
+void scene_manager_adopt_textures(SceneManager& manager, const TextureCache& texture_cache)
+{
+	manager.scene_slots.clear();
+	for (const auto& [key, entry] : texture_cache.entries)
+		manager.scene_slots.insert(manager.scene_slots.end(), entry.ref_count, entry.texture_index);
+}
+
+void scene_manager_load_scene(SceneManager& manager, const char* path)
+{
+	manager.queued_scene = path;
+	if (manager.state == SceneManager::SCENE_MANAGER_IDLE)
+		start_import(manager);
+}
+
+void scene_manager_load_environment(SceneManager& manager, const std::filesystem::path& path)
+{
+	manager.queued_environment = path;
+	if (manager.state == SceneManager::SCENE_MANAGER_IDLE)
+		start_import(manager);
+}
+
+bool update_scene_manager(
+	SceneManager& manager,
+	std::vector<Texture>& textures,
+	Environment& environment,
+	TextureCache& texture_cache,
+	TextureStreamer* streamer,
+	ResidencyManager& residency,
+	HotReloader& reloader,
+	UploadBatcher& uploader,
+	SceneSwap& swap)
+{
+	manager.update_index++;
+	SceneManager::Import& import = manager.import;
+
+	if (manager.state == SceneManager::SCENE_MANAGER_IMPORTING)
+	{
+		if (!manager.import_done.load(std::memory_order_acquire))
+			return false;
+
+		manager.import_thread.join();
+		if (!import.success || (!import.is_environment && !assign_texture_slots(manager, textures, texture_cache)))
+		{
+			printf("Failed to load '%s', keeping the current %s\n", import.path.c_str(), import.is_environment ? "environment" : "scene");
+			import = {};
+			manager.state = SceneManager::SCENE_MANAGER_IDLE;
+			start_import(manager);
+			return false;
+		}
+		manager.state = SceneManager::SCENE_MANAGER_UPLOADING;
+	}
+
+	if (manager.state == SceneManager::SCENE_MANAGER_UPLOADING)
+	{
+		if (import.is_environment)
+			upload_environment(manager, uploader);
+		else if (!upload_scene(manager, textures, streamer, residency, uploader))
+			return false;
+
+		manager.acquire_update = manager.update_index;
+		manager.state = manager.baker->is_baking ? SceneManager::SCENE_MANAGER_BAKING : SceneManager::SCENE_MANAGER_ACQUIRING;
+		return false;
+	}
+
+	if (manager.state == SceneManager::SCENE_MANAGER_BAKING)
+	{
+		std::vector<TextureImage> images;
+		if (!finish_environment_bake(*manager.baker, images))
+			return false;
+
+		// Written on the import thread so the disk write does not stall the frame, the next import joins it
+		PackContents cache;
+		cache.textures = std::move(images);
+		generate_sky_box(cache.meshes, cache.vertices, cache.indices);
+		manager.import_thread = std::thread([path = import.cache_path, cache = std::move(cache)]() {
+			if (!write_cached_pack(path.c_str(), cache))
+				printf("Failed to write environment cache entry %s\n", path.c_str());
+		});
+		manager.state = SceneManager::SCENE_MANAGER_ACQUIRING;
+	}
+
+	// Reloads deferred by the hot reloader may still replace what the switch replaces
+	if (manager.state != SceneManager::SCENE_MANAGER_ACQUIRING || manager.update_index <= manager.acquire_update || !reloader.swaps.empty())
+		return false;
+
+	bool is_scene = !import.is_environment;
+	if (is_scene)
+	{
+		swap.meshes = std::move(import.contents.meshes);
+		swap.materials = std::move(import.contents.materials);
+		swap.vertices = std::move(import.contents.vertices);
+		swap.indices = std::move(import.contents.indices);
+		swap.mesh_draws = std::move(import.contents.mesh_draws);
+		swap.geometry = import.geometry;
+		swap.cull_batch = manager.cull_batch;
+		import.geometry = {};
+		manager.cull_batch = {};
+
+		release_scene_textures(manager, textures, texture_cache, streamer, residency, reloader);
+		manager.scene_slots = manager.texture_slots;
+		printf("Switched to '%s' in %.2f ms, %zu of %zu textures shared with loaded scenes\n", import.path.c_str(), get_time_ms() - import.start_ms,
+			manager.texture_slots.size() - manager.new_textures.size(), manager.texture_slots.size());
+	}
+	else
+	{
+		// Replaced in place, everything else points at the environment's members
+		for (const Texture* texture : { &environment.irradiance, &environment.reflection, &environment.diffuse })
+			hot_reload_unwatch_texture(reloader, *texture);
+		destroy_environment(environment);
+		environment = std::move(manager.environment);
+		manager.environment = {};
+
+		if (manager.hot_reload && !import.texture_paths.empty())
+		{
+			hot_reload_watch_texture(reloader, environment.irradiance, import.texture_paths[0], false);
+			hot_reload_watch_texture(reloader, environment.reflection, import.texture_paths[1], false);
+			hot_reload_watch_texture(reloader, environment.diffuse, import.texture_paths[2], true);
+		}
+		printf("Switched to environment '%s' in %.2f ms\n", import.path.c_str(), get_time_ms() - import.start_ms);
+	}
+
+	manager.switch_count++;
+	import = {};
+	manager.state = SceneManager::SCENE_MANAGER_IDLE;
+	start_import(manager);
+	return is_scene;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "culling.h"
+#include "environment_baker.h"
+#include "pack.h"
+
+#include <atomic>
+#include <filesystem>
+#include <thread>
+
+struct HotReloader;
+struct ResidencyManager;
+struct TextureCache;
+struct TextureStreamer;
+
+// Scene texture bytes uploaded per update while switching, at least one texture is uploaded by every update
+static constexpr VkDeviceSize SCENE_SWITCH_UPLOAD_BUDGET = 32 * 1024 * 1024;
+
+// Sky dome and image based lighting textures
+struct Environment
+{
+	Texture irradiance;
+	Texture diffuse;
+	Texture reflection;
+	Mesh mesh;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	Buffer index_buffer;
+	Buffer vertex_buffer;
+};
+
+// A loaded scene handed to the caller to replace the one it draws
+struct SceneSwap
+{
+	std::vector<Mesh> meshes;
+	std::vector<Material> materials;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<MeshDraw> mesh_draws;
+	Geometry geometry;
+	CullBatch cull_batch;
+};
+
+// Switches scenes and environments while the current ones keep rendering. Files are read, decoded and turned
+// into geometry on a background thread, the result is uploaded by later updates within a byte budget each and
+// swapped in once the frame that acquired the last upload has completed. Scene textures live in slots of the
+// caller's texture array, shared through the texture cache, and slots the previous scene alone referenced are
+// recycled by the next switch.
+struct SceneManager
+{
+	enum State
+	{
+		SCENE_MANAGER_IDLE,
+		SCENE_MANAGER_IMPORTING, // The import thread is running
+		SCENE_MANAGER_UPLOADING, // Textures and then buffers are uploaded, some per update
+		SCENE_MANAGER_BAKING,    // The environment baker runs on an HDR image
+		SCENE_MANAGER_ACQUIRING, // Waiting for the frame that acquires the last upload
+	};
+
+	// Written by the import thread until import_done is set
+	struct Import
+	{
+		std::string path;
+		bool is_environment;
+		bool success;
+
+		// Materials reference textures by index. Environments have their sky dome in meshes[0], vertices and
+		// indices and their irradiance, reflection and diffuse textures in that order.
+		PackContents contents;
+		std::vector<uint64_t> texture_keys; // Texture cache key per texture of a scene
+		std::vector<std::filesystem::path> texture_paths; // Per texture of an environment, for hot reload
+		HdrImage hdr;           // Of an HDR environment that is not in the environment cache
+		std::string cache_path; // Of an HDR environment
+
+		Geometry geometry; // Without buffers until uploaded
+		GeometryData geometry_data;
+		double start_ms;
+	};
+
+	VkDevice device;
+	VmaAllocator allocator;
+	ThreadPool* thread_pool;
+	EnvironmentBaker* baker;
+	bool compress_textures;
+	bool cache_scenes;
+	bool hot_reload;
+	size_t light_count;
+	uint32_t cull_view_count;
+
+	State state;
+	std::thread import_thread; // Also writes environment cache entries after a bake
+	std::atomic<bool> import_done;
+	Import import;
+
+	// Requested while busy, only the latest request of each kind is kept
+	std::string queued_scene;
+	std::filesystem::path queued_environment;
+
+	std::vector<uint32_t> texture_slots; // Slot per texture of the import
+	std::vector<uint32_t> new_textures;  // Textures of the import that are not cached yet, uploaded in order
+	size_t uploaded_textures;
+	CullBatch cull_batch;
+	Environment environment;
+
+	uint64_t update_index;
+	uint64_t acquire_update; // Update that flushed the last upload of the switch
+
+	std::vector<uint32_t> scene_slots; // Slot per texture cache reference of the current scene
+	std::vector<uint32_t> free_slots;
+	uint32_t switch_count;
+};
+
+void init_scene_manager(SceneManager& manager, VkDevice device, VmaAllocator allocator, ThreadPool& thread_pool, EnvironmentBaker& baker,
+	bool compress_textures, bool cache_scenes, bool hot_reload, size_t light_count, uint32_t cull_view_count);
+// Waits for a running import and destroys what a switch that has not completed has created
+void destroy_scene_manager(SceneManager& manager);
+
+// Takes over the texture cache references of the scene loaded at startup, released by the first switch
+void scene_manager_adopt_textures(SceneManager& manager, const TextureCache& texture_cache);
+
+// Queues a switch to a glTF scene, pack or sdkmesh character
+void scene_manager_load_scene(SceneManager& manager, const char* path);
+// Queues a switch to the environment in the directory, which holds a SkyDome.sdkmesh and its textures, or to
+// an equirectangular .hdr image. Images are baked on the GPU the first time and read from the environment cache
+// after that.
+void scene_manager_load_environment(SceneManager& manager, const std::filesystem::path& path);
+
+// Call once per frame right after the frame fence wait, before update_texture_streamer and update_hot_reloader.
+// Advances the switch in progress, the textures array has to have capacity for TEXTURE_STREAMING_MAX_TEXTURES
+// so slots can be added without moving the textures others point to. The environment is replaced in place.
+// Returns true when swap holds a loaded scene, the caller swaps it in right away and destroys the geometry
+// and cull batch it replaces, which the completed frame was the last to use.
+bool update_scene_manager(
+	SceneManager& manager,
+	std::vector<Texture>& textures,
+	Environment& environment,
+	TextureCache& texture_cache,
+	TextureStreamer* streamer,
+	ResidencyManager& residency,
+	HotReloader& reloader,
+	UploadBatcher& uploader,
+	SceneSwap& swap);
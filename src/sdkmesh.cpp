@@ -0,0 +1,540 @@
+#include "load_telemetry.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "scene.h"
+#include "sdkmesh.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <immintrin.h>
+#define SDKMESH_SSE2 1
+#endif
+
+// The AVX2 index kernel is compiled for AVX2 on its own and only runs where the CPU supports it,
+// the rest of the build targets the SSE2 baseline
+#if defined(SDKMESH_SSE2) && defined(_MSC_VER)
+#include <intrin.h>
+#define SDKMESH_AVX2 1
+#define SDKMESH_TARGET_AVX2
+#elif defined(SDKMESH_SSE2) && defined(__GNUC__)
+#define SDKMESH_AVX2 1
+#define SDKMESH_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// D3DDECLTYPE and D3DDECLUSAGE values used by sdkmesh vertex declarations
+static constexpr uint8_t SDKMESH_DECLTYPE_FLOAT2 = 1;
+static constexpr uint8_t SDKMESH_DECLTYPE_FLOAT3 = 2;
+static constexpr uint8_t SDKMESH_DECLTYPE_FLOAT4 = 3;
+static constexpr uint8_t SDKMESH_DECLUSAGE_POSITION = 0;
+static constexpr uint8_t SDKMESH_DECLUSAGE_NORMAL = 3;
+static constexpr uint8_t SDKMESH_DECLUSAGE_TEXCOORD = 5;
+static constexpr uint8_t SDKMESH_DECLUSAGE_TANGENT = 6;
+static constexpr uint16_t SDKMESH_DECL_END_STREAM = 0xFF;
+
+// Work is split across the thread pool in chunks of this many vertices and indices
+static constexpr size_t SDKMESH_VERTEX_CHUNK = 16384;
+static constexpr size_t SDKMESH_INDEX_CHUNK = 24 * 4096; // Whole triangles and whole AVX2 blocks
+
+// Attributes of the vertices of one mesh, possibly spread over several streams. Missing attributes
+// point at a default value with a stride of 0.
+struct SdkMeshVertexStreams
+{
+	const uint8_t* position;
+	const uint8_t* normal;
+	const uint8_t* texcoord;
+	const uint8_t* tangent;
+	size_t position_stride;
+	size_t normal_stride;
+	size_t texcoord_stride;
+	size_t tangent_stride;
+	size_t vertex_count;
+};
+
+// Padded to 16 bytes so SSE loads of the defaults stay inside them
+alignas(16) static const float SDKMESH_DEFAULT_NORMAL[4] = { 0.0f, 0.0f, 1.0f, 0.0f };
+alignas(16) static const float SDKMESH_DEFAULT_TEXCOORD[4] = {};
+alignas(16) static const float SDKMESH_DEFAULT_TANGENT[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+
+static void convert_vertex(const SdkMeshVertexStreams& streams, size_t i, Vertex& vertex)
+{
+	glm::vec3 p, n, t;
+	glm::vec2 uv;
+	memcpy(&p, streams.position + i * streams.position_stride, sizeof(p));
+	memcpy(&n, streams.normal + i * streams.normal_stride, sizeof(n));
+	memcpy(&uv, streams.texcoord + i * streams.texcoord_stride, sizeof(uv));
+	memcpy(&t, streams.tangent + i * streams.tangent_stride, sizeof(t));
+
+	vertex = {
+		.position = glm::vec3(p.x, p.y, -p.z),
+		.normal = glm::vec3(n.x, n.y, -n.z),
+		.tangent = glm::vec4(t.x, t.y, -t.z, -1.0f),
+		.uv = uv,
+	};
+}
+
+// Converts vertices [begin, end) to the engine's layout and handedness: Z of positions, normals and
+// tangents is negated and the bitangent sign is set to -1 to match.
+static void convert_vertices(const SdkMeshVertexStreams& streams, Vertex* vertices, size_t begin, size_t end)
+{
+	static_assert(sizeof(Vertex) == 48 && offsetof(Vertex, normal) == 12 && offsetof(Vertex, tangent) == 24 && offsetof(Vertex, uv) == 40);
+
+#ifdef SDKMESH_SSE2
+	// Every attribute is read with a 16 byte load and written with overlapping stores, which read
+	// past the end of 12 byte attributes. The last vertex of a stream goes through the scalar path.
+	size_t vector_end = std::min(end, streams.vertex_count - 1);
+
+	const __m128 flip_z = _mm_castsi128_ps(_mm_setr_epi32(0, 0, (int)0x80000000, 0));
+	const __m128 xyz_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	const __m128 tangent_w = _mm_setr_ps(0.0f, 0.0f, 0.0f, -1.0f);
+
+	size_t i = begin;
+	for (; i < vector_end; ++i)
+	{
+		__m128 p = _mm_loadu_ps((const float*)(streams.position + i * streams.position_stride));
+		__m128 n = _mm_loadu_ps((const float*)(streams.normal + i * streams.normal_stride));
+		__m128 t = _mm_loadu_ps((const float*)(streams.tangent + i * streams.tangent_stride));
+		__m128i uv = _mm_loadl_epi64((const __m128i*)(streams.texcoord + i * streams.texcoord_stride));
+
+		p = _mm_xor_ps(p, flip_z);
+		n = _mm_xor_ps(n, flip_z);
+		t = _mm_or_ps(_mm_and_ps(_mm_xor_ps(t, flip_z), xyz_mask), tangent_w);
+
+		// Stores in order, each one overwrites the garbage fourth lane of the previous one
+		float* dst = (float*)(vertices + i);
+		_mm_storeu_ps(dst + 0, p);
+		_mm_storeu_ps(dst + 3, n);
+		_mm_storeu_ps(dst + 6, t);
+		_mm_storel_epi64((__m128i*)(dst + 10), uv);
+	}
+
+	for (; i < end; ++i)
+		convert_vertex(streams, i, vertices[i]);
+#else
+	for (size_t i = begin; i < end; ++i)
+		convert_vertex(streams, i, vertices[i]);
+#endif
+}
+
+template<typename T>
+static void convert_indices_scalar(const T* src, uint32_t* dst, size_t begin, size_t end)
+{
+	for (size_t i = begin; i + 2 < end; i += 3)
+	{
+		dst[i + 0] = src[i + 2];
+		dst[i + 1] = src[i + 1];
+		dst[i + 2] = src[i + 0];
+	}
+}
+
+#ifdef SDKMESH_AVX2
+static bool detect_avx2()
+{
+#ifdef _MSC_VER
+	// AVX2 instructions, and the OS saving the YMM registers
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static bool has_avx2()
+{
+	static const bool supported = detect_avx2();
+	return supported;
+}
+
+SDKMESH_TARGET_AVX2 static inline __m256i load_indices(const uint16_t* src)
+{
+	return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)src));
+}
+
+SDKMESH_TARGET_AVX2 static inline __m256i load_indices(const uint32_t* src)
+{
+	return _mm256_loadu_si256((const __m256i*)src);
+}
+
+// convert_indices for whole blocks of 24 indices, returns where the remaining indices start
+template<typename T>
+SDKMESH_TARGET_AVX2 static size_t convert_indices_avx2(const T* src, uint32_t* dst, size_t begin, size_t end)
+{
+	// 24 indices (8 triangles) per step. Output lane j of block k takes the index at 3 * (i / 3) + 2 - i % 3
+	// with i = 8k + j, which lies in block k or one of its neighbours.
+	const __m256i permute_a0 = _mm256_setr_epi32(2, 1, 0, 5, 4, 3, 0, 7);
+	const __m256i permute_b0 = _mm256_setr_epi32(0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i permute_a1 = _mm256_setr_epi32(6, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i permute_b1 = _mm256_setr_epi32(0, 3, 2, 1, 6, 5, 4, 0);
+	const __m256i permute_c1 = _mm256_setr_epi32(0, 0, 0, 0, 0, 0, 0, 1);
+	const __m256i permute_b2 = _mm256_setr_epi32(0, 7, 0, 0, 0, 0, 0, 0);
+	const __m256i permute_c2 = _mm256_setr_epi32(0, 0, 4, 3, 2, 7, 6, 5);
+
+	size_t i = begin;
+	for (; i + 24 <= end; i += 24)
+	{
+		__m256i a = load_indices(src + i);
+		__m256i b = load_indices(src + i + 8);
+		__m256i c = load_indices(src + i + 16);
+
+		__m256i out0 = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(a, permute_a0), _mm256_permutevar8x32_epi32(b, permute_b0), 0x40);
+		__m256i out1 = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(b, permute_b1), _mm256_permutevar8x32_epi32(a, permute_a1), 0x01);
+		out1 = _mm256_blend_epi32(out1, _mm256_permutevar8x32_epi32(c, permute_c1), 0x80);
+		__m256i out2 = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(c, permute_c2), _mm256_permutevar8x32_epi32(b, permute_b2), 0x02);
+
+		_mm256_storeu_si256((__m256i*)(dst + i), out0);
+		_mm256_storeu_si256((__m256i*)(dst + i + 8), out1);
+		_mm256_storeu_si256((__m256i*)(dst + i + 16), out2);
+	}
+
+	return i;
+}
+#endif
+
+// Widens indices [begin, end) to 32 bits and swaps the first and last index of every triangle to
+// flip the winding along with the handedness. begin has to be the start of a triangle.
+template<typename T>
+static void convert_indices(const T* src, uint32_t* dst, size_t begin, size_t end)
+{
+	size_t i = begin;
+#ifdef SDKMESH_AVX2
+	if (has_avx2())
+		i = convert_indices_avx2(src, dst, begin, end);
+#endif
+	convert_indices_scalar(src, dst, i, end);
+}
+
+// Runs function(begin, end) over [0, count) in chunks, on the thread pool when there is more than one
+static void for_each_chunk(ThreadPool* thread_pool, size_t count, size_t chunk_size, const std::function<void(size_t, size_t)>& function)
+{
+	uint32_t chunk_count = (uint32_t)((count + chunk_size - 1) / chunk_size);
+	auto run_chunk = [&](uint32_t chunk) {
+		function(chunk * chunk_size, std::min(count, (chunk + 1) * chunk_size));
+	};
+
+	if (thread_pool && chunk_count > 1)
+		parallel_for(*thread_pool, chunk_count, run_chunk);
+	else
+		for (uint32_t chunk = 0; chunk < chunk_count; ++chunk)
+			run_chunk(chunk);
+}
+
+template<typename T>
+static bool is_in_file(const T* begin, size_t count, const uint8_t* data, size_t size)
+{
+	const uint8_t* p = (const uint8_t*)begin;
+	return p >= data && p <= data + size && count <= (size_t)(data + size - p) / sizeof(T);
+}
+
+static bool is_range_in_file(uint64_t offset, uint64_t length, size_t size)
+{
+	return offset <= size && length <= size - offset;
+}
+
+// Collects the attributes of a mesh from the declarations of its vertex streams
+static bool get_vertex_streams(SdkMeshVertexStreams& streams, const SDKMESH_MESH& mesh, const SDKMESH_VERTEX_BUFFER_HEADER* vertex_buffers, uint32_t vertex_buffer_count, const uint8_t* data)
+{
+	streams = {
+		.normal = (const uint8_t*)SDKMESH_DEFAULT_NORMAL,
+		.texcoord = (const uint8_t*)SDKMESH_DEFAULT_TEXCOORD,
+		.tangent = (const uint8_t*)SDKMESH_DEFAULT_TANGENT,
+	};
+
+	for (uint32_t s = 0; s < mesh.NumVertexBuffers && s < MAX_VERTEX_STREAMS; ++s)
+	{
+		if (mesh.VertexBuffers[s] >= vertex_buffer_count)
+			return false;
+
+		const SDKMESH_VERTEX_BUFFER_HEADER& vertex_buffer = vertex_buffers[mesh.VertexBuffers[s]];
+		if (s == 0)
+			streams.vertex_count = vertex_buffer.NumVertices;
+		else if (vertex_buffer.NumVertices != streams.vertex_count)
+			return false;
+
+		for (const D3DVERTEXELEMENT9& element : vertex_buffer.Decl)
+		{
+			if (element.Stream == SDKMESH_DECL_END_STREAM)
+				break;
+			if (element.Stream != s)
+				continue;
+
+			const uint8_t* source = data + vertex_buffer.DataOffset + element.Offset;
+			bool is_vector3 = element.Type == SDKMESH_DECLTYPE_FLOAT3 || element.Type == SDKMESH_DECLTYPE_FLOAT4;
+			if (element.Usage == SDKMESH_DECLUSAGE_POSITION && element.UsageIndex == 0 && is_vector3)
+			{
+				streams.position = source;
+				streams.position_stride = vertex_buffer.StrideBytes;
+			}
+			else if (element.Usage == SDKMESH_DECLUSAGE_NORMAL && element.UsageIndex == 0 && is_vector3)
+			{
+				streams.normal = source;
+				streams.normal_stride = vertex_buffer.StrideBytes;
+			}
+			else if (element.Usage == SDKMESH_DECLUSAGE_TEXCOORD && element.UsageIndex == 0 && element.Type == SDKMESH_DECLTYPE_FLOAT2)
+			{
+				streams.texcoord = source;
+				streams.texcoord_stride = vertex_buffer.StrideBytes;
+			}
+			else if (element.Usage == SDKMESH_DECLUSAGE_TANGENT && element.UsageIndex == 0 && is_vector3)
+			{
+				streams.tangent = source;
+				streams.tangent_stride = vertex_buffer.StrideBytes;
+			}
+		}
+	}
+
+	return streams.position != nullptr && streams.vertex_count > 0;
+}
+
+// Negates Z on both sides of a transform, matching the flip applied to the vertices
+static glm::mat4 flip_handedness(const glm::mat4& transform)
+{
+	glm::mat4 flip = glm::mat4(1.0f);
+	flip[2][2] = -1.0f;
+	return flip * transform * flip;
+}
+
+bool import_sdkmesh(
+	const uint8_t* data,
+	size_t size,
+	std::vector<Mesh>& meshes,
+	std::vector<MeshDraw>& mesh_draws,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<SdkMeshTextures>& materials,
+	ThreadPool* thread_pool)
+{
+	// Imported from memory, the file read is recorded by the caller
+	LoadScope scope(LOAD_STAGE_SCENE, "sdkmesh of " + std::to_string(size) + " bytes");
+	const SDKMESH_HEADER* header = (const SDKMESH_HEADER*)data;
+	if (size < sizeof(SDKMESH_HEADER) || header->Version != SDKMESH_FILE_VERSION || header->IsBigEndian)
+	{
+		printf("Invalid sdkmesh file\n");
+		return false;
+	}
+
+	const SDKMESH_VERTEX_BUFFER_HEADER* vertex_buffers = (const SDKMESH_VERTEX_BUFFER_HEADER*)(data + header->VertexStreamHeadersOffset);
+	const SDKMESH_INDEX_BUFFER_HEADER* index_buffers = (const SDKMESH_INDEX_BUFFER_HEADER*)(data + header->IndexStreamHeadersOffset);
+	const SDKMESH_MESH* file_meshes = (const SDKMESH_MESH*)(data + header->MeshDataOffset);
+	const SDKMESH_SUBSET* subsets = (const SDKMESH_SUBSET*)(data + header->SubsetDataOffset);
+	const SDKMESH_FRAME* frames = (const SDKMESH_FRAME*)(data + header->FrameDataOffset);
+	const SDKMESH_MATERIAL* file_materials = (const SDKMESH_MATERIAL*)(data + header->MaterialDataOffset);
+
+	if (!is_in_file(vertex_buffers, header->NumVertexBuffers, data, size)
+		|| !is_in_file(index_buffers, header->NumIndexBuffers, data, size)
+		|| !is_in_file(file_meshes, header->NumMeshes, data, size)
+		|| !is_in_file(subsets, header->NumTotalSubsets, data, size)
+		|| !is_in_file(frames, header->NumFrames, data, size)
+		|| !is_in_file(file_materials, header->NumMaterials, data, size))
+	{
+		printf("Invalid sdkmesh file: tables out of bounds\n");
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header->NumVertexBuffers; ++i)
+	{
+		const SDKMESH_VERTEX_BUFFER_HEADER& vertex_buffer = vertex_buffers[i];
+		if (vertex_buffer.NumVertices > UINT32_MAX || !is_range_in_file(vertex_buffer.DataOffset, vertex_buffer.SizeBytes, size)
+			|| vertex_buffer.NumVertices * vertex_buffer.StrideBytes > vertex_buffer.SizeBytes)
+		{
+			printf("Invalid sdkmesh file: bad vertex buffer %u\n", i);
+			return false;
+		}
+	}
+
+	// Every index buffer is converted once, subsets of all meshes reference it
+	std::vector<uint32_t> index_buffer_bases(header->NumIndexBuffers);
+	for (uint32_t i = 0; i < header->NumIndexBuffers; ++i)
+	{
+		const SDKMESH_INDEX_BUFFER_HEADER& index_buffer = index_buffers[i];
+		uint32_t bytes_per_index = index_buffer.IndexType == IT_32BIT ? 4 : 2;
+		if (!is_range_in_file(index_buffer.DataOffset, index_buffer.SizeBytes, size) || index_buffer.NumIndices * bytes_per_index > index_buffer.SizeBytes)
+		{
+			printf("Invalid sdkmesh file: bad index buffer %u\n", i);
+			return false;
+		}
+
+		size_t first_index = indices.size();
+		size_t index_count = index_buffer.NumIndices;
+		index_buffer_bases[i] = (uint32_t)first_index;
+		indices.resize(first_index + index_count);
+
+		uint32_t* dst = indices.data() + first_index;
+		const uint8_t* src = data + index_buffer.DataOffset;
+		for_each_chunk(thread_pool, index_count, SDKMESH_INDEX_CHUNK, [&](size_t begin, size_t end) {
+			if (bytes_per_index == 4)
+				convert_indices((const uint32_t*)src, dst, begin, end);
+			else
+				convert_indices((const uint16_t*)src, dst, begin, end);
+		});
+	}
+
+	// Meshes using the same set of vertex streams share the converted vertices
+	std::map<std::vector<uint32_t>, uint32_t> vertex_bases;
+	size_t first_mesh = meshes.size();
+	// One draw per subset of every mesh, placed by the frames below
+	std::vector<std::vector<MeshDraw>> subset_draws(header->NumMeshes);
+	uint32_t first_material = (uint32_t)materials.size();
+
+	for (uint32_t m = 0; m < header->NumMeshes; ++m)
+	{
+		const SDKMESH_MESH& file_mesh = file_meshes[m];
+
+		SdkMeshVertexStreams streams;
+		const UINT* subset_indices = (const UINT*)(data + file_mesh.SubsetOffset);
+		if (file_mesh.IndexBuffer >= header->NumIndexBuffers || !is_in_file(subset_indices, file_mesh.NumSubsets, data, size)
+			|| !get_vertex_streams(streams, file_mesh, vertex_buffers, header->NumVertexBuffers, data))
+		{
+			printf("Invalid sdkmesh file: bad mesh %u\n", m);
+			return false;
+		}
+
+		std::vector<uint32_t> key(file_mesh.VertexBuffers, file_mesh.VertexBuffers + std::min<uint32_t>(file_mesh.NumVertexBuffers, MAX_VERTEX_STREAMS));
+		auto [base, inserted] = vertex_bases.try_emplace(key, (uint32_t)vertices.size());
+		if (inserted)
+		{
+			vertices.resize(vertices.size() + streams.vertex_count);
+			Vertex* dst = vertices.data() + base->second;
+			for_each_chunk(thread_pool, streams.vertex_count, SDKMESH_VERTEX_CHUNK, [&](size_t begin, size_t end) {
+				convert_vertices(streams, dst, begin, end);
+			});
+		}
+
+		const SDKMESH_INDEX_BUFFER_HEADER& index_buffer = index_buffers[file_mesh.IndexBuffer];
+		for (uint32_t s = 0; s < file_mesh.NumSubsets; ++s)
+		{
+			if (subset_indices[s] >= header->NumTotalSubsets)
+			{
+				printf("Invalid sdkmesh file: bad subset %u\n", subset_indices[s]);
+				return false;
+			}
+
+			const SDKMESH_SUBSET& subset = subsets[subset_indices[s]];
+			if (subset.PrimitiveType != PT_TRIANGLE_LIST)
+			{
+				printf("Skipping sdkmesh subset %s: only triangle lists are supported\n", subset.Name);
+				continue;
+			}
+
+			if (subset.IndexStart + subset.IndexCount > index_buffer.NumIndices || subset.IndexStart % 3 != 0
+				|| subset.VertexStart + subset.VertexCount > streams.vertex_count)
+			{
+				printf("Invalid sdkmesh file: subset %s out of bounds\n", subset.Name);
+				return false;
+			}
+
+			Mesh mesh{
+				.first_vertex = base->second + (uint32_t)subset.VertexStart,
+				.vertex_count = (uint32_t)subset.VertexCount,
+				.first_index = index_buffer_bases[file_mesh.IndexBuffer] + (uint32_t)subset.IndexStart,
+				.index_count = (uint32_t)subset.IndexCount,
+			};
+
+			subset_draws[m].push_back({
+				.transform = glm::mat4(1.0f),
+				.mesh_index = (uint32_t)meshes.size(),
+				.material_index = subset.MaterialID < header->NumMaterials ? (int)(first_material + subset.MaterialID) : -1,
+			});
+			meshes.push_back(mesh);
+		}
+	}
+
+	optimize_meshes(meshes, first_mesh, vertices, indices, thread_pool);
+	build_mesh_lods(meshes, first_mesh, vertices, indices, thread_pool);
+
+	// Frames referencing a mesh draw its subsets with their world transform, files without such
+	// frames draw every mesh once in place
+
+	std::vector<glm::mat4> world_transforms(header->NumFrames);
+	std::vector<uint8_t> is_resolved(header->NumFrames, 0);
+	auto resolve_frame = [&](auto& self, uint32_t f, uint32_t depth) -> const glm::mat4& {
+		if (!is_resolved[f])
+		{
+			uint32_t parent = frames[f].ParentFrame;
+			bool has_parent = parent < header->NumFrames && depth < header->NumFrames;
+			world_transforms[f] = has_parent ? self(self, parent, depth + 1) * frames[f].Matrix : frames[f].Matrix;
+			is_resolved[f] = 1;
+		}
+		return world_transforms[f];
+	};
+
+	bool has_placed_meshes = false;
+	for (uint32_t f = 0; f < header->NumFrames; ++f)
+	{
+		if (frames[f].Mesh >= header->NumMeshes)
+			continue;
+
+		glm::mat4 transform = flip_handedness(resolve_frame(resolve_frame, f, 0));
+		for (MeshDraw draw : subset_draws[frames[f].Mesh])
+		{
+			draw.transform = transform;
+			mesh_draws.push_back(draw);
+		}
+		has_placed_meshes = true;
+	}
+
+	if (!has_placed_meshes)
+		for (const std::vector<MeshDraw>& draws : subset_draws)
+			mesh_draws.insert(mesh_draws.end(), draws.begin(), draws.end());
+
+	for (uint32_t i = 0; i < header->NumMaterials; ++i)
+	{
+		materials.push_back({
+			.diffuse = file_materials[i].DiffuseTexture,
+			.normal = file_materials[i].NormalTexture,
+		});
+	}
+
+	return true;
+}
+
+bool import_sdkmesh_scene(
+	const uint8_t* data,
+	size_t size,
+	std::vector<Mesh>& meshes,
+	std::vector<Material>& materials,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<MeshDraw>& mesh_draws,
+	int first_texture,
+	std::vector<SdkMeshTextures>& textures,
+	ThreadPool* thread_pool)
+{
+	size_t first_draw = mesh_draws.size();
+	int first_material = (int)materials.size();
+
+	textures.clear();
+	if (!import_sdkmesh(data, size, meshes, mesh_draws, vertices, indices, textures, thread_pool))
+		return false;
+
+	if (textures.empty())
+	{
+		printf("sdkmesh file has no materials\n");
+		return false;
+	}
+
+	for (size_t i = 0; i < textures.size(); ++i)
+	{
+		materials.push_back({
+			.type = Material::SKIN,
+			.basecolor_texture = first_texture + 1 + 2 * (int)i,
+			.normal_texture = first_texture + 2 + 2 * (int)i,
+			.specular_texture = first_texture,
+		});
+	}
+
+	// Subsets without a material fall back to the first one
+	for (size_t i = first_draw; i < mesh_draws.size(); ++i)
+		mesh_draws[i].material_index = first_material + std::max(mesh_draws[i].material_index, 0);
+
+	return true;
+}
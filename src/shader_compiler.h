@@ -0,0 +1,22 @@
+#pragma once
+
+#ifdef _WIN32
+#include "windows.h"
+#include <atlbase.h>
+#else _WIN32
+#include <dxc/WinAdapter.h>
+#endif
+
+#include <dxc/dxcapi.h>
+
+#include "shaders.h"
+
+struct ShaderCompiler
+{
+	CComPtr<IDxcUtils> dxc_utils;
+	CComPtr<IDxcCompiler3> compiler;
+	CComPtr<IDxcIncludeHandler> include_handler;
+};
+
+bool create_shader_compiler(ShaderCompiler& compiler);
+bool load_shader(Shader& shader, const ShaderCompiler& compiler, VkDevice device, const char* filepath, const char* entry_point, VkShaderStageFlagBits shader_stage);
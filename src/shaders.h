@@ -1,30 +1,15 @@
 #pragma once
 
-#ifdef _WIN32
-#include "windows.h"
-#include <atlbase.h>
-#else _WIN32
-#include <dxc/WinAdapter.h>
-#endif
-
-#include <dxc/dxcapi.h>
-
 #include "common.h"
 
 #include <glm/glm.hpp>
 
-struct ShaderCompiler
-{
-	CComPtr<IDxcUtils> dxc_utils;
-	CComPtr<IDxcCompiler3> compiler;
-	CComPtr<IDxcIncludeHandler> include_handler;
-};
-
 struct Shader
 {
 	std::vector<uint8_t> spirv;
 	VkShaderStageFlagBits stage;
 	std::string entry_point;
+	std::string filepath;
 
 	VkDescriptorType descriptor_types[32];
 	uint32_t descriptor_counts[32];
@@ -99,7 +84,6 @@ VkDescriptorSetLayout create_descriptor_set_layout(VkDevice device, const std::v
 std::vector<VkDescriptorSetLayoutBinding> get_descriptor_set_layout_binding(std::initializer_list<Shader> shaders);
 VkPipelineLayout create_pipeline_layout(VkDevice device, std::initializer_list<VkDescriptorSetLayout> set_layouts = {}, std::initializer_list<Shader> shaders = {});
 VkDescriptorUpdateTemplate create_descriptor_update_template(VkDevice device, VkDescriptorSetLayout layout, VkPipelineLayout pipeline_layout, std::initializer_list<Shader> shaders, bool uses_push_descriptors = false);
-bool create_shader_compiler(ShaderCompiler& compiler);
-bool load_shader(Shader& shader, const ShaderCompiler& compiler, VkDevice device, const char* filepath, const char* entry_point, VkShaderStageFlagBits shader_stage);
 Program create_program(VkDevice device, std::initializer_list<Shader> shaders, bool use_push_descriptors);
+VkPipeline create_compute_pipeline(VkDevice device, const Shader& shader, VkPipelineLayout layout);
 void destroy_program(VkDevice device, Program& program);
\ No newline at end of file
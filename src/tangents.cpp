@@ -0,0 +1,203 @@
+#include "tangents.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <immintrin.h>
+#define TANGENTS_SSE2 1
+#endif
+
+// Tangent of a triangle along increasing u, unnormalized, with twice its signed uv area in w. Triangles
+// with mirrored uvs have a negative area, their tangent is flipped so it still points along u.
+static glm::vec4 compute_face_tangent(const Vertex& v0, const Vertex& v1, const Vertex& v2)
+{
+	glm::vec3 d1 = v1.position - v0.position;
+	glm::vec3 d2 = v2.position - v0.position;
+	glm::vec2 t21 = v1.uv - v0.uv;
+	glm::vec2 t31 = v2.uv - v0.uv;
+
+	float area = t21.x * t31.y - t21.y * t31.x;
+	glm::vec3 tangent = (d1 * t31.y - d2 * t21.y) * (area < 0.0f ? -1.0f : 1.0f);
+	return glm::vec4(tangent, area);
+}
+
+#ifdef TANGENTS_SSE2
+// compute_face_tangent for four triangles, the corners are gathered into one register per component
+static void compute_face_tangents4(const Vertex* vertices, const uint32_t* corners, glm::vec4* faces)
+{
+	alignas(16) float positions[3][3][4]; // Corner, component, triangle
+	alignas(16) float uvs[3][2][4];
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		for (uint32_t k = 0; k < 3; ++k)
+		{
+			const Vertex& vertex = vertices[corners[i * 3 + k]];
+			positions[k][0][i] = vertex.position.x;
+			positions[k][1][i] = vertex.position.y;
+			positions[k][2][i] = vertex.position.z;
+			uvs[k][0][i] = vertex.uv.x;
+			uvs[k][1][i] = vertex.uv.y;
+		}
+	}
+
+	__m128 t21x = _mm_sub_ps(_mm_load_ps(uvs[1][0]), _mm_load_ps(uvs[0][0]));
+	__m128 t21y = _mm_sub_ps(_mm_load_ps(uvs[1][1]), _mm_load_ps(uvs[0][1]));
+	__m128 t31x = _mm_sub_ps(_mm_load_ps(uvs[2][0]), _mm_load_ps(uvs[0][0]));
+	__m128 t31y = _mm_sub_ps(_mm_load_ps(uvs[2][1]), _mm_load_ps(uvs[0][1]));
+	__m128 area = _mm_sub_ps(_mm_mul_ps(t21x, t31y), _mm_mul_ps(t21y, t31x));
+	__m128 sign = _mm_and_ps(area, _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000)));
+
+	__m128 tangent[3];
+	for (uint32_t c = 0; c < 3; ++c)
+	{
+		__m128 d1 = _mm_sub_ps(_mm_load_ps(positions[1][c]), _mm_load_ps(positions[0][c]));
+		__m128 d2 = _mm_sub_ps(_mm_load_ps(positions[2][c]), _mm_load_ps(positions[0][c]));
+		tangent[c] = _mm_xor_ps(_mm_sub_ps(_mm_mul_ps(d1, t31y), _mm_mul_ps(d2, t21y)), sign);
+	}
+
+	_MM_TRANSPOSE4_PS(tangent[0], tangent[1], tangent[2], area);
+	_mm_storeu_ps(&faces[0].x, tangent[0]);
+	_mm_storeu_ps(&faces[1].x, tangent[1]);
+	_mm_storeu_ps(&faces[2].x, tangent[2]);
+	_mm_storeu_ps(&faces[3].x, area);
+}
+#endif
+
+static glm::vec3 project_normalized(glm::vec3 v, glm::vec3 normal, bool& is_valid)
+{
+	v -= normal * glm::dot(normal, v);
+	float length = glm::length(v);
+	is_valid = length > 1e-20f && std::isfinite(length);
+	return is_valid ? v / length : glm::vec3(0.0f);
+}
+
+// Sum of the face tangents around a vertex in the plane of its normal, weighted by the corner angles
+static glm::vec4 compute_vertex_tangent(const Vertex* vertices, uint32_t vertex, const uint32_t* vertex_corners, uint32_t corner_count,
+	const uint32_t* corners, const glm::vec4* faces)
+{
+	float normal_length = glm::length(vertices[vertex].normal);
+	glm::vec3 normal = normal_length > 0.0f ? vertices[vertex].normal / normal_length : glm::vec3(0.0f);
+	glm::vec3 position = vertices[vertex].position;
+
+	glm::vec3 tangent(0.0f);
+	float orientation = 0.0f;
+	for (uint32_t i = 0; i < corner_count; ++i)
+	{
+		uint32_t corner = vertex_corners[i];
+		uint32_t k = corner % 3;
+		uint32_t first_corner = corner - k;
+		const glm::vec4& face = faces[corner / 3];
+		if (face.w == 0.0f)
+			continue;
+
+		bool is_valid[3];
+		glm::vec3 face_tangent = project_normalized(glm::vec3(face), normal, is_valid[0]);
+		glm::vec3 previous = project_normalized(vertices[corners[first_corner + (k + 2) % 3]].position - position, normal, is_valid[1]);
+		glm::vec3 next = project_normalized(vertices[corners[first_corner + (k + 1) % 3]].position - position, normal, is_valid[2]);
+		if (!is_valid[0] || !is_valid[1] || !is_valid[2])
+			continue;
+
+		float angle = acosf(std::clamp(glm::dot(previous, next), -1.0f, 1.0f));
+		tangent += face_tangent * angle;
+		orientation += face.w > 0.0f ? angle : -angle;
+	}
+
+	// Vertices without a usable uv mapping get any tangent perpendicular to the normal
+	bool is_valid;
+	tangent = project_normalized(tangent, normal, is_valid);
+	if (!is_valid)
+	{
+		glm::vec3 axis = fabsf(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		tangent = glm::normalize(axis - normal * glm::dot(normal, axis));
+	}
+
+	return glm::vec4(tangent, orientation < 0.0f ? -1.0f : 1.0f);
+}
+
+static void for_each_chunk(ThreadPool* thread_pool, uint32_t chunk_count, const std::function<void(uint32_t)>& function)
+{
+	if (thread_pool)
+		parallel_for(*thread_pool, chunk_count, function);
+	else
+		for (uint32_t i = 0; i < chunk_count; ++i)
+			function(i);
+}
+
+void generate_tangents(
+	const std::vector<Mesh>& meshes,
+	const std::vector<uint32_t>& mesh_indices,
+	std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	ThreadPool* thread_pool)
+{
+	if (mesh_indices.empty())
+		return;
+
+	double start_ms = get_time_ms();
+
+	// Triangles of all meshes are numbered consecutively, those of mesh_indices[i] start at first_triangles[i]
+	std::vector<uint32_t> first_triangles(mesh_indices.size() + 1, 0);
+	for (size_t i = 0; i < mesh_indices.size(); ++i)
+		first_triangles[i + 1] = first_triangles[i] + meshes[mesh_indices[i]].index_count / 3;
+	uint32_t triangle_count = first_triangles.back();
+
+	// Corners hold the index of their vertex in vertices
+	std::vector<uint32_t> corners((size_t)triangle_count * 3);
+	std::vector<glm::vec4> faces(triangle_count);
+	for_each_chunk(thread_pool, (triangle_count + TANGENT_CHUNK_SIZE - 1) / TANGENT_CHUNK_SIZE, [&](uint32_t chunk) {
+		uint32_t begin = chunk * TANGENT_CHUNK_SIZE;
+		uint32_t end = std::min(begin + TANGENT_CHUNK_SIZE, triangle_count);
+
+		size_t m = std::upper_bound(first_triangles.begin(), first_triangles.end(), begin) - first_triangles.begin() - 1;
+		for (uint32_t t = begin; t < end; ++t)
+		{
+			while (t >= first_triangles[m + 1])
+				m++;
+
+			const Mesh& mesh = meshes[mesh_indices[m]];
+			const uint32_t* triangle = indices.data() + mesh.first_index + (size_t)(t - first_triangles[m]) * 3;
+			for (uint32_t k = 0; k < 3; ++k)
+				corners[(size_t)t * 3 + k] = mesh.first_vertex + triangle[k];
+		}
+
+		uint32_t t = begin;
+#ifdef TANGENTS_SSE2
+		for (; t + 4 <= end; t += 4)
+			compute_face_tangents4(vertices.data(), corners.data() + (size_t)t * 3, faces.data() + t);
+#endif
+		for (; t < end; ++t)
+			faces[t] = compute_face_tangent(vertices[corners[(size_t)t * 3 + 0]], vertices[corners[(size_t)t * 3 + 1]], vertices[corners[(size_t)t * 3 + 2]]);
+	});
+
+	// Corners of every vertex
+	std::vector<uint32_t> corner_offsets(vertices.size() + 1, 0);
+	for (uint32_t vertex : corners)
+		corner_offsets[vertex + 1]++;
+	for (size_t i = 1; i < corner_offsets.size(); ++i)
+		corner_offsets[i] += corner_offsets[i - 1];
+
+	std::vector<uint32_t> vertex_corners(corners.size());
+	std::vector<uint32_t> corner_fill(corner_offsets.begin(), corner_offsets.end() - 1);
+	for (uint32_t i = 0; i < (uint32_t)corners.size(); ++i)
+		vertex_corners[corner_fill[corners[i]]++] = i;
+
+	std::vector<std::pair<uint32_t, uint32_t>> vertex_chunks;
+	for (uint32_t mesh_index : mesh_indices)
+	{
+		const Mesh& mesh = meshes[mesh_index];
+		for (uint32_t v = mesh.first_vertex; v < mesh.first_vertex + mesh.vertex_count; v += TANGENT_CHUNK_SIZE)
+			vertex_chunks.push_back({ v, std::min(v + TANGENT_CHUNK_SIZE, mesh.first_vertex + mesh.vertex_count) });
+	}
+
+	for_each_chunk(thread_pool, (uint32_t)vertex_chunks.size(), [&](uint32_t chunk) {
+		for (uint32_t v = vertex_chunks[chunk].first; v < vertex_chunks[chunk].second; ++v)
+		{
+			vertices[v].tangent = compute_vertex_tangent(vertices.data(), v, vertex_corners.data() + corner_offsets[v], corner_offsets[v + 1] - corner_offsets[v],
+				corners.data(), faces.data());
+		}
+	});
+
+	printf("Generated tangents for %zu meshes (%u triangles) in %.2f ms\n", mesh_indices.size(), triangle_count, get_time_ms() - start_ms);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "scene.h"
+
+// Work is split across the thread pool in chunks of this many triangles and vertices
+static constexpr uint32_t TANGENT_CHUNK_SIZE = 16384;
+
+// Generates tangents for meshes[mesh_indices[i]] following MikkTSpace (Mikkelsen 2008), which glTF prescribes
+// for primitives without tangents. Every triangle's tangent comes from its uv derivatives, four triangles at a
+// time with SSE where available. Every vertex sums the tangents of its corners projected onto the plane of its
+// normal, weighted by the corner angle, and w is the sign of the bitangent, cross(normal, tangent.xyz) * w.
+// Unlike MikkTSpace, vertices are not split where their triangles disagree on the uv orientation, the
+// orientation of the larger angle sum wins. Triangles are processed in parallel when a thread pool is given.
+void generate_tangents(
+	const std::vector<Mesh>& meshes,
+	const std::vector<uint32_t>& mesh_indices,
+	std::vector<Vertex>& vertices,
+	const std::vector<uint32_t>& indices,
+	ThreadPool* thread_pool = nullptr);
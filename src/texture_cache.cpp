@@ -0,0 +1,95 @@
+#include "texture_cache.h"
+#include "thread_pool.h"
+
+uint64_t get_texture_cache_key(const uint8_t* data, size_t size, bool is_srgb, uint32_t flags)
+{
+	return hash_bytes(data, size, (uint64_t)flags << 1 | (is_srgb ? 1 : 0));
+}
+
+int texture_cache_acquire(TextureCache& cache, uint64_t key)
+{
+	auto entry = cache.entries.find(key);
+	if (entry == cache.entries.end())
+		return -1;
+
+	entry->second.ref_count++;
+	cache.deduplicated_count++;
+	cache.deduplicated_bytes += entry->second.size;
+	return (int)entry->second.texture_index;
+}
+
+void texture_cache_insert(TextureCache& cache, uint64_t key, uint32_t texture_index, size_t size)
+{
+	assert(!cache.entries.contains(key) && !cache.keys.contains(texture_index));
+	cache.entries[key] = TextureCache::Entry{
+		.texture_index = texture_index,
+		.ref_count = 1,
+		.size = size,
+	};
+	cache.keys[texture_index] = key;
+}
+
+bool texture_cache_release(TextureCache& cache, uint32_t texture_index)
+{
+	auto key = cache.keys.find(texture_index);
+	assert(key != cache.keys.end());
+
+	auto entry = cache.entries.find(key->second);
+	if (--entry->second.ref_count > 0)
+		return false;
+
+	cache.entries.erase(entry);
+	cache.keys.erase(key);
+	return true;
+}
+
+void deduplicate_scene_images(
+	TextureCache& cache,
+	const std::vector<SceneImage>& images,
+	uint32_t first_texture,
+	bool compress_textures,
+	std::vector<uint32_t>& texture_indices,
+	std::vector<uint32_t>& unique_images,
+	ThreadPool* thread_pool)
+{
+	// Uncompressed imports do not depend on the usage
+	std::vector<uint64_t> keys(images.size());
+	auto hash_image = [&](uint32_t i) {
+		keys[i] = get_texture_cache_key(images[i].data, images[i].size, images[i].is_srgb, compress_textures ? images[i].usage + 1 : 0);
+	};
+	if (thread_pool)
+		parallel_for(*thread_pool, (uint32_t)images.size(), hash_image);
+	else
+		for (uint32_t i = 0; i < (uint32_t)images.size(); ++i)
+			hash_image(i);
+
+	texture_indices.resize(images.size());
+	unique_images.clear();
+	for (uint32_t i = 0; i < (uint32_t)images.size(); ++i)
+	{
+		int cached = texture_cache_acquire(cache, keys[i]);
+		if (cached >= 0)
+		{
+			texture_indices[i] = (uint32_t)cached;
+			continue;
+		}
+
+		texture_indices[i] = first_texture + (uint32_t)unique_images.size();
+		texture_cache_insert(cache, keys[i], texture_indices[i], images[i].size);
+		unique_images.push_back(i);
+	}
+}
+
+void remap_material_textures(std::vector<Material>& materials, size_t first_material, const std::vector<uint32_t>& texture_indices)
+{
+	for (size_t i = first_material; i < materials.size(); ++i)
+	{
+		Material& material = materials[i];
+		for (int* texture : { &material.basecolor_texture, &material.normal_texture, &material.metallic_roughness_texture,
+			&material.specular_texture, &material.occlusion_texture, &material.emissive_texture })
+		{
+			if (*texture >= 0)
+				*texture = (int)texture_indices[*texture];
+		}
+	}
+}
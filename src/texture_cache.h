@@ -0,0 +1,50 @@
+#pragma once
+
+#include "scene.h"
+
+#include <unordered_map>
+
+// Scene textures shared by content. Entries are keyed by a hash of the encoded source bytes and of how they
+// are imported and name the slot of the scene texture array that holds the texture, so identical images are
+// decoded, uploaded and kept in VRAM once however many texture entries, materials or scenes reference them.
+// Slots are shared rather than Texture copies because streaming and hot reload replace textures in place.
+struct TextureCache
+{
+	struct Entry
+	{
+		uint32_t texture_index;
+		uint32_t ref_count;
+		size_t size; // Of the source bytes
+	};
+
+	std::unordered_map<uint64_t, Entry> entries;
+	std::unordered_map<uint32_t, uint64_t> keys; // By texture index
+
+	uint32_t deduplicated_count; // References served by an existing texture
+	size_t deduplicated_bytes;   // Source bytes of those references
+};
+
+// The flags are anything else that changes the imported texture, e.g. the block compression usage
+uint64_t get_texture_cache_key(const uint8_t* data, size_t size, bool is_srgb, uint32_t flags = 0);
+
+// Adds a reference to the texture cached for the key and returns its index, -1 if there is none
+int texture_cache_acquire(TextureCache& cache, uint64_t key);
+// Caches a texture the caller loads for the key, with a single reference
+void texture_cache_insert(TextureCache& cache, uint64_t key, uint32_t texture_index, size_t size);
+// Drops a reference, returns true when it was the last one and the texture can be destroyed
+bool texture_cache_release(TextureCache& cache, uint32_t texture_index);
+
+// Assigns every glTF texture a slot from first_texture on, or the slot of a cached texture with the same
+// image. texture_indices receives the slot per image, unique_images the images that still have to be loaded,
+// in slot order. Keys are hashed on the thread pool when one is given.
+void deduplicate_scene_images(
+	TextureCache& cache,
+	const std::vector<SceneImage>& images,
+	uint32_t first_texture,
+	bool compress_textures,
+	std::vector<uint32_t>& texture_indices,
+	std::vector<uint32_t>& unique_images,
+	ThreadPool* thread_pool = nullptr);
+
+// Replaces the texture references of the materials from first_material on with texture_indices[reference]
+void remap_material_textures(std::vector<Material>& materials, size_t first_material, const std::vector<uint32_t>& texture_indices);
@@ -0,0 +1,533 @@
+#include "texture_compression.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <filesystem>
+
+// Principal axis of a set of points through power iteration on their covariance matrix
+static void principal_axis(const float (*points)[4], uint32_t count, uint32_t dims, const float mean[4], float axis[4])
+{
+	float covariance[4][4] = {};
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		float d[4];
+		for (uint32_t c = 0; c < dims; ++c)
+			d[c] = points[i][c] - mean[c];
+		for (uint32_t r = 0; r < dims; ++r)
+			for (uint32_t c = 0; c < dims; ++c)
+				covariance[r][c] += d[r] * d[c];
+	}
+
+	for (uint32_t c = 0; c < 4; ++c)
+		axis[c] = c < dims ? 1.0f : 0.0f;
+
+	for (uint32_t iteration = 0; iteration < 8; ++iteration)
+	{
+		float next[4] = {};
+		for (uint32_t r = 0; r < dims; ++r)
+			for (uint32_t c = 0; c < dims; ++c)
+				next[r] += covariance[r][c] * axis[c];
+
+		float length = 0.0f;
+		for (uint32_t c = 0; c < dims; ++c)
+			length = std::max(length, std::abs(next[c]));
+
+		// Flat block, any axis works
+		if (length < 1e-6f)
+			return;
+
+		for (uint32_t c = 0; c < dims; ++c)
+			axis[c] = next[c] / length;
+	}
+}
+
+// Endpoints at the extremes of the block projected onto its principal axis
+static void fit_endpoints(const float (*points)[4], uint32_t dims, float e0[4], float e1[4])
+{
+	float mean[4] = {};
+	for (uint32_t i = 0; i < 16; ++i)
+		for (uint32_t c = 0; c < dims; ++c)
+			mean[c] += points[i][c] / 16.0f;
+
+	float axis[4];
+	principal_axis(points, 16, dims, mean, axis);
+
+	float t_min = FLT_MAX;
+	float t_max = -FLT_MAX;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		float t = 0.0f;
+		for (uint32_t c = 0; c < dims; ++c)
+			t += (points[i][c] - mean[c]) * axis[c];
+		t_min = std::min(t_min, t);
+		t_max = std::max(t_max, t);
+	}
+
+	float axis_length_sq = 0.0f;
+	for (uint32_t c = 0; c < dims; ++c)
+		axis_length_sq += axis[c] * axis[c];
+	axis_length_sq = std::max(axis_length_sq, 1e-12f);
+
+	for (uint32_t c = 0; c < dims; ++c)
+	{
+		e0[c] = std::clamp(mean[c] + axis[c] * t_max / axis_length_sq, 0.0f, 255.0f);
+		e1[c] = std::clamp(mean[c] + axis[c] * t_min / axis_length_sq, 0.0f, 255.0f);
+	}
+}
+
+// Least squares endpoints for fixed interpolation weights, weights[i] is the contribution of e1.
+// Returns false when the system is degenerate (all texels using the same weight).
+static bool refine_endpoints(const float (*points)[4], uint32_t dims, const float* weights, float e0[4], float e1[4])
+{
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		float b = weights[i];
+		float a = 1.0f - b;
+		aa += a * a;
+		bb += b * b;
+		ab += a * b;
+		for (uint32_t c = 0; c < dims; ++c)
+		{
+			ax[c] += a * points[i][c];
+			bx[c] += b * points[i][c];
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (std::abs(det) < 1e-6f)
+		return false;
+
+	for (uint32_t c = 0; c < dims; ++c)
+	{
+		e0[c] = std::clamp((bb * ax[c] - ab * bx[c]) / det, 0.0f, 255.0f);
+		e1[c] = std::clamp((aa * bx[c] - ab * ax[c]) / det, 0.0f, 255.0f);
+	}
+
+	return true;
+}
+
+static void load_block(const uint8_t* texels, uint32_t dims, float points[16][4])
+{
+	for (uint32_t i = 0; i < 16; ++i)
+		for (uint32_t c = 0; c < 4; ++c)
+			points[i][c] = c < dims ? (float)texels[i * 4 + c] : 0.0f;
+}
+
+static uint16_t pack_565(const float color[3])
+{
+	uint32_t r = (uint32_t)std::clamp(std::lround(color[0] * 31.0f / 255.0f), 0l, 31l);
+	uint32_t g = (uint32_t)std::clamp(std::lround(color[1] * 63.0f / 255.0f), 0l, 63l);
+	uint32_t b = (uint32_t)std::clamp(std::lround(color[2] * 31.0f / 255.0f), 0l, 31l);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpack_565(uint16_t packed, float color[3])
+{
+	uint32_t r = packed >> 11;
+	uint32_t g = (packed >> 5) & 63;
+	uint32_t b = packed & 31;
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Picks the closest of the four palette entries of a 4 color BC1 block for every texel
+static float bc1_select_indices(const float points[16][4], uint16_t c0, uint16_t c1, uint32_t& indices)
+{
+	float palette[4][3];
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	for (uint32_t c = 0; c < 3; ++c)
+	{
+		palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+		palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+	}
+
+	float error = 0.0f;
+	indices = 0;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		uint32_t best_index = 0;
+		float best_error = FLT_MAX;
+		for (uint32_t p = 0; p < 4; ++p)
+		{
+			float e = 0.0f;
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				float d = points[i][c] - palette[p][c];
+				e += d * d;
+			}
+			if (e < best_error)
+			{
+				best_error = e;
+				best_index = p;
+			}
+		}
+
+		indices |= best_index << (i * 2);
+		error += best_error;
+	}
+
+	return error;
+}
+
+void compress_bc1_block(const uint8_t* texels, uint8_t* block)
+{
+	float points[16][4];
+	load_block(texels, 3, points);
+
+	float e0[4], e1[4];
+	fit_endpoints(points, 3, e0, e1);
+
+	uint16_t best_c0 = 0, best_c1 = 0;
+	uint32_t best_indices = 0;
+	float best_error = FLT_MAX;
+
+	// Initial fit followed by least squares refinement of the endpoints for the chosen indices
+	for (uint32_t iteration = 0; iteration < 3; ++iteration)
+	{
+		uint16_t c0 = pack_565(e0);
+		uint16_t c1 = pack_565(e1);
+
+		// Four color mode needs c0 > c1, equal endpoints only ever use index 0
+		if (c0 < c1)
+			std::swap(c0, c1);
+
+		uint32_t indices;
+		float error = bc1_select_indices(points, c0, c1, indices);
+		if (c0 == c1)
+			indices = 0;
+
+		if (error < best_error)
+		{
+			best_error = error;
+			best_c0 = c0;
+			best_c1 = c1;
+			best_indices = indices;
+		}
+
+		if (c0 == c1)
+			break;
+
+		static constexpr float weights_for_index[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+		float weights[16];
+		for (uint32_t i = 0; i < 16; ++i)
+			weights[i] = weights_for_index[(indices >> (i * 2)) & 3];
+
+		unpack_565(c0, e0);
+		unpack_565(c1, e1);
+		if (!refine_endpoints(points, 3, weights, e0, e1))
+			break;
+	}
+
+	block[0] = (uint8_t)(best_c0 & 0xff);
+	block[1] = (uint8_t)(best_c0 >> 8);
+	block[2] = (uint8_t)(best_c1 & 0xff);
+	block[3] = (uint8_t)(best_c1 >> 8);
+	block[4] = (uint8_t)(best_indices & 0xff);
+	block[5] = (uint8_t)((best_indices >> 8) & 0xff);
+	block[6] = (uint8_t)((best_indices >> 16) & 0xff);
+	block[7] = (uint8_t)(best_indices >> 24);
+}
+
+void compress_bc4_block(const uint8_t* texels, uint32_t channel, uint8_t* block)
+{
+	uint8_t values[16];
+	uint8_t min_value = 255;
+	uint8_t max_value = 0;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		values[i] = texels[i * 4 + channel];
+		min_value = std::min(min_value, values[i]);
+		max_value = std::max(max_value, values[i]);
+	}
+
+	// Eight value mode (a0 > a1): index 0 is a0, 1 is a1 and 2..7 interpolate from a0 towards a1
+	block[0] = max_value;
+	block[1] = min_value;
+
+	uint64_t indices = 0;
+	if (max_value > min_value)
+	{
+		float range = (float)(max_value - min_value);
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			uint32_t step = (uint32_t)std::lround((values[i] - min_value) * 7.0f / range);
+			uint32_t index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+			indices |= (uint64_t)index << (i * 3);
+		}
+	}
+
+	for (uint32_t i = 0; i < 6; ++i)
+		block[2 + i] = (uint8_t)((indices >> (i * 8)) & 0xff);
+}
+
+void compress_bc5_block(const uint8_t* texels, uint8_t* block)
+{
+	compress_bc4_block(texels, 0, block);
+	compress_bc4_block(texels, 1, block + 8);
+}
+
+static constexpr uint32_t BC7_WEIGHTS_4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct Bc7Endpoints
+{
+	uint32_t e0[4]; // 7 bit per channel
+	uint32_t e1[4];
+	uint32_t p0;
+	uint32_t p1;
+};
+
+// Quantizes an endpoint to 7 bits per channel plus a shared p-bit, trying both p-bit values
+static void bc7_quantize_endpoint(const float value[4], uint32_t quantized[4], uint32_t& p_bit)
+{
+	float best_error = FLT_MAX;
+	for (uint32_t p = 0; p < 2; ++p)
+	{
+		uint32_t q[4];
+		float error = 0.0f;
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			q[c] = (uint32_t)std::clamp(std::lround((value[c] - (float)p) / 2.0f), 0l, 127l);
+			float d = (float)((q[c] << 1) | p) - value[c];
+			error += d * d;
+		}
+
+		if (error < best_error)
+		{
+			best_error = error;
+			p_bit = p;
+			memcpy(quantized, q, sizeof(q));
+		}
+	}
+}
+
+static float bc7_select_indices(const float points[16][4], const Bc7Endpoints& endpoints, uint32_t indices[16])
+{
+	uint32_t palette[16][4];
+	for (uint32_t c = 0; c < 4; ++c)
+	{
+		uint32_t a = (endpoints.e0[c] << 1) | endpoints.p0;
+		uint32_t b = (endpoints.e1[c] << 1) | endpoints.p1;
+		for (uint32_t i = 0; i < 16; ++i)
+			palette[i][c] = ((64 - BC7_WEIGHTS_4[i]) * a + BC7_WEIGHTS_4[i] * b + 32) >> 6;
+	}
+
+	float error = 0.0f;
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		float best_error = FLT_MAX;
+		for (uint32_t p = 0; p < 16; ++p)
+		{
+			float e = 0.0f;
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				float d = points[i][c] - (float)palette[p][c];
+				e += d * d;
+			}
+			if (e < best_error)
+			{
+				best_error = e;
+				indices[i] = p;
+			}
+		}
+		error += best_error;
+	}
+
+	return error;
+}
+
+static void write_bits(uint8_t* block, uint32_t& offset, uint32_t value, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; ++i, ++offset)
+		block[offset >> 3] |= (uint8_t)(((value >> i) & 1) << (offset & 7));
+}
+
+// Mode 6 only: one subset, RGBA endpoints with 7 bits plus p-bit and 4 bit indices. Not the best
+// mode for every block, but a good quality/speed trade off for color textures.
+void compress_bc7_block(const uint8_t* texels, uint8_t* block)
+{
+	float points[16][4];
+	load_block(texels, 4, points);
+
+	float e0[4], e1[4];
+	fit_endpoints(points, 4, e0, e1);
+
+	Bc7Endpoints best_endpoints{};
+	uint32_t best_indices[16] = {};
+	float best_error = FLT_MAX;
+
+	for (uint32_t iteration = 0; iteration < 3; ++iteration)
+	{
+		Bc7Endpoints endpoints;
+		bc7_quantize_endpoint(e0, endpoints.e0, endpoints.p0);
+		bc7_quantize_endpoint(e1, endpoints.e1, endpoints.p1);
+
+		uint32_t indices[16];
+		float error = bc7_select_indices(points, endpoints, indices);
+		if (error < best_error)
+		{
+			best_error = error;
+			best_endpoints = endpoints;
+			memcpy(best_indices, indices, sizeof(indices));
+		}
+
+		float weights[16];
+		for (uint32_t i = 0; i < 16; ++i)
+			weights[i] = BC7_WEIGHTS_4[indices[i]] / 64.0f;
+
+		if (!refine_endpoints(points, 4, weights, e0, e1))
+			break;
+	}
+
+	// The anchor index is stored with an implicit zero high bit, flip the block if it is set
+	if (best_indices[0] & 8)
+	{
+		std::swap(best_endpoints.e0, best_endpoints.e1);
+		std::swap(best_endpoints.p0, best_endpoints.p1);
+		for (uint32_t i = 0; i < 16; ++i)
+			best_indices[i] = 15 - best_indices[i];
+	}
+
+	memset(block, 0, 16);
+	uint32_t offset = 0;
+	write_bits(block, offset, 1 << 6, 7);
+	for (uint32_t c = 0; c < 4; ++c)
+	{
+		write_bits(block, offset, best_endpoints.e0[c], 7);
+		write_bits(block, offset, best_endpoints.e1[c], 7);
+	}
+	write_bits(block, offset, best_endpoints.p0, 1);
+	write_bits(block, offset, best_endpoints.p1, 1);
+	write_bits(block, offset, best_indices[0], 3);
+	for (uint32_t i = 1; i < 16; ++i)
+		write_bits(block, offset, best_indices[i], 4);
+	assert(offset == 128);
+}
+
+void compress_texture_image(TextureImage& compressed, const TextureImage& source, TextureUsage usage, bool is_srgb)
+{
+	assert(source.format == VK_FORMAT_R8G8B8A8_UNORM || source.format == VK_FORMAT_R8G8B8A8_SRGB);
+
+	VkFormat format;
+	uint32_t block_size;
+	switch (usage)
+	{
+	case TEXTURE_USAGE_COLOR:
+		format = is_srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+		block_size = 16;
+		break;
+	case TEXTURE_USAGE_NORMAL:
+		format = VK_FORMAT_BC5_UNORM_BLOCK;
+		block_size = 16;
+		break;
+	case TEXTURE_USAGE_SINGLE_CHANNEL:
+		format = VK_FORMAT_BC4_UNORM_BLOCK;
+		block_size = 8;
+		break;
+	default:
+		format = is_srgb ? VK_FORMAT_BC1_RGBA_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+		block_size = 8;
+		break;
+	}
+
+	compressed.width = source.width;
+	compressed.height = source.height;
+	compressed.depth = 1;
+	compressed.mip_levels = source.mip_levels;
+	compressed.array_layers = 1;
+	compressed.format = format;
+	compressed.is_cubemap = false;
+	compressed.regions = source.regions;
+
+	size_t total_size = 0;
+	for (VkBufferImageCopy& region : compressed.regions)
+	{
+		region.bufferOffset = total_size;
+		total_size += (size_t)((region.imageExtent.width + 3) / 4) * ((region.imageExtent.height + 3) / 4) * block_size;
+	}
+
+	compressed.storage.resize(total_size);
+	compressed.data = compressed.storage.data();
+	compressed.size = total_size;
+
+	for (size_t level = 0; level < source.regions.size(); ++level)
+	{
+		const VkBufferImageCopy& src_region = source.regions[level];
+		const uint8_t* src = source.data + src_region.bufferOffset;
+		uint8_t* dst = compressed.storage.data() + compressed.regions[level].bufferOffset;
+		uint32_t width = src_region.imageExtent.width;
+		uint32_t height = src_region.imageExtent.height;
+
+		for (uint32_t by = 0; by < height; by += 4)
+		{
+			for (uint32_t bx = 0; bx < width; bx += 4)
+			{
+				// Blocks overhanging the edge of small mips repeat the last row/column
+				uint8_t texels[16 * 4];
+				for (uint32_t y = 0; y < 4; ++y)
+				{
+					uint32_t sy = std::min(by + y, height - 1);
+					for (uint32_t x = 0; x < 4; ++x)
+					{
+						uint32_t sx = std::min(bx + x, width - 1);
+						memcpy(&texels[(y * 4 + x) * 4], src + ((size_t)sy * width + sx) * 4, 4);
+					}
+				}
+
+				switch (usage)
+				{
+				case TEXTURE_USAGE_COLOR: compress_bc7_block(texels, dst); break;
+				case TEXTURE_USAGE_NORMAL: compress_bc5_block(texels, dst); break;
+				case TEXTURE_USAGE_SINGLE_CHANNEL: compress_bc4_block(texels, 0, dst); break;
+				default: compress_bc1_block(texels, dst); break;
+				}
+				dst += block_size;
+			}
+		}
+	}
+}
+
+bool import_compressed_texture(TextureImage& image, const uint8_t* data, size_t data_size, TextureUsage usage, bool is_srgb)
+{
+	char cache_path[512];
+	snprintf(cache_path, sizeof(cache_path), "%s/%016llx_%u%u_v%u.dds", TEXTURE_CACHE_DIRECTORY,
+		(unsigned long long)hash_bytes(data, data_size), (uint32_t)usage, is_srgb ? 1u : 0u, TEXTURE_COMPRESSION_VERSION);
+
+	std::error_code error;
+	if (std::filesystem::exists(cache_path, error))
+	{
+		std::vector<uint8_t> cached;
+		if (read_binary_file(cache_path, cached) && parse_dds(image, cached.data(), cached.size(), is_srgb))
+		{
+			// Moving the vector keeps the buffer image.data points into alive
+			if (image.storage.empty())
+				image.storage = std::move(cached);
+			return true;
+		}
+
+		printf("Ignoring invalid texture cache entry %s\n", cache_path);
+	}
+
+	DecodedImage decoded;
+	if (!decode_png_or_jpg(decoded, data, data_size))
+		return false;
+
+	TextureImage uncompressed;
+	build_mip_chain(uncompressed, decoded, is_srgb);
+	free_decoded_image(decoded);
+
+	compress_texture_image(image, uncompressed, usage, is_srgb);
+
+	// Write to a unique temporary name first, two workers may import the same image at once
+	char temp_path[600];
+	snprintf(temp_path, sizeof(temp_path), "%s.%p.tmp", cache_path, (void*)&image);
+	std::filesystem::create_directories(TEXTURE_CACHE_DIRECTORY, error);
+	if (write_dds(temp_path, image))
+		std::filesystem::rename(temp_path, cache_path, error);
+
+	return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "resources.h"
+
+// What a texture is sampled for. Decides the block compression format it is imported with.
+enum TextureUsage
+{
+	TEXTURE_USAGE_COLOR = 0,      // BC7, RGBA color (basecolor)
+	TEXTURE_USAGE_NORMAL,         // BC5, tangent space XY in RG, Z is reconstructed in the shader
+	TEXTURE_USAGE_SINGLE_CHANNEL, // BC4, R only (occlusion)
+	TEXTURE_USAGE_PACKED,         // BC1, RGB masks (metallic/roughness, specular, emissive)
+};
+
+// Bump whenever the encoders change so stale cache entries are not picked up
+static constexpr uint32_t TEXTURE_COMPRESSION_VERSION = 1;
+static constexpr const char* TEXTURE_CACHE_DIRECTORY = "cache/textures";
+
+// Block encoders for a single 4x4 block of RGBA8 texels in row major order
+void compress_bc1_block(const uint8_t* texels, uint8_t* block);
+void compress_bc4_block(const uint8_t* texels, uint32_t channel, uint8_t* block);
+void compress_bc5_block(const uint8_t* texels, uint8_t* block);
+void compress_bc7_block(const uint8_t* texels, uint8_t* block);
+
+// Block compresses every level of an RGBA8 mip chain (as produced by build_mip_chain)
+void compress_texture_image(TextureImage& compressed, const TextureImage& source, TextureUsage usage, bool is_srgb);
+
+// Decodes a PNG/JPG image, builds its mip chain and block compresses it for its usage. The result is
+// cached as a DDS file under TEXTURE_CACHE_DIRECTORY keyed by a hash of the encoded image, later
+// imports of the same image only read the cached file. Safe to call from worker threads.
+bool import_compressed_texture(TextureImage& image, const uint8_t* data, size_t data_size, TextureUsage usage, bool is_srgb);
@@ -0,0 +1,220 @@
+#include "texture_streaming.h"
+#include "upload.h"
+
+#include <algorithm>
+
+#include "vma/vk_mem_alloc.h"
+
+void create_texture_streamer(TextureStreamer& streamer, VkDevice device, VmaAllocator allocator)
+{
+	std::vector<uint32_t> feedback(TEXTURE_STREAMING_MAX_TEXTURES, UINT32_MAX);
+
+	streamer.device = device;
+	streamer.allocator = allocator;
+	streamer.feedback = create_buffer(allocator, feedback.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT, feedback.data());
+	streamer.feedback_mapped = (uint32_t*)streamer.feedback.map();
+	streamer.update_index = 0;
+	streamer.streamed_bytes = 0;
+	streamer.streamed_count = 0;
+	streamer.evicted_count = 0;
+}
+
+void destroy_texture_streamer(TextureStreamer& streamer)
+{
+	for (TextureStreamer::StreamedTexture& streamed : streamer.textures)
+	{
+		if (streamed.pending.image != VK_NULL_HANDLE)
+			streamed.pending.destroy();
+	}
+	streamer.textures.clear();
+
+	streamer.feedback.unmap();
+	streamer.feedback.destroy();
+}
+
+// Creates a texture holding the levels of the full chain from first_mip on. The levels current holds, from
+// resident_mip on, are copied from it on the GPU and only the others are staged from the image.
+static Texture upload_resident_levels(const TextureStreamer& streamer, const TextureImage& image, uint32_t first_mip, const Texture* current, uint32_t resident_mip,
+	UploadBatcher& uploader, VkDeviceSize& uploaded)
+{
+	Texture texture = create_texture(streamer.device, streamer.allocator, std::max(image.width >> first_mip, 1u), std::max(image.height >> first_mip, 1u), 1,
+		image.format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, image.mip_levels - first_mip);
+
+	uint32_t copied_mip = current ? std::max(first_mip, resident_mip) : image.mip_levels;
+
+	std::vector<VkBufferImageCopy> regions;
+	for (const VkBufferImageCopy& region : image.regions)
+	{
+		if (region.imageSubresource.mipLevel < first_mip || region.imageSubresource.mipLevel >= copied_mip)
+			continue;
+
+		VkBufferImageCopy copy = region;
+		copy.imageSubresource.mipLevel -= first_mip;
+		regions.push_back(copy);
+	}
+
+	if (!regions.empty())
+		uploaded += upload_batcher_upload_image(uploader, texture, image.data, regions.data(), (uint32_t)regions.size());
+	if (copied_mip < image.mip_levels)
+		upload_batcher_copy_levels(uploader, *current, copied_mip - resident_mip, texture, copied_mip - first_mip, image.mip_levels - copied_mip, !regions.empty());
+
+	return texture;
+}
+
+// The finer levels are uploaded long after the source file is gone
+static void take_image_ownership(TextureImage& image)
+{
+	if (image.storage.empty())
+	{
+		image.storage.assign(image.data, image.data + image.size);
+		image.data = image.storage.data();
+	}
+}
+
+static uint32_t get_initial_mip(const TextureImage& image)
+{
+	uint32_t first_mip = 0;
+	while (first_mip + 1 < image.mip_levels && std::max(image.width >> first_mip, image.height >> first_mip) > TEXTURE_STREAMING_INITIAL_SIZE)
+		first_mip++;
+
+	return first_mip;
+}
+
+void stream_texture_image(TextureStreamer& streamer, Texture& texture, uint32_t texture_index, TextureImage&& image, UploadBatcher& uploader)
+{
+	if (image.mip_levels < 2 || image.depth != 1 || image.array_layers != 1 || image.is_cubemap || texture_index >= TEXTURE_STREAMING_MAX_TEXTURES)
+	{
+		load_texture_image(texture, image, streamer.device, streamer.allocator, uploader);
+		return;
+	}
+
+	take_image_ownership(image);
+	uint32_t first_mip = get_initial_mip(image);
+
+	VkDeviceSize uploaded = 0;
+	texture = upload_resident_levels(streamer, image, first_mip, nullptr, 0, uploader, uploaded);
+
+	if (streamer.textures.size() <= texture_index)
+		streamer.textures.resize(texture_index + 1);
+
+	streamer.textures[texture_index] = {
+		.image = std::move(image),
+		.resident_mip = first_mip,
+		.initial_mip = first_mip,
+		.last_sampled = streamer.update_index,
+	};
+}
+
+void release_streamed_texture(TextureStreamer& streamer, uint32_t texture_index)
+{
+	if (texture_index >= streamer.textures.size())
+		return;
+
+	TextureStreamer::StreamedTexture& streamed = streamer.textures[texture_index];
+	if (streamed.pending.image != VK_NULL_HANDLE)
+		streamed.pending.destroy();
+	streamed = {};
+}
+
+uint32_t get_texture_stream(const TextureStreamer& streamer, int texture_index)
+{
+	if (texture_index < 0 || (size_t)texture_index >= streamer.textures.size() || !streamer.textures[texture_index].image.data)
+		return TEXTURE_STREAMING_NONE;
+
+	return ((uint32_t)texture_index << 8) | streamer.textures[texture_index].resident_mip;
+}
+
+void update_texture_streamer(TextureStreamer& streamer, std::vector<Texture>& textures, UploadBatcher& uploader, VkDeviceSize byte_budget)
+{
+	streamer.update_index++;
+
+	// The frame that just completed waited for the uploads queued by the previous update, and was the
+	// last one to sample the textures they replace
+	for (size_t i = 0; i < streamer.textures.size(); ++i)
+	{
+		TextureStreamer::StreamedTexture& streamed = streamer.textures[i];
+		if (streamed.pending.image == VK_NULL_HANDLE)
+			continue;
+
+		textures[i].destroy();
+		textures[i] = streamed.pending;
+		streamed.resident_mip = streamed.pending_mip;
+		streamed.pending = {};
+	}
+
+	VK_CHECK(vmaInvalidateAllocation(streamer.allocator, streamer.feedback.allocation, 0, VK_WHOLE_SIZE));
+
+	// Textures over the budget are sampled again by the next frame and picked up by a later update
+	VkDeviceSize uploaded = 0;
+	for (uint32_t i = 0; i < (uint32_t)streamer.textures.size(); ++i)
+	{
+		uint32_t sampled_mip = streamer.feedback_mapped[i];
+		streamer.feedback_mapped[i] = UINT32_MAX;
+
+		TextureStreamer::StreamedTexture& streamed = streamer.textures[i];
+		if (sampled_mip != UINT32_MAX)
+			streamed.last_sampled = streamer.update_index;
+
+		if (!streamed.image.data || sampled_mip >= streamed.resident_mip || uploaded >= byte_budget)
+			continue;
+
+		streamed.pending = upload_resident_levels(streamer, streamed.image, sampled_mip, &textures[i], streamed.resident_mip, uploader, uploaded);
+		streamed.pending_mip = sampled_mip;
+		streamer.streamed_count++;
+	}
+
+	VK_CHECK(vmaFlushAllocation(streamer.allocator, streamer.feedback.allocation, 0, VK_WHOLE_SIZE));
+
+	if (uploaded != 0)
+	{
+		streamer.streamed_bytes += uploaded;
+		upload_batcher_flush(uploader);
+	}
+}
+
+bool evict_texture_mips(TextureStreamer& streamer, const Texture& texture, uint32_t texture_index, uint32_t first_mip, UploadBatcher& uploader)
+{
+	if (texture_index >= streamer.textures.size())
+		return false;
+
+	TextureStreamer::StreamedTexture& streamed = streamer.textures[texture_index];
+	if (!streamed.image.data || streamed.pending.image != VK_NULL_HANDLE || first_mip <= streamed.resident_mip || first_mip > streamed.initial_mip)
+		return false;
+
+	VkDeviceSize uploaded = 0;
+	streamed.pending = upload_resident_levels(streamer, streamed.image, first_mip, &texture, streamed.resident_mip, uploader, uploaded);
+	streamed.pending_mip = first_mip;
+	streamer.evicted_count++;
+
+	return true;
+}
+
+bool restream_texture_image(TextureStreamer& streamer, uint32_t texture_index, TextureImage&& image, UploadBatcher& uploader)
+{
+	TextureStreamer::StreamedTexture& streamed = streamer.textures[texture_index];
+	if (streamed.pending.image != VK_NULL_HANDLE)
+		return false;
+
+	if (image.depth != 1 || image.array_layers != 1 || image.is_cubemap)
+	{
+		printf("Streamed textures cannot become cubemaps, arrays or volumes, the new image is ignored\n");
+		return true;
+	}
+
+	take_image_ownership(image);
+	uint32_t initial_mip = get_initial_mip(image);
+
+	// Keep the current detail if the mip chain has the same shape
+	uint32_t first_mip = initial_mip;
+	if (image.width == streamed.image.width && image.height == streamed.image.height && image.mip_levels == streamed.image.mip_levels)
+		first_mip = std::min(first_mip, streamed.resident_mip);
+
+	VkDeviceSize uploaded = 0;
+	streamed.pending = upload_resident_levels(streamer, image, first_mip, nullptr, 0, uploader, uploaded);
+	streamed.pending_mip = first_mip;
+	streamed.initial_mip = initial_mip;
+	streamed.image = std::move(image);
+
+	return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "resources.h"
+
+// The feedback buffer has one slot per texture for up to this many textures
+static constexpr uint32_t TEXTURE_STREAMING_MAX_TEXTURES = 4096;
+// Mip levels up to this size are made resident when a texture is loaded
+static constexpr uint32_t TEXTURE_STREAMING_INITIAL_SIZE = 64;
+// Upper bound for the texel data streamed in by a single update
+static constexpr VkDeviceSize TEXTURE_STREAMING_BYTES_PER_UPDATE = 32 * 1024 * 1024;
+// Written to the feedback stream constant of textures that are not streamed
+static constexpr uint32_t TEXTURE_STREAMING_NONE = 0xFFFFFFFF;
+
+// Progressive mip streaming. Every streamed texture starts out with only its smallest levels resident
+// and its full mip chain kept on the CPU. The forward pass records the finest level each texture would
+// sample into a feedback buffer, and textures that are sampled finer than they are resident are
+// reallocated with the missing levels. Only those are uploaded in the background, the resident ones are
+// copied over from the current texture on the GPU.
+//
+// A texture only ever holds its resident levels, so the view of the current Texture clamps sampling
+// to the finest level loaded. Shaders add resident_mip to their computed level of detail to get the
+// level of the full chain.
+struct TextureStreamer
+{
+	struct StreamedTexture
+	{
+		TextureImage image; // Full mip chain, regions use the mip levels of the full chain
+		uint32_t resident_mip; // First level of the full chain held by the current texture, 0 when fully resident
+		uint32_t initial_mip; // Levels from here on are never evicted
+		uint32_t pending_mip;
+		Texture pending; // Uploading, replaces the current texture on the next update
+		uint64_t last_sampled; // Update that last saw the texture in the feedback
+	};
+
+	VkDevice device;
+	VmaAllocator allocator;
+
+	std::vector<StreamedTexture> textures; // Indexed like the scene textures, image.data is null for textures not streamed
+	Buffer feedback; // Finest mip level sampled per texture since the last update, host visible
+	uint32_t* feedback_mapped;
+
+	uint64_t update_index;
+	VkDeviceSize streamed_bytes;
+	uint32_t streamed_count;
+	uint32_t evicted_count;
+};
+
+void create_texture_streamer(TextureStreamer& streamer, VkDevice device, VmaAllocator allocator);
+void destroy_texture_streamer(TextureStreamer& streamer);
+
+// Creates the texture with its smallest levels and queues their upload. The streamer takes over the image,
+// images that reference their source data are copied first. Textures without a mip chain, cubemaps,
+// arrays and volumes are loaded completely.
+void stream_texture_image(TextureStreamer& streamer, Texture& texture, uint32_t texture_index, TextureImage&& image, UploadBatcher& uploader);
+
+// Replaces the full mip chain of a streamed texture, e.g. after its file changed. The new image is uploaded at
+// the current resident level when it has the same size and swapped in by the next update. Returns false while
+// an upload of the texture is pending, try again after the next update.
+bool restream_texture_image(TextureStreamer& streamer, uint32_t texture_index, TextureImage&& image, UploadBatcher& uploader);
+
+// Stops streaming the texture once it is unloaded and destroys its pending upload. The upload has to have
+// completed, like the textures the caller destroys with it.
+void release_streamed_texture(TextureStreamer& streamer, uint32_t texture_index);
+
+// Returns the stream constant of a texture for the forward pass, the texture index in the upper 24 bits
+// and its first resident level in the lower 8, or TEXTURE_STREAMING_NONE.
+uint32_t get_texture_stream(const TextureStreamer& streamer, int texture_index);
+
+// Call once per frame after the frame that sampled the textures has completed, the previous frame's
+// command buffer must also have acquired the uploads flushed by the previous update. Swaps in the
+// textures whose upload was queued by the previous update and destroys the ones they replace, then
+// reads and resets the feedback and queues the uploads of textures that need finer levels, up to byte_budget.
+void update_texture_streamer(TextureStreamer& streamer, std::vector<Texture>& textures, UploadBatcher& uploader, VkDeviceSize byte_budget = TEXTURE_STREAMING_BYTES_PER_UPDATE);
+
+// Queues a GPU copy of the current texture that only holds the levels from first_mip on, it replaces the current
+// one on the next update. Returns false if the texture is not streamed, has an upload pending or first_mip would
+// drop levels it started out with. The caller flushes the uploader.
+bool evict_texture_mips(TextureStreamer& streamer, const Texture& texture, uint32_t texture_index, uint32_t first_mip, UploadBatcher& uploader);
@@ -0,0 +1,101 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+static void worker_main(ThreadPool* pool)
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(pool->mutex);
+			pool->work_available.wait(lock, [&] { return pool->stopping || !pool->jobs.empty(); });
+			if (pool->jobs.empty())
+				return;
+
+			job = std::move(pool->jobs.front());
+			pool->jobs.pop_front();
+			pool->busy++;
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock(pool->mutex);
+			pool->busy--;
+		}
+		pool->work_done.notify_all();
+	}
+}
+
+void init_thread_pool(ThreadPool& pool, uint32_t worker_count)
+{
+	pool.busy = 0;
+	pool.stopping = false;
+
+	if (worker_count == 0)
+		worker_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+	for (uint32_t i = 0; i < worker_count; ++i)
+		pool.workers.emplace_back(worker_main, &pool);
+}
+
+void destroy_thread_pool(ThreadPool& pool)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.stopping = true;
+	}
+	pool.work_available.notify_all();
+
+	for (std::thread& worker : pool.workers)
+		worker.join();
+
+	pool.workers.clear();
+	pool.jobs.clear();
+}
+
+void thread_pool_submit(ThreadPool& pool, std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.jobs.push_back(std::move(job));
+	}
+	pool.work_available.notify_one();
+}
+
+void thread_pool_wait(ThreadPool& pool)
+{
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	pool.work_done.wait(lock, [&] { return pool.jobs.empty() && pool.busy == 0; });
+}
+
+void parallel_for(ThreadPool& pool, uint32_t count, const std::function<void(uint32_t)>& function)
+{
+	if (count == 0)
+		return;
+
+	// One job per worker pulling indices keeps the queue short for large counts. The jobs reference
+	// this stack frame, so wait for the jobs themselves to exit rather than for the last index.
+	std::atomic<uint32_t> next_index = 0;
+	uint32_t running_jobs = std::min(count, pool.worker_count());
+	std::mutex done_mutex;
+	std::condition_variable done;
+
+	uint32_t job_count = running_jobs;
+	for (uint32_t i = 0; i < job_count; ++i)
+	{
+		thread_pool_submit(pool, [&]() {
+			for (uint32_t index = next_index++; index < count; index = next_index++)
+				function(index);
+
+			std::lock_guard<std::mutex> lock(done_mutex);
+			if (--running_jobs == 0)
+				done.notify_all();
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(done_mutex);
+	done.wait(lock, [&] { return running_jobs == 0; });
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Fixed set of worker threads for CPU heavy asset work (image decoding, mesh processing).
+// Jobs are plain callables; results are handed back through whatever the caller captures.
+struct ThreadPool
+{
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable work_done;
+	uint32_t busy;
+	bool stopping;
+
+	inline uint32_t worker_count() const { return (uint32_t)workers.size(); }
+};
+
+// A worker count of 0 starts one worker per hardware thread.
+void init_thread_pool(ThreadPool& pool, uint32_t worker_count = 0);
+void destroy_thread_pool(ThreadPool& pool);
+
+void thread_pool_submit(ThreadPool& pool, std::function<void()> job);
+
+// Blocks until every submitted job has finished.
+void thread_pool_wait(ThreadPool& pool);
+
+// Runs function(i) for every i in [0, count) on the pool and waits for all of them.
+// Must not be called from inside a pool job.
+void parallel_for(ThreadPool& pool, uint32_t count, const std::function<void(uint32_t)>& function);
@@ -0,0 +1,690 @@
+#include "upload.h"
+#include "downsample.h"
+#include "load_telemetry.h"
+
+static constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+UploadBatcher create_upload_batcher(VkDevice device, VmaAllocator allocator, uint32_t queue_family, VkQueue queue, uint32_t graphics_queue_family, VkDeviceSize staging_capacity)
+{
+	assert(staging_capacity >= UPLOAD_STAGING_MIN_SIZE);
+
+	UploadBatcher batcher{};
+	batcher.device = device;
+	batcher.allocator = allocator;
+	batcher.queue = queue;
+	batcher.queue_family = queue_family;
+	batcher.graphics_queue_family = graphics_queue_family;
+
+	for (auto& slot : batcher.slots)
+	{
+		VkCommandPoolCreateInfo pool_info{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+			.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+			.queueFamilyIndex = queue_family,
+		};
+		VK_CHECK(vkCreateCommandPool(device, &pool_info, nullptr, &slot.command_pool));
+
+		VkCommandBufferAllocateInfo allocate_info{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.commandPool = slot.command_pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = 1
+		};
+		VK_CHECK(vkAllocateCommandBuffers(device, &allocate_info, &slot.command_buffer));
+	}
+
+	VkSemaphoreTypeCreateInfo type_info{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+		.initialValue = 0,
+	};
+
+	VkSemaphoreCreateInfo semaphore_info{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.pNext = &type_info,
+	};
+	VK_CHECK(vkCreateSemaphore(device, &semaphore_info, nullptr, &batcher.timeline));
+
+	// The staging buffer is created by the first allocation
+	batcher.staging_capacity = staging_capacity;
+
+	return batcher;
+}
+
+static void release_staging(UploadBatcher& batcher)
+{
+	if (batcher.staging.buffer == VK_NULL_HANDLE) return;
+
+	batcher.staging.unmap();
+	batcher.staging.destroy();
+	batcher.staging = {};
+	batcher.staging_mapped = nullptr;
+}
+
+void destroy_upload_batcher(UploadBatcher& batcher)
+{
+	upload_batcher_wait(batcher);
+
+	for (auto& slot : batcher.slots)
+		for (VkImageView view : slot.mip_views)
+			vkDestroyImageView(batcher.device, view, nullptr);
+	for (VkImageView view : batcher.acquire_mip_views)
+		vkDestroyImageView(batcher.device, view, nullptr);
+
+	release_staging(batcher);
+	vkDestroySemaphore(batcher.device, batcher.timeline, nullptr);
+	for (auto& slot : batcher.slots)
+		vkDestroyCommandPool(batcher.device, slot.command_pool, nullptr);
+}
+
+static void wait_for_value(const UploadBatcher& batcher, uint64_t value)
+{
+	if (value == 0) return;
+
+	LoadScope scope(LOAD_STAGE_GPU_WAIT, "upload timeline");
+
+	VkSemaphoreWaitInfo wait_info{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.semaphoreCount = 1,
+		.pSemaphores = &batcher.timeline,
+		.pValues = &value,
+	};
+	VK_CHECK(vkWaitSemaphores(batcher.device, &wait_info, UINT64_MAX));
+}
+
+bool upload_batcher_is_complete(const UploadBatcher& batcher, uint64_t timeline_value)
+{
+	uint64_t completed = 0;
+	VK_CHECK(vkGetSemaphoreCounterValue(batcher.device, batcher.timeline, &completed));
+	return completed >= timeline_value;
+}
+
+static void retire_staging(UploadBatcher& batcher)
+{
+	uint64_t completed = 0;
+	VK_CHECK(vkGetSemaphoreCounterValue(batcher.device, batcher.timeline, &completed));
+
+	while (!batcher.staging_allocations.empty())
+	{
+		const auto& a = batcher.staging_allocations.front();
+		if (a.timeline_value == 0 || a.timeline_value > completed) break;
+		batcher.staging_allocations.pop_front();
+	}
+}
+
+static bool try_allocate_staging(const UploadBatcher& batcher, VkDeviceSize size, VkDeviceSize& offset)
+{
+	const VkDeviceSize capacity = batcher.staging.size;
+	if (batcher.staging.buffer == VK_NULL_HANDLE)
+		return false;
+	if (batcher.staging_allocations.empty())
+	{
+		offset = 0;
+		return size <= capacity;
+	}
+
+	VkDeviceSize tail = batcher.staging_allocations.front().offset;
+	VkDeviceSize head = batcher.staging_allocations.back().offset + batcher.staging_allocations.back().size;
+	head = (head + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+	if (head > tail)
+	{
+		// Free space at the end of the ring and in front of the oldest allocation
+		if (head <= capacity && capacity - head >= size)
+		{
+			offset = head;
+			return true;
+		}
+		if (tail >= size)
+		{
+			offset = 0;
+			return true;
+		}
+		return false;
+	}
+
+	// The ring has wrapped, only the space between the newest and oldest allocation is free
+	if (tail - head >= size)
+	{
+		offset = head;
+		return true;
+	}
+	return false;
+}
+
+// Replaces the staging buffer with one that fits at least two allocations of the given size, everything
+// staged so far is submitted and waited on first since pending copies read from the old buffer
+static void grow_staging(UploadBatcher& batcher, VkDeviceSize size)
+{
+	upload_batcher_wait(batcher);
+	retire_staging(batcher);
+	assert(batcher.staging_allocations.empty());
+
+	VkDeviceSize new_size = std::max(std::max(UPLOAD_STAGING_MIN_SIZE, batcher.staging.size * 2), size * 2);
+	new_size = std::min(new_size, batcher.staging_capacity);
+
+	release_staging(batcher);
+	batcher.staging = create_buffer(batcher.allocator, new_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+	batcher.staging_mapped = (uint8_t*)batcher.staging.map();
+	batcher.staging_peak_size = std::max(batcher.staging_peak_size, new_size);
+}
+
+VkDeviceSize upload_batcher_max_chunk_size(const UploadBatcher& batcher)
+{
+	return batcher.staging_capacity / UPLOAD_STAGING_CHUNKS & ~(STAGING_ALIGNMENT - 1);
+}
+
+uint8_t* upload_batcher_allocate(UploadBatcher& batcher, VkDeviceSize size, VkDeviceSize& offset)
+{
+	assert(size <= upload_batcher_max_chunk_size(batcher));
+
+	for (;;)
+	{
+		retire_staging(batcher);
+		if (try_allocate_staging(batcher, size, offset)) break;
+
+		if (batcher.staging.size < batcher.staging_capacity)
+		{
+			grow_staging(batcher, size);
+			continue;
+		}
+
+		// Out of space: the oldest allocation has to be submitted and retired before it can be reused
+		if (batcher.staging_allocations.front().timeline_value == 0)
+			upload_batcher_flush(batcher);
+		wait_for_value(batcher, batcher.staging_allocations.front().timeline_value);
+	}
+
+	batcher.staging_allocations.push_back({ offset, size, 0 });
+	batcher.bytes_uploaded += size;
+	load_telemetry_add_bytes_uploaded(size);
+	batcher.last_staging_use_ms = get_time_ms();
+
+	return batcher.staging_mapped + offset;
+}
+
+static void begin_texture_upload(UploadBatcher& batcher, const Texture& texture)
+{
+	batcher.pre_barriers.push_back(image_barrier(texture.image,
+		0, 0, VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_IMAGE_ASPECT_COLOR_BIT));
+}
+
+// Copies of a texture may be spread over several batches between begin and end. The transition to
+// transfer dst is recorded in the first of them and orders the copies of the later ones as well.
+static void end_texture_upload(UploadBatcher& batcher, const Texture& texture, bool generate_mips)
+{
+	generate_mips = generate_mips && texture.mip_levels > 1;
+	if (generate_mips)
+		batcher.mip_textures.push_back(texture);
+
+	if (batcher.uses_dedicated_queue())
+	{
+		// Release to the graphics queue. Textures that still need mips stay in transfer dst since
+		// they can't be generated on a transfer only queue.
+		VkImageLayout new_layout = generate_mips ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		VkImageMemoryBarrier2 barrier = image_barrier(texture.image,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_2_NONE, 0, new_layout,
+			VK_IMAGE_ASPECT_COLOR_BIT);
+		barrier.srcQueueFamilyIndex = batcher.queue_family;
+		barrier.dstQueueFamilyIndex = batcher.graphics_queue_family;
+		batcher.post_barriers.push_back(barrier);
+	}
+	else if (!generate_mips)
+	{
+		batcher.post_barriers.push_back(image_barrier(texture.image,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_IMAGE_ASPECT_COLOR_BIT));
+	}
+}
+
+void upload_batcher_add_texture(UploadBatcher& batcher, const Texture& texture, const VkBufferImageCopy* copies, uint32_t copy_count, bool generate_mips)
+{
+	begin_texture_upload(batcher, texture);
+
+	for (uint32_t i = 0; i < copy_count; ++i)
+		batcher.image_copies.push_back({ texture.image, copies[i] });
+
+	end_texture_upload(batcher, texture, generate_mips);
+}
+
+static VkDeviceSize get_region_size(VkFormat format, const VkBufferImageCopy& region)
+{
+	return get_subresource_size(format, region.imageExtent.width, region.imageExtent.height, region.imageExtent.depth) * region.imageSubresource.layerCount;
+}
+
+// Splits a tightly packed region into pieces of at most max_size bytes, by array layers if a layer fits,
+// otherwise by depth slices if a slice fits and by rows of blocks if not
+static void split_region(VkFormat format, const VkBufferImageCopy& region, VkDeviceSize max_size, std::vector<VkBufferImageCopy>& pieces)
+{
+	assert(region.bufferRowLength == 0 && region.bufferImageHeight == 0);
+
+	const VkExtent3D extent = region.imageExtent;
+	const uint32_t layer_count = region.imageSubresource.layerCount;
+	const VkDeviceSize slice_size = get_subresource_size(format, extent.width, extent.height, 1);
+	const VkDeviceSize layer_size = slice_size * extent.depth;
+
+	if (layer_size * layer_count <= max_size)
+	{
+		pieces.push_back(region);
+		return;
+	}
+
+	if (layer_size <= max_size)
+	{
+		const uint32_t layers_per_piece = (uint32_t)(max_size / layer_size);
+		for (uint32_t layer = 0; layer < layer_count; layer += layers_per_piece)
+		{
+			VkBufferImageCopy piece = region;
+			piece.bufferOffset += layer * layer_size;
+			piece.imageSubresource.baseArrayLayer += layer;
+			piece.imageSubresource.layerCount = std::min(layers_per_piece, layer_count - layer);
+			pieces.push_back(piece);
+		}
+		return;
+	}
+
+	const uint32_t block_height = is_compressed_format(format) ? 4 : 1;
+	const uint32_t row_count = (extent.height + block_height - 1) / block_height;
+	const VkDeviceSize row_size = get_subresource_size(format, extent.width, block_height, 1);
+	assert(row_size <= max_size);
+
+	for (uint32_t layer = 0; layer < layer_count; ++layer)
+	{
+		VkBufferImageCopy layer_piece = region;
+		layer_piece.bufferOffset += layer * layer_size;
+		layer_piece.imageSubresource.baseArrayLayer += layer;
+		layer_piece.imageSubresource.layerCount = 1;
+
+		if (slice_size <= max_size)
+		{
+			const uint32_t slices_per_piece = (uint32_t)(max_size / slice_size);
+			for (uint32_t z = 0; z < extent.depth; z += slices_per_piece)
+			{
+				VkBufferImageCopy piece = layer_piece;
+				piece.bufferOffset += z * slice_size;
+				piece.imageOffset.z += (int32_t)z;
+				piece.imageExtent.depth = std::min(slices_per_piece, extent.depth - z);
+				pieces.push_back(piece);
+			}
+			continue;
+		}
+
+		const uint32_t rows_per_piece = (uint32_t)(max_size / row_size);
+		for (uint32_t z = 0; z < extent.depth; ++z)
+		{
+			for (uint32_t row = 0; row < row_count; row += rows_per_piece)
+			{
+				VkBufferImageCopy piece = layer_piece;
+				piece.bufferOffset += z * slice_size + row * row_size;
+				piece.imageOffset.y += (int32_t)(row * block_height);
+				piece.imageOffset.z += (int32_t)z;
+				piece.imageExtent.height = std::min(rows_per_piece * block_height, extent.height - row * block_height);
+				piece.imageExtent.depth = 1;
+				pieces.push_back(piece);
+			}
+		}
+	}
+}
+
+VkDeviceSize upload_batcher_upload_image(UploadBatcher& batcher, const Texture& texture, const uint8_t* data, const VkBufferImageCopy* regions, uint32_t region_count, bool generate_mips)
+{
+	const VkDeviceSize max_chunk_size = upload_batcher_max_chunk_size(batcher);
+
+	std::vector<VkBufferImageCopy> pieces;
+	for (uint32_t i = 0; i < region_count; ++i)
+		split_region(texture.format, regions[i], max_chunk_size, pieces);
+
+	begin_texture_upload(batcher, texture);
+
+	VkDeviceSize staged = 0;
+	for (size_t first = 0; first < pieces.size(); )
+	{
+		// As many consecutive pieces as fit into one chunk
+		VkDeviceSize chunk_size = 0;
+		size_t end = first;
+		for (; end < pieces.size(); ++end)
+		{
+			VkDeviceSize piece_end = ((chunk_size + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1)) + get_region_size(texture.format, pieces[end]);
+			if (end > first && piece_end > max_chunk_size)
+				break;
+			chunk_size = piece_end;
+		}
+
+		VkDeviceSize staging_offset = 0;
+		uint8_t* mapped = upload_batcher_allocate(batcher, chunk_size, staging_offset);
+
+		VkDeviceSize offset = 0;
+		for (size_t i = first; i < end; ++i)
+		{
+			offset = (offset + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+			VkDeviceSize piece_size = get_region_size(texture.format, pieces[i]);
+			memcpy(mapped + offset, data + pieces[i].bufferOffset, piece_size);
+
+			VkBufferImageCopy copy = pieces[i];
+			copy.bufferOffset = staging_offset + offset;
+			batcher.image_copies.push_back({ texture.image, copy });
+
+			offset += piece_size;
+		}
+
+		staged += chunk_size;
+		first = end;
+
+		// Let the GPU copy this chunk while the next one is written
+		if (first < pieces.size())
+			upload_batcher_flush(batcher);
+	}
+
+	end_texture_upload(batcher, texture, generate_mips);
+
+	return staged;
+}
+
+void upload_batcher_upload_buffer(UploadBatcher& batcher, const Buffer& buffer, const void* data, VkDeviceSize size, VkDeviceSize dst_offset)
+{
+	// A barrier over zero bytes is invalid, and there is nothing to hand over to the graphics queue
+	if (size == 0)
+		return;
+
+	const VkDeviceSize max_chunk_size = upload_batcher_max_chunk_size(batcher);
+
+	for (VkDeviceSize offset = 0; offset < size; offset += max_chunk_size)
+	{
+		VkDeviceSize chunk_size = std::min(size - offset, max_chunk_size);
+		VkDeviceSize staging_offset = 0;
+		uint8_t* mapped = upload_batcher_allocate(batcher, chunk_size, staging_offset);
+		memcpy(mapped, (const uint8_t*)data + offset, chunk_size);
+
+		batcher.buffer_copies.push_back({
+			.buffer = buffer.buffer,
+			.region = {
+				.srcOffset = staging_offset,
+				.dstOffset = dst_offset + offset,
+				.size = chunk_size
+			}
+		});
+
+		if (offset + chunk_size < size)
+			upload_batcher_flush(batcher);
+	}
+
+	VkBufferMemoryBarrier2 barrier{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+		.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
+		.dstAccessMask = VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = buffer.buffer,
+		.offset = dst_offset,
+		.size = size,
+	};
+
+	if (batcher.uses_dedicated_queue())
+	{
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+		barrier.dstAccessMask = 0;
+		barrier.srcQueueFamilyIndex = batcher.queue_family;
+		barrier.dstQueueFamilyIndex = batcher.graphics_queue_family;
+	}
+
+	batcher.buffer_post_barriers.push_back(barrier);
+}
+
+// Builds the mip chains of textures whose level 0 has just been copied and leaves them shader read
+// only. The storage views used by the dispatches are appended to views and have to outlive them.
+static void record_mip_generation(const UploadBatcher& batcher, VkCommandBuffer command_buffer, const std::vector<Texture>& textures, std::vector<VkImageView>& views)
+{
+	if (!batcher.downsampler)
+	{
+		generate_mipmaps(command_buffer, textures);
+		return;
+	}
+
+	std::vector<VkImageMemoryBarrier2> barriers;
+	std::vector<DownsampleChain> chains;
+	barriers.reserve(textures.size());
+	chains.reserve(textures.size());
+	for (const Texture& t : textures)
+	{
+		barriers.push_back(image_barrier(t.image,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL));
+		chains.push_back(create_downsample_chain(batcher.device, t.image, t.format, t.width, t.height, t.mip_levels));
+	}
+
+	pipeline_barrier(command_buffer, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
+
+	record_downsample(*batcher.downsampler, command_buffer, chains.data(), (uint32_t)chains.size());
+
+	barriers.clear();
+	for (const Texture& t : textures)
+	{
+		barriers.push_back(image_barrier(t.image,
+			VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+			VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+	}
+
+	pipeline_barrier(command_buffer, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
+
+	for (const DownsampleChain& chain : chains)
+		views.insert(views.end(), chain.views.begin(), chain.views.end());
+}
+
+void upload_batcher_copy_levels(UploadBatcher& batcher, const Texture& src, uint32_t src_first_mip, const Texture& dst, uint32_t dst_first_mip, uint32_t level_count, bool dst_uploaded)
+{
+	for (uint32_t i = 0; i < level_count; ++i)
+	{
+		uint32_t dst_mip = dst_first_mip + i;
+		batcher.level_copies.push_back({
+			.src = src.image,
+			.dst = dst.image,
+			.dst_layout = dst_uploaded ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+			.region = {
+				.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, src_first_mip + i, 0, 1 },
+				.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, dst_mip, 0, 1 },
+				.extent = { std::max(dst.width >> dst_mip, 1u), std::max(dst.height >> dst_mip, 1u), 1 },
+			}
+		});
+	}
+}
+
+static VkImageMemoryBarrier2 level_barrier(VkImage image, uint32_t mip,
+	VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkImageLayout old_layout,
+	VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access, VkImageLayout new_layout)
+{
+	return image_barrier(image, src_stage, src_access, old_layout, dst_stage, dst_access, new_layout,
+		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, mip, 1, 0, 1 });
+}
+
+// Every level is copied by a single copy, so the barriers can be per level
+static void record_level_copies(VkCommandBuffer command_buffer, const std::vector<UploadBatcher::LevelCopy>& copies)
+{
+	std::vector<VkImageMemoryBarrier2> barriers;
+	barriers.reserve(copies.size() * 2);
+	for (const auto& c : copies)
+	{
+		barriers.push_back(level_barrier(c.src, c.region.srcSubresource.mipLevel,
+			VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL));
+		barriers.push_back(level_barrier(c.dst, c.region.dstSubresource.mipLevel,
+			VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, 0, c.dst_layout,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+	}
+	pipeline_barrier(command_buffer, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
+
+	for (const auto& c : copies)
+		vkCmdCopyImage(command_buffer, c.src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, c.dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &c.region);
+
+	barriers.clear();
+	for (const auto& c : copies)
+	{
+		barriers.push_back(level_barrier(c.src, c.region.srcSubresource.mipLevel,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, 0, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+		barriers.push_back(level_barrier(c.dst, c.region.dstSubresource.mipLevel,
+			VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+	}
+	pipeline_barrier(command_buffer, 0, nullptr, (uint32_t)barriers.size(), barriers.data());
+}
+
+static void record_barriers(VkCommandBuffer command_buffer, const std::vector<VkImageMemoryBarrier2>& image_barriers, const std::vector<VkBufferMemoryBarrier2>& buffer_barriers)
+{
+	if (image_barriers.empty() && buffer_barriers.empty()) return;
+
+	VkDependencyInfo info{
+		.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+		.bufferMemoryBarrierCount = (uint32_t)buffer_barriers.size(),
+		.pBufferMemoryBarriers = buffer_barriers.data(),
+		.imageMemoryBarrierCount = (uint32_t)image_barriers.size(),
+		.pImageMemoryBarriers = image_barriers.data()
+	};
+
+	vkCmdPipelineBarrier2(command_buffer, &info);
+}
+
+uint64_t upload_batcher_flush(UploadBatcher& batcher)
+{
+	if (batcher.image_copies.empty() && batcher.buffer_copies.empty() && batcher.level_copies.empty()) return batcher.timeline_value;
+
+	UploadBatcher::Slot& slot = batcher.slots[batcher.slot_index];
+	batcher.slot_index = (batcher.slot_index + 1) % UPLOAD_BATCHER_SLOTS;
+
+	wait_for_value(batcher, slot.timeline_value);
+	VK_CHECK(vkResetCommandPool(batcher.device, slot.command_pool, 0));
+	for (VkImageView view : slot.mip_views)
+		vkDestroyImageView(batcher.device, view, nullptr);
+	slot.mip_views.clear();
+
+	VkCommandBufferBeginInfo begin_info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+	};
+	VK_CHECK(vkBeginCommandBuffer(slot.command_buffer, &begin_info));
+
+	if (!batcher.pre_barriers.empty())
+		pipeline_barrier(slot.command_buffer, 0, nullptr, (uint32_t)batcher.pre_barriers.size(), batcher.pre_barriers.data());
+
+	for (const auto& c : batcher.image_copies)
+		vkCmdCopyBufferToImage(slot.command_buffer, batcher.staging.buffer, c.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &c.region);
+
+	for (const auto& c : batcher.buffer_copies)
+		vkCmdCopyBuffer(slot.command_buffer, batcher.staging.buffer, c.buffer, 1, &c.region);
+
+	record_barriers(slot.command_buffer, batcher.post_barriers, batcher.buffer_post_barriers);
+
+	const uint64_t signal_value = ++batcher.timeline_value;
+
+	if (batcher.uses_dedicated_queue())
+	{
+		// Mirror every release with an acquire on the graphics queue
+		UploadBatcher::PendingAcquire acquire{ .timeline_value = signal_value };
+		for (VkImageMemoryBarrier2 barrier : batcher.post_barriers)
+		{
+			bool needs_mips = barrier.newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+			barrier.srcAccessMask = 0;
+			barrier.dstStageMask = needs_mips ? VK_PIPELINE_STAGE_2_TRANSFER_BIT : VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT;
+			barrier.dstAccessMask = needs_mips ? VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT : VK_ACCESS_2_SHADER_READ_BIT;
+			acquire.image_barriers.push_back(barrier);
+		}
+		for (VkBufferMemoryBarrier2 barrier : batcher.buffer_post_barriers)
+		{
+			barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+			barrier.srcAccessMask = 0;
+			barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT;
+			barrier.dstAccessMask = VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT;
+			acquire.buffer_barriers.push_back(barrier);
+		}
+		acquire.mip_textures = std::move(batcher.mip_textures);
+		acquire.level_copies = std::move(batcher.level_copies);
+		batcher.pending_acquires.push_back(std::move(acquire));
+	}
+	else
+	{
+		if (!batcher.mip_textures.empty())
+			record_mip_generation(batcher, slot.command_buffer, batcher.mip_textures, slot.mip_views);
+		if (!batcher.level_copies.empty())
+			record_level_copies(slot.command_buffer, batcher.level_copies);
+	}
+
+	VK_CHECK(vkEndCommandBuffer(slot.command_buffer));
+
+	VkTimelineSemaphoreSubmitInfo timeline_info{
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+		.signalSemaphoreValueCount = 1,
+		.pSignalSemaphoreValues = &signal_value,
+	};
+
+	VkSubmitInfo submit_info{
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = &timeline_info,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &slot.command_buffer,
+		.signalSemaphoreCount = 1,
+		.pSignalSemaphores = &batcher.timeline
+	};
+
+	VK_CHECK(vkQueueSubmit(batcher.queue, 1, &submit_info, VK_NULL_HANDLE));
+
+	slot.timeline_value = signal_value;
+	for (auto it = batcher.staging_allocations.rbegin(); it != batcher.staging_allocations.rend() && it->timeline_value == 0; ++it)
+		it->timeline_value = signal_value;
+
+	batcher.submit_count++;
+	batcher.pre_barriers.clear();
+	batcher.image_copies.clear();
+	batcher.buffer_copies.clear();
+	batcher.post_barriers.clear();
+	batcher.buffer_post_barriers.clear();
+	batcher.mip_textures.clear();
+	batcher.level_copies.clear();
+
+	return signal_value;
+}
+
+uint64_t upload_batcher_record_acquire(UploadBatcher& batcher, VkCommandBuffer command_buffer)
+{
+	for (VkImageView view : batcher.acquire_mip_views)
+		vkDestroyImageView(batcher.device, view, nullptr);
+	batcher.acquire_mip_views.clear();
+
+	uint64_t wait_value = 0;
+	for (const auto& acquire : batcher.pending_acquires)
+	{
+		record_barriers(command_buffer, acquire.image_barriers, acquire.buffer_barriers);
+		if (!acquire.mip_textures.empty())
+			record_mip_generation(batcher, command_buffer, acquire.mip_textures, batcher.acquire_mip_views);
+		if (!acquire.level_copies.empty())
+			record_level_copies(command_buffer, acquire.level_copies);
+
+		wait_value = std::max(wait_value, acquire.timeline_value);
+	}
+
+	batcher.pending_acquires.clear();
+	return wait_value;
+}
+
+void upload_batcher_wait(UploadBatcher& batcher)
+{
+	upload_batcher_flush(batcher);
+	wait_for_value(batcher, batcher.timeline_value);
+}
+
+void upload_batcher_trim(UploadBatcher& batcher)
+{
+	if (batcher.staging.buffer == VK_NULL_HANDLE || get_time_ms() - batcher.last_staging_use_ms < UPLOAD_STAGING_IDLE_MS)
+		return;
+
+	retire_staging(batcher);
+	if (!batcher.staging_allocations.empty())
+		return;
+
+	release_staging(batcher);
+}
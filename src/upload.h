@@ -0,0 +1,165 @@
+#pragma once
+
+#include "resources.h"
+
+#include <deque>
+
+static constexpr uint32_t UPLOAD_BATCHER_SLOTS = 4;
+
+// The staging buffer starts at this size and grows up to the capacity given at creation
+static constexpr VkDeviceSize UPLOAD_STAGING_MIN_SIZE = 4 * 1024 * 1024;
+// Uploads larger than capacity / UPLOAD_STAGING_CHUNKS are split into chunks of at most that size
+static constexpr uint32_t UPLOAD_STAGING_CHUNKS = 4;
+// The staging buffer is released once no upload has used it for this long
+static constexpr double UPLOAD_STAGING_IDLE_MS = 2000.0;
+
+struct Downsampler;
+
+// Collects texture and buffer uploads into as few submissions as possible. Data is written into
+// a staging ring, the copies and layout transitions are recorded in bulk on flush and completion
+// is tracked with a timeline semaphore instead of waiting for the whole device to go idle.
+//
+// Uploads run on a dedicated transfer queue when the device exposes one. Resources are then
+// released to the graphics queue family at the end of each batch and have to be acquired on
+// the graphics queue with upload_batcher_record_acquire before they are used.
+//
+// The staging buffer is the only host visible memory the batcher holds and never exceeds the
+// capacity it is created with. It is allocated on first use, grows while uploads need more and is
+// released by upload_batcher_trim when loading goes idle.
+struct UploadBatcher
+{
+	struct ImageCopy
+	{
+		VkImage image;
+		VkBufferImageCopy region;
+	};
+
+	struct BufferCopy
+	{
+		VkBuffer buffer;
+		VkBufferCopy region;
+	};
+
+	struct LevelCopy
+	{
+		VkImage src;
+		VkImage dst;
+		VkImageLayout dst_layout; // Of the copied levels before the copy
+		VkImageCopy region;
+	};
+
+	struct StagingAllocation
+	{
+		VkDeviceSize offset;
+		VkDeviceSize size;
+		uint64_t timeline_value; // 0 until the batch using it has been submitted
+	};
+
+	struct Slot
+	{
+		VkCommandPool command_pool;
+		VkCommandBuffer command_buffer;
+		uint64_t timeline_value;
+		std::vector<VkImageView> mip_views; // Storage views of the mip chains generated in this slot
+	};
+
+	struct PendingAcquire
+	{
+		uint64_t timeline_value;
+		std::vector<VkImageMemoryBarrier2> image_barriers;
+		std::vector<VkBufferMemoryBarrier2> buffer_barriers;
+		std::vector<Texture> mip_textures;
+		std::vector<LevelCopy> level_copies;
+	};
+
+	VkDevice device;
+	VmaAllocator allocator;
+	VkQueue queue;
+	uint32_t queue_family;
+	uint32_t graphics_queue_family;
+
+	Slot slots[UPLOAD_BATCHER_SLOTS];
+	uint32_t slot_index;
+
+	VkSemaphore timeline;
+	uint64_t timeline_value;
+
+	Buffer staging; // VK_NULL_HANDLE while released
+	uint8_t* staging_mapped;
+	VkDeviceSize staging_capacity;
+	std::deque<StagingAllocation> staging_allocations;
+	double last_staging_use_ms;
+
+	std::vector<VkImageMemoryBarrier2> pre_barriers;
+	std::vector<ImageCopy> image_copies;
+	std::vector<BufferCopy> buffer_copies;
+	std::vector<VkImageMemoryBarrier2> post_barriers;
+	std::vector<VkBufferMemoryBarrier2> buffer_post_barriers;
+	std::vector<Texture> mip_textures;
+	std::vector<LevelCopy> level_copies; // Recorded on the graphics queue, like the mip generation
+
+	std::vector<PendingAcquire> pending_acquires;
+	std::vector<VkImageView> acquire_mip_views; // Released by the next upload_batcher_record_acquire
+
+	// Mip chains are built with compute dispatches when set, otherwise with blits
+	const Downsampler* downsampler;
+
+	uint32_t submit_count;
+	VkDeviceSize bytes_uploaded;
+	VkDeviceSize staging_peak_size;
+
+	inline bool uses_dedicated_queue() const { return queue_family != graphics_queue_family; }
+};
+
+// staging_capacity caps the host visible memory used for staging
+UploadBatcher create_upload_batcher(VkDevice device, VmaAllocator allocator, uint32_t queue_family, VkQueue queue, uint32_t graphics_queue_family, VkDeviceSize staging_capacity);
+void destroy_upload_batcher(UploadBatcher& batcher);
+
+// Reserves staging memory for the next upload. Retired regions of the ring are reused; if the
+// ring is full the pending batch is flushed and the oldest submission waited on, or the buffer
+// grows once everything in it has retired. size must not exceed upload_batcher_max_chunk_size.
+// Returns the write pointer and the offset of the allocation inside the staging buffer.
+uint8_t* upload_batcher_allocate(UploadBatcher& batcher, VkDeviceSize size, VkDeviceSize& offset);
+
+// Largest single staging allocation
+VkDeviceSize upload_batcher_max_chunk_size(const UploadBatcher& batcher);
+
+// Queues copies from the staging buffer into every subresource of the texture. The texture is
+// transitioned to shader read only optimal after the copy, or after its mip chain has been
+// generated from level 0 if generate_mips is set.
+void upload_batcher_add_texture(UploadBatcher& batcher, const Texture& texture, const VkBufferImageCopy* copies, uint32_t copy_count, bool generate_mips = false);
+
+// Copies the regions of an image from data into the texture, bufferOffset being relative to data and
+// every region tightly packed. Regions are staged together when they fit into one chunk. Larger images
+// are split by region, array layer, depth slice and rows of blocks, and every chunk but the last is
+// flushed once written so the GPU copies it while the next one is filled. Returns the staged bytes.
+VkDeviceSize upload_batcher_upload_image(UploadBatcher& batcher, const Texture& texture, const uint8_t* data, const VkBufferImageCopy* regions, uint32_t region_count, bool generate_mips = false);
+
+// Copies data into a device local buffer through the staging ring, in chunks if it is large.
+void upload_batcher_upload_buffer(UploadBatcher& batcher, const Buffer& buffer, const void* data, VkDeviceSize size, VkDeviceSize dst_offset = 0);
+
+// Copies level_count mip levels of src, which has to be shader read only, into dst on the GPU instead of staging
+// them again. dst_uploaded is set if an upload of dst was queued before, otherwise dst has to be new. The copies
+// run on the graphics queue after the rest of the batch, when it is acquired if uploads use a dedicated queue,
+// and leave both textures shader read only. src has to outlive the command buffer recording them.
+void upload_batcher_copy_levels(UploadBatcher& batcher, const Texture& src, uint32_t src_first_mip, const Texture& dst, uint32_t dst_first_mip, uint32_t level_count, bool dst_uploaded);
+
+// Records and submits everything queued so far without waiting for it to complete.
+// Returns the timeline value that is signaled once the batch has completed.
+uint64_t upload_batcher_flush(UploadBatcher& batcher);
+
+// Records the queue family acquire barriers and pending mip generation for every submitted batch
+// into a graphics command buffer. Returns the timeline value the submission of that command
+// buffer has to wait for, or 0 if there was nothing to acquire. The command buffer recorded by the
+// previous call has to have completed, the views its mip generation used are released here.
+uint64_t upload_batcher_record_acquire(UploadBatcher& batcher, VkCommandBuffer command_buffer);
+
+// Returns true once the GPU has finished the submission that signals the given value.
+bool upload_batcher_is_complete(const UploadBatcher& batcher, uint64_t timeline_value);
+
+// Submits any pending work and blocks until all uploads have completed.
+void upload_batcher_wait(UploadBatcher& batcher);
+
+// Releases the staging buffer once everything staged in it has completed and nothing has been
+// allocated for UPLOAD_STAGING_IDLE_MS. Meant to be called once per frame.
+void upload_batcher_trim(UploadBatcher& batcher);
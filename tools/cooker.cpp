@@ -0,0 +1,146 @@
+// Offline cooker for .rxpak scene packs. Imports a glTF or sdkmesh scene, converts it to the runtime
+// layout and writes it as a single pack that the renderer loads without any per-asset parsing.
+// Also converts single DDS textures to zstd supercompressed KTX2, which the renderer picks up in
+// place of a .dds with the same name.
+
+#include "common.h"
+#include "pack.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
+
+#include <filesystem>
+
+static bool cook_sdkmesh(const char* path, PackContents& contents, ThreadPool& thread_pool)
+{
+	std::vector<uint8_t> sdkmesh;
+	if (!read_binary_file(path, sdkmesh))
+		return false;
+
+	std::vector<SdkMeshTextures> sdkmesh_textures;
+	if (!import_sdkmesh_scene(sdkmesh.data(), sdkmesh.size(), contents.meshes, contents.materials, contents.vertices, contents.indices, contents.mesh_draws, 0, sdkmesh_textures, &thread_pool))
+		return false;
+
+	// Same texture layout as import_sdkmesh_scene: the shared specular map, then diffuse and normal per material
+	std::filesystem::path directory = std::filesystem::path(path).parent_path();
+	std::vector<std::pair<std::filesystem::path, bool>> texture_paths = { { directory / SDKMESH_SPECULAR_TEXTURE, false } };
+	for (const SdkMeshTextures& material_textures : sdkmesh_textures)
+	{
+		texture_paths.push_back({ directory / material_textures.diffuse, true });
+		texture_paths.push_back({ directory / material_textures.normal, false });
+	}
+
+	// Files with the same content are stored once
+	TextureCache cache{};
+	std::vector<uint32_t> texture_indices;
+	for (const auto& [texture_path, is_srgb] : texture_paths)
+	{
+		std::vector<uint8_t> dds;
+		if (!read_binary_file(texture_path.string().c_str(), dds))
+		{
+			printf("Failed to load texture: %s\n", texture_path.string().c_str());
+			return false;
+		}
+
+		uint64_t key = get_texture_cache_key(dds.data(), dds.size(), is_srgb);
+		int cached = texture_cache_acquire(cache, key);
+		if (cached >= 0)
+		{
+			texture_indices.push_back((uint32_t)cached);
+			continue;
+		}
+
+		TextureImage image;
+		if (!parse_dds(image, dds.data(), dds.size(), is_srgb))
+		{
+			printf("Failed to load texture: %s\n", texture_path.string().c_str());
+			return false;
+		}
+		texture_indices.push_back((uint32_t)contents.textures.size());
+		texture_cache_insert(cache, key, texture_indices.back(), dds.size());
+
+		// The payload references the file data unless it had to be converted, take a copy before it goes away
+		if (image.storage.empty())
+		{
+			image.storage.assign(image.data, image.data + image.size);
+			image.data = image.storage.data();
+		}
+
+		contents.textures.push_back(std::move(image));
+	}
+	remap_material_textures(contents.materials, 0, texture_indices);
+
+	return true;
+}
+
+static bool cook_texture(const char* path, const char* output_path)
+{
+	std::vector<uint8_t> data;
+	TextureImage image;
+	if (!read_binary_file(path, data) || !parse_texture(image, data.data(), data.size()))
+	{
+		printf("Failed to load texture: %s\n", path);
+		return false;
+	}
+
+	if (!write_ktx2(output_path, image, true))
+		return false;
+
+	printf("Cooked %s: %.2f KB -> %.2f KB\n", output_path, (double)data.size() / 1024.0, (double)std::filesystem::file_size(output_path) / 1024.0);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		printf("Usage: %s <scene file (.glb, .gltf, .sdkmesh)> <output .rxpak>\n", argv[0]);
+		printf("       %s <texture (.dds, .ktx2)> <output .ktx2>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (std::filesystem::path(argv[2]).extension() == ".ktx2")
+		return cook_texture(argv[1], argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	double start_ms = get_time_ms();
+
+	ThreadPool thread_pool;
+	init_thread_pool(thread_pool);
+
+	PackContents contents;
+	bool success = false;
+	std::filesystem::path ext = std::filesystem::path(argv[1]).extension();
+	if (ext == ".glb" || ext == ".gltf")
+	{
+		success = cook_gltf(argv[1], contents, thread_pool);
+	}
+	else if (ext == ".sdkmesh")
+	{
+		success = cook_sdkmesh(argv[1], contents, thread_pool);
+	}
+	else
+	{
+		printf("Unsupported file format: %s\n", ext.string().c_str());
+	}
+
+	destroy_thread_pool(thread_pool);
+
+	// The renderer uploads the geometry of a pack as it is stored
+	if (success && !has_built_geometry(contents))
+		build_geometry(contents.geometry, contents.geometry_data, contents.meshes, contents.vertices, contents.indices);
+
+	if (!success || !write_pack(argv[2], contents))
+	{
+		printf("Failed to cook %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	size_t texture_bytes = 0;
+	for (const TextureImage& image : contents.textures)
+		texture_bytes += image.size;
+
+	printf("Cooked %s in %.2f ms: %zu meshes, %zu vertices, %zu indices, %zu textures (%.2f MB)\n",
+		argv[2], get_time_ms() - start_ms, contents.meshes.size(), contents.vertices.size(), contents.indices.size(),
+		contents.textures.size(), (double)texture_bytes / (1024.0 * 1024.0));
+
+	return EXIT_SUCCESS;
+}